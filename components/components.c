@@ -1,5 +1,6 @@
 #include "components.h"
 #include "math/utility.h"
+#include "datastructures/ecs_snapshot.h"
 
 //Since every CustomDrawable is "custom", call the per-instance constructor.
 CD(customdrawable_constructor)
@@ -17,6 +18,12 @@ CD(customdrawable_destructor)
 		cd->destruct(eid, component, userdata);
 }
 
+//The ctx a CustomDrawable points to belongs to the ECS it was snapshotted from, so build a new one.
+SD(customdrawable_deserialize)
+{
+	customdrawable_constructor(eid, component, userdata);
+}
+
 CD(camera_constructor)
 {
 	Camera *c = component;
@@ -40,3 +47,19 @@ CD(label_destructor)
 	free(l->name);
 	free(l->description);
 }
+
+//Strings go into the snapshot's blobs, and are copied back out by the constructor when it's loaded.
+SD(label_serialize)
+{
+	Label *l = component;
+	l->name = (char *)(uintptr_t)ecs_snapshot_blob_add_string(blobs, l->name);
+	l->description = (char *)(uintptr_t)ecs_snapshot_blob_add_string(blobs, l->description);
+}
+
+SD(label_deserialize)
+{
+	Label *l = component;
+	l->name = ecs_snapshot_blob_get(blobs, (uintptr_t)l->name);
+	l->description = ecs_snapshot_blob_get(blobs, (uintptr_t)l->description);
+	label_constructor(eid, component, userdata);
+}
@@ -5,10 +5,12 @@
 #include "datastructures/ecs.h"
 #include "glla.h"
 #include "math/bpos.h"
+#include "math/frustum.h"
 #include "graphics.h"
 #include "systems/ply_mesh_renderer.h"
 
 #define CD ecs_c_constructor_destructor
+#define SD ecs_c_serialize_deserialize
 
 //Possible future work: Parse this file (or parse a separate schema file to generate this)
 //and generate Lua getters/setters.
@@ -21,6 +23,7 @@ typedef struct component_camera {
 	bool log_depth;
 	float proj_mat[16];
 	float proj_view_mat[16]; //Will be updated once per frame
+	struct frustum frustum; //Side planes of proj_view_mat, updated with it.
 	float width, height;
 	hframebuffer fbo; //Framebuffer object
 	// Camera will '&' drawable's draw_group with this bitfield and draw if the result is nonzero,
@@ -52,6 +55,7 @@ typedef struct component_customdrawable {
 } CustomDrawable;
 CD(customdrawable_constructor);
 CD(customdrawable_destructor);
+SD(customdrawable_deserialize);
 
 //TODO(Gavin): Give label a GC / generic constructor specialization
 typedef struct component_label {
@@ -60,6 +64,8 @@ typedef struct component_label {
 } Label;
 CD(label_constructor);
 CD(label_destructor);
+SD(label_serialize);
+SD(label_deserialize);
 
 //Temporary copy of "Physical" component while I refactor
 typedef struct component_physicaltemp {
@@ -25,8 +25,13 @@ proctri_tex = "grass.png"
 tex_scale = 4
 gpu_tiles = false
 num_tile_rows = 80
+planet_tile_budget_mb = 512 --Merged planet tiles are freed past this, least recently drawn first.
+gpu_planet_atlas_cells = 16 --Tiles per side of each GPU planet's heightmap atlas.
 gen_solar_systems = false
 
+--universe_scene.c config values
+worker_threads = 4 --Set to 0 to run ECS systems and planet tile generation single-threaded and deterministically.
+
 --twotri_scene.c config values
 spiral_vsh_key = "spiral.vertex.GL33"
 spiral_fsh_key = "spiral.fragment.GL33"
@@ -0,0 +1,231 @@
+#include "chunkpool.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+#define CHUNKPOOL_CHUNK(cp, c) (*(struct chunkpool_chunk **)mempool_get(&(cp)->chunks, c))
+#define CHUNKPOOL_ITEM(cp, chunk, slot) ((unsigned char *)(chunk) + (cp)->items_offset + (cp)->size * (slot))
+
+static size_t chunkpool_items_offset(size_t words)
+{
+	size_t offset = sizeof(struct chunkpool_chunk) + words * sizeof(uint64_t);
+	return (offset + CHUNKPOOL_ITEM_ALIGN - 1) & ~(size_t)(CHUNKPOOL_ITEM_ALIGN - 1);
+}
+
+struct chunkpool chunkpool_new(size_t num, size_t size)
+{
+	assert(size > 0 && size <= CHUNKPOOL_CHUNK_SIZE - chunkpool_items_offset(1));
+	//Start from the most items that could fit with no header, and back off until the bitmap and items both fit.
+	size_t per_chunk = CHUNKPOOL_CHUNK_SIZE / size;
+	while (chunkpool_items_offset((per_chunk + 63) / 64) + per_chunk * size > CHUNKPOOL_CHUNK_SIZE)
+		per_chunk--;
+	size_t words = (per_chunk + 63) / 64;
+	size_t num_chunks = (num + per_chunk - 1) / per_chunk;
+	struct chunkpool cp = {
+		.size = size,
+		.per_chunk = per_chunk,
+		.bitmap_words = words,
+		.items_offset = chunkpool_items_offset(words),
+		.chunks = mempool_new(num_chunks ? num_chunks : 1, sizeof(struct chunkpool_chunk *)),
+		.free_chunks = mempool_new(num_chunks ? num_chunks : 1, sizeof(uint32_t)),
+		.allocated = true,
+	};
+	chunkpool_reserve(&cp, num);
+	return cp;
+}
+
+void chunkpool_delete(struct chunkpool *cp)
+{
+	if (!cp->allocated)
+		return;
+	for (size_t c = 0; c < cp->chunks.num; c++)
+		free(CHUNKPOOL_CHUNK(cp, c));
+	mempool_delete(&cp->chunks);
+	mempool_delete(&cp->free_chunks);
+	cp->allocated = false;
+}
+
+static bool chunkpool_add_chunk(struct chunkpool *cp)
+{
+	struct chunkpool_chunk *chunk = aligned_alloc(CHUNKPOOL_CHUNK_SIZE, CHUNKPOOL_CHUNK_SIZE);
+	if (!chunk) {
+		printf("Whoops, running out of memory.\n");
+		return false;
+	}
+	uint32_t c = cp->chunks.num;
+	chunk->num = 0;
+	chunk->index = c;
+	memset(chunk->occupied, 0, cp->bitmap_words * sizeof(uint64_t));
+	if (cp->chunks.num >= cp->chunks.max) {
+		mempool_resize(&cp->chunks, cp->chunks.max * 2);
+		mempool_resize(&cp->free_chunks, cp->chunks.max);
+	}
+	mempool_add(&cp->chunks, &chunk);
+	mempool_add(&cp->free_chunks, &c);
+	return true;
+}
+
+void chunkpool_reserve(struct chunkpool *cp, size_t num)
+{
+	while (cp->chunks.num * cp->per_chunk < num)
+		if (!chunkpool_add_chunk(cp))
+			return;
+}
+
+void * chunkpool_add_raw(struct chunkpool *cp, uint32_t *index)
+{
+	if (!cp->free_chunks.num && !chunkpool_add_chunk(cp))
+		return NULL;
+
+	//Fill the most recently freed-up chunk first, it's the most likely to be in cache.
+	uint32_t c = *(uint32_t *)mempool_get(&cp->free_chunks, cp->free_chunks.num - 1);
+	struct chunkpool_chunk *chunk = CHUNKPOOL_CHUNK(cp, c);
+	size_t w = 0;
+	while (chunk->occupied[w] == UINT64_MAX)
+		w++;
+	size_t slot = w * 64 + __builtin_ctzll(~chunk->occupied[w]);
+	assert(slot < cp->per_chunk);
+	chunk->occupied[w] |= 1ull << (slot % 64);
+	if (++chunk->num == cp->per_chunk)
+		cp->free_chunks.num--;
+	cp->num++;
+	if (index)
+		*index = c * cp->per_chunk + slot;
+	return CHUNKPOOL_ITEM(cp, chunk, slot);
+}
+
+//First slot of num free slots in a row in chunk, or per_chunk if there aren't any.
+static size_t chunkpool_find_run(struct chunkpool *cp, struct chunkpool_chunk *chunk, size_t num)
+{
+	size_t run = 0;
+	for (size_t slot = 0; slot < cp->per_chunk; slot++) {
+		if (slot % 64 == 0 && chunk->occupied[slot / 64] == UINT64_MAX) {
+			slot += 63;
+			run = 0;
+			continue;
+		}
+		run = chunk->occupied[slot / 64] & (1ull << (slot % 64)) ? 0 : run + 1;
+		if (run == num)
+			return slot + 1 - num;
+	}
+	return cp->per_chunk;
+}
+
+void * chunkpool_add_run(struct chunkpool *cp, size_t num, uint32_t *index)
+{
+	assert(num > 0 && num <= cp->per_chunk);
+	//Same order as chunkpool_add_raw, most recently freed-up first, then a new chunk if none have room.
+	struct chunkpool_chunk *chunk = NULL;
+	size_t f = cp->free_chunks.num, slot = cp->per_chunk;
+	while (slot == cp->per_chunk && f > 0) {
+		chunk = CHUNKPOOL_CHUNK(cp, *(uint32_t *)mempool_get(&cp->free_chunks, --f));
+		slot = chunkpool_find_run(cp, chunk, num);
+	}
+	if (slot == cp->per_chunk) {
+		if (!chunkpool_add_chunk(cp))
+			return NULL;
+		f = cp->free_chunks.num - 1;
+		chunk = CHUNKPOOL_CHUNK(cp, cp->chunks.num - 1);
+		slot = 0;
+	}
+
+	for (size_t s = slot; s < slot + num; s++)
+		chunk->occupied[s / 64] |= 1ull << (s % 64);
+	chunk->num += num;
+	if (chunk->num == cp->per_chunk)
+		mempool_remove(&cp->free_chunks, f);
+	cp->num += num;
+	if (index)
+		*index = chunk->index * cp->per_chunk + slot;
+	return CHUNKPOOL_ITEM(cp, chunk, slot);
+}
+
+void * chunkpool_add(struct chunkpool *cp, const void *item, uint32_t *index)
+{
+	void *dst = chunkpool_add_raw(cp, index);
+	if (dst)
+		memcpy(dst, item, cp->size);
+	return dst;
+}
+
+static void chunkpool_remove_slot(struct chunkpool *cp, struct chunkpool_chunk *chunk, size_t slot)
+{
+	uint64_t bit = 1ull << (slot % 64);
+	assert(chunk->occupied[slot / 64] & bit);
+	chunk->occupied[slot / 64] &= ~bit;
+	//A full chunk is not in the free list, put it back now that it has room.
+	if (chunk->num-- == cp->per_chunk)
+		mempool_add(&cp->free_chunks, &chunk->index);
+	cp->num--;
+}
+
+void chunkpool_remove(struct chunkpool *cp, uint32_t i)
+{
+	chunkpool_remove_slot(cp, CHUNKPOOL_CHUNK(cp, i / cp->per_chunk), i % cp->per_chunk);
+}
+
+void chunkpool_remove_ptr(struct chunkpool *cp, void *item)
+{
+	struct chunkpool_chunk *chunk = (struct chunkpool_chunk *)((uintptr_t)item & ~(uintptr_t)(CHUNKPOOL_CHUNK_SIZE - 1));
+	chunkpool_remove_slot(cp, chunk, ((unsigned char *)item - CHUNKPOOL_ITEM(cp, chunk, 0)) / cp->size);
+}
+
+void * chunkpool_get(struct chunkpool *cp, uint32_t i)
+{
+	size_t c = i / cp->per_chunk, slot = i % cp->per_chunk;
+	if (c >= cp->chunks.num)
+		return NULL;
+	struct chunkpool_chunk *chunk = CHUNKPOOL_CHUNK(cp, c);
+	if (!(chunk->occupied[slot / 64] & (1ull << (slot % 64))))
+		return NULL;
+	return CHUNKPOOL_ITEM(cp, chunk, slot);
+}
+
+uint32_t chunkpool_index_of(struct chunkpool *cp, const void *item)
+{
+	struct chunkpool_chunk *chunk = (struct chunkpool_chunk *)((uintptr_t)item & ~(uintptr_t)(CHUNKPOOL_CHUNK_SIZE - 1));
+	return chunk->index * cp->per_chunk + ((const unsigned char *)item - CHUNKPOOL_ITEM(cp, chunk, 0)) / cp->size;
+}
+
+void chunkpool_iter_init(struct chunkpool_iter *it, struct chunkpool *cp)
+{
+	*it = (struct chunkpool_iter){.cp = cp};
+}
+
+void * chunkpool_next_run(struct chunkpool_iter *it, size_t *num, uint32_t *first)
+{
+	struct chunkpool *cp = it->cp;
+	for (; it->chunk < cp->chunks.num; it->chunk++, it->slot = 0) {
+		struct chunkpool_chunk *chunk = CHUNKPOOL_CHUNK(cp, it->chunk);
+		if (!chunk->num)
+			continue;
+		//Find the first occupied slot at or after it->slot.
+		size_t w = it->slot / 64;
+		if (w >= cp->bitmap_words)
+			continue;
+		uint64_t bits = chunk->occupied[w] & (UINT64_MAX << (it->slot % 64));
+		while (!bits && ++w < cp->bitmap_words)
+			bits = chunk->occupied[w];
+		if (!bits)
+			continue;
+		size_t start = w * 64 + __builtin_ctzll(bits);
+
+		//Then the first empty slot after that. Bits past per_chunk are never set, so runs stop there.
+		uint64_t holes = ~chunk->occupied[w] & (UINT64_MAX << (start % 64));
+		while (!holes && ++w < cp->bitmap_words)
+			holes = ~chunk->occupied[w];
+		size_t end = holes ? w * 64 + __builtin_ctzll(holes) : cp->bitmap_words * 64;
+		if (end > cp->per_chunk)
+			end = cp->per_chunk;
+
+		it->slot = end;
+		*num = end - start;
+		if (first)
+			*first = it->chunk * cp->per_chunk + start;
+		return CHUNKPOOL_ITEM(cp, chunk, start);
+	}
+	*num = 0;
+	return NULL;
+}
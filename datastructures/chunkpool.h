@@ -0,0 +1,72 @@
+#ifndef CHUNKPOOL_H
+#define CHUNKPOOL_H
+#include "mempool.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+/*
+A chunkpool is a pool of items with stable addresses, an alternative to mempool/hmempool for when
+things need to hold pointers to items.
+
+Items live in fixed-size chunks (CHUNKPOOL_CHUNK_SIZE bytes, aligned to their own size), each with an
+occupancy bitmap. Removing an item just clears its bit, so nothing is ever moved, and the hole is reused
+by a later add. Since chunks are aligned, the chunk (and index) of any item can be found from its address.
+
+Item indices are chunk * per_chunk + slot, and are as stable as the addresses.
+Iteration goes a run of consecutive occupied items at a time, so loops over a run can be vectorized,
+and bitmap words (and whole chunks) with nothing in them are skipped.
+*/
+
+#define CHUNKPOOL_CHUNK_SIZE 16384
+//Items in each chunk start at a multiple of this, so runs of items are cache line (and SIMD) aligned.
+#define CHUNKPOOL_ITEM_ALIGN 64
+
+struct chunkpool_chunk {
+	uint32_t num; //Number of occupied slots.
+	uint32_t index; //Position of this chunk in the chunkpool's chunk list.
+	uint64_t occupied[]; //Occupancy bitmap, one bit per slot. Items follow at items_offset.
+};
+
+struct chunkpool {
+	size_t num, size; //Number of items, size of each item in bytes.
+	size_t per_chunk, items_offset, bitmap_words;
+	struct mempool chunks; //struct chunkpool_chunk pointers.
+	struct mempool free_chunks; //Stack of indices of chunks that have at least one free slot.
+	bool allocated;
+};
+
+struct chunkpool_iter {
+	struct chunkpool *cp;
+	size_t chunk, slot;
+};
+
+//Create a new chunkpool of items of "size" size (in bytes), with room for at least "num" before it allocates more chunks.
+struct chunkpool chunkpool_new(size_t num, size_t size);
+//Delete a chunkpool, freeing all of its chunks.
+void chunkpool_delete(struct chunkpool *cp);
+//Claim a slot, return a pointer to it. If index is not NULL, *index is set to the new item's index.
+void * chunkpool_add_raw(struct chunkpool *cp, uint32_t *index);
+//Claim num slots in a row in one chunk, up to per_chunk, and return a pointer to the first. They're removed one at a time.
+//If index is not NULL, *index is set to the first one's index.
+void * chunkpool_add_run(struct chunkpool *cp, size_t num, uint32_t *index);
+//Copy an item into the chunkpool, return a pointer to its new (stable) location.
+void * chunkpool_add(struct chunkpool *cp, const void *item, uint32_t *index);
+//Remove the item at index i. Other items are not moved.
+void chunkpool_remove(struct chunkpool *cp, uint32_t i);
+//Remove the item at address "item", which must have come from this chunkpool.
+void chunkpool_remove_ptr(struct chunkpool *cp, void *item);
+//Returns a pointer to the item at index i, or NULL if that slot is empty.
+void * chunkpool_get(struct chunkpool *cp, uint32_t i);
+//Returns the index of the item at address "item", which must have come from this chunkpool.
+uint32_t chunkpool_index_of(struct chunkpool *cp, const void *item);
+//Make sure there is room for at least num items, allocating chunks up front.
+void chunkpool_reserve(struct chunkpool *cp, size_t num);
+//Start iterating over every item in the chunkpool, in index order.
+void chunkpool_iter_init(struct chunkpool_iter *it, struct chunkpool *cp);
+//Returns a pointer to the first item of the next run of consecutive occupied items, and sets *num to its length.
+//If first is not NULL, *first is set to the index of the first item of the run. Returns NULL when there are no more items.
+//Items can be removed during iteration, but items added during iteration may or may not be visited.
+void * chunkpool_next_run(struct chunkpool_iter *it, size_t *num, uint32_t *first);
+
+#endif
@@ -2,6 +2,10 @@ OBJECTS += \
 	datastructures/quadtree.o \
 	datastructures/octree.o \
 	datastructures/hashtable.o \
+	datastructures/hashmap.o \
 	datastructures/mempool.o \
 	datastructures/hmempool.o \
+	datastructures/chunkpool.o \
 	datastructures/ecs.o \
+	datastructures/ecs_cmdbuf.o \
+	datastructures/ecs_snapshot.o \
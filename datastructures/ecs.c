@@ -1,6 +1,7 @@
 #include "ecs.h"
 #include "mempool.h"
 #include "hmempool.h"
+#include "chunkpool.h"
 #include "math/utility.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -13,6 +14,104 @@ void ecs_call_destructor(ecs_ctx *E, uint32_t eid, uint32_t ctype, void *compone
 		E->destructors[ctype](eid, component, E->userdatas[ctype]);
 }
 
+//Turn an item of a component pool into a pointer to the component itself.
+//Stable ctypes store a pointer to the component (in their chunkpool) in the pool item.
+static inline void * ecs_component_data(ecs_ctx *E, uint32_t ctype, void *item)
+{
+	return item && E->stable_components[ctype].allocated ? *(void **)item : item;
+}
+
+//Give a newly claimed pool item of a stable ctype its component. Returns a pointer to the component.
+static void * ecs_component_stable_claimed(ecs_ctx *E, uint32_t ctype, void *item, const void *c)
+{
+	struct chunkpool *cp = &E->stable_components[ctype];
+	void *component = c ? chunkpool_add(cp, c, NULL) : chunkpool_add_raw(cp, NULL);
+	*(void **)item = component;
+	return component;
+}
+
+//Returns true if q matches on ctype, and sets *column to the position of ctype in q->ctypes.
+static bool ecs_query_column(struct ecs_query *q, uint32_t ctype, size_t *column)
+{
+	for (size_t k = 0; k < q->num_ctypes; k++) {
+		if (q->ctypes[k] == ctype) {
+			*column = k;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void ecs_query_match_add(ecs_ctx *E, struct ecs_query *q, uint32_t eid)
+{
+	uint32_t row[ECS_QUERY_MAX_CTYPES];
+	for (size_t k = 0; k < q->num_ctypes; k++) {
+		uint32_t i = E->components[q->ctypes[k]].htoi[ecs_eid_slot(eid)-1];
+		if (!i)
+			return; //Entity is missing one of the components.
+		row[k] = i - 1;
+	}
+
+	if (q->eids.num >= q->eids.max) {
+		mempool_resize(&q->eids, q->eids.max * 2);
+		mempool_resize(&q->indices, q->indices.max * 2);
+	}
+	mempool_add(&q->indices, row);
+	q->eid_to_match[ecs_eid_slot(eid)] = mempool_add(&q->eids, &eid) + 1;
+}
+
+static void ecs_query_match_remove(struct ecs_query *q, uint32_t eid)
+{
+	uint32_t m = q->eid_to_match[ecs_eid_slot(eid)];
+	if (!m)
+		return;
+	//Same edge case as hmempool_unclaim, update the moved match before clearing the removed one.
+	mempool_remove(&q->indices, m-1);
+	uint32_t i2 = mempool_remove(&q->eids, m-1);
+	uint32_t eid2 = *(uint32_t *)mempool_get(&q->eids, i2);
+	q->eid_to_match[ecs_eid_slot(eid2)] = m;
+	q->eid_to_match[ecs_eid_slot(eid)] = 0;
+}
+
+//Call after a component of type ctype is attached to eid.
+static void ecs_queries_component_claimed(ecs_ctx *E, uint32_t eid, uint32_t ctype)
+{
+	size_t column;
+	for (size_t j = 0; j < E->queries.num; j++) {
+		struct ecs_query *q = *(struct ecs_query **)mempool_get(&E->queries, j);
+		if (!q->eid_to_match[ecs_eid_slot(eid)] && ecs_query_column(q, ctype, &column))
+			ecs_query_match_add(E, q, eid);
+	}
+}
+
+//Detach the component of type ctype from eid, keeping queries in sync with the item that gets moved into its place.
+static void ecs_component_unclaim(ecs_ctx *E, uint32_t eid, uint32_t ctype)
+{
+	struct hmempool *cl = &E->components[ctype];
+	uint32_t i = cl->htoi[ecs_eid_slot(eid)-1] - 1;
+	if (E->stable_components[ctype].allocated)
+		chunkpool_remove_ptr(&E->stable_components[ctype], *(void **)mempool_get(&cl->pool, i));
+	size_t column;
+	for (size_t j = 0; j < E->queries.num; j++) {
+		struct ecs_query *q = *(struct ecs_query **)mempool_get(&E->queries, j);
+		if (ecs_query_column(q, ctype, &column))
+			ecs_query_match_remove(q, eid);
+	}
+
+	hmempool_unclaim(cl, eid);
+
+	//If another component was moved into slot i, fix up its index in any query that holds it.
+	if (i >= cl->pool.num)
+		return;
+	uint32_t moved = cl->itoh[i];
+	for (size_t j = 0; j < E->queries.num; j++) {
+		struct ecs_query *q = *(struct ecs_query **)mempool_get(&E->queries, j);
+		uint32_t m = q->eid_to_match[ecs_eid_slot(moved)];
+		if (m && ecs_query_column(q, ctype, &column))
+			((uint32_t *)mempool_get(&q->indices, m-1))[column] = i;
+	}
+}
+
 size_t ecs_entities_max(ecs_ctx *E)
 {
 	return E->free_eids.max;
@@ -35,8 +134,24 @@ size_t ecs_components_num(ecs_ctx *E)
 
 bool ecs_eid_used(ecs_ctx *E, uint32_t eid)
 {
-	//Could do bounds / validity check on eid, possibly.
-	return E->eid_used[eid];
+	uint32_t slot = ecs_eid_slot(eid);
+	return slot && slot <= ecs_entities_max(E) && E->live_eids[slot] == eid;
+}
+
+size_t ecs_entities_alive(ecs_ctx *E, const uint32_t eids[], size_t num, uint64_t out_mask[])
+{
+	size_t alive = 0;
+	size_t max = ecs_entities_max(E);
+	memset(out_mask, 0, (num + 63) / 64 * sizeof(uint64_t));
+	for (size_t i = 0; i < num; i++) {
+		//Out of range slots are redirected to slot 0, which never holds a live eid.
+		uint32_t slot = ecs_eid_slot(eids[i]);
+		slot = slot <= max ? slot : 0;
+		uint64_t used = E->live_eids[slot] == eids[i] && slot;
+		out_mask[i / 64] |= used << (i % 64);
+		alive += used;
+	}
+	return alive;
 }
 
 ecs_ctx ecs_new(int num_entities, int num_component_types)
@@ -44,12 +159,16 @@ ecs_ctx ecs_new(int num_entities, int num_component_types)
 	ecs_ctx tmp = {
 		.free_component_slots = mempool_new(num_component_types, sizeof(uint32_t)),
 		.free_eids = mempool_new(num_entities, sizeof(uint32_t)),
-		.eid_used = calloc(num_entities + 1, sizeof(bool)),
+		.live_eids = calloc(num_entities + 1, sizeof(uint32_t)),
 		.components = calloc(num_component_types, sizeof(struct hmempool)),
+		.stable_components = calloc(num_component_types, sizeof(struct chunkpool)),
 		.constructors = calloc(num_component_types, sizeof(ecs_c_constructor_fn *)),
 		.destructors = calloc(num_component_types, sizeof(ecs_c_destructor_fn *)),
 		.userdatas = calloc(num_component_types, sizeof(void *)),
 		.init_params = calloc(num_component_types, sizeof(struct ecs_component_init_params *)),
+		.queries = mempool_new(4, sizeof(struct ecs_query *)),
+		.tick = 1,
+		.write_ticks = calloc(num_component_types, sizeof(uint32_t *)),
 	};
 	for (uint32_t i = 0; i < num_component_types; i++)
 		mempool_add(&tmp.free_component_slots, &i);
@@ -61,8 +180,8 @@ void ecs_free(ecs_ctx *E)
 {
 	uint32_t num = ecs_entities_max(E);
 	for (int i = 1; i < num + 1; i++) {
-		if (ecs_eid_used(E, i))
-			ecs_entity_destruct_remove_components(E, i);
+		if (E->live_eids[i])
+			ecs_entity_destruct_remove_components(E, E->live_eids[i]);
 	}
 
 	//All component destructors have been called now, safe to unregister all components, call component deinit if present.
@@ -70,44 +189,78 @@ void ecs_free(ecs_ctx *E)
 		if (E->init_params[i] && E->init_params[i]->deinit)
 			E->init_params[i]->deinit(E->init_params[i]);
 
-	for (int i = 0; i < ecs_components_max(E); i++)
+	while (E->queries.num)
+		ecs_query_delete(E, *(struct ecs_query **)mempool_get(&E->queries, 0));
+
+	for (int i = 0; i < ecs_components_max(E); i++) {
 		hmempool_delete(&E->components[i]);
-	free(E->eid_used);
+		chunkpool_delete(&E->stable_components[i]);
+		free(E->write_ticks[i]);
+	}
+	free(E->write_ticks);
+	free(E->live_eids);
 	free(E->components);
+	free(E->stable_components);
 	free(E->constructors);
 	free(E->destructors);
 	free(E->userdatas);
 	free(E->init_params);
 	mempool_delete(&E->free_eids);
 	mempool_delete(&E->free_component_slots);
+	mempool_delete(&E->queries);
 }
 
 void ecs_realloc(ecs_ctx *E, int num_entities, int num_component_types)
 {
+	assert(num_entities <= ECS_EID_SLOT_MASK);
 	size_t emax = ecs_entities_max(E);
 	size_t cmax = ecs_components_max(E);
 	if (num_entities > emax) {
-		for (int i = 0; i < cmax; i++)
+		//Unregistered slots get handle tables sized to ecs_entities_max when they are registered.
+		for (int i = 0; i < cmax; i++) {
+			if (!E->components[i].allocated)
+				continue;
 			hmempool_handles_resize(&E->components[i], num_entities);
+			uint32_t *new_write_ticks = crealloc(E->write_ticks[i], (num_entities + 1) * sizeof(uint32_t), (emax + 1) * sizeof(uint32_t));
+			if (new_write_ticks)
+				E->write_ticks[i] = new_write_ticks;
+			else
+				printf("Whoops, running out of memory.\n");
+		}
 		mempool_resize(&E->free_eids, num_entities);
 		mempool_fill_uint32_t_descending(&E->free_eids, emax+1, num_entities);
-		bool *new_eid_used = crealloc(E->eid_used, num_entities + 1, emax);
-		if (new_eid_used)
-			E->eid_used = new_eid_used;
+		uint32_t *new_live_eids = crealloc(E->live_eids, (num_entities + 1) * sizeof(uint32_t), (emax + 1) * sizeof(uint32_t));
+		if (new_live_eids)
+			E->live_eids = new_live_eids;
 		else
 			printf("Whoops, running out of memory.\n");
+		for (int i = 0; i < E->queries.num; i++) {
+			struct ecs_query *q = *(struct ecs_query **)mempool_get(&E->queries, i);
+			uint32_t *new_eid_to_match = crealloc(q->eid_to_match, (num_entities + 1) * sizeof(uint32_t), (emax + 1) * sizeof(uint32_t));
+			if (new_eid_to_match)
+				q->eid_to_match = new_eid_to_match;
+			else
+				printf("Whoops, running out of memory.\n");
+		}
 	}
 	if (num_component_types > cmax) {
 		mempool_resize(&E->free_component_slots, num_component_types);
 		for (uint32_t i = cmax; i < num_component_types; i++)
 			mempool_add(&E->free_component_slots, &i);
 
-		struct hmempool *new_components = realloc(E->components, num_component_types * sizeof(struct hmempool));
+		//Zeroed, so that unregistered slots read as unallocated.
+		struct hmempool *new_components = crealloc(E->components, num_component_types * sizeof(struct hmempool), cmax * sizeof(struct hmempool));
 		if (new_components)
 			E->components = new_components;
 		else
 			printf("Whoops, running out of memory.\n");
 
+		struct chunkpool *new_stable_components = crealloc(E->stable_components, num_component_types * sizeof(struct chunkpool), cmax * sizeof(struct chunkpool));
+		if (new_stable_components)
+			E->stable_components = new_stable_components;
+		else
+			printf("Whoops, running out of memory.\n");
+
 		ecs_c_constructor_fn **new_constructors = crealloc(E->constructors, num_component_types * sizeof(ecs_c_constructor_fn *), cmax * sizeof(ecs_c_constructor_fn *));
 		if (new_constructors)
 			E->constructors = new_constructors;
@@ -131,6 +284,12 @@ void ecs_realloc(ecs_ctx *E, int num_entities, int num_component_types)
 			E->init_params = new_init_params;
 		else
 			printf("Whoops, running out of memory.\n");
+
+		uint32_t **new_write_ticks = crealloc(E->write_ticks, num_component_types * sizeof(uint32_t *), cmax * sizeof(uint32_t *));
+		if (new_write_ticks)
+			E->write_ticks = new_write_ticks;
+		else
+			printf("Whoops, running out of memory.\n");
 	}
 }
 
@@ -144,15 +303,27 @@ uint32_t ecs_component_register(ecs_ctx *E, size_t num, size_t size)
 	mempool_pop(&E->free_component_slots, &ctype);
 
 	E->components[ctype] = hmempool_new_unmanaged(num, size, ecs_entities_max(E));
+	E->write_ticks[ctype] = calloc(ecs_entities_max(E) + 1, sizeof(uint32_t));
+	return ctype;
+}
+
+uint32_t ecs_component_register_stable(ecs_ctx *E, size_t num, size_t size)
+{
+	//The hmempool still does the eid bookkeeping, but its items are pointers into the chunkpool.
+	uint32_t ctype = ecs_component_register(E, num, sizeof(void *));
+	E->stable_components[ctype] = chunkpool_new(num, size);
 	return ctype;
 }
 
 //Register and initialize a new type of component, passing an init params struct with these members:
 //num: Initialize storage for this number of components of that type.
 //size: Each component of this type is this many bytes in size.
+//stable: If true, register with ecs_component_register_stable.
 //Any of the following can be NULL.
 //construct: Constructor that will be called on new component instances after they are allocated.
 //destruct: Destructor that will be called on component right before it is destroyed.
+//serialize: Called on a copy of each component as it is written by ecs_snapshot_write, should replace any pointers.
+//deserialize: Called on each component after ecs_snapshot_map, should undo what serialize did.
 //userdata: Pointer passed to constructor and destructor, usually used to interact with resources not managed by ECS.
 //ctype: If not NULL, *ctype will be set to the ctype that is returned from this call.
 //E: Pointer to the ECS context, will be set before init is called.
@@ -162,7 +333,7 @@ uint32_t ecs_component_register(ecs_ctx *E, size_t num, size_t size)
 //deinit: Deinitialization function for component runtime, will be called and passed p when component is unregistered or ECS is freed.
 uint32_t ecs_component_init(ecs_ctx *E, struct ecs_component_init_params *p)
 {
-	uint32_t ctype = ecs_component_register(E, p->num, p->size);
+	uint32_t ctype = p->stable ? ecs_component_register_stable(E, p->num, p->size) : ecs_component_register(E, p->num, p->size);
 	ecs_component_set_construct_destruct(E, ctype, p->construct, p->destruct, p->userdata);
 	if (p->ctype)
 		*p->ctype = ctype;
@@ -190,29 +361,57 @@ void ecs_component_unregister(ecs_ctx *E, uint32_t ctype)
 	for (int i = 0; i < num; i++) {
 		//Iterate over entity indices, retrieve live entity handles.
 		uint32_t eid = components->itoh[i];
-		ecs_call_destructor(E, eid, ctype, hmempool_get(&E->components[ctype], eid));
+		ecs_call_destructor(E, eid, ctype, ecs_component_data(E, ctype, hmempool_get(&E->components[ctype], eid)));
 	}
 	if (E->init_params[ctype] && E->init_params[ctype]->deinit)
 		E->init_params[ctype]->deinit(E->init_params[ctype]);
+	//Any query over this ctype can no longer match anything.
+	size_t column;
+	for (int i = 0; i < E->queries.num; i++) {
+		struct ecs_query *q = *(struct ecs_query **)mempool_get(&E->queries, i);
+		if (ecs_query_column(q, ctype, &column)) {
+			memset(q->eid_to_match, 0, (ecs_entities_max(E) + 1) * sizeof(uint32_t));
+			q->eids.num = 0;
+			q->indices.num = 0;
+		}
+	}
 	E->init_params[ctype] = NULL;
 	E->constructors[ctype] = NULL;
 	E->destructors[ctype] = NULL;
 	E->userdatas[ctype] = NULL;
 
 	hmempool_delete(&E->components[ctype]);
+	chunkpool_delete(&E->stable_components[ctype]);
+	free(E->write_ticks[ctype]);
+	E->write_ticks[ctype] = NULL;
 	mempool_add(&E->free_component_slots, &ctype);
 }
 
 void * ecs_components(ecs_ctx *E, uint32_t ctype, size_t *num)
 {
 	//You can't safely access the list without knowing its length, so error if num is NULL.
-	if (E->components[ctype].allocated && num) {
+	if (E->components[ctype].allocated && !E->stable_components[ctype].allocated && num) {
 		*num = E->components[ctype].pool.num;
 		return E->components[ctype].pool.pool;
 	}
 	return NULL;
 }
 
+bool ecs_component_is_stable(ecs_ctx *E, uint32_t ctype)
+{
+	return E->stable_components[ctype].allocated;
+}
+
+struct chunkpool * ecs_component_chunkpool(ecs_ctx *E, uint32_t ctype)
+{
+	return E->stable_components[ctype].allocated ? &E->stable_components[ctype] : NULL;
+}
+
+size_t ecs_component_size(ecs_ctx *E, uint32_t ctype)
+{
+	return E->stable_components[ctype].allocated ? E->stable_components[ctype].size : E->components[ctype].pool.size;
+}
+
 const uint32_t * ecs_component_itoh(ecs_ctx *E, uint32_t ctype)
 {
 	return E->components[ctype].itoh;
@@ -225,55 +424,192 @@ uint32_t ecs_entity_add(ecs_ctx *E)
 
 	//At this point, we know there must be at least one free slot.
 
-	//For now, eids are just hmempool handles.
-	//Later, I can bitwise-or in more information to the handle, if needed.
+	//eids are hmempool handles, the generation in the upper bits was bumped when the slot was last freed.
 	uint32_t h = 0;
 	mempool_pop(&E->free_eids, &h);
-	E->eid_used[h] = true;
+	E->live_eids[ecs_eid_slot(h)] = h;
 	return h;
 }
 
+static void ecs_entities_spawn_internal(ecs_ctx *E, size_t num, const uint32_t ctypes[], size_t num_ctypes, const void *initial_data[], uint32_t out_eids[], bool construct)
+{
+	if (!num)
+		return;
+	size_t needed = ecs_entities_num(E) + num;
+	if (needed > ecs_entities_max(E)) {
+		size_t max = ecs_entities_max(E) * 2;
+		ecs_realloc(E, max > needed ? max : needed, ecs_components_max(E));
+	}
+
+	//Take eids off the top of the free stack in the same order as ecs_entity_add would.
+	uint32_t *free_eids = (uint32_t *)E->free_eids.pool;
+	for (size_t j = 0; j < num; j++) {
+		uint32_t h = free_eids[E->free_eids.num - 1 - j];
+		E->live_eids[ecs_eid_slot(h)] = h;
+		out_eids[j] = h;
+	}
+	E->free_eids.num -= num;
+
+	for (size_t k = 0; k < num_ctypes; k++) {
+		struct hmempool *cl = &E->components[ctypes[k]];
+		if (cl->pool.num + num > cl->pool.max) {
+			size_t max = cl->pool.max * 2;
+			hmempool_resize(cl, max > cl->pool.num + num ? max : cl->pool.num + num);
+		}
+		const unsigned char *data = initial_data ? initial_data[k] : NULL;
+		struct chunkpool *cp = &E->stable_components[ctypes[k]];
+		if (cp->allocated) {
+			//Pool items are pointers here, so each component has to be copied into the chunkpool separately.
+			uint32_t first = hmempool_claim_many(cl, out_eids, num, NULL);
+			chunkpool_reserve(cp, cp->num + num);
+			for (size_t i = 0; i < num; i++) {
+				void *c = ecs_component_stable_claimed(E, ctypes[k], mempool_get(&cl->pool, first + i), data ? data + i * cp->size : NULL);
+				if (!data)
+					memset(c, 0, cp->size);
+			}
+			continue;
+		}
+		uint32_t first = hmempool_claim_many(cl, out_eids, num, data);
+		if (!data)
+			memset(mempool_get(&cl->pool, first), 0, num * cl->pool.size);
+	}
+	for (size_t k = 0; k < num_ctypes; k++)
+		for (size_t i = 0; i < num; i++)
+			E->write_ticks[ctypes[k]][ecs_eid_slot(out_eids[i])] = E->tick;
+
+	for (size_t j = 0; j < E->queries.num; j++) {
+		struct ecs_query *q = *(struct ecs_query **)mempool_get(&E->queries, j);
+		if (q->eids.num + num > q->eids.max) {
+			mempool_resize(&q->eids, q->eids.num + num);
+			mempool_resize(&q->indices, q->eids.num + num);
+		}
+		for (size_t i = 0; i < num; i++)
+			ecs_query_match_add(E, q, out_eids[i]);
+	}
+
+	if (construct) {
+		for (size_t k = 0; k < num_ctypes; k++) {
+			uint32_t ctype = ctypes[k];
+			if (!E->constructors[ctype])
+				continue;
+			for (size_t i = 0; i < num; i++)
+				E->constructors[ctype](out_eids[i], ecs_entity_get_component(E, out_eids[i], ctype), E->userdatas[ctype]);
+		}
+	}
+}
+
+void ecs_entities_spawn(ecs_ctx *E, size_t num, const uint32_t ctypes[], size_t num_ctypes, const void *initial_data[], uint32_t out_eids[])
+{
+	ecs_entities_spawn_internal(E, num, ctypes, num_ctypes, initial_data, out_eids, false);
+}
+
+void ecs_entities_spawn_construct(ecs_ctx *E, size_t num, const uint32_t ctypes[], size_t num_ctypes, const void *initial_data[], uint32_t out_eids[])
+{
+	ecs_entities_spawn_internal(E, num, ctypes, num_ctypes, initial_data, out_eids, true);
+}
+
+static void ecs_entities_despawn_internal(ecs_ctx *E, const uint32_t eids[], size_t num, bool destruct)
+{
+	uint64_t alive[(num + 63) / 64 + 1];
+	ecs_entities_alive(E, eids, num, alive);
+
+	//Go one component pool at a time, rather than one entity at a time.
+	for (int ctype = 0; ctype < ecs_components_max(E); ctype++) {
+		struct hmempool *cl = &E->components[ctype];
+		if (!cl->allocated || !cl->pool.num)
+			continue;
+		for (size_t i = 0; i < num; i++) {
+			if (!((alive[i / 64] >> (i % 64)) & 1))
+				continue;
+			void *component = ecs_component_data(E, ctype, hmempool_get(cl, eids[i]));
+			if (component) {
+				if (destruct)
+					ecs_call_destructor(E, eids[i], ctype, component);
+				ecs_component_unclaim(E, eids[i], ctype);
+			}
+		}
+	}
+
+	for (size_t i = 0; i < num; i++) {
+		//Re-check liveness, in case the same eid was passed more than once.
+		if (!ecs_eid_used(E, eids[i]))
+			continue;
+		E->live_eids[ecs_eid_slot(eids[i])] = 0;
+		uint32_t next = hmempool_handle_next_generation(eids[i]);
+		mempool_add(&E->free_eids, &next);
+	}
+}
+
+void ecs_entities_despawn(ecs_ctx *E, const uint32_t eids[], size_t num)
+{
+	ecs_entities_despawn_internal(E, eids, num, false);
+}
+
+void ecs_entities_destruct_despawn(ecs_ctx *E, const uint32_t eids[], size_t num)
+{
+	ecs_entities_despawn_internal(E, eids, num, true);
+}
+
 void ecs_entity_remove(ecs_ctx *E, uint32_t eid)
 {
+	//Removing a stale eid would free the slot out from under the entity that now owns it.
+	if (!ecs_eid_used(E, eid))
+		return;
+
 	//Remove all components under that handle
 	for (int i = 0; i < ecs_components_max(E); i++) {
+		if (!E->components[i].allocated)
+			continue;
 		//If it's a valid component handle, remove and clear it.
 		void *component = hmempool_get(&E->components[i], eid);
 		if (component) {
-			hmempool_unclaim(&E->components[i], eid);
+			ecs_component_unclaim(E, eid, i);
 		}
 	}
 
-	E->eid_used[eid] = false;
-	mempool_add(&E->free_eids, &eid);
+	E->live_eids[ecs_eid_slot(eid)] = 0;
+	uint32_t next = hmempool_handle_next_generation(eid);
+	mempool_add(&E->free_eids, &next);
 }
 
 void ecs_entity_destruct_remove(ecs_ctx *E, uint32_t eid)
 {
+	//Removing a stale eid would free the slot out from under the entity that now owns it.
+	if (!ecs_eid_used(E, eid))
+		return;
+
 	//Remove all components under that handle
 	for (int i = 0; i < ecs_components_max(E); i++) {
+		if (!E->components[i].allocated)
+			continue;
 		//If it's a valid component handle, remove and clear it.
-		void *component = hmempool_get(&E->components[i], eid);
+		void *component = ecs_component_data(E, i, hmempool_get(&E->components[i], eid));
 		if (component) {
 			ecs_call_destructor(E, eid, i, component);
-			hmempool_unclaim(&E->components[i], eid);
+			ecs_component_unclaim(E, eid, i);
 		}
 	}
 
-	E->eid_used[eid] = false;
-	mempool_add(&E->free_eids, &eid);
+	E->live_eids[ecs_eid_slot(eid)] = 0;
+	uint32_t next = hmempool_handle_next_generation(eid);
+	mempool_add(&E->free_eids, &next);
 }
 
 void * ecs_entity_add_component(ecs_ctx *E, uint32_t eid, uint32_t ctype)
 {
+	assert(ecs_eid_used(E, eid));
 	//Get the component list, resize if needed.
 	struct hmempool *cl = &E->components[ctype];
 	if (cl->pool.num >= cl->pool.max)
 		hmempool_resize(&E->components[ctype], cl->pool.max * 2);
 
 	hmempool_claim_raw(cl, eid);
+	if (E->stable_components[ctype].allocated)
+		ecs_component_stable_claimed(E, ctype, hmempool_get(cl, eid), NULL);
+	ecs_component_mark_written(E, eid, ctype);
+	ecs_queries_component_claimed(E, eid, ctype);
 	//Attach component to entity.
-	return hmempool_get(cl, eid);
+	return ecs_entity_get_component(E, eid, ctype);
 }
 
 void * ecs_entity_add_construct_component(ecs_ctx *E, uint32_t eid, uint32_t ctype)
@@ -286,14 +622,20 @@ void * ecs_entity_add_construct_component(ecs_ctx *E, uint32_t eid, uint32_t cty
 
 void * ecs_entity_add_copy_component(ecs_ctx *E, uint32_t eid, uint32_t ctype, void *c)
 {
+	assert(ecs_eid_used(E, eid));
 	//Get the component list, resize if needed.
 	struct hmempool *cl = &E->components[ctype];
 	if (cl->pool.num >= cl->pool.max)
 		hmempool_resize(&E->components[ctype], cl->pool.max * 2);
 
-	hmempool_claim(cl, eid, c);
+	if (E->stable_components[ctype].allocated)
+		ecs_component_stable_claimed(E, ctype, hmempool_get(cl, hmempool_claim_raw(cl, eid)), c);
+	else
+		hmempool_claim(cl, eid, c);
+	ecs_component_mark_written(E, eid, ctype);
+	ecs_queries_component_claimed(E, eid, ctype);
 	//Attach component to entity.
-	return hmempool_get(&E->components[ctype], eid);
+	return ecs_entity_get_component(E, eid, ctype);
 }
 
 void * ecs_entity_add_copy_construct_component(ecs_ctx *E, uint32_t eid, uint32_t ctype, void *c)
@@ -309,17 +651,17 @@ void ecs_entity_remove_component(ecs_ctx *E, uint32_t eid, uint32_t ctype)
 	struct hmempool *cl = &E->components[ctype];
 	void *c = hmempool_get(cl, eid);
 	if (c) {
-		hmempool_unclaim(cl, eid);
+		ecs_component_unclaim(E, eid, ctype);
 	}
 }
 
 void ecs_entity_destruct_remove_component(ecs_ctx *E, uint32_t eid, uint32_t ctype)
 {
 	struct hmempool *cl = &E->components[ctype];
-	void *c = hmempool_get(cl, eid);
+	void *c = ecs_component_data(E, ctype, hmempool_get(cl, eid));
 	if (c) {
 		ecs_call_destructor(E, eid, ctype, c);
-		hmempool_unclaim(cl, eid);
+		ecs_component_unclaim(E, eid, ctype);
 	}
 }
 
@@ -341,5 +683,132 @@ void ecs_entity_destruct_remove_components(ecs_ctx *E, uint32_t eid)
 
 void * ecs_entity_get_component(ecs_ctx *E, uint32_t eid, uint32_t ctype)
 {
-	return hmempool_get(&E->components[ctype], eid);
+	return ecs_component_data(E, ctype, hmempool_get(&E->components[ctype], eid));
+}
+
+uint32_t ecs_tick(ecs_ctx *E)
+{
+	return E->tick++;
+}
+
+void * ecs_component_write(ecs_ctx *E, uint32_t eid, uint32_t ctype)
+{
+	void *c = ecs_entity_get_component(E, eid, ctype);
+	if (c)
+		E->write_ticks[ctype][ecs_eid_slot(eid)] = E->tick;
+	return c;
+}
+
+void ecs_component_mark_written(ecs_ctx *E, uint32_t eid, uint32_t ctype)
+{
+	E->write_ticks[ctype][ecs_eid_slot(eid)] = E->tick;
+}
+
+bool ecs_component_changed_since(ecs_ctx *E, uint32_t eid, uint32_t ctype, uint32_t since)
+{
+	return ecs_entity_get_component(E, eid, ctype) && E->write_ticks[ctype][ecs_eid_slot(eid)] > since;
+}
+
+void ecs_components_changed_since(struct ecs_changed_iter *it, ecs_ctx *E, uint32_t ctype, uint32_t since)
+{
+	*it = (struct ecs_changed_iter){.E = E, .ctype = ctype, .since = since};
+}
+
+void * ecs_changed_next(struct ecs_changed_iter *it, uint32_t *eid)
+{
+	struct hmempool *cl = &it->E->components[it->ctype];
+	const uint32_t *ticks = it->E->write_ticks[it->ctype];
+	for (; it->next < cl->pool.num; it->next++) {
+		uint32_t h = cl->itoh[it->next];
+		if (ticks[ecs_eid_slot(h)] > it->since) {
+			if (eid)
+				*eid = h;
+			return ecs_component_data(it->E, it->ctype, mempool_get(&cl->pool, it->next++));
+		}
+	}
+	return NULL;
+}
+
+struct ecs_query * ecs_query_new(ecs_ctx *E, const uint32_t ctypes[], size_t num_ctypes)
+{
+	assert(num_ctypes > 0 && num_ctypes <= ECS_QUERY_MAX_CTYPES);
+	//Start from the smallest component pool, since every match must be in it.
+	size_t smallest = 0;
+	for (size_t k = 1; k < num_ctypes; k++)
+		if (E->components[ctypes[k]].pool.num < E->components[ctypes[smallest]].pool.num)
+			smallest = k;
+	struct hmempool *driver = &E->components[ctypes[smallest]];
+	size_t initial = driver->pool.num > 16 ? driver->pool.num : 16;
+
+	struct ecs_query *q = malloc(sizeof(struct ecs_query));
+	*q = (struct ecs_query){
+		.num_ctypes = num_ctypes,
+		.eids = mempool_new(initial, sizeof(uint32_t)),
+		.indices = mempool_new(initial, num_ctypes * sizeof(uint32_t)),
+		.eid_to_match = calloc(ecs_entities_max(E) + 1, sizeof(uint32_t)),
+	};
+	memcpy(q->ctypes, ctypes, num_ctypes * sizeof(uint32_t));
+
+	for (uint32_t i = 0; i < driver->pool.num; i++)
+		ecs_query_match_add(E, q, driver->itoh[i]);
+
+	if (E->queries.num >= E->queries.max)
+		mempool_resize(&E->queries, E->queries.max * 2);
+	mempool_add(&E->queries, &q);
+	return q;
+}
+
+void ecs_query_delete(ecs_ctx *E, struct ecs_query *q)
+{
+	for (int i = 0; i < E->queries.num; i++) {
+		if (*(struct ecs_query **)mempool_get(&E->queries, i) == q) {
+			mempool_remove(&E->queries, i);
+			break;
+		}
+	}
+	mempool_delete(&q->eids);
+	mempool_delete(&q->indices);
+	free(q->eid_to_match);
+	free(q);
+}
+
+size_t ecs_query_num(struct ecs_query *q)
+{
+	return q->eids.num;
+}
+
+void ecs_query_iter_init(struct ecs_query_iter *it, ecs_ctx *E, struct ecs_query *q)
+{
+	it->E = E;
+	it->q = q;
+	it->next = 0;
+	it->num = 0;
+	it->eids = NULL;
+}
+
+bool ecs_query_next(struct ecs_query_iter *it)
+{
+	struct ecs_query *q = it->q;
+	if (it->next >= q->eids.num)
+		return false;
+
+	size_t start = it->next;
+	size_t num = q->eids.num - start;
+	it->num = num < ECS_QUERY_BATCH ? num : ECS_QUERY_BATCH;
+	it->next = start + it->num;
+	it->eids = mempool_get(&q->eids, start);
+
+	const uint32_t *rows = mempool_get(&q->indices, start);
+	for (size_t k = 0; k < q->num_ctypes; k++) {
+		struct mempool *pool = &it->E->components[q->ctypes[k]].pool;
+		unsigned char *base = pool->pool;
+		size_t size = pool->size;
+		if (it->E->stable_components[q->ctypes[k]].allocated)
+			for (size_t i = 0; i < it->num; i++)
+				it->components[k][i] = *(void **)(base + size * rows[i * q->num_ctypes + k]);
+		else
+			for (size_t i = 0; i < it->num; i++)
+				it->components[k][i] = base + size * rows[i * q->num_ctypes + k];
+	}
+	return true;
 }
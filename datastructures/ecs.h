@@ -2,32 +2,63 @@
 #define ECS_H
 #include "mempool.h"
 #include "hmempool.h"
+#include "chunkpool.h"
 #include <inttypes.h>
 
+/*
+An eid is an hmempool handle: a slot in the lower ECS_EID_SLOT_BITS bits, plus a generation counter above that.
+The generation is bumped every time an entity is removed, so an eid that outlives its entity (for example a
+Target.target or Camera.next) won't alias whatever new entity reuses the slot.
+ecs_eid_used and ecs_entity_get_component reject stale eids.
+*/
+#define ECS_EID_SLOT_BITS HMEMPOOL_SLOT_BITS
+#define ECS_EID_SLOT_MASK HMEMPOOL_SLOT_MASK
+#define ecs_eid_slot(eid) hmempool_handle_slot(eid)
+
 #define ecs_c_constructor_destructor(name) void name(uint32_t eid, void *component, void *userdata)
 typedef ecs_c_constructor_destructor(ecs_c_constructor_fn);
 typedef ecs_c_constructor_destructor(ecs_c_destructor_fn);
+//Called on a copy of each component of a type as it is written to a snapshot, and on each component as it is mapped
+//back in, so that types holding pointers can swap them for blobs (see ecs_snapshot.h) and back.
+#define ecs_c_serialize_deserialize(name) void name(uint32_t eid, void *component, struct ecs_snapshot_blobs *blobs, void *userdata)
+struct ecs_snapshot_blobs;
+typedef ecs_c_serialize_deserialize(ecs_c_serialize_fn);
+typedef ecs_c_serialize_deserialize(ecs_c_deserialize_fn);
 struct ecs_component_init_params;
+struct ecs_query;
 typedef struct ecs_context {
 	struct mempool free_eids;
-	bool *eid_used;
+	//Indexed by eid slot, holds the eid (with generation) currently using that slot, or 0 if it's free.
+	uint32_t *live_eids;
 	//Stack of free component slots
 	struct mempool free_component_slots;
 	//Component pool array
 	struct hmempool *components;
+	//Parallel to components. For ctypes registered as stable, components[ctype] holds pointers into
+	//stable_components[ctype], which holds the component data itself. Unallocated for every other ctype.
+	struct chunkpool *stable_components;
 	//Mapping of anything to ctype, not maintained by ecs. Convenience for generic wrapper.
 	void *user_ctypes;
 	ecs_c_constructor_fn **constructors;
 	ecs_c_destructor_fn **destructors;
 	void **userdatas;
 	struct ecs_component_init_params **init_params;
+	//Pool of struct ecs_query pointers, kept up to date as components are added and removed.
+	struct mempool queries;
+	//Change tracking. write_ticks[ctype] is indexed by eid slot, and holds the tick at which that entity's component
+	//was last added or written through ecs_component_write. tick only moves forward when ecs_tick is called.
+	uint32_t tick;
+	uint32_t **write_ticks;
 } ecs_ctx;
 
 //Explained above ecs_component_init
 struct ecs_component_init_params {
 	size_t num, size;
+	bool stable;
 	ecs_c_constructor_fn *construct;
 	ecs_c_destructor_fn *destruct;
+	ecs_c_serialize_fn *serialize;
+	ecs_c_deserialize_fn *deserialize;
 	void *userdata;
 	uint32_t *ctype;
 	ecs_ctx *E;
@@ -37,6 +68,42 @@ struct ecs_component_init_params {
 	void (*deinit)(struct ecs_component_init_params *);
 };
 
+//Maximum number of component types a single query can match on.
+#define ECS_QUERY_MAX_CTYPES 8
+//Maximum number of entities yielded by each call to ecs_query_next.
+#define ECS_QUERY_BATCH 64
+
+//Cached list of all entities that have every one of a set of component types.
+//The ECS maintains it incrementally as components are added and removed, so systems that need several
+//components per entity don't have to go through ecs_entity_get_component (and the htoi table) for each one.
+struct ecs_query {
+	size_t num_ctypes;
+	uint32_t ctypes[ECS_QUERY_MAX_CTYPES];
+	//Handles of matching entities, densely packed. Order is not stable.
+	struct mempool eids;
+	//Parallel to eids, each item is num_ctypes uint32_t component pool indices, one per ctype.
+	struct mempool indices;
+	//Maps eid to its index in eids, with a +1 bias so that 0 means the entity does not match.
+	uint32_t *eid_to_match;
+};
+
+//Iterates over the components of one type that were written after a given tick, in component list order.
+struct ecs_changed_iter {
+	ecs_ctx *E;
+	uint32_t ctype, since;
+	size_t next;
+};
+
+//Iterates over a query in batches. components[k][i] points to the component of type ctypes[k] owned by eids[i].
+struct ecs_query_iter {
+	ecs_ctx *E;
+	struct ecs_query *q;
+	size_t next; //Match index of the start of the next batch.
+	size_t num; //Number of entities in the current batch.
+	const uint32_t *eids;
+	void *components[ECS_QUERY_MAX_CTYPES][ECS_QUERY_BATCH];
+};
+
 //Current maximum number of entities, will reallocate if number goes above this.
 size_t ecs_entities_max(ecs_ctx *E) __attribute__ ((pure));
 //Current number of entities.
@@ -45,8 +112,11 @@ size_t ecs_entities_num(ecs_ctx *E) __attribute__ ((pure));
 size_t ecs_components_max(ecs_ctx *E) __attribute__ ((pure));
 //Current number of registered components.
 size_t ecs_components_num(ecs_ctx *E) __attribute__ ((pure));
-//Returns true if a given eid is currently in use.
+//Returns true if a given eid is currently in use (and is not stale).
 bool ecs_eid_used(ecs_ctx *E, uint32_t eid);
+//Check many eids at once. Bit i of out_mask (out_mask[i/64] >> (i%64)) is set if eids[i] is in use.
+//out_mask should hold at least (num + 63) / 64 words. Returns the number of eids in use.
+size_t ecs_entities_alive(ecs_ctx *E, const uint32_t eids[], size_t num, uint64_t out_mask[]);
 //Create a new ecs_ctx
 //num_entities: Initial number of entities ecs can hold.
 //num_component_types: Initial number of types of components per entity.
@@ -60,15 +130,23 @@ void ecs_realloc(ecs_ctx *E, int num_entities, int num_component_types);
 //size: Each component of this type is this many bytes in size.
 //Returns the ctype, used to index an entity's component list.
 uint32_t ecs_component_register(ecs_ctx *E, size_t num, size_t size);
+//Same as ecs_component_register, but components of this type are stored in a chunkpool and never move,
+//so pointers to them stay valid until the component is removed. See chunkpool.h.
+//Lookups by eid go through one more pointer, and ecs_components can't be used for this type;
+//iterate with ecs_component_chunkpool or a query instead.
+uint32_t ecs_component_register_stable(ecs_ctx *E, size_t num, size_t size);
 //Register and initialize a new type of component, passing an init params struct with these members:
 //!!! IMPORTANT !!! p should remain valid for the lifetime of the ECS. If p is freed, undefined behavior will occur.
 //num: Initialize storage for this number of components of that type.
 //size: Each component of this type is this many bytes in size.
+//stable: If true, register with ecs_component_register_stable.
 //Any of the following can be NULL.
 //construct: Constructor that will be called on new component instances after they are allocated, if either
 //ecs_entity_add_construct_component or ecs_entity_add_copy_construct_component is used.
 //destruct: Destructor that will be called on component right before it is destroyed, if either
 //ecs_entity_destruct_remove_component or ecs_entity_destruct_remove_components is used.
+//serialize: Called on a copy of each component as it is written by ecs_snapshot_write, should replace any pointers.
+//deserialize: Called on each component after ecs_snapshot_map, should undo what serialize did.
 //userdata: Pointer passed to constructor and destructor, usually used to interact with resources not managed by ECS.
 //ctype: If not NULL, *ctype will be set to the ctype that is returned from this call.
 //E: Pointer to the ECS context, will be set before init is called.
@@ -89,11 +167,28 @@ void ecs_component_unregister(ecs_ctx *E, uint32_t ctype);
 //Returns the list of components of a given type.
 //This list may be invalidated if more components are registered (underlying memory is reallocated).
 //num: The number of components in the list.
+//Returns NULL for stable component types, which aren't stored contiguously.
 void * ecs_components(ecs_ctx *E, uint32_t ctype, size_t *num);
+//Returns true if ctype was registered with ecs_component_register_stable.
+bool ecs_component_is_stable(ecs_ctx *E, uint32_t ctype);
+//Returns the chunkpool holding the components of a stable ctype, or NULL if ctype is not stable.
+struct chunkpool * ecs_component_chunkpool(ecs_ctx *E, uint32_t ctype);
+//Size in bytes of a component of type ctype.
+size_t ecs_component_size(ecs_ctx *E, uint32_t ctype);
 //Returns a table that maps the index of a component within a component array to the handle of the entity that owns the component.
 const uint32_t * ecs_component_itoh(ecs_ctx *E, uint32_t ctype);
 //Add a new empty entity to the ecs.
 uint32_t ecs_entity_add(ecs_ctx *E);
+//Add num new entities, each with one component of every type in ctypes, and write their eids to out_eids.
+//initial_data[k] points to num contiguous components of type ctypes[k] to copy in (SoA), or is NULL to zero them.
+//Entity and component storage is grown at most once per call, and components are copied in with one memcpy per ctype.
+void ecs_entities_spawn(ecs_ctx *E, size_t num, const uint32_t ctypes[], size_t num_ctypes, const void *initial_data[], uint32_t out_eids[]);
+//Same as ecs_entities_spawn, then calls the registered constructor for each new component, after all of them are attached.
+void ecs_entities_spawn_construct(ecs_ctx *E, size_t num, const uint32_t ctypes[], size_t num_ctypes, const void *initial_data[], uint32_t out_eids[]);
+//Remove num entities and all their components. Stale eids are skipped.
+void ecs_entities_despawn(ecs_ctx *E, const uint32_t eids[], size_t num);
+//Same as ecs_entities_despawn, but calls registered destructors for each component first.
+void ecs_entities_destruct_despawn(ecs_ctx *E, const uint32_t eids[], size_t num);
 //Remove the entity with handle "eid" from the ecs.
 //The entity will be immediately overwritten.
 void ecs_entity_remove(ecs_ctx *E, uint32_t eid);
@@ -132,7 +227,36 @@ void ecs_entity_remove_components(ecs_ctx *E, uint32_t eid);
 //All components will immediately be overwritten.
 void ecs_entity_destruct_remove_components(ecs_ctx *E, uint32_t eid);
 //Get the component of type ctype from the entity with handle "eid".
-//Returns a pointer to the new component, or NULL if the entity does not have a component of that type.
+//Returns a pointer to the new component, or NULL if the entity does not have a component of that type, or eid is stale.
 void * ecs_entity_get_component(ecs_ctx *E, uint32_t eid, uint32_t ctype) __attribute__ ((pure));
+//Create a query matching all entities that have every component type in ctypes (at most ECS_QUERY_MAX_CTYPES).
+//The query is owned by the ECS and freed with it, or earlier with ecs_query_delete.
+//If one of the ctypes is unregistered, the query will be emptied and should be deleted.
+struct ecs_query * ecs_query_new(ecs_ctx *E, const uint32_t ctypes[], size_t num_ctypes);
+//Delete a query created with ecs_query_new.
+void ecs_query_delete(ecs_ctx *E, struct ecs_query *q);
+//Number of entities currently matching the query.
+size_t ecs_query_num(struct ecs_query *q) __attribute__ ((pure));
+//Returns the current change tick, then advances it, so anything written from here on is newer than the returned tick.
+//Typical use is for a cache to iterate over ecs_components_changed_since its last tick, then store ecs_tick(E).
+//Ticks start at 1, so a cache starting from 0 sees every component.
+uint32_t ecs_tick(ecs_ctx *E);
+//Same as ecs_entity_get_component, but also marks the component as written in the current tick.
+void * ecs_component_write(ecs_ctx *E, uint32_t eid, uint32_t ctype);
+//Mark the component as written in the current tick, for code that already has a pointer to it.
+//Safe to call from several threads at once, as long as they're marking different entities.
+void ecs_component_mark_written(ecs_ctx *E, uint32_t eid, uint32_t ctype);
+//Returns true if the component was added or written after tick "since".
+bool ecs_component_changed_since(ecs_ctx *E, uint32_t eid, uint32_t ctype, uint32_t since);
+//Prepare "it" to iterate over components of type ctype written after tick "since".
+//Adding or removing components of that type invalidates the iterator.
+void ecs_components_changed_since(struct ecs_changed_iter *it, ecs_ctx *E, uint32_t ctype, uint32_t since);
+//Returns the next changed component and sets *eid to its entity, or returns NULL when there are no more.
+void * ecs_changed_next(struct ecs_changed_iter *it, uint32_t *eid);
+//Prepare "it" to iterate over q from the start. Adding or removing components invalidates the iterator.
+void ecs_query_iter_init(struct ecs_query_iter *it, ecs_ctx *E, struct ecs_query *q);
+//Fill "it" with the next batch of matching entities and their components.
+//Returns false once there are no more matches.
+bool ecs_query_next(struct ecs_query_iter *it);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,206 @@
+#include "ecs_cmdbuf.h"
+#include "ecs.h"
+#include "mempool.h"
+#include "hmempool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+enum ecs_cmd_op {
+	ECS_CMD_ADD_COMPONENT,
+	ECS_CMD_ADD_CONSTRUCT_COMPONENT,
+	ECS_CMD_REMOVE_COMPONENT,
+	ECS_CMD_DESTRUCT_REMOVE_COMPONENT,
+	ECS_CMD_REMOVE_ENTITY,
+	ECS_CMD_DESTRUCT_REMOVE_ENTITY,
+};
+
+//Entity commands sort after every component command.
+#define ECS_CMD_NO_CTYPE UINT32_MAX
+
+struct ecs_cmd {
+	uint32_t ctype;
+	uint32_t seq; //Recording order, keeps the sort stable.
+	uint32_t eid;
+	uint32_t op;
+	size_t data; //Offset into the arena.
+};
+
+static struct ecs_cmd * ecs_cmdbuf_push(struct ecs_cmdbuf *cb, uint32_t op, uint32_t eid, uint32_t ctype)
+{
+	if (cb->cmds.num >= cb->cmds.max)
+		mempool_resize(&cb->cmds, cb->cmds.max * 2);
+	struct ecs_cmd *cmd = mempool_get(&cb->cmds, mempool_add_raw(&cb->cmds));
+	*cmd = (struct ecs_cmd){.ctype = ctype, .seq = cb->cmds.num - 1, .eid = eid, .op = op};
+	return cmd;
+}
+
+static void * ecs_cmdbuf_push_data(struct ecs_cmdbuf *cb, struct ecs_cmd *cmd, size_t size)
+{
+	//Keep component data aligned for any component type.
+	size_t aligned = (size + 15) & ~(size_t)15;
+	if (cb->arena_used + aligned > cb->arena_size) {
+		size_t new_size = cb->arena_size * 2 > cb->arena_used + aligned ? cb->arena_size * 2 : cb->arena_used + aligned;
+		unsigned char *new_arena = realloc(cb->arena, new_size);
+		if (new_arena) {
+			cb->arena = new_arena;
+			cb->arena_size = new_size;
+		} else {
+			printf("Whoops, running out of memory.\n");
+		}
+	}
+	cmd->data = cb->arena_used;
+	cb->arena_used += aligned;
+	return cb->arena + cmd->data;
+}
+
+struct ecs_cmdbuf ecs_cmdbuf_new(ecs_ctx *E, size_t num_cmds, size_t arena_size)
+{
+	return (struct ecs_cmdbuf){
+		.E = E,
+		.cmds = mempool_new(num_cmds ? num_cmds : 1, sizeof(struct ecs_cmd)),
+		.arena = malloc(arena_size ? arena_size : 16),
+		.arena_size = arena_size ? arena_size : 16,
+		.resolved = mempool_new(num_cmds ? num_cmds : 1, sizeof(uint32_t)),
+	};
+}
+
+void ecs_cmdbuf_delete(struct ecs_cmdbuf *cb)
+{
+	mempool_delete(&cb->cmds);
+	mempool_delete(&cb->resolved);
+	free(cb->arena);
+	cb->arena = NULL;
+}
+
+uint32_t ecs_cmdbuf_entity_add(struct ecs_cmdbuf *cb)
+{
+	return ECS_CMDBUF_PENDING_BIT | cb->num_pending++;
+}
+
+void ecs_cmdbuf_entity_remove(struct ecs_cmdbuf *cb, uint32_t eid)
+{
+	ecs_cmdbuf_push(cb, ECS_CMD_REMOVE_ENTITY, eid, ECS_CMD_NO_CTYPE);
+}
+
+void ecs_cmdbuf_entity_destruct_remove(struct ecs_cmdbuf *cb, uint32_t eid)
+{
+	ecs_cmdbuf_push(cb, ECS_CMD_DESTRUCT_REMOVE_ENTITY, eid, ECS_CMD_NO_CTYPE);
+}
+
+void * ecs_cmdbuf_add_component(struct ecs_cmdbuf *cb, uint32_t eid, uint32_t ctype)
+{
+	struct ecs_cmd *cmd = ecs_cmdbuf_push(cb, ECS_CMD_ADD_COMPONENT, eid, ctype);
+	return ecs_cmdbuf_push_data(cb, cmd, ecs_component_size(cb->E, ctype));
+}
+
+void ecs_cmdbuf_add_copy_component(struct ecs_cmdbuf *cb, uint32_t eid, uint32_t ctype, void *c)
+{
+	size_t size = ecs_component_size(cb->E, ctype);
+	memcpy(ecs_cmdbuf_add_component(cb, eid, ctype), c, size);
+}
+
+void ecs_cmdbuf_add_copy_construct_component(struct ecs_cmdbuf *cb, uint32_t eid, uint32_t ctype, void *c)
+{
+	size_t size = ecs_component_size(cb->E, ctype);
+	struct ecs_cmd *cmd = ecs_cmdbuf_push(cb, ECS_CMD_ADD_CONSTRUCT_COMPONENT, eid, ctype);
+	memcpy(ecs_cmdbuf_push_data(cb, cmd, size), c, size);
+}
+
+void ecs_cmdbuf_remove_component(struct ecs_cmdbuf *cb, uint32_t eid, uint32_t ctype)
+{
+	ecs_cmdbuf_push(cb, ECS_CMD_REMOVE_COMPONENT, eid, ctype);
+}
+
+void ecs_cmdbuf_destruct_remove_component(struct ecs_cmdbuf *cb, uint32_t eid, uint32_t ctype)
+{
+	ecs_cmdbuf_push(cb, ECS_CMD_DESTRUCT_REMOVE_COMPONENT, eid, ctype);
+}
+
+uint32_t ecs_cmdbuf_resolve(struct ecs_cmdbuf *cb, uint32_t eid)
+{
+	if (!(eid & ECS_CMDBUF_PENDING_BIT))
+		return eid;
+	uint32_t i = eid & ~ECS_CMDBUF_PENDING_BIT;
+	assert(i < cb->resolved.num);
+	return *(uint32_t *)mempool_get(&cb->resolved, i);
+}
+
+static int ecs_cmd_compare(const void *a, const void *b)
+{
+	const struct ecs_cmd *ca = a, *cb = b;
+	if (ca->ctype != cb->ctype)
+		return ca->ctype < cb->ctype ? -1 : 1;
+	return (ca->seq > cb->seq) - (ca->seq < cb->seq);
+}
+
+void ecs_cmdbuf_flush(struct ecs_cmdbuf *cb)
+{
+	ecs_ctx *E = cb->E;
+
+	//Add pending entities, growing the ECS at most once.
+	size_t num_entities = ecs_entities_num(E) + cb->num_pending;
+	if (num_entities > ecs_entities_max(E)) {
+		size_t max = ecs_entities_max(E) * 2;
+		ecs_realloc(E, max > num_entities ? max : num_entities, ecs_components_max(E));
+	}
+	if (cb->num_pending > cb->resolved.max)
+		mempool_resize(&cb->resolved, cb->num_pending);
+	cb->resolved.num = 0;
+	for (uint32_t i = 0; i < cb->num_pending; i++) {
+		uint32_t eid = ecs_entity_add(E);
+		mempool_add(&cb->resolved, &eid);
+	}
+
+	struct ecs_cmd *cmds = (struct ecs_cmd *)cb->cmds.pool;
+	size_t num = cb->cmds.num;
+	qsort(cmds, num, sizeof(struct ecs_cmd), ecs_cmd_compare);
+
+	for (size_t start = 0, end = 0; start < num; start = end) {
+		uint32_t ctype = cmds[start].ctype;
+		size_t num_adds = 0;
+		for (end = start; end < num && cmds[end].ctype == ctype; end++)
+			num_adds += cmds[end].op == ECS_CMD_ADD_COMPONENT || cmds[end].op == ECS_CMD_ADD_CONSTRUCT_COMPONENT;
+
+		//Make room for every add in this group with one resize.
+		if (ctype != ECS_CMD_NO_CTYPE && num_adds) {
+			struct hmempool *cl = &E->components[ctype];
+			if (cl->pool.num + num_adds > cl->pool.max) {
+				size_t max = cl->pool.max * 2;
+				hmempool_resize(cl, max > cl->pool.num + num_adds ? max : cl->pool.num + num_adds);
+			}
+		}
+
+		for (size_t i = start; i < end; i++) {
+			struct ecs_cmd *cmd = &cmds[i];
+			uint32_t eid = ecs_cmdbuf_resolve(cb, cmd->eid);
+			switch (cmd->op) {
+			case ECS_CMD_ADD_COMPONENT:
+				ecs_entity_add_copy_component(E, eid, ctype, cb->arena + cmd->data);
+				break;
+			case ECS_CMD_ADD_CONSTRUCT_COMPONENT:
+				ecs_entity_add_copy_construct_component(E, eid, ctype, cb->arena + cmd->data);
+				break;
+			case ECS_CMD_REMOVE_COMPONENT:
+				ecs_entity_remove_component(E, eid, ctype);
+				break;
+			case ECS_CMD_DESTRUCT_REMOVE_COMPONENT:
+				ecs_entity_destruct_remove_component(E, eid, ctype);
+				break;
+			case ECS_CMD_REMOVE_ENTITY:
+				if (ecs_eid_used(E, eid))
+					ecs_entity_remove(E, eid);
+				break;
+			case ECS_CMD_DESTRUCT_REMOVE_ENTITY:
+				if (ecs_eid_used(E, eid))
+					ecs_entity_destruct_remove(E, eid);
+				break;
+			}
+		}
+	}
+
+	cb->cmds.num = 0;
+	cb->arena_used = 0;
+	cb->num_pending = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef ECS_CMDBUF_H
+#define ECS_CMDBUF_H
+#include "ecs.h"
+#include "mempool.h"
+#include <inttypes.h>
+
+/*
+A command buffer records structural changes to an ecs_ctx (entity and component adds and removes)
+so they can be made while iterating over ecs_components, and applied later in one batch with ecs_cmdbuf_flush.
+
+Entities added through a command buffer get a "pending" eid (ECS_CMDBUF_PENDING_BIT is set), which can be used
+with other commands in the same buffer. Real eids are assigned during the flush, see ecs_cmdbuf_resolve.
+
+Command records and component data are stored in storage owned by the buffer, which is reused between flushes.
+It only grows if more is recorded than has ever been recorded before, so steady-state recording does not allocate.
+*/
+
+#define ECS_CMDBUF_PENDING_BIT 0x80000000u
+
+struct ecs_cmdbuf {
+	ecs_ctx *E;
+	//Command records, struct ecs_cmd (private to ecs_cmdbuf.c).
+	struct mempool cmds;
+	//Arena for copied component data, referenced by offset from command records.
+	unsigned char *arena;
+	size_t arena_used, arena_size;
+	//Number of entities added since the last flush.
+	uint32_t num_pending;
+	//Real eids assigned to pending eids during the last flush, indexed by pending eid.
+	struct mempool resolved;
+};
+
+//Create a new command buffer for E.
+//num_cmds: Initial number of commands that can be recorded without allocating.
+//arena_size: Initial number of bytes of component data that can be recorded without allocating.
+struct ecs_cmdbuf ecs_cmdbuf_new(ecs_ctx *E, size_t num_cmds, size_t arena_size);
+//Free a command buffer. Unflushed commands are discarded.
+void ecs_cmdbuf_delete(struct ecs_cmdbuf *cb);
+//Record adding a new empty entity, returns a pending eid.
+uint32_t ecs_cmdbuf_entity_add(struct ecs_cmdbuf *cb);
+//Record removing an entity, see ecs_entity_remove.
+void ecs_cmdbuf_entity_remove(struct ecs_cmdbuf *cb, uint32_t eid);
+//Record removing an entity, calling component destructors, see ecs_entity_destruct_remove.
+void ecs_cmdbuf_entity_destruct_remove(struct ecs_cmdbuf *cb, uint32_t eid);
+//Record adding a component of type ctype to eid.
+//Returns a pointer to storage for the component, to be initialized by the caller.
+//The pointer is only valid until the next command is recorded.
+void * ecs_cmdbuf_add_component(struct ecs_cmdbuf *cb, uint32_t eid, uint32_t ctype);
+//Record adding a component of type ctype to eid, copied from c now.
+void ecs_cmdbuf_add_copy_component(struct ecs_cmdbuf *cb, uint32_t eid, uint32_t ctype, void *c);
+//Record adding a component of type ctype to eid, copied from c now. The constructor is called when it is flushed.
+void ecs_cmdbuf_add_copy_construct_component(struct ecs_cmdbuf *cb, uint32_t eid, uint32_t ctype, void *c);
+//Record removing the component of type ctype from eid.
+void ecs_cmdbuf_remove_component(struct ecs_cmdbuf *cb, uint32_t eid, uint32_t ctype);
+//Record removing the component of type ctype from eid, calling its destructor when it is flushed.
+void ecs_cmdbuf_destruct_remove_component(struct ecs_cmdbuf *cb, uint32_t eid, uint32_t ctype);
+//Apply all recorded commands to the ECS, then clear the buffer.
+//Entities are added first, then component commands grouped by ctype (in recording order within each ctype),
+//then entity removals. Each component pool is resized at most once.
+void ecs_cmdbuf_flush(struct ecs_cmdbuf *cb);
+//Translate a pending eid into the eid that was assigned to it by the last flush. Other eids are returned as-is.
+uint32_t ecs_cmdbuf_resolve(struct ecs_cmdbuf *cb, uint32_t eid);
+
+#endif
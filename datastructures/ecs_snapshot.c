@@ -0,0 +1,305 @@
+#include "ecs_snapshot.h"
+#include "ecs.h"
+#include "hmempool.h"
+#include "chunkpool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static uint64_t ecs_snapshot_align(uint64_t offset)
+{
+	return (offset + ECS_SNAPSHOT_ALIGN - 1) & ~(uint64_t)(ECS_SNAPSHOT_ALIGN - 1);
+}
+
+//Reserve a section of size bytes at *offset, and move *offset past it. Returns the section's offset.
+static uint64_t ecs_snapshot_section(uint64_t *offset, uint64_t size)
+{
+	uint64_t section = ecs_snapshot_align(*offset);
+	*offset = section + size;
+	return section;
+}
+
+//Write size bytes of data at offset, zero-padding from *written up to offset first.
+static bool ecs_snapshot_write_section(int fd, uint64_t *written, uint64_t offset, const void *data, size_t size)
+{
+	static const unsigned char zeros[ECS_SNAPSHOT_ALIGN] = {0};
+	assert(offset >= *written && offset - *written <= ECS_SNAPSHOT_ALIGN);
+	const unsigned char *bytes[2] = {zeros, data};
+	size_t sizes[2] = {offset - *written, size};
+	for (int k = 0; k < 2; k++) {
+		for (size_t done = 0; done < sizes[k];) {
+			ssize_t ret = write(fd, bytes[k] + done, sizes[k] - done);
+			if (ret < 0)
+				return false;
+			done += ret;
+		}
+	}
+	*written = offset + size;
+	return true;
+}
+
+bool ecs_snapshot_write(ecs_ctx *E, int fd)
+{
+	size_t emax = ecs_entities_max(E), cmax = ecs_components_max(E);
+	struct ecs_snapshot_header h = {
+		.magic = ECS_SNAPSHOT_MAGIC,
+		.version = ECS_SNAPSHOT_VERSION,
+		.header_size = sizeof(struct ecs_snapshot_header),
+		.entities_max = emax,
+		.components_max = cmax,
+		.num_free_eids = E->free_eids.num,
+		.num_free_ctypes = E->free_component_slots.num,
+	};
+	uint64_t offset = sizeof(h);
+	h.free_eids_offset = ecs_snapshot_section(&offset, h.num_free_eids * sizeof(uint32_t));
+	h.free_ctypes_offset = ecs_snapshot_section(&offset, h.num_free_ctypes * sizeof(uint32_t));
+	h.live_eids_offset = ecs_snapshot_section(&offset, (emax + 1) * sizeof(uint32_t));
+	h.ctypes_offset = ecs_snapshot_section(&offset, cmax * sizeof(struct ecs_snapshot_ctype));
+
+	struct ecs_snapshot_blobs blobs = {0};
+	struct ecs_snapshot_ctype *ctypes = calloc(cmax, sizeof(struct ecs_snapshot_ctype));
+	//Data written for each ctype's pool. Either the pool itself, or a copy for stable ctypes and ctypes with a serialize hook.
+	void **pools = calloc(cmax, sizeof(void *));
+	for (uint32_t c = 0; c < cmax; c++) {
+		struct hmempool *cl = &E->components[c];
+		if (!cl->allocated)
+			continue;
+		struct ecs_snapshot_ctype *sc = &ctypes[c];
+		sc->allocated = true;
+		sc->stable = ecs_component_is_stable(E, c);
+		sc->num = cl->pool.num;
+		sc->max = cl->pool.max;
+		sc->size = ecs_component_size(E, c);
+		sc->indirection_len = cl->indirection_len;
+		sc->pool_offset = ecs_snapshot_section(&offset, sc->num * sc->size);
+		sc->htoi_offset = ecs_snapshot_section(&offset, sc->indirection_len * sizeof(uint32_t));
+		sc->itoh_offset = ecs_snapshot_section(&offset, sc->num * sizeof(uint32_t));
+
+		struct ecs_component_init_params *p = E->init_params[c];
+		ecs_c_serialize_fn *serialize = p ? p->serialize : NULL;
+		if (!sc->stable && !serialize) {
+			pools[c] = cl->pool.pool;
+			continue;
+		}
+		unsigned char *copy = malloc(sc->num * sc->size);
+		for (size_t i = 0; i < sc->num; i++) {
+			memcpy(copy + i * sc->size, ecs_entity_get_component(E, cl->itoh[i], c), sc->size);
+			if (serialize)
+				serialize(cl->itoh[i], copy + i * sc->size, &blobs, p->userdata);
+		}
+		pools[c] = copy;
+	}
+	h.blobs_size = blobs.size;
+	h.blobs_offset = ecs_snapshot_section(&offset, blobs.size);
+	h.file_size = offset;
+
+	uint64_t written = 0;
+	bool ok = ecs_snapshot_write_section(fd, &written, 0, &h, sizeof(h));
+	ok = ok && ecs_snapshot_write_section(fd, &written, h.free_eids_offset, E->free_eids.pool, h.num_free_eids * sizeof(uint32_t));
+	ok = ok && ecs_snapshot_write_section(fd, &written, h.free_ctypes_offset, E->free_component_slots.pool, h.num_free_ctypes * sizeof(uint32_t));
+	ok = ok && ecs_snapshot_write_section(fd, &written, h.live_eids_offset, E->live_eids, (emax + 1) * sizeof(uint32_t));
+	ok = ok && ecs_snapshot_write_section(fd, &written, h.ctypes_offset, ctypes, cmax * sizeof(struct ecs_snapshot_ctype));
+	for (uint32_t c = 0; c < cmax; c++) {
+		struct ecs_snapshot_ctype *sc = &ctypes[c];
+		if (!sc->allocated)
+			continue;
+		ok = ok && ecs_snapshot_write_section(fd, &written, sc->pool_offset, pools[c], sc->num * sc->size);
+		ok = ok && ecs_snapshot_write_section(fd, &written, sc->htoi_offset, E->components[c].htoi, sc->indirection_len * sizeof(uint32_t));
+		ok = ok && ecs_snapshot_write_section(fd, &written, sc->itoh_offset, E->components[c].itoh, sc->num * sizeof(uint32_t));
+		if (pools[c] != E->components[c].pool.pool)
+			free(pools[c]);
+	}
+	ok = ok && ecs_snapshot_write_section(fd, &written, h.blobs_offset, blobs.data, blobs.size);
+
+	free(blobs.data);
+	free(pools);
+	free(ctypes);
+	return ok;
+}
+
+static bool ecs_snapshot_in_bounds(struct ecs_snapshot_header *h, uint64_t offset, uint64_t size)
+{
+	return offset <= h->file_size && size <= h->file_size - offset;
+}
+
+static bool ecs_snapshot_valid(struct ecs_snapshot_header *h, size_t file_size)
+{
+	if (file_size < sizeof(struct ecs_snapshot_header) || memcmp(h->magic, ECS_SNAPSHOT_MAGIC, sizeof(h->magic)))
+		return false;
+	if (h->version != ECS_SNAPSHOT_VERSION || h->header_size != sizeof(struct ecs_snapshot_header) || h->file_size != file_size)
+		return false;
+	if (h->num_free_eids > h->entities_max || h->num_free_ctypes > h->components_max)
+		return false;
+	if (!ecs_snapshot_in_bounds(h, h->free_eids_offset, h->num_free_eids * sizeof(uint32_t)) ||
+		!ecs_snapshot_in_bounds(h, h->free_ctypes_offset, h->num_free_ctypes * sizeof(uint32_t)) ||
+		!ecs_snapshot_in_bounds(h, h->live_eids_offset, (h->entities_max + 1ull) * sizeof(uint32_t)) ||
+		!ecs_snapshot_in_bounds(h, h->ctypes_offset, h->components_max * sizeof(struct ecs_snapshot_ctype)) ||
+		!ecs_snapshot_in_bounds(h, h->blobs_offset, h->blobs_size))
+		return false;
+	struct ecs_snapshot_ctype *ctypes = (struct ecs_snapshot_ctype *)((unsigned char *)h + h->ctypes_offset);
+	for (uint32_t c = 0; c < h->components_max; c++) {
+		struct ecs_snapshot_ctype *sc = &ctypes[c];
+		if (!sc->allocated)
+			continue;
+		if (sc->num > sc->max || sc->num > sc->indirection_len || sc->indirection_len < h->entities_max || !sc->size || sc->size > SIZE_MAX / (sc->num + 1) ||
+			!ecs_snapshot_in_bounds(h, sc->pool_offset, sc->num * sc->size) ||
+			!ecs_snapshot_in_bounds(h, sc->htoi_offset, sc->indirection_len * sizeof(uint32_t)) ||
+			!ecs_snapshot_in_bounds(h, sc->itoh_offset, sc->num * sizeof(uint32_t)))
+			return false;
+	}
+	return true;
+}
+
+static struct hmempool ecs_snapshot_restore_pool(ecs_ctx *E, uint32_t c, struct ecs_snapshot_ctype *sc, unsigned char *map)
+{
+	struct hmempool hm;
+	unsigned char *data = map + sc->pool_offset;
+	if (sc->stable) {
+		hm = hmempool_new_unmanaged(sc->max, sizeof(void *), sc->indirection_len);
+		E->stable_components[c] = chunkpool_new(sc->num, sc->size);
+		for (size_t i = 0; i < sc->num; i++) {
+			void *component = chunkpool_add(&E->stable_components[c], data + i * sc->size, NULL);
+			mempool_add(&hm.pool, &component);
+		}
+	} else if (sc->num) {
+		//Point the pool at the mapped section. It only has room for what's there, the first add copies it out.
+		hm = (struct hmempool){
+			.pool = mempool_init(sc->num, sc->size, data),
+			.indirection_len = sc->indirection_len,
+			.htoi = calloc(sc->indirection_len, sizeof(uint32_t)),
+			.itoh = calloc(sc->indirection_len, sizeof(uint32_t)),
+			.allocated = true,
+		};
+		hm.pool.num = sc->num;
+	} else {
+		hm = hmempool_new_unmanaged(sc->max ? sc->max : 1, sc->size, sc->indirection_len);
+	}
+	memcpy(hm.htoi, map + sc->htoi_offset, sc->indirection_len * sizeof(uint32_t));
+	memcpy(hm.itoh, map + sc->itoh_offset, sc->num * sizeof(uint32_t));
+	return hm;
+}
+
+bool ecs_snapshot_map(struct ecs_snapshot *snap, const char *path, ecs_ctx *E,
+	struct ecs_component_init_params *init_params[], size_t num_init_params)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		printf("Could not open ECS snapshot %s.\n", path);
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(struct ecs_snapshot_header)) {
+		close(fd);
+		printf("ECS snapshot %s is too small.\n", path);
+		return false;
+	}
+	//Private and writable, so component pools can be used in place without changing the file.
+	unsigned char *map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		printf("Could not map ECS snapshot %s.\n", path);
+		return false;
+	}
+	struct ecs_snapshot_header *h = (struct ecs_snapshot_header *)map;
+	if (!ecs_snapshot_valid(h, st.st_size)) {
+		munmap(map, st.st_size);
+		printf("ECS snapshot %s is invalid, or from a different version.\n", path);
+		return false;
+	}
+
+	*E = ecs_new(h->entities_max, h->components_max);
+	memcpy(E->free_eids.pool, map + h->free_eids_offset, h->num_free_eids * sizeof(uint32_t));
+	E->free_eids.num = h->num_free_eids;
+	memcpy(E->free_component_slots.pool, map + h->free_ctypes_offset, h->num_free_ctypes * sizeof(uint32_t));
+	E->free_component_slots.num = h->num_free_ctypes;
+	memcpy(E->live_eids, map + h->live_eids_offset, (h->entities_max + 1) * sizeof(uint32_t));
+
+	struct ecs_snapshot_ctype *ctypes = (struct ecs_snapshot_ctype *)(map + h->ctypes_offset);
+	for (uint32_t c = 0; c < h->components_max; c++) {
+		if (!ctypes[c].allocated)
+			continue;
+		E->components[c] = ecs_snapshot_restore_pool(E, c, &ctypes[c], map);
+		//Change ticks aren't saved, everything restored counts as written in the first tick.
+		E->write_ticks[c] = malloc((h->entities_max + 1) * sizeof(uint32_t));
+		for (size_t i = 0; i <= h->entities_max; i++)
+			E->write_ticks[c][i] = E->tick;
+	}
+
+	for (uint32_t c = 0; c < h->components_max && c < num_init_params; c++) {
+		struct ecs_component_init_params *p = init_params[c];
+		if (!p || !ctypes[c].allocated)
+			continue;
+		ecs_component_set_construct_destruct(E, c, p->construct, p->destruct, p->userdata);
+		if (p->ctype)
+			*p->ctype = c;
+		p->E = E;
+		p->ip = p;
+		if (p->init)
+			p->ctx = p->init(p);
+		E->init_params[c] = p;
+	}
+
+	struct ecs_snapshot_blobs blobs = {.data = map + h->blobs_offset, .size = h->blobs_size, .max = h->blobs_size};
+	for (uint32_t c = 0; c < h->components_max && c < num_init_params; c++) {
+		struct ecs_component_init_params *p = E->init_params[c];
+		if (!p || !p->deserialize)
+			continue;
+		for (size_t i = 0; i < E->components[c].pool.num; i++) {
+			uint32_t eid = E->components[c].itoh[i];
+			p->deserialize(eid, ecs_entity_get_component(E, eid, c), &blobs, p->userdata);
+		}
+	}
+
+	snap->map = map;
+	snap->size = st.st_size;
+	return true;
+}
+
+void ecs_snapshot_unmap(struct ecs_snapshot *snap)
+{
+	if (snap->map)
+		munmap(snap->map, snap->size);
+	snap->map = NULL;
+	snap->size = 0;
+}
+
+uint64_t ecs_snapshot_blob_add(struct ecs_snapshot_blobs *blobs, const void *data, size_t size)
+{
+	if (!data)
+		return 0;
+	//Keep blobs 8-byte aligned, in case they hold more than strings.
+	size_t start = (blobs->size + 7) & ~(size_t)7;
+	if (start + size > blobs->max) {
+		size_t max = blobs->max ? blobs->max * 2 : 4096;
+		while (max < start + size)
+			max *= 2;
+		unsigned char *new_data = realloc(blobs->data, max);
+		if (!new_data) {
+			printf("Whoops, running out of memory.\n");
+			return 0;
+		}
+		blobs->data = new_data;
+		blobs->max = max;
+	}
+	memset(blobs->data + blobs->size, 0, start - blobs->size);
+	memcpy(blobs->data + start, data, size);
+	blobs->size = start + size;
+	return start + 1;
+}
+
+uint64_t ecs_snapshot_blob_add_string(struct ecs_snapshot_blobs *blobs, const char *str)
+{
+	return ecs_snapshot_blob_add(blobs, str, str ? strlen(str) + 1 : 0);
+}
+
+void * ecs_snapshot_blob_get(struct ecs_snapshot_blobs *blobs, uint64_t offset)
+{
+	if (!offset || offset > blobs->size)
+		return NULL;
+	return blobs->data + offset - 1;
+}
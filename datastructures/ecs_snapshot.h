@@ -0,0 +1,76 @@
+#ifndef ECS_SNAPSHOT_H
+#define ECS_SNAPSHOT_H
+#include "ecs.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+/*
+Binary snapshots of a whole ecs_ctx, for instant scene reloads and test fixtures.
+
+A snapshot is a header followed by ECS_SNAPSHOT_ALIGN-aligned sections: the eid and ctype free lists, live_eids,
+then for each registered ctype its raw component pool and htoi/itoh tables, and finally a blob section.
+Restoring maps the file and points each component pool straight at its section (copy-on-write), so there is no
+per-entity parsing. The handle tables are copied, since the ECS grows them in place.
+
+Components are written as raw bytes. Types that hold pointers (Label strings, for example) should register
+serialize/deserialize hooks in their ecs_component_init_params: serialize swaps pointers for blob offsets on the
+copy that gets written, and deserialize swaps them back once the snapshot is mapped.
+Function pointers are only meaningful within the same run of the same binary, so they're fine for reloads.
+Stable ctypes (see ecs_component_register_stable) are written in pool order and copied back into a new chunkpool.
+Queries are not saved, make new ones after restoring.
+*/
+
+#define ECS_SNAPSHOT_MAGIC "TUECSNAP"
+#define ECS_SNAPSHOT_VERSION 1
+#define ECS_SNAPSHOT_ALIGN 64
+
+struct ecs_snapshot_header {
+	char magic[8];
+	uint32_t version, header_size;
+	uint32_t entities_max, components_max;
+	uint64_t num_free_eids, free_eids_offset;
+	uint64_t num_free_ctypes, free_ctypes_offset;
+	uint64_t live_eids_offset;
+	uint64_t ctypes_offset; //components_max struct ecs_snapshot_ctype
+	uint64_t blobs_offset, blobs_size;
+	uint64_t file_size;
+};
+
+struct ecs_snapshot_ctype {
+	uint32_t allocated, stable;
+	uint64_t num, max, size; //size is the component size, not the size of the pointers a stable ctype's pool holds.
+	uint64_t indirection_len;
+	uint64_t pool_offset, htoi_offset, itoh_offset;
+};
+
+//Variable-size data that components point to. Offsets start at 1, so 0 can stand for NULL.
+struct ecs_snapshot_blobs {
+	unsigned char *data;
+	size_t size, max;
+};
+
+//A mapped snapshot file. Keep it around until the ECS restored from it has been freed.
+struct ecs_snapshot {
+	void *map;
+	size_t size;
+};
+
+//Write a snapshot of E to the file descriptor fd. Returns false if a write failed.
+bool ecs_snapshot_write(ecs_ctx *E, int fd);
+//Map the snapshot at path and restore it into *E, which should not already hold an ECS.
+//init_params[ctype] (num_init_params long, entries can be NULL) are re-attached to each ctype in the snapshot:
+//constructors, destructors, userdata and hooks are set, *ctype is set, and init is called as in ecs_component_init.
+//deserialize hooks are called after that. Constructors are not called. Returns false if the file isn't a valid snapshot.
+bool ecs_snapshot_map(struct ecs_snapshot *snap, const char *path, ecs_ctx *E,
+	struct ecs_component_init_params *init_params[], size_t num_init_params);
+//Unmap a snapshot. Call after ecs_free on the ECS restored from it.
+void ecs_snapshot_unmap(struct ecs_snapshot *snap);
+//Copy size bytes into the blobs, returns an offset for ecs_snapshot_blob_get. Returns 0 if data is NULL.
+uint64_t ecs_snapshot_blob_add(struct ecs_snapshot_blobs *blobs, const void *data, size_t size);
+//Convenience for ecs_snapshot_blob_add with a NUL-terminated string.
+uint64_t ecs_snapshot_blob_add_string(struct ecs_snapshot_blobs *blobs, const char *str);
+//Returns a pointer to the blob at offset, or NULL if offset is 0.
+void * ecs_snapshot_blob_get(struct ecs_snapshot_blobs *blobs, uint64_t offset);
+
+#endif
@@ -0,0 +1,349 @@
+#include "hashmap.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define HASHMAP_SEED 0
+#define STRPOOL_BLOCK_SIZE 4096
+
+//wyhash's mixing constants, and its 64x64->128 bit multiply folded back down to 64 bits.
+static const uint64_t hashmap_secret[4] = {
+	0xa0761d6478bd642full, 0xe7037ed1a0b428dbull, 0x8ebc6af09c88c6e3ull, 0x589965cc75374cc3ull
+};
+
+static inline void hashmap_mum(uint64_t *a, uint64_t *b)
+{
+	__uint128_t r = (__uint128_t)*a * *b;
+	*a = (uint64_t)r;
+	*b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t hashmap_mix(uint64_t a, uint64_t b)
+{
+	hashmap_mum(&a, &b);
+	return a ^ b;
+}
+
+static inline uint64_t hashmap_read8(const unsigned char *p)
+{
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t hashmap_read4(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+uint64_t hashmap_hash(const void *data, size_t len, uint64_t seed)
+{
+	const uint64_t *s = hashmap_secret;
+	const unsigned char *p = data;
+	uint64_t a, b;
+	seed ^= hashmap_mix(seed ^ s[0], s[1]);
+	if (len <= 16) {
+		if (len >= 4) {
+			//Two overlapping pairs of 4-byte reads cover anything from 4 to 16 bytes.
+			size_t mid = (len >> 3) << 2;
+			a = (hashmap_read4(p) << 32) | hashmap_read4(p + mid);
+			b = (hashmap_read4(p + len - 4) << 32) | hashmap_read4(p + len - 4 - mid);
+		} else if (len > 0) {
+			a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+			b = 0;
+		} else {
+			a = b = 0;
+		}
+	} else {
+		size_t i = len;
+		if (i > 48) {
+			uint64_t seed1 = seed, seed2 = seed;
+			do {
+				seed = hashmap_mix(hashmap_read8(p) ^ s[1], hashmap_read8(p + 8) ^ seed);
+				seed1 = hashmap_mix(hashmap_read8(p + 16) ^ s[2], hashmap_read8(p + 24) ^ seed1);
+				seed2 = hashmap_mix(hashmap_read8(p + 32) ^ s[3], hashmap_read8(p + 40) ^ seed2);
+				p += 48;
+				i -= 48;
+			} while (i > 48);
+			seed ^= seed1 ^ seed2;
+		}
+		while (i > 16) {
+			seed = hashmap_mix(hashmap_read8(p) ^ s[1], hashmap_read8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		//The last 16 bytes, overlapping whatever the loops already covered.
+		a = hashmap_read8(p + i - 16);
+		b = hashmap_read8(p + i - 8);
+	}
+	a ^= s[1];
+	b ^= seed;
+	hashmap_mum(&a, &b);
+	return hashmap_mix(a ^ s[0] ^ len, b ^ s[1]);
+}
+
+static size_t hashmap_capacity_for(size_t num)
+{
+	//Keep the load at or under 7/8.
+	size_t max = HASHMAP_MIN_SIZE;
+	while (max * 7 / 8 < num)
+		max *= 2;
+	return max;
+}
+
+static struct hashmap hashmap_new_internal(size_t num, struct strpool *strings, bool owns_keys)
+{
+	struct hashmap m = {
+		.max = hashmap_capacity_for(num),
+		.strings = strings,
+		.owns_keys = owns_keys,
+	};
+	m.slots = calloc(m.max, sizeof(struct hashmap_slot));
+	if (!m.slots) {
+		printf("Whoops, running out of memory.\n");
+		m.max = 0;
+	}
+	return m;
+}
+
+struct hashmap hashmap_new(size_t num, struct strpool *strings)
+{
+	return hashmap_new_internal(num, strings, !strings);
+}
+
+void hashmap_delete(struct hashmap *m, void (*cleanup)(struct hashmap_entry *, void *), void *userdata)
+{
+	for (size_t i = 0; i < m->max; i++) {
+		struct hashmap_slot *s = &m->slots[i];
+		if (!s->dist)
+			continue;
+		if (cleanup)
+			cleanup(&s->entry, userdata);
+		if (m->owns_keys)
+			free((char *)s->entry.key);
+	}
+	free(m->slots);
+	*m = (struct hashmap){0};
+}
+
+//Returns the slot holding key, or NULL. With interned set, keys are only compared by address.
+static struct hashmap_slot * hashmap_probe(struct hashmap *m, const char *key, uint32_t hash, bool interned)
+{
+	if (!m->num)
+		return NULL;
+	size_t mask = m->max - 1;
+	for (size_t i = hash & mask, dist = 1;; i = (i + 1) & mask, dist++) {
+		struct hashmap_slot *s = &m->slots[i];
+		//Empty, or an entry closer to its home slot than key would be: Robin Hood would have put key before it.
+		if (s->dist < dist)
+			return NULL;
+		if (s->hash == hash && (s->entry.key == key || (!interned && !strcmp(s->entry.key, key))))
+			return s;
+	}
+}
+
+//Place a slot's contents into slots, returns where it ended up. There has to be at least one empty slot.
+static struct hashmap_slot * hashmap_place(struct hashmap_slot *slots, size_t mask, struct hashmap_slot item)
+{
+	struct hashmap_slot *placed = NULL;
+	item.dist = 1;
+	for (size_t i = item.hash & mask;; i = (i + 1) & mask, item.dist++) {
+		struct hashmap_slot *s = &slots[i];
+		if (!s->dist) {
+			*s = item;
+			return placed ? placed : s;
+		}
+		if (s->dist < item.dist) {
+			//Take from the rich: item has probed further than s, so it gets the slot and s moves on.
+			struct hashmap_slot displaced = *s;
+			*s = item;
+			item = displaced;
+			if (!placed)
+				placed = s;
+		}
+	}
+}
+
+static bool hashmap_resize(struct hashmap *m, size_t max)
+{
+	struct hashmap_slot *slots = calloc(max, sizeof(struct hashmap_slot));
+	if (!slots) {
+		printf("Whoops, running out of memory.\n");
+		return false;
+	}
+	for (size_t i = 0; i < m->max; i++)
+		if (m->slots[i].dist)
+			hashmap_place(slots, max - 1, m->slots[i]);
+	free(m->slots);
+	m->slots = slots;
+	m->max = max;
+	return true;
+}
+
+void hashmap_reserve(struct hashmap *m, size_t num)
+{
+	size_t max = hashmap_capacity_for(num);
+	if (max > m->max)
+		hashmap_resize(m, max);
+}
+
+//Insert a key that isn't in the map yet. key is stored as-is.
+static struct hashmap_slot * hashmap_insert(struct hashmap *m, const char *key, uint32_t hash)
+{
+	if ((m->num + 1) * 8 > m->max * 7 && !hashmap_resize(m, m->max ? m->max * 2 : HASHMAP_MIN_SIZE)
+		&& m->num + 1 >= m->max)
+		return NULL;
+	m->num++;
+	return hashmap_place(m->slots, m->max - 1, (struct hashmap_slot){.entry.key = key, .hash = hash});
+}
+
+static const char * strpool_intern_hashed(struct strpool *sp, const char *str, size_t len, uint64_t hash);
+
+struct hashmap_entry * hashmap_find(struct hashmap *m, const char *key, bool insert)
+{
+	size_t len = strlen(key);
+	uint64_t hash = hashmap_hash(key, len, HASHMAP_SEED);
+	struct hashmap_slot *s = hashmap_probe(m, key, hash, false);
+	if (s || !insert)
+		return s ? &s->entry : NULL;
+
+	char *copy = NULL;
+	if (m->strings) {
+		key = strpool_intern_hashed(m->strings, key, len, hash);
+	} else {
+		copy = malloc(len + 1);
+		if (copy)
+			memcpy(copy, key, len + 1);
+		key = copy;
+	}
+	if (!key || !(s = hashmap_insert(m, key, hash))) {
+		free(copy);
+		return NULL;
+	}
+	return &s->entry;
+}
+
+struct hashmap_entry * hashmap_find_interned(struct hashmap *m, const char *key, bool insert)
+{
+	assert(m->strings);
+	uint64_t hash = strpool_hash(key);
+	struct hashmap_slot *s = hashmap_probe(m, key, hash, true);
+	if (!s && insert)
+		s = hashmap_insert(m, key, hash);
+	return s ? &s->entry : NULL;
+}
+
+bool hashmap_remove(struct hashmap *m, const char *key)
+{
+	struct hashmap_slot *s = hashmap_probe(m, key, hashmap_hash(key, strlen(key), HASHMAP_SEED), false);
+	if (!s)
+		return false;
+	if (m->owns_keys)
+		free((char *)s->entry.key);
+	m->num--;
+	//Shift everything after it back a slot, until an empty slot or an entry already in its home slot.
+	size_t mask = m->max - 1, i = s - m->slots;
+	for (;;) {
+		size_t next = (i + 1) & mask;
+		if (m->slots[next].dist <= 1) {
+			m->slots[i] = (struct hashmap_slot){0};
+			return true;
+		}
+		m->slots[i] = m->slots[next];
+		m->slots[i].dist--;
+		i = next;
+	}
+}
+
+struct hashmap_entry * hashmap_next(struct hashmap *m, size_t *i)
+{
+	while (*i < m->max) {
+		struct hashmap_slot *s = &m->slots[(*i)++];
+		if (s->dist)
+			return &s->entry;
+	}
+	return NULL;
+}
+
+struct strpool strpool_new(size_t num)
+{
+	return (struct strpool){
+		//The pool owns its strings through blocks, not through the map.
+		.map = hashmap_new_internal(num, NULL, false),
+	};
+}
+
+void strpool_delete(struct strpool *sp)
+{
+	hashmap_delete(&sp->map, NULL, NULL);
+	for (size_t i = 0; i < sp->num_blocks; i++)
+		free(sp->blocks[i]);
+	free(sp->blocks);
+	*sp = (struct strpool){0};
+}
+
+//Bump-allocate size bytes, 8-byte aligned. Strings too big for a block get a block of their own.
+static char * strpool_alloc(struct strpool *sp, size_t size)
+{
+	sp->block_used = (sp->block_used + 7) & ~(size_t)7;
+	if (!sp->num_blocks || sp->block_used + size > sp->block_size) {
+		if (sp->num_blocks >= sp->max_blocks) {
+			size_t max = sp->max_blocks ? sp->max_blocks * 2 : 16;
+			char **blocks = realloc(sp->blocks, max * sizeof(char *));
+			if (!blocks) {
+				printf("Whoops, running out of memory.\n");
+				return NULL;
+			}
+			sp->blocks = blocks;
+			sp->max_blocks = max;
+		}
+		size_t block_size = size > STRPOOL_BLOCK_SIZE ? size : STRPOOL_BLOCK_SIZE;
+		char *block = malloc(block_size);
+		if (!block) {
+			printf("Whoops, running out of memory.\n");
+			return NULL;
+		}
+		sp->blocks[sp->num_blocks++] = block;
+		sp->block_size = block_size;
+		sp->block_used = 0;
+	}
+	char *p = sp->blocks[sp->num_blocks - 1] + sp->block_used;
+	sp->block_used += size;
+	return p;
+}
+
+static const char * strpool_intern_hashed(struct strpool *sp, const char *str, size_t len, uint64_t hash)
+{
+	struct hashmap_slot *s = hashmap_probe(&sp->map, str, hash, false);
+	if (s)
+		return s->entry.key;
+	//Each string is stored right after its hash, see strpool_hash.
+	char *p = strpool_alloc(sp, sizeof(uint64_t) + len + 1);
+	if (!p)
+		return NULL;
+	memcpy(p, &hash, sizeof(uint64_t));
+	memcpy(p + sizeof(uint64_t), str, len + 1);
+	if (!hashmap_insert(&sp->map, p + sizeof(uint64_t), hash))
+		return NULL;
+	return p + sizeof(uint64_t);
+}
+
+const char * strpool_intern(struct strpool *sp, const char *str)
+{
+	size_t len = strlen(str);
+	return strpool_intern_hashed(sp, str, len, hashmap_hash(str, len, HASHMAP_SEED));
+}
+
+const char * strpool_find(struct strpool *sp, const char *str)
+{
+	struct hashmap_slot *s = hashmap_probe(&sp->map, str, hashmap_hash(str, strlen(str), HASHMAP_SEED), false);
+	return s ? s->entry.key : NULL;
+}
+
+uint64_t strpool_hash(const char *interned)
+{
+	return ((const uint64_t *)interned)[-1];
+}
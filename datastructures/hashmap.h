@@ -0,0 +1,89 @@
+#ifndef HASHMAP_H
+#define HASHMAP_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+/*
+An open-addressing string hash map, meant to replace hashtable for asset and name lookups.
+
+Entries live in a single power-of-two array, placed with Robin Hood hashing: on insert, an entry that has probed
+further than the one in its way takes that slot, and the displaced entry carries on probing. That keeps probe
+lengths short and even, so the map can run at 7/8 load before growing, and a lookup can stop as soon as it
+reaches an entry that is closer to home than the key would be. Removal shifts the following entries back,
+so there are no tombstones.
+
+Keys are hashed with a wyhash-style 64-bit hash, and 32 bits of it are kept in each slot so most mismatches are
+rejected without touching the key string. That keeps a slot at 24 bytes.
+
+A map can intern its keys into a strpool. Interned strings carry their hash in front of them, so looking up an
+interned pointer skips hashing entirely and finds its entry with a pointer compare.
+
+Entry pointers returned by hashmap_find are only valid until the next insert or remove.
+*/
+
+#define HASHMAP_MIN_SIZE 8
+
+struct hashmap_entry {
+	const char *key;
+	union {
+		void *data;
+		uint32_t handle;
+	};
+};
+
+struct hashmap_slot {
+	struct hashmap_entry entry;
+	uint32_t hash; //The low 32 bits of the key's hash, which is enough for maps of up to 2^32 slots.
+	uint32_t dist; //0 for an empty slot, otherwise one more than the distance from the slot the hash maps to.
+};
+
+struct strpool;
+
+struct hashmap {
+	size_t num, max; //max is always a power of two.
+	struct hashmap_slot *slots;
+	struct strpool *strings; //If not NULL, keys are interned here instead of being copied.
+	bool owns_keys;
+};
+
+//Interned strings. Every distinct string is stored once, and stays at the same address until the pool is deleted.
+struct strpool {
+	struct hashmap map;
+	char **blocks;
+	size_t num_blocks, max_blocks;
+	size_t block_used, block_size;
+};
+
+//Hash len bytes of data.
+uint64_t hashmap_hash(const void *data, size_t len, uint64_t seed);
+//Create a map with room for num keys before it has to grow.
+//If strings is not NULL keys are interned into it, otherwise they are copied. strings must outlive the map.
+struct hashmap hashmap_new(size_t num, struct strpool *strings);
+//Free the map, and its key copies if it made any.
+//If cleanup is not NULL, it is called on every entry first: cleanup(entry, userdata)
+void hashmap_delete(struct hashmap *m, void (*cleanup)(struct hashmap_entry *, void *), void *userdata);
+//Find key in the map and return its entry.
+//If it isn't found and insert is true, the key is copied or interned and a new zeroed entry is returned,
+//otherwise returns NULL.
+struct hashmap_entry * hashmap_find(struct hashmap *m, const char *key, bool insert);
+//Same as hashmap_find, for a key that came from strpool_intern on the map's own strpool. No hashing or strcmp.
+struct hashmap_entry * hashmap_find_interned(struct hashmap *m, const char *key, bool insert);
+//Remove key from the map. Returns false if it wasn't there.
+bool hashmap_remove(struct hashmap *m, const char *key);
+//Make room for num keys without growing.
+void hashmap_reserve(struct hashmap *m, size_t num);
+//Iterate over the entries, starting with *i = 0. Returns NULL at the end.
+//Don't insert or remove while iterating.
+struct hashmap_entry * hashmap_next(struct hashmap *m, size_t *i);
+
+struct strpool strpool_new(size_t num);
+void strpool_delete(struct strpool *sp);
+//Return the pool's copy of str, adding it if it isn't there yet.
+const char * strpool_intern(struct strpool *sp, const char *str);
+//Return the pool's copy of str, or NULL if it has never been interned.
+const char * strpool_find(struct strpool *sp, const char *str);
+//The hash of an interned string, as hashmap_hash computes it for hashmap keys.
+uint64_t strpool_hash(const char *interned);
+
+#endif
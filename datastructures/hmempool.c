@@ -9,6 +9,7 @@
 #include <stdbool.h>
 
 //Note: Indexes in htoi are stored with a +1 bias, so that an index of 0 can represent a handle not mapping to anything in the pool.
+//htoi is indexed by handle slot, itoh stores full handles (slot and generation).
 
 struct hmempool hmempool_new(size_t max, size_t size)
 {
@@ -73,7 +74,7 @@ void hmempool_handles_resize(struct hmempool *hm, size_t num)
 
 void hmempool_resize_stretch(struct hmempool *hm, size_t num, size_t size)
 {
-	assert(num >= hm->indirection_len); //Making the pool smaller is such a headache, let's not bother for now.
+	assert(num >= hm->pool.max); //Making the pool smaller is such a headache, let's not bother for now.
 	mempool_resize_stretch(&hm->pool, num, size);
 	hmempool_handles_resize(hm, num);
 }
@@ -93,7 +94,7 @@ void hmempool_delete(struct hmempool *hm)
 uint32_t hmempool_claim(struct hmempool *hm, uint32_t h, void *item)
 {
 	uint32_t i = mempool_add(&hm->pool, item);
-	hm->htoi[h-1] = i+1;
+	hm->htoi[hmempool_handle_slot(h)-1] = i+1;
 	hm->itoh[i] = h;
 	return h;
 }
@@ -101,11 +102,25 @@ uint32_t hmempool_claim(struct hmempool *hm, uint32_t h, void *item)
 uint32_t hmempool_claim_raw(struct hmempool *hm, uint32_t h)
 {
 	uint32_t i = mempool_add_raw(&hm->pool);
-	hm->htoi[h-1] = i+1;
+	hm->htoi[hmempool_handle_slot(h)-1] = i+1;
 	hm->itoh[i] = h;
 	return h;
 }
 
+uint32_t hmempool_claim_many(struct hmempool *hm, const uint32_t handles[], size_t num, const void *items)
+{
+	assert(hm->pool.num + num <= hm->pool.max);
+	uint32_t first = hm->pool.num;
+	if (items)
+		memcpy(mempool_get(&hm->pool, first), items, num * hm->pool.size);
+	hm->pool.num += num;
+	for (size_t j = 0; j < num; j++) {
+		hm->htoi[hmempool_handle_slot(handles[j])-1] = first + j + 1;
+		hm->itoh[first + j] = handles[j];
+	}
+	return first;
+}
+
 uint32_t hmempool_add(struct hmempool *hm, void *item)
 {
 	//Get new handle from free handle pool
@@ -125,26 +140,29 @@ uint32_t hmempool_add_raw(struct hmempool *hm)
 void hmempool_unclaim(struct hmempool *hm, uint32_t h)
 {
 	//Get item index
-	int i = hm->htoi[h-1]-1;
+	int i = hm->htoi[hmempool_handle_slot(h)-1]-1;
 	//Invalidate handle
 	uint32_t i2 = mempool_remove(&hm->pool, i);
 	uint32_t h2 = hm->itoh[i2];
 	//The order of these operations is very important to handle edge cases correctly.
 	hm->itoh[i] = h2;
 	hm->itoh[i2] = 0;
-	hm->htoi[h2-1] = i+1;
-	hm->htoi[h-1] = 0;
+	hm->htoi[hmempool_handle_slot(h2)-1] = i+1;
+	hm->htoi[hmempool_handle_slot(h)-1] = 0;
 }
 
 void hmempool_remove(struct hmempool *hm, uint32_t h)
 {
-	//Add handle to free handle pool
-	mempool_add(&hm->free_handles, &h);
+	//Add handle to free handle pool, with a new generation so the old handle goes stale.
+	uint32_t next = hmempool_handle_next_generation(h);
+	mempool_add(&hm->free_handles, &next);
 	hmempool_unclaim(hm, h);
 }
 
 void * hmempool_get(struct hmempool *hm, uint32_t h)
 {
-	uint32_t i = hm->htoi[h-1];
-	return h && i ? mempool_get(&hm->pool, i-1) : NULL;
+	if (!h)
+		return NULL;
+	uint32_t i = hm->htoi[hmempool_handle_slot(h)-1];
+	return i && hm->itoh[i-1] == h ? mempool_get(&hm->pool, i-1) : NULL;
 }
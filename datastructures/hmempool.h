@@ -22,8 +22,19 @@ If the deleted item was not the last item in the pool, any pointers to the moved
 This is a wrapper around the mempool implementation to provide stable handles to elements of a mempool.
 Mempool elements will still be moved around when items are removed or added (triggering a resize),
 but the new location will always be accessible using the handle.
+
+Handles are a slot (lower HMEMPOOL_SLOT_BITS bits, starting at 1) plus a generation counter in the bits above that.
+The itoh table stores the full handle, so hmempool_get returns NULL for a stale handle whose slot has been reused.
+Managed hmempools bump the generation when a handle is removed. The top bit is never used, callers can use it as a flag.
 */
 
+#define HMEMPOOL_SLOT_BITS 24
+#define HMEMPOOL_SLOT_MASK ((1u << HMEMPOOL_SLOT_BITS) - 1)
+#define HMEMPOOL_GENERATION_MASK (0x7Fu << HMEMPOOL_SLOT_BITS)
+#define hmempool_handle_slot(h) ((h) & HMEMPOOL_SLOT_MASK)
+//The same slot as h, with the generation incremented (wrapping around).
+#define hmempool_handle_next_generation(h) (hmempool_handle_slot(h) | (((h) + (1u << HMEMPOOL_SLOT_BITS)) & HMEMPOOL_GENERATION_MASK))
+
 struct hmempool {
 	struct mempool pool, free_handles;
 	size_t indirection_len; //Length of the indirection tables. They can't be made smaller (easily).
@@ -43,6 +54,9 @@ void hmempool_delete(struct hmempool *hm);
 uint32_t hmempool_claim(struct hmempool *hm, uint32_t h, void *item);
 //Claim the mempool slot owned by h, return h.
 uint32_t hmempool_claim_raw(struct hmempool *hm, uint32_t h);
+//Claim the next num mempool slots for handles[0..num), copying items in from "items" (num contiguous items) if not NULL.
+//The caller must make sure the pool has room. Returns the index of the first claimed item.
+uint32_t hmempool_claim_many(struct hmempool *hm, const uint32_t handles[], size_t num, const void *items);
 //Copy an item into the hmempool, return a handle.
 uint32_t hmempool_add(struct hmempool *hm, void *item);
 //Claim a mempool slot, return a handle.
@@ -62,6 +76,7 @@ void hmempool_unclaim(struct hmempool *hm, uint32_t h);
 //Remove the item with handle h from the hmempool.
 void hmempool_remove(struct hmempool *hm, uint32_t h);
 //Get a pointer to an item with handle h from the hmempool.
+//Returns NULL if h is 0, or if h has no item (including stale handles from an older generation).
 void * hmempool_get(struct hmempool *hm, uint32_t h);
 
 #endif
\ No newline at end of file
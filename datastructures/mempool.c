@@ -39,9 +39,13 @@ void * mempool_stretch(struct mempool *m, size_t size)
 
 void * mempool_resize_stretch(struct mempool *m, size_t num, size_t size)
 {
-	void *new_pool = realloc(m->pool, num * size);
+	void *new_pool = m->from_malloc ? realloc(m->pool, num * size) : malloc(num * size);
 	if (new_pool) {
 		// memset(new_pool, 0, num * size);
+		if (!m->from_malloc) {
+			memcpy(new_pool, m->pool, (m->num < num ? m->num : num) * m->size);
+			m->from_malloc = true;
+		}
 		m->pool = new_pool;
 		if (size > m->size)
 			for (int i = m->num; i-- > 0;) {
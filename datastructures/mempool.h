@@ -27,6 +27,9 @@ struct mempool {
 
 //Create a new mempool that holds "num" items of "size" size (in bytes). 
 struct mempool mempool_new(size_t num, size_t size);
+//Create a new mempool that holds up to "num" items of "size" size (in bytes), in storage owned by the caller.
+//If the mempool is resized later, it copies its items out of storage into memory it allocates (and owns) itself.
+struct mempool mempool_init(size_t num, size_t size, void *storage);
 //Delete a mempool.
 void mempool_delete(struct mempool *m);
 //Copy an item into the mempool, return an index to the location at which it was inserted.
@@ -11,14 +11,31 @@ quadtree_node * quadtree_new(void *data, int depth)
 	quadtree_node *new = malloc(sizeof(struct quadtree_node));
 	new->data = data;
 	new->depth = depth;
+	new->allocator = NULL;
 	quadtree_node_set_childless(new);
 	return new;
 }
 
-void quadtree_node_add_children(quadtree_node *node, void *child_data[NCHILDREN])
+bool quadtree_node_add_children(quadtree_node *node, void *child_data[NCHILDREN])
 {
-	for (int i = 0; i < NCHILDREN; i++)
-		node->children[i] = quadtree_new(child_data[i], node->depth + 1);
+	const quadtree_allocator *a = node->allocator;
+	quadtree_node *family = a ? a->alloc_children(a->context) : NULL;
+	for (int i = 0; i < NCHILDREN; i++) {
+		quadtree_node *child = a ? (family ? &family[i] : NULL) : malloc(sizeof(struct quadtree_node));
+		if (!child) {
+			printf("Whoops, running out of memory.\n");
+			for (int j = 0; j < i && !a; j++)
+				free(node->children[j]);
+			quadtree_node_set_childless(node);
+			return false;
+		}
+		child->data = child_data[i];
+		child->depth = node->depth + 1;
+		child->allocator = a;
+		quadtree_node_set_childless(child);
+		node->children[i] = child;
+	}
+	return true;
 }
 
 void quadtree_preorder_visit(quadtree_node *tree, quadtree_visit_fn visit, void *context)
@@ -43,20 +60,33 @@ void quadtree_postorder_visit(quadtree_node *tree, quadtree_visit_fn visit, void
 	visit(tree, context);
 }
 
-bool quadtree_node_free(quadtree_node *node, void *free_data)
+void quadtree_free(quadtree_node *tree, void (*free_data)(void *data))
 {
-	if (node && free_data) {
-		//Cast free_data to a function taking a void * and returning void, and call it.
-		((void (*)(void *))free_data)(node->data);
-		free(node);
-		return true;
-	}
-	return false;
+	if (!tree)
+		return;
+	quadtree_node_remove_children(tree, free_data);
+	if (free_data)
+		free_data(tree->data);
+	free(tree);
 }
 
-void quadtree_free(quadtree_node *tree, void (*free_data)(void *data))
+//Postorder, like the rest of the tree's teardown: children's data is freed before their parent's.
+void quadtree_node_remove_children(quadtree_node *node, quadtree_free_fn free_data)
 {
-	quadtree_postorder_visit(tree, quadtree_node_free, free_data);
+	if (!quadtree_node_has_children(node))
+		return;
+
+	for (int i = 0; i < NCHILDREN; i++) {
+		quadtree_node *child = node->children[i];
+		quadtree_node_remove_children(child, free_data);
+		if (free_data)
+			free_data(child->data);
+		if (node->allocator)
+			node->allocator->free_node(child, node->allocator->context);
+		else
+			free(child);
+	}
+	quadtree_node_set_childless(node);
 }
 
 bool quadtree_node_has_children(quadtree_node *tree)
@@ -15,10 +15,22 @@ where the tree is sufficiently generated. Gen also takes a "split" function, whi
 called on the void * tile member to generate split tiles for each child. 
 */
 
+/*
+Where a node's children come from and go back to, if not malloc and free. alloc_children returns all
+QUADTREE_NUM_CHILDREN of them in a row, so siblings sit together for traversals. They're freed one at a time.
+Children share their parent's allocator, so setting it on the root covers the whole tree.
+*/
+typedef struct quadtree_allocator {
+	struct quadtree_node * (*alloc_children)(void *context);
+	void (*free_node)(struct quadtree_node *node, void *context);
+	void *context;
+} quadtree_allocator;
+
 typedef struct quadtree_node {
 	int depth;
 	void *data;
 	struct quadtree_node *children[QUADTREE_NUM_CHILDREN];
+	const quadtree_allocator *allocator; //NULL for malloc.
 } quadtree_node;
 
 //The visit function performs some operation on the quadtree_node and/or its data.
@@ -26,11 +38,15 @@ typedef struct quadtree_node {
 typedef bool (*quadtree_visit_fn)(quadtree_node *, void *);
 typedef void (*quadtree_free_fn)(void *);
 
+//The root of a tree, from malloc. Children come from malloc too, unless allocator is set afterwards.
 quadtree_node * quadtree_new(void *tile, int depth);
 void quadtree_free(quadtree_node *tree, quadtree_free_fn free_data);
 void quadtree_preorder_visit(quadtree_node *tree, quadtree_visit_fn visit, void *context);
 void quadtree_postorder_visit(quadtree_node *tree, quadtree_visit_fn visit, void *context);
-void quadtree_node_add_children(quadtree_node *node, void *child_data[QUADTREE_NUM_CHILDREN]);
+//Returns false if there was no memory for them, leaving node childless.
+bool quadtree_node_add_children(quadtree_node *node, void *child_data[QUADTREE_NUM_CHILDREN]);
+//Free node's subtrees, leaving node itself childless.
+void quadtree_node_remove_children(quadtree_node *node, quadtree_free_fn free_data);
 bool quadtree_node_has_children(quadtree_node *tree);
 void quadtree_node_set_childless(quadtree_node *tree);
 
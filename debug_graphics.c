@@ -5,6 +5,7 @@
 #include "math/bpos.h"
 #include "shader_utils.h"
 #include <math.h>
+#include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <inttypes.h>
@@ -33,7 +34,7 @@ void debug_graphics_init()
 
 	glUseProgram(effects.debug_graphics.handle);
 	checkErrors("debug_graphics use program");
-	glGenBuffers(1, &debug_graphics.vbo);
+	stream_buffer_init(&debug_graphics.stream, "debug graphics", 64 * 6 * sizeof(GLfloat));
 	checkErrors("debug_graphics gen buffers");
 	glUniform1f(effects.debug_graphics.log_depth_intermediate_factor, log_depth_intermediate_factor);
 	checkErrors("debug_graphics gl uniform");
@@ -51,42 +52,47 @@ void debug_graphics_deinit()
 		return;
 
 	glDeleteVertexArrays(1, &debug_graphics.vao);
-	glDeleteBuffers(1, &debug_graphics.vbo);
+	stream_buffer_deinit(&debug_graphics.stream);
 
 	debug_graphics.is_init = false;
 }
 
-int buffer_lines()
+//Streams num interleaved position and color vertices, and points the vertex attributes at them.
+//Returns how many there are to draw.
+static int buffer_vertices(GLfloat *vertices, int num)
 {
+	GLintptr offset;
+	GLfloat *streamed = stream_buffer_alloc(&debug_graphics.stream, num*6*sizeof(GLfloat), &offset);
+	if (!streamed)
+		return 0;
+	memcpy(streamed, vertices, num*6*sizeof(GLfloat));
+	stream_buffer_flush(&debug_graphics.stream);
+
+	glBindBuffer(GL_ARRAY_BUFFER, debug_graphics.stream.buffer);
 	glEnableVertexAttribArray(effects.debug_graphics.vPos);
-	glVertexAttribPointer(effects.debug_graphics.vPos, 3, GL_FLOAT, GL_FALSE, 6*sizeof(GLfloat), NULL);
+	glVertexAttribPointer(effects.debug_graphics.vPos, 3, GL_FLOAT, GL_FALSE, 6*sizeof(GLfloat), (void *)offset);
 	glEnableVertexAttribArray(effects.debug_graphics.vColor);
-	glVertexAttribPointer(effects.debug_graphics.vColor, 3, GL_FLOAT, GL_FALSE, 6*sizeof(GLfloat), (void *)(3*sizeof(GLfloat)));
+	glVertexAttribPointer(effects.debug_graphics.vColor, 3, GL_FLOAT, GL_FALSE, 6*sizeof(GLfloat), (void *)(offset + 3*sizeof(GLfloat)));
+	return num;
+}
 
+int buffer_lines()
+{
 	GLfloat lines[] = { //Position, color, interleaved vertex attributes.
 		VEC3_COORDS(debug_graphics.lines.ship_to_planet.start), 0.0, 0.8, 0.0,
 		VEC3_COORDS(debug_graphics.lines.ship_to_planet.end),   0.0, 0.1, 0.0
 	};
 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(lines), lines, GL_DYNAMIC_DRAW);
-
-	return 2; //Current number of vertices.
+	return buffer_vertices(lines, 2); //Current number of vertices.
 }
 
 int buffer_points()
 {
-	glEnableVertexAttribArray(effects.debug_graphics.vPos);
-	glVertexAttribPointer(effects.debug_graphics.vPos, 3, GL_FLOAT, GL_FALSE, 6*sizeof(GLfloat), NULL);
-	glEnableVertexAttribArray(effects.debug_graphics.vColor);
-	glVertexAttribPointer(effects.debug_graphics.vColor, 3, GL_FLOAT, GL_FALSE, 6*sizeof(GLfloat), (void *)(3*sizeof(GLfloat)));
-
 	GLfloat points[] = { //Position, color, interleaved vertex attributes.
 		VEC3_COORDS(debug_graphics.points.ship_to_planet_intersection.pos), 0.0, 0.3, 0.9,
 	};
 
-	glBufferData(GL_ARRAY_BUFFER, sizeof(points), points, GL_DYNAMIC_DRAW);
-
-	return 1; //Current number of vertices.
+	return buffer_vertices(points, 1); //Current number of vertices.
 }
 
 void debug_graphics_draw(amat4 eye_frame, float proj_view_mat[16])
@@ -99,17 +105,15 @@ void debug_graphics_draw(amat4 eye_frame, float proj_view_mat[16])
 	glUniform3f(effects.debug_graphics.eye_pos, eye_frame.t.x, eye_frame.t.y, eye_frame.t.z);
 	glUniformMatrix4fv(effects.debug_graphics.model_view_projection_matrix, 1, GL_TRUE, proj_view_mat);
 
-	//I can just reallocate the buffer every time I want to draw a different kind of debug graphics primitive.
-	//For simplicity, they don't need to run fast.
+	//Each kind of debug graphics primitive gets its own piece of the stream buffer.
+	stream_buffer_begin_frame(&debug_graphics.stream);
 
 	if (debug_graphics.lines.ship_to_planet.enabled) {
-		glBindBuffer(GL_ARRAY_BUFFER, debug_graphics.vbo);
 		int num = buffer_lines();
 		glDrawArrays(GL_LINES, 0, num);
 	}
 
 	if (debug_graphics.points.ship_to_planet_intersection.enabled) {
-		glBindBuffer(GL_ARRAY_BUFFER, debug_graphics.vbo);
 		int num = buffer_points();
 		glDrawArrays(GL_POINTS, 0, num);
 	}
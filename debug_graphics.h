@@ -2,6 +2,7 @@
 #define DEBUG_GRAPHICS_H
 #include "glla.h"
 #include "graphics.h"
+#include "stream_buffer.h"
 #include <stdbool.h>
 
 struct debug_graphics_line {
@@ -16,7 +17,7 @@ struct debug_graphics_point {
 };
 
 extern struct debug_graphics_globals {
-	GLuint vbo;
+	struct stream_buffer stream;
 	GLuint vao;
 	bool is_init;
 
@@ -27,7 +27,7 @@ const char *shader_file_paths[] = {
 	"shaders/stars.fs"
 };
 
-const char *uniform_strings[] = {"accum_cube", "ambient_pass", "bpos_size", "camera_position", "eye_box_offset", "eye_pos", "eye_sector_coords", "gLightPos", "hella_time", "log_depth_intermediate_factor", "model_matrix", "model_view_normal_matrix", "model_view_projection_matrix", "num_frames_accum", "override_col", "projection_view_matrix", "sector_size", "star_box_size", "sun_color", "sun_direction", "uLight_attr", "uLight_col", "uLight_pos", "uOrigin", "zpass"};
+const char *uniform_strings[] = {"accum_cube", "ambient_pass", "box_vertex_stride", "bpos_size", "camera_position", "eye_box_offset", "eye_pos", "eye_sector_coords", "gLightPos", "hella_time", "log_depth_intermediate_factor", "model_matrix", "model_view_normal_matrix", "model_view_projection_matrix", "num_frames_accum", "override_col", "projection_view_matrix", "sector_size", "star_box_size", "sun_color", "sun_direction", "uLight_attr", "uLight_col", "uLight_pos", "uOrigin", "zpass"};
 const char *attribute_strings[] = {"sector_coords", "star_pos", "vColor", "vNormal", "vPos"};
 union effect_list effects = {{{0}}};
 
@@ -10,6 +10,7 @@ typedef struct effect_data {
 		struct {
 			GLint accum_cube;
 			GLint ambient_pass;
+			GLint box_vertex_stride;
 			GLint bpos_size;
 			GLint camera_position;
 			GLint eye_box_offset;
@@ -34,7 +35,7 @@ typedef struct effect_data {
 			GLint uOrigin;
 			GLint zpass;
 		};
-		GLint unif[25];
+		GLint unif[26];
 	};
 	union {
 		struct {
@@ -63,7 +64,7 @@ union effect_list {
 
 extern union effect_list effects;
 
-extern const char *uniform_strings[25];
+extern const char *uniform_strings[26];
 extern const char *attribute_strings[5];
 extern const char *shader_file_paths[21];
 
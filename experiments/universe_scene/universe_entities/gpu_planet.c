@@ -24,6 +24,7 @@ extern struct entity_ctypes universe_ecs_ctypes;
 #include "open-simplex-noise-in-c/open-simplex-noise.h"
 #include "gpu_planet.h"
 #include "shader_utils.h"
+#include "stream_buffer.h"
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
@@ -33,6 +34,9 @@ extern struct entity_ctypes universe_ecs_ctypes;
 struct {
 	GLuint vao;
 	bool is_init;
+	struct stream_buffer instances;
+	float *morphs; //Alongside the drawlist, grown to fit it.
+	int max_morphs;
 } gpu_planets = {0, 0};
 
 extern bpos_origin eye_sector;
@@ -42,39 +46,10 @@ extern float log_depth_intermediate_factor;
 extern vec3 sun_position;
 extern vec3 sun_color;
  
-//Adapted from http://www.glprogramming.com/red/chapter02.html
+//The icosahedron's vertex coordinates, as in terrain_lod.c.
 static const float x = 0.525731112119133606;
 static const float z = 0.850650808352039932;
-static const vec3 ico_v[] = {    
-	{-x,  0, z}, { x,  0,  z}, {-x, 0, -z}, { x, 0, -z}, {0,  z, x}, { 0,  z, -x},
-	{ 0, -z, x}, { 0, -z, -x}, { z, x,  0}, {-z, x,  0}, {z, -x, 0}, {-z, -x,  0}
-};
-
-static const int ico_i[] = {
-	1,0,4,   9,4,0,   9,5,4,   8,4,5,   4,8,1,  10,1,8,  10,8,3,  5,3,8,   3,5,2,  9,2,5,  
-	3,7,10,  6,10,7,  7,11,6,  0,6,11,  0,1,6,  10,6,1,  0,11,9,  2,9,11,  3,2,7,  11,7,2,
-};
-
-//Texture coordinates for each vertex of a face. Pairs of faces share a texture.
-static const float ico_tx[] = {
-	0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,  0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0, 
-	0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,  0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0, 
-	0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,  0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0, 
-	0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,  0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0, 
-	0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,  0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,
-};
-
-//In my debug view, these colors are applied to tiles based on the number of times they've been split.
-vec3 gpu_planet_primary_color_by_depth[] = {
-	{1.0, 0.0, 0.0}, //Red
-	{0.5, 0.5, 0.0}, //Yellow
-	{0.0, 1.0, 0.0}, //Green
-	{0.0, 0.5, 0.5}, //Cyan
-	{0.0, 0.0, 1.0}, //Blue
-	{0.5, 0.0, 0.5}, //Purple
-};
-
-const vec3 gpu_planet_up = (vec3){z/3, (z+z+x)/3, 0}; //Centroid of ico_i[3]
+const vec3 gpu_planet_up = (vec3){z/3, (z+z+x)/3, 0}; //Centroid of the icosahedron's face 3
 //Originally made to get rid of the black dot at the poles. Weirdly, they disappeared when I tilted the axis.
 //Keep around and use on the tiles (and descendent tiles) of the poles to get rid of the black dots, should they reappear.
 //const vec3 gpu_planet_not_up = (vec3){-(z+z+x)/3, z/3, 0};
@@ -93,9 +68,10 @@ extern lua_State *L;
 /* OpenGL Variables */
 
 static GLuint ROWS;
-static GLuint SHADER, VAO, MM, MVPM, TEXSCALE, PRADIUS, LCOL, LPOS, EYEPOS, PORIGIN, VBO, INBO;
-static GLint SAMPLER0, VLERPS_ATTR;
-static GLint POS_ATTR[3] = {1,2,3}, TX_ATTR[3] = {4,5,6};
+static GLuint SHADER, VAO, MM, MVPM, TEXSCALE, PRADIUS, LCOL, LPOS, EYEPOS, PORIGIN, VBO;
+static GLint SAMPLER0, HEIGHT_ATLAS, NORMAL_ATLAS, VLERPS_ATTR;
+static GLint POS_ATTR[3] = {1,2,3}, TX_ATTR[3] = {4,5,6}, ATLAS_ATTR = 8;
+static GLuint ATLAS_SHADER, ATLAS_VAO, ATLAS_ROWS, ATLAS_PRADIUS, ATLAS_TILE_POS, ATLAS_CELL_ORIGIN;
 static GLuint gpu_planet_tx = 0;
 
 /* Instance Attribute Data */
@@ -103,6 +79,7 @@ static GLuint gpu_planet_tx = 0;
 struct instance_attributes {
 	float pos[9];
 	float tx[6];
+	float atlas[3]; //Texel origin of the tile's atlas cell, or -1 if it has none, and its morph.
 };
 extern int PRIMITIVE_RESTART_INDEX;
 
@@ -113,76 +90,11 @@ static tri_tile * tree_tile(quadtree_node *tree)
 	return (tri_tile *)tree->data;
 }
 
-static int splits_per_distance(float distance, float scale)
-{
-	return fmax(fmin(log2(scale/distance), GPU_PLANET_TILE_MAX_SUBDIVISIONS), 0);
-}
-
-static void tri_tile_split(tri_tile *t, tri_tile *out[DEFAULT_NUM_TRI_TILE_DIVS]);
-
-static bool above_horizon(tri_tile *tile, int depth, struct gpu_planet_terrain_context ctx)
-{
-	ctx.cam_pos.offset = bpos_remap(ctx.cam_pos, (bpos_origin){0});
-	vec3 tile_pos = bpos_remap((bpos){tile->centroid, tile->offset}, (bpos_origin){0});
-	float altitude = fmax(vec3_mag(ctx.cam_pos.offset) - ctx.planet->radius, 0);
-	return nes30_buttons[INPUT_BUTTON_START] || 
-		distance_to_horizon(ctx.planet->radius, altitude) > (vec3_dist(ctx.cam_pos.offset, tile_pos) - tile->radius);
-}
-
-struct tile_cull_data {
-	vec3 tile_pos;
-	float tile_dist, altitude;
-};
-
-//TODO: See if I can factor out depth somehow.
-static int gpu_planet_subdiv_depth(gpu_planet *planet, tri_tile *tile, int depth, bpos cam_pos)
-{
-	//Convert camera and tile position to planet-coordinates.
-	//These calculations might hit the limits of floating-point precision if the planet is really large.
-	cam_pos.offset = bpos_remap(cam_pos, (bpos_origin){0});
-	vec3 tile_pos = bpos_remap((bpos){tile->centroid, tile->offset}, (bpos_origin){0});
-	vec3 surface_pos = cam_pos.offset * planet->radius/vec3_mag(cam_pos.offset);
-
-	float altitude = vec3_mag(cam_pos.offset) - planet->radius;
-	float tile_dist = vec3_dist(surface_pos, tile_pos) - tile->radius;
-	float subdiv_dist = fmax(altitude, tile_dist);
-	float scale_factor = (screen_width * planet->edge_len) / (2 * GPU_PLANET_TILE_PIXELS_PER_TRI * GPU_PLANET_NUM_TILE_ROWS);
-
-	//Maybe I can handle this when preparing the drawlist, instead?
-	//TODO(Gavin): Some of this effort is duplicated in "above_horizon". See if I can refactor.
-	float horizon_dist = distance_to_horizon(planet->radius, fmax(altitude, 0));
-	float direct_dist = vec3_dist(cam_pos.offset, tile_pos) - tile->radius;
-	if (horizon_dist < direct_dist && !nes30_buttons[INPUT_BUTTON_START])
-		return 0; //Tiles beyond the horizon should not be split.
-
-	return splits_per_distance(subdiv_dist, scale_factor);
-}
-
-static bool gpu_planet_split_visit(quadtree_node *node, void *context)
+//Duplicate from procedural_planet.c for now
+static float gpu_planet_max_height(gpu_planet *p)
 {
-	struct gpu_planet_terrain_context *ctx = (struct gpu_planet_terrain_context *)context;
-	tri_tile *tile = tree_tile(node);
-	ctx->visited++;
-
-	//Cap the number of subdivisions per whole-tree traversal (per frame essentially)
-	if (node->depth == 0)
-		ctx->splits_left = ctx->splits_max;
-
-	int depth = gpu_planet_subdiv_depth(ctx->planet, tile, node->depth, ctx->cam_pos);
-
-	if (depth > node->depth && !quadtree_node_has_children(node) && ctx->splits_left > 0) {
-		tri_tile *new_tiles[DEFAULT_NUM_TRI_TILE_DIVS];
-		tri_tile_split(tile, new_tiles);
-		quadtree_node_add_children(node, (void **)new_tiles);
-		ctx->splits_left--;
-	}
-
-	if (nes30_buttons[INPUT_BUTTON_START])
-		tile->override_col = gpu_planet_primary_color_by_depth[depth % LENGTH(gpu_planet_primary_color_by_depth)];
-	else
-		tile->override_col = (vec3){1, 1, 1};
-
-	return depth > node->depth;
+	float sum_scales = 2 * (pow(4, p->num_elements) - 1) / 3;
+	return p->amplitude * sum_scales * p->radius / p->noise_radius;
 }
 
 static float noise3(vec3 pos)
@@ -271,35 +183,304 @@ static void gpu_planet_finishing_touches(tri_tile *t, void *finishing_touches_co
 	gpu_planet_vertices_and_normals(props, p->num_elements, t, p->height, planet_pos, p->noise_radius, p->radius, p->amplitude);
 }
 
-static void tri_tile_split(tri_tile *t, tri_tile *out[DEFAULT_NUM_TRI_TILE_DIVS])
+/* Tiles, for terrain_lod */
+
+//Counted as if every tile had its CPU mesh, like proc_planet's, since a raycast or the non-instanced path can give
+//any of them one.
+static size_t gpu_planet_tile_bytes()
 {
-	struct tri_tile_big_vertex new_vertices[] = {
-		tri_tile_get_big_vert_average(t, 0, 1),
-		tri_tile_get_big_vert_average(t, 0, 2),
-		tri_tile_get_big_vert_average(t, 1, 2)
-	};
+	return sizeof(tri_tile) + 2 * sizeof(struct tri_tile_vertex) * num_tri_tile_vertices(GPU_PLANET_NUM_TILE_ROWS);
+}
 
-	gpu_planet *planet = (gpu_planet *)t->finishing_touches_context;
-	vec3 planet_pos = bpos_remap((bpos){0}, t->offset);
-	for (int i = 0; i < 3; i++) {
-		vec3 d = new_vertices[i].position - planet_pos;
-		new_vertices[i].position = d * planet->radius/vec3_mag(d) + planet_pos;
+static bool gpu_planet_tile_split(void *context, tri_tile *t, struct tri_tile_big_vertex new_tile_vertices[DEFAULT_NUM_TRI_TILE_DIVS][3], tri_tile *out[DEFAULT_NUM_TRI_TILE_DIVS])
+{
+	for (int i = 0; i < DEFAULT_NUM_TRI_TILE_DIVS; i++) {
+		out[i] = tri_tile_new(new_tile_vertices[i]);
+		out[i]->offset = t->offset;
+		out[i]->finishing_touches_context = t->finishing_touches_context;
 	}
+	return true;
+}
 
-	struct tri_tile_big_vertex new_tile_vertices[DEFAULT_NUM_TRI_TILE_DIVS][3] = {
-		{t->big_vertices[0], new_vertices[0],    new_vertices[1]},
-		{new_vertices[0],    t->big_vertices[1], new_vertices[2]},
-		{new_vertices[0],    new_vertices[2],    new_vertices[1]},
-		{new_vertices[1],    new_vertices[2],    t->big_vertices[2]}
-	};
+//The instanced path only needs tiles' big vertices, so that's all a split makes. What tri_tile_mesh_gen does besides
+//the mesh: moving the offset to the sector the centroid is in. Right away, on this thread.
+static void gpu_planet_tile_place(void *context, tri_tile **tiles, size_t num, atomic_size_t *remaining)
+{
+	for (size_t i = 0; i < num; i++) {
+		tri_tile *t = tiles[i];
+		qvec3 offset = t->offset;
+		bpos_split_fix(&t->centroid, &t->offset);
+		for (int k = 0; k < 3; k++)
+			t->big_vertices[k].position = bpos_remap((bpos){t->big_vertices[k].position, offset}, t->offset);
+		t->override_col = (vec3){1, 1, 1};
+	}
+}
 
-	for (int i = 0; i < DEFAULT_NUM_TRI_TILE_DIVS; i++) {
-		out[i] = tri_tile_new(new_tile_vertices[i]);
-		tri_tile_init(out[i], t->offset, GPU_PLANET_NUM_TILE_ROWS, t->finishing_touches, t->finishing_touches_context);
-		//tri_tile_buffer(out[i]);
+static void gpu_planet_tile_gen_wait(void *context, atomic_size_t *remaining)
+{
+}
+
+//Nothing to upload. Cells in the atlas are rendered as the tiles are drawn, and meshes as they're needed.
+static void gpu_planet_tile_finish(void *context, tri_tile *t)
+{
+}
+
+//Makes the tile's CPU mesh, if it hasn't got one yet. Only raycasts and the non-instanced path need them. Splits are
+//throttled by how long these take, so they slow down while meshes are being made.
+static void gpu_planet_tile_mesh(gpu_planet *p, tri_tile *t)
+{
+	if (t->mesh)
+		return;
+	uint32_t ticks = SDL_GetTicks();
+	tri_tile_mesh_gen(t, t->offset, GPU_PLANET_NUM_TILE_ROWS, gpu_planet_finishing_touches, t->finishing_touches_context);
+	p->ms_per_tile_gen = (p->ms_per_tile_gen + SDL_GetTicks() - ticks) / 2;
+}
+
+//Gives back the tile's atlas slot too. Every tile's finishing_touches_context is its planet.
+static void gpu_planet_tile_free(void *data)
+{
+	tri_tile *t = data;
+	gpu_planet *p = t->finishing_touches_context;
+	tile_atlas_free(&p->atlas.slots, t->atlas_slot);
+	tri_tile_free(t);
+}
+
+/* Heightmap atlas */
+
+static void gpu_planet_atlas_deinit(struct gpu_planet_atlas *a)
+{
+	glDeleteFramebuffers(1, &a->fbo);
+	glDeleteTextures(1, &a->heights);
+	glDeleteTextures(1, &a->normals);
+	tile_atlas_deinit(&a->slots);
+	*a = (struct gpu_planet_atlas){0};
+}
+
+static bool gpu_planet_atlas_init(struct gpu_planet_atlas *a, int cells_per_side)
+{
+	//The parent's vertices have to be every other one of the tile's.
+	if (rows % 2) {
+		printf("The heightmap atlas needs an even num_tile_rows, not %i.\n", rows);
+		return false;
 	}
+	int cell_size = rows + 1;
+	GLint max_size, framebuffer;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+	if (cells_per_side * cell_size > max_size)
+		cells_per_side = max_size / cell_size;
+	if (!tile_atlas_init(&a->slots, cells_per_side, cell_size))
+		return false;
+	a->size = cells_per_side * cell_size;
+
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+	glGenFramebuffers(1, &a->fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, a->fbo);
+	glGenTextures(1, &a->heights);
+	glGenTextures(1, &a->normals);
+
+	glBindTexture(GL_TEXTURE_2D, a->heights);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32F, a->size, a->size, 0, GL_RG, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, a->heights, 0);
+
+	glBindTexture(GL_TEXTURE_2D, a->normals);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB10_A2, a->size, a->size, 0, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, a->normals, 0);
+
+	GLenum draw_buffers[] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+	glDrawBuffers(LENGTH(draw_buffers), draw_buffers);
+	GLenum status = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	checkErrors("After creating heightmap atlas");
+
+	if (status != GL_FRAMEBUFFER_COMPLETE) {
+		printf("FB error, status: 0x%x\n", status);
+		return false;
+	}
+	printf("Heightmap atlas is %i^2 texels, %i tiles.\n", a->size, a->slots.num_cells);
+	return true;
+}
 
-	printf("Dividing %p.\n", t);
+//Renders each tile's heights and normals into its cell.
+static void gpu_planet_atlas_render(gpu_planet *p, tri_tile **tiles, int num_tiles)
+{
+	struct gpu_planet_atlas *a = &p->atlas;
+	GLint viewport[4], framebuffer;
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+	GLboolean depth_test = glIsEnabled(GL_DEPTH_TEST), blend = glIsEnabled(GL_BLEND);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, a->fbo);
+	glBindVertexArray(ATLAS_VAO);
+	glUseProgram(ATLAS_SHADER);
+	glUniform1i(ATLAS_ROWS, rows);
+	glUniform1f(ATLAS_PRADIUS, p->radius);
+
+	for (int i = 0; i < num_tiles; i++) {
+		tri_tile *t = tiles[i];
+		struct tile_atlas_slot *slot = tile_atlas_get(&a->slots, t->atlas_slot);
+		//Relative to the planet's center, so the noise is the same as the vertex shader's.
+		vec3 planet_pos = bpos_remap((bpos){0}, t->offset);
+		float corners[9];
+		for (int k = 0; k < 3; k++) {
+			vec3 corner = t->big_vertices[k].position - planet_pos;
+			memcpy(&corners[3*k], &corner, 3*sizeof(float));
+		}
+		glUniform3fv(ATLAS_TILE_POS, 3, corners);
+		glUniform2i(ATLAS_CELL_ORIGIN, slot->origin[0], slot->origin[1]);
+		glViewport(slot->origin[0], slot->origin[1], a->slots.cell_size, a->slots.cell_size);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	}
+	checkErrors("After rendering tiles into the atlas");
+
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	if (depth_test)
+		glEnable(GL_DEPTH_TEST);
+	if (blend)
+		glEnable(GL_BLEND);
+}
+
+//Finds the drawn tiles' cells, giving cells to up to GPU_PLANET_ATLAS_RENDERS_PER_FRAME more, and packs where they
+//are into the tiles' instances.
+static void gpu_planet_atlas_update(gpu_planet *p, tri_tile **tiles, const float *morphs, int num_tiles, struct instance_attributes *instances)
+{
+	struct gpu_planet_atlas *a = &p->atlas;
+	tri_tile *fresh[GPU_PLANET_ATLAS_RENDERS_PER_FRAME];
+	int num_fresh = 0;
+	tile_atlas_next_frame(&a->slots);
+	//Touch everything first, so giving one tile a cell never takes another's that's being drawn.
+	for (int i = 0; i < num_tiles; i++)
+		if (!tile_atlas_touch(&a->slots, tiles[i]->atlas_slot))
+			tiles[i]->atlas_slot = 0;
+	for (int i = 0; i < num_tiles && num_fresh < GPU_PLANET_ATLAS_RENDERS_PER_FRAME && a->size; i++)
+		if (!tiles[i]->atlas_slot && tile_atlas_alloc(&a->slots, &tiles[i]->atlas_slot))
+			fresh[num_fresh++] = tiles[i];
+	if (num_fresh)
+		gpu_planet_atlas_render(p, fresh, num_fresh);
+
+	for (int i = 0; i < num_tiles; i++)
+		tile_atlas_instance(&a->slots, tiles[i]->atlas_slot, morphs[i], instances[i].atlas);
+}
+
+/* Checking the atlas */
+
+//The terrain noise the shaders use, on the CPU, to check the atlas pass against. As in common.glsl and gpu_planet.glsl.
+static const int gpu_planet_terrain_octaves = 5;
+static const float gpu_planet_terrain_scale = 7000000;
+
+static float gpu_planet_mod289(float x)
+{
+	return x - floorf(x * (1.0f / 289)) * 289;
+}
+
+static float gpu_planet_permute(float x)
+{
+	return gpu_planet_mod289((x * 34 + 1) * x);
+}
+
+//Gradient in xyz, value in w, as snoise_grad.
+static void gpu_planet_snoise_grad(const float v[3], float out[4])
+{
+	const float C[2] = {1.0f / 6, 1.0f / 3};
+	float i[3], x0[3], g[3], l[3], i1[3], i2[3];
+	float skew = (v[0] + v[1] + v[2]) * C[1];
+	for (int k = 0; k < 3; k++)
+		i[k] = floorf(v[k] + skew);
+	float unskew = (i[0] + i[1] + i[2]) * C[0];
+	for (int k = 0; k < 3; k++)
+		x0[k] = v[k] - i[k] + unskew;
+	for (int k = 0; k < 3; k++) {
+		g[k] = x0[k] >= x0[(k + 1) % 3];
+		l[k] = 1 - g[k];
+	}
+	for (int k = 0; k < 3; k++) {
+		i1[k] = fminf(g[k], l[(k + 2) % 3]);
+		i2[k] = fmaxf(g[k], l[(k + 2) % 3]);
+	}
+
+	//The simplex's corners, as offsets from i, and v relative to each.
+	const float *corners[4] = {(float[3]){0, 0, 0}, i1, i2, (float[3]){1, 1, 1}};
+	const float corner_skew[4] = {0, C[0], C[1], 0.5f};
+	float x[4][3];
+	for (int c = 0; c < 4; c++)
+		for (int k = 0; k < 3; k++)
+			x[c][k] = x0[k] - corners[c][k] + corner_skew[c];
+	for (int k = 0; k < 3; k++)
+		i[k] = gpu_planet_mod289(i[k]);
+
+	const float n_ = 0.142857142857f;
+	const float ns[3] = {2 * n_, 0.5f * n_ - 1, n_};
+	memset(out, 0, 4 * sizeof(float));
+	for (int c = 0; c < 4; c++) {
+		float p = gpu_planet_permute(gpu_planet_permute(gpu_planet_permute(
+			i[2] + corners[c][2]) +
+			i[1] + corners[c][1]) +
+			i[0] + corners[c][0]);
+
+		//Gradients: 7x7 points over a square, mapped onto an octahedron.
+		float j = p - 49 * floorf(p * ns[2] * ns[2]);
+		float x_ = floorf(j * ns[2]);
+		float y_ = floorf(j - 7 * x_);
+		float gx = x_ * ns[0] + ns[1], gy = y_ * ns[0] + ns[1];
+		float h = 1 - fabsf(gx) - fabsf(gy);
+		float sh = h <= 0 ? -1 : 0;
+		float grad[3] = {gx + (floorf(gx) * 2 + 1) * sh, gy + (floorf(gy) * 2 + 1) * sh, h};
+		float norm = 1.79284291400159f - 0.85373472095314f * (grad[0] * grad[0] + grad[1] * grad[1] + grad[2] * grad[2]);
+		for (int k = 0; k < 3; k++)
+			grad[k] *= norm;
+
+		float m = fmaxf(0.6f - (x[c][0] * x[c][0] + x[c][1] * x[c][1] + x[c][2] * x[c][2]), 0);
+		float m2 = m * m, m4 = m2 * m2;
+		float pdotx = grad[0] * x[c][0] + grad[1] * x[c][1] + grad[2] * x[c][2];
+		for (int k = 0; k < 3; k++)
+			out[k] += 42 * (-8 * m2 * m * pdotx * x[c][k] + m4 * grad[k]);
+		out[3] += 42 * m4 * pdotx;
+	}
+}
+
+//Height above radius, and the normal, of the terrain in the direction x (unit length), as terrain.
+static float gpu_planet_terrain(vec3 x, float radius, vec3 *normal)
+{
+	float val[4] = {0};
+	for (int i = 0; i < gpu_planet_terrain_octaves; i++) {
+		float s = powf(4, i), w = powf(0.5, i), seed[3] = {s * x.x, s * x.y, s * x.z}, octave[4];
+		gpu_planet_snoise_grad(seed, octave);
+		for (int k = 0; k < 4; k++)
+			val[k] += w * octave[k];
+	}
+	float height = gpu_planet_terrain_scale * val[3];
+	vec3 g = (vec3){val[0], val[1], val[2]} / (radius + height);
+	vec3 h = g - vec3_dot(g, x) * x;
+	*normal = vec3_normalize(x - gpu_planet_terrain_scale * h);
+	return height;
+}
+
+//Where vertex (j, r) of a tile is, as tile_position.
+static vec3 gpu_planet_tile_position(const vec3 corners[3], int r, int j)
+{
+	float y = (float)r / rows, x = r ? (float)j / r : 0;
+	vec3 left = corners[0] + (corners[1] - corners[0]) * y;
+	vec3 right = corners[0] + (corners[2] - corners[0]) * y;
+	return left + (right - left) * x;
+}
+
+//Corners of t relative to its planet's center, as gpu_planet_atlas_render gives them to the atlas pass.
+static void gpu_planet_tile_corners(tri_tile *t, vec3 out[3])
+{
+	vec3 planet_pos = bpos_remap((bpos){0}, t->offset);
+	for (int k = 0; k < 3; k++)
+		out[k] = t->big_vertices[k].position - planet_pos;
+}
+
+static float gpu_planet_vertex_height(const vec3 corners[3], float radius, int j, int r, vec3 *normal)
+{
+	return gpu_planet_terrain(vec3_normalize(gpu_planet_tile_position(corners, r, j)), radius, normal);
 }
 
 static float fbm(vec3 p)
@@ -370,13 +551,18 @@ int gpu_planet_init()
 	glswAddDirectiveToken("glsl330", "#version 330");
 
 	GLuint shader[] = {
-		glsw_shader_from_keys(GL_VERTEX_SHADER, "versions.glsl330", "common.noise.GL33", "proc_planet.vertex.GL33"),
+		glsw_shader_from_keys(GL_VERTEX_SHADER, "versions.glsl330", "common.noise.GL33", "gpu_planet.terrain", "gpu_planet.vertex.GL33"),
 		glsw_shader_from_keys(GL_FRAGMENT_SHADER, "versions.glsl330", "common.noise.GL33", "proc_planet.fragment.GL33", "common.lighting"),
 	};
 	SHADER = glsw_new_shader_program(shader, LENGTH(shader));
+	GLuint atlas_shader[] = {
+		glsw_shader_from_keys(GL_VERTEX_SHADER, "versions.glsl330", "gpu_planet.atlas.vertex.GL33"),
+		glsw_shader_from_keys(GL_FRAGMENT_SHADER, "versions.glsl330", "common.noise.GL33", "gpu_planet.terrain", "gpu_planet.atlas.fragment.GL33"),
+	};
+	ATLAS_SHADER = glsw_new_shader_program(atlas_shader, LENGTH(atlas_shader));
 	glswShutdown();
 
-	if (!SHADER) {
+	if (!SHADER || !ATLAS_SHADER) {
 		gpu_planet_deinit();
 		return -1;
 	}
@@ -393,6 +579,12 @@ int gpu_planet_init()
 	LCOL     = glGetUniformLocation(SHADER, "light_col");
 	EYEPOS   = glGetUniformLocation(SHADER, "eye_pos");
 	PORIGIN  = glGetUniformLocation(SHADER, "planet_origin");
+	HEIGHT_ATLAS = glGetUniformLocation(SHADER, "height_atlas");
+	NORMAL_ATLAS = glGetUniformLocation(SHADER, "normal_atlas");
+	ATLAS_ROWS        = glGetUniformLocation(ATLAS_SHADER, "rows");
+	ATLAS_PRADIUS     = glGetUniformLocation(ATLAS_SHADER, "planet_radius");
+	ATLAS_TILE_POS    = glGetUniformLocation(ATLAS_SHADER, "tile_pos");
+	ATLAS_CELL_ORIGIN = glGetUniformLocation(ATLAS_SHADER, "cell_origin");
 	checkErrors("After getting uniform handles");
 
 	/* Vertex data */
@@ -403,18 +595,16 @@ int gpu_planet_init()
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(tri_lerps), tri_lerps, GL_STATIC_DRAW);
 
-	glGenBuffers(1, &INBO);
-	glBindBuffer(GL_ARRAY_BUFFER, INBO);
+	stream_buffer_init(&gpu_planets.instances, "gpu planet instances", 5000 * sizeof(struct instance_attributes));
 	checkErrors("After gen indexed array buffer");
 
 	/* Vertex attributes */
 
+	//Pointers are set when drawing, since the instances move around the stream buffer.
 	int attr_div = 1;
 	for (int i = 0; i < 3; i++)
 	{
 		glEnableVertexAttribArray(POS_ATTR[i]);
-		glVertexAttribPointer(POS_ATTR[i], 3, GL_FLOAT, GL_FALSE,
-			sizeof(struct instance_attributes), (void *)(offsetof(struct instance_attributes, pos) + i*3*sizeof(float)));
 		glVertexAttribDivisor(POS_ATTR[i], attr_div);
 		checkErrors("After attr divisor for pos");
 	}
@@ -422,12 +612,13 @@ int gpu_planet_init()
 	for (int i = 0; i < 3; i++)
 	{
 		glEnableVertexAttribArray(TX_ATTR[i]);
-		glVertexAttribPointer(TX_ATTR[i], 2, GL_FLOAT, GL_FALSE,
-			sizeof(struct instance_attributes), (void *)(offsetof(struct instance_attributes, tx) + i*2*sizeof(float)));
 		glVertexAttribDivisor(TX_ATTR[i], attr_div);
 		checkErrors("After attr divisor for attr");
 	}
 
+	glEnableVertexAttribArray(ATLAS_ATTR);
+	glVertexAttribDivisor(ATLAS_ATTR, attr_div);
+
 	VLERPS_ATTR = 7;
 	glEnableVertexAttribArray(VLERPS_ATTR);
 
@@ -447,6 +638,9 @@ int gpu_planet_init()
 	glPrimitiveRestartIndex(PRIMITIVE_RESTART_INDEX);
 	glBindVertexArray(0);
 
+	//The atlas pass makes its quad from gl_VertexID, so it has no attributes.
+	glGenVertexArrays(1, &ATLAS_VAO);
+
 	/* For rotating the icosahedron */
 	//SDL_SetRelativeMouseMode(true);
 
@@ -456,6 +650,8 @@ int gpu_planet_init()
 	glUseProgram(SHADER);
 	glUniform1f(TEXSCALE, getglob(L, "tex_scale", 1.0));
 	glUniform1f(glGetUniformLocation(SHADER, "log_depth_intermediate_factor"), log_depth_intermediate_factor);
+	glUniform1i(HEIGHT_ATLAS, 1);
+	glUniform1i(NORMAL_ATLAS, 2);
 	glUseProgram(0);
 
 	return 0;
@@ -469,8 +665,14 @@ void gpu_planet_deinit()
 	}
 
 	glDeleteVertexArrays(1, &VAO);
+	glDeleteVertexArrays(1, &ATLAS_VAO);
 	glDeleteBuffers(1, &VBO);
 	glDeleteProgram(SHADER);
+	glDeleteProgram(ATLAS_SHADER);
+	stream_buffer_deinit(&gpu_planets.instances);
+	free(gpu_planets.morphs);
+	gpu_planets.morphs = NULL;
+	gpu_planets.max_morphs = 0;
 }
 
 gpu_planet * gpu_planet_new(float radius, height_map_func height, int *elements, int num_elements)
@@ -488,78 +690,161 @@ gpu_planet * gpu_planet_new(float radius, height_map_func height, int *elements,
 		p->elements[i] = elements[i];
 	printf("Edge len: %f\n", p->edge_len);
 
-	uint32_t ticks = SDL_GetTicks();
-
 	//Initialize the planet terrain
+	tri_tile *faces[NUM_ICOSPHERE_FACES];
 	for (int i = 0; i < NUM_ICOSPHERE_FACES; i++) {
 		struct tri_tile_big_vertex verts[3];
-		for (int j = 0; j < 3; j++)
-			verts[j] = (struct tri_tile_big_vertex){ico_v[ico_i[3*i+j]] * radius, {ico_tx[(6*i)+(2*j)], ico_tx[(6*i)+(2*j)+1]}};
-
-		p->tiles[i] = quadtree_new(tri_tile_new(verts), 0);
+		terrain_lod_face_vertices(i, radius, verts);
+		faces[i] = tri_tile_new(verts);
 		//Initialize tile with verts expressed relative to p->sector.
-		tri_tile_init((tri_tile *)p->tiles[i]->data, (bpos_origin){0, 0, 0}, GPU_PLANET_NUM_TILE_ROWS, &gpu_planet_finishing_touches, p);
+		faces[i]->offset = (bpos_origin){0, 0, 0};
+		faces[i]->finishing_touches_context = p;
 	}
-
-	uint32_t ticks2 = SDL_GetTicks();
-
-	for (int i = 0; i < NUM_ICOSPHERE_FACES; i++)
-		tri_tile_buffer(p->tiles[i]->data);
-
-	uint32_t ticks3 = SDL_GetTicks();
-
-	p->ms_per_tile_gen    = (ticks2 - ticks)  / (float)NUM_ICOSPHERE_FACES;
-	p->ms_per_tile_buffer = (ticks3 - ticks2) / (float)NUM_ICOSPHERE_FACES;
-	printf("Planet took %f, %f ms to generate.\n", p->ms_per_tile_gen, p->ms_per_tile_buffer);
+	gpu_planet_tile_place(p, faces, NUM_ICOSPHERE_FACES, NULL);
+
+	struct terrain_lod_params params = {
+		.radius = radius,
+		.max_height = gpu_planet_max_height(p),
+		.split_distance = (screen_width * p->edge_len) / (2 * GPU_PLANET_TILE_PIXELS_PER_TRI * GPU_PLANET_NUM_TILE_ROWS),
+		.max_subdivisions = GPU_PLANET_TILE_MAX_SUBDIVISIONS,
+		.tile_budget = (size_t)getglob(L, "planet_tile_budget_mb", GPU_PLANET_DEFAULT_TILE_BUDGET_MB) << 20,
+	};
+	struct terrain_lod_provider provider = {
+		.split = gpu_planet_tile_split,
+		.generate = gpu_planet_tile_place,
+		.wait = gpu_planet_tile_gen_wait,
+		.finish = gpu_planet_tile_finish,
+		.free_tile = gpu_planet_tile_free,
+		.tile_bytes = gpu_planet_tile_bytes(),
+		.context = p,
+	};
+	terrain_lod_init(&p->lod, &params, &provider, faces, NULL);
+	if (!gpu_planet_atlas_init(&p->atlas, getglob(L, "gpu_planet_atlas_cells", GPU_PLANET_DEFAULT_ATLAS_CELLS)))
+		gpu_planet_atlas_deinit(&p->atlas); //Tiles compute their heights in the vertex shader instead.
 
 	return p;
 }
 
 void gpu_planet_free(gpu_planet *p)
 {
-	for (int i = 0; i < NUM_ICOSPHERE_FACES; i++)
-		quadtree_free(p->tiles[i], (quadtree_free_fn)tri_tile_free);
+	terrain_lod_deinit(&p->lod);
+	gpu_planet_atlas_deinit(&p->atlas);
 	free(p);
 }
 
-static bool gpu_planet_drawlist_visit(quadtree_node *node, void *context)
+int gpu_planet_atlas_check()
 {
-	struct gpu_planet_terrain_context *ctx = (struct gpu_planet_terrain_context *)context;
-	tri_tile *tile = tree_tile(node);
-	int depth = gpu_planet_subdiv_depth(ctx->planet, tile, node->depth, ctx->cam_pos);
+	int failed = 0;
+	gpu_planet *p = gpu_planet_new(600, gpu_planet_height, NULL, 0);
+	struct gpu_planet_atlas *a = &p->atlas;
+	if (!a->size) {
+		printf("No heightmap atlas to check.\n");
+		gpu_planet_free(p);
+		return 1;
+	}
 
-	if (depth == node->depth || !quadtree_node_has_children(node)) {
-		if (ctx->num_tiles < ctx->max_tiles && above_horizon(tile, depth, *ctx))
-			ctx->tiles[ctx->num_tiles++] = tile;
-		// else
-		// 	ctx->excess_tiles = true;
+	//A face and its children, as a split makes them.
+	tri_tile *tiles[1 + DEFAULT_NUM_TRI_TILE_DIVS];
+	struct tri_tile_big_vertex child_vertices[DEFAULT_NUM_TRI_TILE_DIVS][3];
+	tiles[0] = tree_tile(p->lod.roots[0]);
+	terrain_lod_child_vertices(&p->lod, tiles[0], child_vertices);
+	gpu_planet_tile_split(p, tiles[0], child_vertices, &tiles[1]);
+	gpu_planet_tile_place(p, &tiles[1], DEFAULT_NUM_TRI_TILE_DIVS, NULL);
+	for (int i = 0; i < LENGTH(tiles); i++)
+		tile_atlas_alloc(&a->slots, &tiles[i]->atlas_slot);
+	gpu_planet_atlas_render(p, tiles, LENGTH(tiles));
+
+	int n = a->slots.cell_size;
+	float *heights = malloc(LENGTH(tiles) * n * n * 2 * sizeof(float)), *normals = malloc(n * n * 4 * sizeof(float));
+	if (!heights || !normals) {
+		printf("Whoops, running out of memory.\n");
+		failed++;
+		goto out;
+	}
+	GLint framebuffer;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &framebuffer);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, a->fbo);
+
+	//Heights are up to a few terrain_scales, and only float on both sides.
+	float tolerance = 1e-5 * gpu_planet_terrain_scale;
+	int non_finite = 0, wrong_heights = 0, wrong_parents = 0, wrong_normals = 0;
+	for (int i = 0; i < LENGTH(tiles); i++) {
+		struct tile_atlas_slot *slot = tile_atlas_get(&a->slots, tiles[i]->atlas_slot);
+		float *cell = &heights[i * n * n * 2];
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glReadPixels(slot->origin[0], slot->origin[1], n, n, GL_RG, GL_FLOAT, cell);
+		glReadBuffer(GL_COLOR_ATTACHMENT1);
+		glReadPixels(slot->origin[0], slot->origin[1], n, n, GL_RGBA, GL_FLOAT, normals);
+
+		vec3 corners[3], normal;
+		gpu_planet_tile_corners(tiles[i], corners);
+		for (int r = 0; r < n; r++) {
+			for (int j = 0; j <= r; j++) {
+				float *h = &cell[2 * (r * n + j)], *nm = &normals[4 * (r * n + j)];
+				if (!isfinite(h[0]) || !isfinite(h[1])) {
+					non_finite++;
+					continue;
+				}
+				float height = gpu_planet_vertex_height(corners, p->radius, j, r, &normal);
+				wrong_heights += fabsf(h[0] - height) > tolerance;
+				wrong_normals += vec3_mag((vec3){2 * nm[0] - 1, 2 * nm[1] - 1, 2 * nm[2] - 1} - normal) > 0.01;
+
+				int pv[2][2];
+				tile_atlas_parent_vertices(j, r, pv);
+				float parent = 0;
+				for (int k = 0; k < 2; k++)
+					parent += gpu_planet_vertex_height(corners, p->radius, pv[k][0], pv[k][1], &normal) / 2;
+				wrong_parents += fabsf(h[1] - parent) > tolerance;
+			}
+		}
 	}
 
-	return depth > node->depth;
+	//Each child's corners are vertices of the face too, so they have its heights, morphed or not. As (j, r) on the face.
+	int half = rows / 2, wrong_corners = 0;
+	const int face_corners[DEFAULT_NUM_TRI_TILE_DIVS][3][2] = {
+		{{0, 0},       {0, half},    {half, half}},
+		{{0, half},    {0, rows},    {half, rows}},
+		{{0, half},    {half, rows}, {half, half}},
+		{{half, half}, {half, rows}, {rows, rows}},
+	};
+	const int child_corners[3][2] = {{0, 0}, {0, rows}, {rows, rows}};
+	for (int i = 0; i < DEFAULT_NUM_TRI_TILE_DIVS; i++) {
+		for (int k = 0; k < 3; k++) {
+			const int *fc = face_corners[i][k], *cc = child_corners[k];
+			float face = heights[2 * (fc[1] * n + fc[0])];
+			float *child = &heights[(i + 1) * n * n * 2 + 2 * (cc[1] * n + cc[0])];
+			wrong_corners += fabsf(child[0] - face) > tolerance || fabsf(child[1] - face) > tolerance;
+		}
+	}
+	printf("Checked %i atlas cells: %i non-finite heights, %i wrong heights, %i wrong parent heights, %i wrong normals, "
+		"%i children's corners off the face's.\n", (int)LENGTH(tiles), non_finite, wrong_heights, wrong_parents, wrong_normals, wrong_corners);
+	failed += non_finite + wrong_heights + wrong_parents + wrong_normals + wrong_corners;
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+	checkErrors("After checking the atlas");
+
+out:
+	free(heights);
+	free(normals);
+	for (int i = 1; i < LENGTH(tiles); i++)
+		gpu_planet_tile_free(tiles[i]);
+	gpu_planet_free(p);
+	return failed;
 }
 
-int gpu_planet_drawlist(gpu_planet *p, tri_tile **tiles, int max_tiles, bpos cam_pos)
+int gpu_planet_drawlist(gpu_planet *p, tri_tile **tiles, float *morphs, int max_tiles, bpos cam_pos, struct frustum *frustum)
 {
-	struct gpu_planet_terrain_context context = {
-		.splits_max = fmax(15.0 / (4 * (p->ms_per_tile_gen + p->ms_per_tile_buffer)), 1), //Total number of splits for this call of drawlist.
+	struct terrain_lod_view view = {
 		.cam_pos = cam_pos,
-		.planet = p,
-		.tiles = tiles,
-		.max_tiles = max_tiles
+		.frustum = frustum,
+		//Total number of splits for this call of drawlist. Placing tiles costs next to nothing, so until meshes are made,
+		//it's as many as can be pending.
+		.max_splits = fmin(fmax(15.0 / (4 * (p->ms_per_tile_gen + p->ms_per_tile_buffer)), 1), TERRAIN_LOD_MAX_PENDING_SPLITS),
+		.max_uploads = TERRAIN_LOD_MAX_PENDING_SPLITS,
+		.debug = nes30_buttons[INPUT_BUTTON_START],
+		.morphs = morphs,
 	};
 	//TODO: Check the distance here and draw an imposter instead of the whole planet if it's far enough.
-
-	for (int i = 0; i < NUM_ICOSPHERE_FACES; i++) {
-		quadtree_preorder_visit(p->tiles[i], gpu_planet_split_visit, &context);
-		quadtree_preorder_visit(p->tiles[i], gpu_planet_drawlist_visit, &context);
-		if (context.excess_tiles)
-			printf("Excess tiles.\n");
-		//TODO: Find a good way to implement prune with hysteresis.
-		//terrain_tree_prune(p->tiles[i], gpu_planet_split_depth, &context, (terrain_tree_free_fn)tri_tile_free);
-	}
-
-	//printf("Num tiles drawn:%d\n", context.visited);
-	return context.num_tiles;
+	return terrain_lod_update(&p->lod, &view, tiles, max_tiles);
 }
 
 //Duplicate from draw.c for now
@@ -591,30 +876,58 @@ bool gpu_planet_point_in_viewport(float *mvpm, float *vpos, float *out)
 	return tmp;;
 }
 
-void gpu_planet_draw(amat4 eye_frame, float proj_view_mat[16], gpu_planet *planets[], bpos planet_positions[], int num_planets)
+void gpu_planet_draw(amat4 eye_frame, float proj_view_mat[16], const struct frustum *frustum, gpu_planet *planets[], bpos planet_positions[], int num_planets)
 {
 	//Create a list of planet tiles to draw.
 	amat4 tri_frame  = {.a = MAT3_IDENT, .t = {0, 0, 0}};
 	int drawlist_max = 5000 * num_planets; //TODO(Gavin): Get a good estimate of this from actual number of runtime tiles.
 	tri_tile *drawlist[drawlist_max] __attribute__((aligned(64)));
+	if (drawlist_max > gpu_planets.max_morphs) {
+		float *morphs = realloc(gpu_planets.morphs, drawlist_max * sizeof(float));
+		if (!morphs) {
+			printf("Whoops, running out of memory.\n");
+			return;
+		}
+		gpu_planets.morphs = morphs;
+		gpu_planets.max_morphs = drawlist_max;
+	}
+	float *morphs = gpu_planets.morphs;
 	//Index for the start of each planet's list of tiles, so I can assign uniforms per-planet.
 	int planet_tiles_start[num_planets + 1] __attribute__((aligned(64))); //Compiler bug!
 	int drawlist_count = 0;
+	//Tiles are tested relative to the eye.
+	struct frustum eye_frustum = *frustum;
+	eye_frustum.tested = eye_frustum.culled = 0;
+	frustum_recenter(&eye_frustum, (float *)&eye_frame.t);
 	//Collect tiles for each planet, store in drawlist.
 	for (int i = 0; i < num_planets; i++) {
 		bpos pos = {eye_frame.t - planet_positions[i].offset, eye_sector - planet_positions[i].origin};
 		planet_tiles_start[i] = drawlist_count;
-		int planet_count = gpu_planet_drawlist(planets[i], drawlist + drawlist_count, drawlist_max - drawlist_count, pos);
+		int planet_count = gpu_planet_drawlist(planets[i], drawlist + drawlist_count, morphs + drawlist_count, drawlist_max - drawlist_count, pos, &eye_frustum);
 		drawlist_count += planet_count;
 		if (key_state[SDL_SCANCODE_2])
 			printf("Planet %2i drawing %10i tiles this frame.\n", i, planet_count);
 	}
+	if (key_state[SDL_SCANCODE_2])
+		printf("Frustum culled %zu of %zu tile tests.\n", eye_frustum.culled, eye_frustum.tested);
 	planet_tiles_start[num_planets] = drawlist_count;
 
 	if (getglobbool(L, "gpu_tiles", false) != key_state[SDL_SCANCODE_3]) {
-		struct instance_attributes planet_tile_data[drawlist_count] __attribute__((aligned(64))); //Compiler bug!
+		struct stream_buffer *sb = &gpu_planets.instances;
+		GLintptr instance_offset;
+		stream_buffer_begin_frame(sb);
+		struct instance_attributes *planet_tile_data = stream_buffer_alloc(sb, drawlist_count * sizeof(struct instance_attributes), &instance_offset);
+		if (!planet_tile_data)
+			return;
 
 		for (int i = 0; i < num_planets; i++) {
+			int start = planet_tiles_start[i];
+			gpu_planet_atlas_update(planets[i], drawlist + start, morphs + start, planet_tiles_start[i+1] - start, planet_tile_data + start);
+			if (key_state[SDL_SCANCODE_2]) {
+				struct tile_atlas_stats s = planets[i]->atlas.slots.stats;
+				printf("Planet %2i atlas: %i of %i cells used, %i hits, %i rendered, %i evicted, %i tiles without a cell.\n",
+					i, s.used, planets[i]->atlas.slots.num_cells, s.hits, s.allocations, s.evictions, planet_tiles_start[i+1] - start - s.hits - s.allocations);
+			}
 			for (int j = planet_tiles_start[i]; j < planet_tiles_start[i+1]; j++) {
 				tri_tile *t = drawlist[j];
 
@@ -641,26 +954,43 @@ void gpu_planet_draw(amat4 eye_frame, float proj_view_mat[16], gpu_planet *plane
 		glUniform3f(LPOS, VEC3_COORDS(sun_position));
 		glUniform3f(EYEPOS, VEC3_COORDS(eye_frame.t));
 		checkErrors("After lighting uniforms");
-		
-		//This should be per-planet. Maybe pack into a vertex attribute? Otherwise each planet can be a separate draw call.
-		glUniform3f(PORIGIN, VEC3_COORDS(bpos_remap(planet_positions[0], eye_sector)));
-		glUniform1f(PRADIUS, planets[0]->radius);
 		glUniformMatrix4fv(MM, 1, true, mm);
 		glUniformMatrix4fv(MVPM, 1, true, proj_view_mat);
 		checkErrors("After uniforms");
-		glBindBuffer(GL_ARRAY_BUFFER, INBO);
-		checkErrors("After bind INBO");
-		//glBufferData(GL_ARRAY_BUFFER, sizeof(test_data), test_data, GL_DYNAMIC_DRAW);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(planet_tile_data), planet_tile_data, GL_DYNAMIC_DRAW);
-		checkErrors("After upload indexed array data");
+		stream_buffer_flush(sb);
+		glBindBuffer(GL_ARRAY_BUFFER, sb->buffer);
+		checkErrors("After binding instance buffer");
+		if (key_state[SDL_SCANCODE_2])
+			stream_buffer_print_stats(sb);
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, gpu_planet_tx);
 		glUniform1i(SAMPLER0, 0);
 		glUniform1i(ROWS, rows);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, get_shared_tri_tile_indices_buffer_object(rows));
 		checkErrors("After binding INBO");
-		glDrawElementsInstanced(GL_TRIANGLE_STRIP, num_tri_tile_indices(rows), GL_UNSIGNED_INT, NULL, drawlist_count);
-		checkErrors("After instanced draw");
+
+		//One draw per planet, since each has its own atlas.
+		for (int i = 0; i < num_planets; i++) {
+			GLintptr offset = instance_offset + planet_tiles_start[i] * sizeof(struct instance_attributes);
+			for (int k = 0; k < 3; k++) {
+				glVertexAttribPointer(POS_ATTR[k], 3, GL_FLOAT, GL_FALSE, sizeof(struct instance_attributes),
+					(void *)(offset + offsetof(struct instance_attributes, pos) + k*3*sizeof(float)));
+				glVertexAttribPointer(TX_ATTR[k], 2, GL_FLOAT, GL_FALSE, sizeof(struct instance_attributes),
+					(void *)(offset + offsetof(struct instance_attributes, tx) + k*2*sizeof(float)));
+			}
+			glVertexAttribPointer(ATLAS_ATTR, 3, GL_FLOAT, GL_FALSE, sizeof(struct instance_attributes),
+				(void *)(offset + offsetof(struct instance_attributes, atlas)));
+			checkErrors("After upload indexed array data");
+			glUniform3f(PORIGIN, VEC3_COORDS(bpos_remap(planet_positions[i], eye_sector)));
+			glUniform1f(PRADIUS, planets[i]->radius);
+			glActiveTexture(GL_TEXTURE1);
+			glBindTexture(GL_TEXTURE_2D, planets[i]->atlas.heights);
+			glActiveTexture(GL_TEXTURE2);
+			glBindTexture(GL_TEXTURE_2D, planets[i]->atlas.normals);
+			glDrawElementsInstanced(GL_TRIANGLE_STRIP, num_tri_tile_indices(rows), GL_UNSIGNED_INT, NULL, planet_tiles_start[i+1] - planet_tiles_start[i]);
+			checkErrors("After instanced draw");
+		}
+		glActiveTexture(GL_TEXTURE0);
 
 		// if (key_state[SDL_SCANCODE_4]) {
 		// 	for (int i = 0; i < drawlist_count; i++) {
@@ -688,6 +1018,13 @@ void gpu_planet_draw(amat4 eye_frame, float proj_view_mat[16], gpu_planet *plane
 				amat4 tile_frame = {tri_frame.a, tile_pos.offset};
 				GLfloat mm[16], mvpm[16], mvnm[16];
 
+				gpu_planet_tile_mesh(planets[i], t);
+				if (!t->vao) {
+					uint32_t ticks = SDL_GetTicks();
+					tri_tile_gl_init(t);
+					tri_tile_buffer(t);
+					planets[i]->ms_per_tile_buffer = (planets[i]->ms_per_tile_buffer + SDL_GetTicks() - ticks) / 2;
+				}
 				glBindVertexArray(t->vao);
 
 				if (!t->buffered) //Last resort "BUFFER RIGHT NOW", will cause hiccups.
@@ -770,9 +1107,10 @@ float gpu_planet_altitude(gpu_planet *p, bpos start, bpos *intersection)
 	};
 	for (int i = 0; i < NUM_ICOSPHERE_FACES; i++) {
 		//Find the intersecting tiles.
-		quadtree_preorder_visit(p->tiles[i], gpu_planet_tile_raycast, &context);
+		quadtree_preorder_visit(p->lod.roots[i], gpu_planet_tile_raycast, &context);
 		tri_tile *t = context.intersecting_tile;
 		if (t) {
+			gpu_planet_tile_mesh(p, t);
 			//Remap ray start relative to tile origin.
 			vec3 local_start = bpos_remap(start, t->offset);
 			//Remap planet center relative to tile origin.
@@ -818,7 +1156,7 @@ customdrawable_callback(entity_gpu_planet_draw)
 	// checkErrors("Universe %d", __LINE__);
 	gpu_planet *gp = cd->ctx;
 	bpos ppos = {.offset = pt->position.t, .origin = pt->origin};
-	gpu_planet_draw(cp->position, c->proj_view_mat, &gp, &ppos, 1);
+	gpu_planet_draw(cp->position, c->proj_view_mat, &c->frustum, &gp, &ppos, 1);
 	checkErrors("GPU Planet %d", __LINE__);
 }
 
@@ -847,12 +1185,6 @@ uint32_t entity_gpu_planet_new()
 
 /*
 TODO(Gavin):
-- Instead of creating a bunch of VBOs, use the method I developed in proctri_scene
-(VBO is parametric coordinates, uniforms define the corners of a triangular tile)
-- Create a texture atlas to store tile attributes. UVs can be calculated using math I figured out in the Lua prototype.
-Slots can be assigned using an hmempool (backing mempool holds the UV coordinates and corner vertices which ultimately "reserve" a slot)
-	(Consider using an ECS with TextureAtlasSlot component? May want to avoid over-generalizing to arbitrary polygonal slots.
-	Maybe I don't need this - the quadtree can hold tile information while the hmempool is just for reserved slots.)
 - Set up sister hmempool for albedo/roughness/normal etc. shading information. Deterministically matches the layout of the heightmap atlas,
 but is many times the resolution. Can use same UV coordinates?!
 
@@ -862,45 +1194,9 @@ because I didn't know how many it would take?)
 Maybe I can evict parent nodes to save 25%. Evicting non-visible tiles aggressively could get it lower. If I evict parent tiles, I can't
 use them to apply lower-frequency detail to smaller tiles, though it would be nice if tiles could be created and destroyed with no dependencies.
 
-- Set up functions to render tiles into the texture atlas. Will read local landmarks per-tile (rivers, mountains, other "decal-like" stuff)
-and draw them into the atlas on the GPU.
-- Preparing for draw means visiting quadtree, constructing a UBO or VBO-with-glAttribDivisor with all the UV coordinates and corner vertices
-- Drawing is as simple as binding the texture, UBO, VBO and calling draw instanced - should be able to draw even multiple planets really easily.
-- Think about frustum culling - could be pretty easy to do while walking the tree, just have to be careful to not cull in this case:
-
-              ^
-              |
-              |
-              |
-        /|    |
-<------/ |---camera frustum
-      /  |
-a____/   |____b (corner vertices a and b are outside frustum, terrain is not)
-
-- Blending between subdivision levels could be done by having a second set of texture coordinates and sampling a different texture,
-or, by placing the previous-detail-level's height in the texture with the current detail level's tile data, allowing for interpolation between
-detail levels from a single texture sample. Could also put the delta between the two, for more height resolution (this would need to be fixed-point to
-avoid pop-in).
-
-Another idea is for "new" vertices to sample the old vertices adjacent to them, and average their heights to reconstruct what the surface height would
-have been (this could be done as part of the draw step and stored to remove the need to do another 2 samples at render time).
-
-In the vertex shader, vertex texture-fetch to get the height, use camera position to determine how to lerp between previous height and current height.
-At 0 looks like prev. detail level, at 1 is "full" resolution. Coordination between selected detail level and calculated lerp factor obviates the need
-for terrain skirts / overlap.
+- Read local landmarks per-tile (rivers, mountains, other "decal-like" stuff) and draw them into the atlas on the GPU.
 
 I'll have to find a solution for doing heightmap lookups CPU-side. I could load heightmaps from the GPU, or re-generate needed height data on the CPU.
 
-Step-by-Step:
-1. Create FBO to render to, attach to a camera
-2. Create some kind of widget to display FBO
-3. Test rendering a triangle into the FBO
-4. Test rendering a bunch of triangles into the FBO, using an hmempool to coordinate, storing UVs
-5. Make a vertex / fragment shader for terrain
-5. Test reading a triangle from FBO in a vertex shader
-6. Create icosphere, reading from FBO
-7. Add icosphere subdivision
-8. Render heightmap into FBO and watch the sphere get all wibbly
-9. Read neigbors to reconstruct "parent" height, store for interpolation between detail levels
-10. Collision :((((
-*/
\ No newline at end of file
+- Collision :((((
+*/
@@ -6,6 +6,9 @@
 #include "space/triangular_terrain_tile.h"
 #include "terrain_constants.h"
 #include "math/bpos.h"
+#include "math/frustum.h"
+#include "space/terrain_lod.h"
+#include "space/tile_atlas.h"
 #include <inttypes.h>
 
 enum {
@@ -16,6 +19,19 @@ enum {
 	GPU_PLANET_NUM_TILE_ROWS = 128,
 	GPU_PLANET_TILE_PIXELS_PER_TRI = 5,
 	GPU_PLANET_TILE_MAX_SUBDIVISIONS = 7, //TODO(Gavin): Choose a number that sets the surface resolution to a nice number.
+	GPU_PLANET_DEFAULT_TILE_BUDGET_MB = 512, //Overridden by planet_tile_budget_mb in conf.lua.
+	GPU_PLANET_DEFAULT_ATLAS_CELLS = 16, //Per side of the heightmap atlas. Overridden by gpu_planet_atlas_cells in conf.lua.
+	GPU_PLANET_ATLAS_RENDERS_PER_FRAME = 16, //Tiles rendered into the atlas per planet per frame. The rest wait.
+};
+
+//Heights and normals for the tiles being drawn, rendered on the GPU, one tile per cell of a tile_atlas. A cell's
+//texel (j, r) is vertex j of row r. Tiles without a cell compute their heights in the vertex shader instead.
+struct gpu_planet_atlas {
+	struct tile_atlas slots;
+	GLuint fbo;
+	GLuint heights; //RG32F, height and what it would be on the parent tile, to morph from.
+	GLuint normals; //RGB10_A2
+	int size; //In texels, per side.
 };
 
 typedef struct gpu_planet {
@@ -30,30 +46,24 @@ typedef struct gpu_planet {
 	vec3 color_family;
 	int elements[GPU_PLANET_MAX_NUM_ELEMENTS];
 	int num_elements;
-	quadtree_node *tiles[NUM_ICOSPHERE_FACES];
 	height_map_func height;
-	float ms_per_tile_gen, ms_per_tile_buffer;
+	float ms_per_tile_gen, ms_per_tile_buffer; //Making a tile's CPU mesh and buffering it, averaged over the recent ones.
+	struct terrain_lod lod;
+	struct gpu_planet_atlas atlas;
 } gpu_planet;
 
-struct gpu_planet_terrain_context {
-	int splits_left;
-	int splits_max;
-	bpos cam_pos;
-	gpu_planet *planet;
-	int visited;
-	tri_tile **tiles;
-	int num_tiles;
-	int max_tiles;
-	bool excess_tiles;
-};
-
 int gpu_planet_init();
 void gpu_planet_deinit();
 gpu_planet * gpu_planet_new(float radius, height_map_func height, int *elements, int num_elements);
 
 void gpu_planet_free(gpu_planet *p);
-int gpu_planet_drawlist(gpu_planet *p, tri_tile **tiles, int max_tiles, bpos cam_pos);
-void gpu_planet_draw(amat4 eye_frame, float proj_view_mat[16], gpu_planet *planets[], bpos planet_positions[], int num_planets);
+//Renders a face and its children into a new planet's atlas, reads their cells back, and checks them against the
+//terrain noise on the CPU. Needs gpu_planet_init. Returns how many checks failed.
+int gpu_planet_atlas_check();
+//morphs are filled in alongside tiles, see terrain_lod_view.
+int gpu_planet_drawlist(gpu_planet *p, tri_tile **tiles, float *morphs, int max_tiles, bpos cam_pos, struct frustum *frustum);
+//frustum is the camera's, relative to eye_sector like proj_view_mat.
+void gpu_planet_draw(amat4 eye_frame, float proj_view_mat[16], const struct frustum *frustum, gpu_planet *planets[], bpos planet_positions[], int num_planets);
 float gpu_planet_height(vec3 pos, vec3 *variety);
 
 //Raycast towards the planet center and find the altitude on the deepest terrain tile. O(log(n)) complexity in the number of planet tiles.
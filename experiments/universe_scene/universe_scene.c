@@ -6,11 +6,15 @@
 #include "shader_utils.h"
 #include "trackball/trackball.h"
 #include "space/star_box.h"
+#include "space/galaxy_volume.h"
 #include "input_event.h"
 #include "experiments/universe_scene/universe_ecs.h"
 #include "experiments/universe_scene/universe_components.h"
 #include "experiments/universe_scene/universe_entities/gpu_planet.h"
 #include "systems/ply_mesh_renderer.h"
+#include "systems/ecs_scheduler.h"
+#include "jobs/thread_pool.h"
+#include "luaengine/lua_configuration.h"
 #include <math.h>
 #include <assert.h>
 SCENE_IMPLEMENT(universe)
@@ -18,9 +22,14 @@ SCENE_IMPLEMENT(universe)
 struct game_scene universe_scene;
 uint32_t default_camera = 0;
 uint32_t test_planet = 0;
+static uint32_t universe_star_box = 0;
 struct entity_ctypes universe_ecs_ctypes = {0};
 static ecs_ctx universe_ecs_ctx = {};
 static struct ply_mesh_renderer_ctx ply_ctx = {};
+static thread_pool *universe_pool = NULL;
+static struct ecs_scheduler universe_scheduler;
+//Change tick at which camera matrices were last brought up to date.
+static uint32_t camera_matrices_tick = 0;
 ecs_ctx *puniverse_ecs_ctx = &universe_ecs_ctx;
 //Short names for convenience
 #define E puniverse_ecs_ctx
@@ -29,6 +38,9 @@ ecs_ctx *puniverse_ecs_ctx = &universe_ecs_ctx;
 #define ply_get(filename) ply_mesh_renderer_get_mesh(&ply_ctx, filename)
 
 
+/* Lua Config */
+extern lua_State *L;
+
 //This doesn't need to be in the ECS because its state can be reconstructed from the camera constructor.
 static struct trackball camera_trackball;
 
@@ -37,9 +49,9 @@ static struct ecs_component_init_params component_init_params[] = {
 //    num, size, constructor, destructor, userdata, ctype out, ECS out, init params out, init, deinit
 	{.num = 10,  .size = sizeof(PhysicalTemp),   .ctype = &ctypes.physical},
 	{.num = 10,  .size = sizeof(Camera),         .ctype = &ctypes.camera,         .construct = camera_constructor},
-	{.num = 500, .size = sizeof(CustomDrawable), .ctype = &ctypes.customdrawable, .construct = customdrawable_constructor, .destruct = customdrawable_destructor},
+	{.num = 500, .size = sizeof(CustomDrawable), .ctype = &ctypes.customdrawable, .construct = customdrawable_constructor, .destruct = customdrawable_destructor, .deserialize = customdrawable_deserialize},
 	{.num = 200, .size = sizeof(PlyMesh),        .ctype = &ctypes.plymesh},
-	{.num = 20,  .size = sizeof(Label),          .ctype = &ctypes.label,          .construct = label_constructor,          .destruct = label_destructor},
+	{.num = 20,  .size = sizeof(Label),          .ctype = &ctypes.label,          .construct = label_constructor,          .destruct = label_destructor,          .serialize = label_serialize, .deserialize = label_deserialize},
 	{.num = 500, .size = sizeof(ScriptableTemp), .ctype = &ctypes.scriptable},
 	{.num = 10,  .size = sizeof(Target),         .ctype = &ctypes.target},
 	{.num = 5,   .size = sizeof(Trackball),      .ctype = &ctypes.trackball,      .construct = trackball_constructor},
@@ -59,11 +71,25 @@ bool target_or_self_origin(uint32_t eid, bpos_origin *origin)
 	return false;
 }
 
+//Velocity of the entity eid's origin follows, in bpos cells per update.
+//A camera sits still relative to what its trackball orbits, so use that entity's velocity instead.
+static vec3 target_or_self_velocity(uint32_t eid)
+{
+	Target *t = entity_target(eid);
+	if (t)
+		eid = t->target;
+	Trackball *tb = entity_trackball(eid);
+	if (tb)
+		eid = tb->target;
+	PhysicalTemp *p = entity_physicaltemp(eid);
+	return p ? p->velocity.t / BPOS_CELL_SIZE : (vec3){0, 0, 0};
+}
+
 scriptabletemp_callback(entity_star_box_script)
 {
 	bpos_origin origin = {0,0,0};
 	target_or_self_origin(eid, &origin);
-	star_box_update(entity_customdrawable(eid)->ctx, origin);
+	star_box_update(entity_customdrawable(eid)->ctx, origin, target_or_self_velocity(eid));
 }
 
 customdrawable_callback(entity_star_box_draw)
@@ -80,7 +106,10 @@ CD(entity_star_box_construct)
 {
 	bpos_origin origin = {0,0,0};
 	target_or_self_origin(eid, &origin);
-	((CustomDrawable *)component)->ctx = star_box_init(star_box_new(), origin);
+	//Stars follow the same galaxy the spiral shader draws.
+	struct galaxy_tweaks gt = galaxy_load_tweaks(L, "galaxy_defaults");
+	struct galaxy_density galaxy = galaxy_density_from_tweaks(&gt);
+	((CustomDrawable *)component)->ctx = star_box_init(star_box_new(), origin, universe_pool, &galaxy);
 }
 
 CD(entity_star_box_destruct)
@@ -131,7 +160,7 @@ static uint32_t entity_universe_new()
 
 scriptabletemp_callback(entity_camera_script)
 {
-	PhysicalTemp *c = entity_physicaltemp(eid);
+	PhysicalTemp *c = ecs_component_write(E, eid, ctypes.physical);
 	PhysicalTemp *p = entity_physicaltemp(entity_target(eid)->target);
 	Trackball *t = entity_trackball(eid);
 	assert(c && p && t);
@@ -175,7 +204,7 @@ static uint32_t entity_default_camera_new(uint32_t target, float width, float he
 
 scriptabletemp_callback(entity_player_script)
 {
-	PhysicalTemp *p = entity_physicaltemp(eid);
+	PhysicalTemp *p = ecs_component_write(E, eid, ctypes.physical);
 	assert(p);
 	// if (key_state[SDL_SCANCODE_W])
 	// 	p->velocity.t.z -= 1.0;
@@ -280,6 +309,26 @@ static uint32_t entity_player_new()
 	return player;
 }
 
+//TODO: Move this to its own file when I make a proper Physical "system"
+static void component_physical_update(struct component_physicaltemp *p)
+{
+	p->velocity.t += p->acceleration.t;
+	p->position.t += p->velocity.t;
+	p->velocity.a = mat3_mult(p->velocity.a, p->acceleration.a);
+	p->position.a = mat3_mult(p->position.a, p->velocity.a);
+
+	bpos_split_fix(&p->position.t, &p->origin);
+}
+
+static ecs_system_chunk_fn(system_physical_update)
+{
+	PhysicalTemp *p = components;
+	for (size_t i = begin; i < end; i++) {
+		component_physical_update(&p[i]);
+		ecs_component_mark_written(E, itoh[i], ctypes.physical);
+	}
+}
+
 int universe_scene_init()
 {
 	float width = 800, height = 600;
@@ -306,6 +355,7 @@ int universe_scene_init()
 
 	e = ecs_new(10000, 50);
 	e.user_ctypes = &ctypes;
+	camera_matrices_tick = 0;
 
 	//TODO(Gavin): Validate ctypes, in case a component type is uninitialized.
 	for (int i = 0; i < LENGTH(component_init_params); i++) {
@@ -314,6 +364,14 @@ int universe_scene_init()
 
 	ply_ctx = ply_mesh_renderer_new(10);
 
+	//0 worker threads runs every system on this thread, in registration order.
+	universe_pool = thread_pool_new(getglob(L, "worker_threads", 0));
+	ecs_scheduler_init(&universe_scheduler, E, universe_pool);
+	ecs_scheduler_add(&universe_scheduler, (struct ecs_system){
+		.name = "physical update",
+		.writes = {ctypes.physical}, .num_writes = 1,
+		.run_chunk = system_physical_update, .chunk_ctype = ctypes.physical, .chunk_size = 256});
+
 	//TODO(Gavin): Copy other needed scene init stuff from space_scene (and convert to ECS stuff where reasonable)
 
 	//Universe entity will spawn and manage galaxy entities,
@@ -323,7 +381,7 @@ int universe_scene_init()
 
 	uint32_t player = entity_player_new();
 	default_camera = entity_default_camera_new(player, width, height);
-	uint32_t starbox = entity_star_box_new(default_camera);
+	universe_star_box = entity_star_box_new(default_camera);
 
 	uint32_t planet = entity_gpu_planet_new();
 	test_planet = planet;
@@ -335,22 +393,14 @@ int universe_scene_init()
 void universe_scene_deinit()
 {
 	gpu_planet_deinit();
+	//Free the ECS first, the star box destructor waits on boxes still generating in the pool.
 	ecs_free(E);
+	thread_pool_free(universe_pool);
+	universe_pool = NULL;
 	ply_mesh_renderer_delete(&ply_ctx);
 	checkErrors("Universe %d", __LINE__);
 }
 
-//TODO: Move this to its own file when I make a proper Physical "system"
-static void component_physical_update(struct component_physicaltemp *p)
-{
-	p->velocity.t += p->acceleration.t;
-	p->position.t += p->velocity.t;
-	p->velocity.a = mat3_mult(p->velocity.a, p->acceleration.a);
-	p->position.a = mat3_mult(p->position.a, p->velocity.a);
-
-	bpos_split_fix(&p->position.t, &p->origin);
-}
-
 void universe_print()
 {
 	size_t num_labels = 0;
@@ -359,19 +409,49 @@ void universe_print()
 	for (int i = 0; i < num_labels; i++) {
 		printf("[Entity %u][%s] %s\n", labels_itoh[i], labels[i].name ? labels[i].name : "", labels[i].description ? labels[i].description : "");
 	}
+	ecs_scheduler_print_timings(&universe_scheduler);
+	CustomDrawable *sb = entity_customdrawable(universe_star_box);
+	if (sb)
+		star_box_print_stats(sb->ctx);
 }
 
 void universe_scene_update(float dt)
 {
-	size_t num_scriptables = 0, num_physicals = 0;
+	size_t num_scriptables = 0;
 	ScriptableTemp *scriptables = ecs_components(E, ctypes.scriptable, &num_scriptables);
 	const uint32_t *scriptables_itoh = ecs_component_itoh(E, ctypes.scriptable);
 	for (int i = 0; i < num_scriptables; i++)
 		scriptables[i].script(scriptables_itoh[i]);
 
-	PhysicalTemp *p = ecs_components(E, ctypes.physical, &num_physicals);
-	for (int i = 0; i < num_physicals; i++)
-		component_physical_update(&p[i]);
+	//Scripts touch SDL and OpenGL, so they stay on this thread. Everything else goes through the scheduler.
+	ecs_scheduler_run(&universe_scheduler, dt);
+}
+
+static void camera_update_proj_view(uint32_t camera)
+{
+	PhysicalTemp *p = entity_physicaltemp(camera);
+	Camera *c = entity_camera(camera);
+	if (!p || !c)
+		return;
+	float tmp[16];
+	amat4_to_array(amat4_inverse(p->position), tmp);
+	amat4_buf_mult(c->proj_mat, tmp, c->proj_view_mat);
+	frustum_from_matrix(&c->frustum, c->proj_view_mat, false);
+}
+
+//Only cameras that moved, or had their projection changed, need a new view-projection matrix.
+static void universe_update_camera_matrices()
+{
+	struct ecs_changed_iter it;
+	uint32_t eid;
+	ecs_components_changed_since(&it, E, ctypes.camera, camera_matrices_tick);
+	while (ecs_changed_next(&it, &eid))
+		camera_update_proj_view(eid);
+	ecs_components_changed_since(&it, E, ctypes.physical, camera_matrices_tick);
+	while (ecs_changed_next(&it, &eid))
+		if (entity_camera(eid))
+			camera_update_proj_view(eid);
+	camera_matrices_tick = ecs_tick(E);
 }
 
 void camera_recursive_add(struct mempool *m, uint32_t camera)
@@ -380,8 +460,10 @@ void camera_recursive_add(struct mempool *m, uint32_t camera)
 	if (c->num_prev == 0 && !c->visited) {
 		c->visited = true;
 		mempool_add(m, &camera);
-		if (c->next) {
-			entity_camera(c->next)->num_prev--;
+		//A stale "next" (its camera was removed) gets no camera back, and is treated as the end of the chain.
+		Camera *next = entity_camera(c->next);
+		if (next) {
+			next->num_prev--;
 			camera_recursive_add(m, c->next);
 		}
 	}
@@ -401,12 +483,7 @@ void universe_scene_render()
 		universe_print();
 	}
 
-	PhysicalTemp *camera_physical = entity_physicaltemp(default_camera);
-	Camera *camera_camera = entity_camera(default_camera);
-	amat4 inv_eye_frame = amat4_inverse(camera_physical->position);
-	float tmp[16];
-	amat4_to_array(inv_eye_frame, tmp);
-	amat4_buf_mult(camera_camera->proj_mat, tmp, camera_camera->proj_view_mat);
+	universe_update_camera_matrices();
 
 	size_t num_cameras = 0;
 	Camera *cameras = ecs_components(E, ctypes.camera, &num_cameras);
@@ -416,8 +493,9 @@ void universe_scene_render()
 	//num_prev assumed to be 0-init, or reset to 0 after previous frame's render.
 	for (int i = 0; i < num_cameras; i++) {
 		cameras[i].visited = false;
-		if (cameras[i].next)
-			entity_camera(cameras[i].next)->num_prev++;
+		Camera *next = entity_camera(cameras[i].next);
+		if (next)
+			next->num_prev++;
 	}
 
 	//Add each camera in order to topologically sort
@@ -448,7 +526,7 @@ void universe_scene_render()
 void universe_scene_resize(float width, float height)
 {
 	//Update the default camera aspect ratio and re-run the constructor to regenerate the projection matrix.
-	Camera *c = entity_camera(default_camera);
+	Camera *c = ecs_component_write(E, default_camera, ctypes.camera);
 	c->width = width; c->height = height;
 	c->aspect = width/height;
 	camera_constructor(default_camera, c, NULL);
@@ -0,0 +1,2 @@
+OBJECTS += \
+	jobs/thread_pool.o \
@@ -0,0 +1,239 @@
+#include "thread_pool.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+//Growable ring buffer of jobs. The owner uses the back, thieves use the front.
+struct thread_pool_deque {
+	pthread_mutex_t lock;
+	struct thread_pool_job *jobs;
+	size_t head, num, max;
+};
+
+struct thread_pool_worker {
+	thread_pool *pool;
+	int index;
+	pthread_t thread;
+};
+
+struct thread_pool {
+	int num_threads;
+	struct thread_pool_worker *workers;
+	//One deque per worker, plus one shared deque (the last) for jobs submitted from outside the pool.
+	struct thread_pool_deque *deques;
+	pthread_mutex_t sleep_lock;
+	pthread_cond_t wake;
+	atomic_size_t queued;
+	atomic_bool quit;
+};
+
+//Index of the worker running on this thread, or -1 if this thread is not one of the pool's workers.
+static _Thread_local int thread_pool_worker_index = -1;
+static _Thread_local thread_pool *thread_pool_current = NULL;
+
+static void thread_pool_deque_init(struct thread_pool_deque *d)
+{
+	pthread_mutex_init(&d->lock, NULL);
+	d->max = 64;
+	d->jobs = malloc(d->max * sizeof(struct thread_pool_job));
+	d->head = d->num = 0;
+}
+
+static void thread_pool_deque_deinit(struct thread_pool_deque *d)
+{
+	pthread_mutex_destroy(&d->lock);
+	free(d->jobs);
+}
+
+static void thread_pool_deque_push_back(struct thread_pool_deque *d, struct thread_pool_job job)
+{
+	pthread_mutex_lock(&d->lock);
+	if (d->num == d->max) {
+		//Unwrap the ring into a buffer twice as large.
+		struct thread_pool_job *jobs = malloc(2 * d->max * sizeof(struct thread_pool_job));
+		for (size_t i = 0; i < d->num; i++)
+			jobs[i] = d->jobs[(d->head + i) % d->max];
+		free(d->jobs);
+		d->jobs = jobs;
+		d->head = 0;
+		d->max *= 2;
+	}
+	d->jobs[(d->head + d->num++) % d->max] = job;
+	pthread_mutex_unlock(&d->lock);
+}
+
+static bool thread_pool_deque_pop_back(struct thread_pool_deque *d, struct thread_pool_job *job)
+{
+	bool found = false;
+	pthread_mutex_lock(&d->lock);
+	if (d->num) {
+		*job = d->jobs[(d->head + --d->num) % d->max];
+		found = true;
+	}
+	pthread_mutex_unlock(&d->lock);
+	return found;
+}
+
+static bool thread_pool_deque_pop_front(struct thread_pool_deque *d, struct thread_pool_job *job)
+{
+	bool found = false;
+	pthread_mutex_lock(&d->lock);
+	if (d->num) {
+		*job = d->jobs[d->head];
+		d->head = (d->head + 1) % d->max;
+		d->num--;
+		found = true;
+	}
+	pthread_mutex_unlock(&d->lock);
+	return found;
+}
+
+static void thread_pool_run_job(struct thread_pool_job job)
+{
+	job.fn(job.ctx, job.begin, job.end);
+	if (job.done)
+		atomic_fetch_sub(job.done, 1);
+}
+
+//Find a job for the calling thread: its own deque first, then the shared deque, then steal from other workers.
+static bool thread_pool_take(thread_pool *pool, int self, struct thread_pool_job *job)
+{
+	int shared = pool->num_threads;
+	if (self >= 0 && thread_pool_deque_pop_back(&pool->deques[self], job))
+		goto found;
+	if (thread_pool_deque_pop_front(&pool->deques[shared], job))
+		goto found;
+	for (int i = 1; i <= pool->num_threads; i++) {
+		int victim = ((self < 0 ? 0 : self) + i) % pool->num_threads;
+		if (victim != self && thread_pool_deque_pop_front(&pool->deques[victim], job))
+			goto found;
+	}
+	return false;
+found:
+	atomic_fetch_sub(&pool->queued, 1);
+	return true;
+}
+
+static void * thread_pool_worker_main(void *arg)
+{
+	struct thread_pool_worker *w = arg;
+	thread_pool *pool = w->pool;
+	thread_pool_worker_index = w->index;
+	thread_pool_current = pool;
+
+	struct thread_pool_job job;
+	for (;;) {
+		if (thread_pool_take(pool, w->index, &job)) {
+			thread_pool_run_job(job);
+			continue;
+		}
+		pthread_mutex_lock(&pool->sleep_lock);
+		while (!atomic_load(&pool->queued) && !atomic_load(&pool->quit))
+			pthread_cond_wait(&pool->wake, &pool->sleep_lock);
+		bool quit = atomic_load(&pool->quit) && !atomic_load(&pool->queued);
+		pthread_mutex_unlock(&pool->sleep_lock);
+		if (quit)
+			break;
+	}
+	return NULL;
+}
+
+thread_pool * thread_pool_new(int num_threads)
+{
+	thread_pool *pool = malloc(sizeof(thread_pool));
+	if (num_threads < 0)
+		num_threads = 0;
+	pool->num_threads = num_threads;
+	pool->workers = calloc(num_threads ? num_threads : 1, sizeof(struct thread_pool_worker));
+	pool->deques = calloc(num_threads + 1, sizeof(struct thread_pool_deque));
+	for (int i = 0; i < num_threads + 1; i++)
+		thread_pool_deque_init(&pool->deques[i]);
+	pthread_mutex_init(&pool->sleep_lock, NULL);
+	pthread_cond_init(&pool->wake, NULL);
+	atomic_init(&pool->queued, 0);
+	atomic_init(&pool->quit, false);
+
+	for (int i = 0; i < num_threads; i++) {
+		pool->workers[i] = (struct thread_pool_worker){.pool = pool, .index = i};
+		if (pthread_create(&pool->workers[i].thread, NULL, thread_pool_worker_main, &pool->workers[i])) {
+			printf("%s: Could not create worker thread %i, continuing with %i.\n", __FUNCTION__, i, i);
+			//Deque i becomes the one for outside threads, and the rest are never used.
+			for (int j = i + 1; j < num_threads + 1; j++)
+				thread_pool_deque_deinit(&pool->deques[j]);
+			pool->num_threads = i;
+			break;
+		}
+	}
+	return pool;
+}
+
+void thread_pool_free(thread_pool *pool)
+{
+	pthread_mutex_lock(&pool->sleep_lock);
+	atomic_store(&pool->quit, true);
+	pthread_cond_broadcast(&pool->wake);
+	pthread_mutex_unlock(&pool->sleep_lock);
+	for (int i = 0; i < pool->num_threads; i++)
+		pthread_join(pool->workers[i].thread, NULL);
+
+	//Anything still queued (only possible if a worker failed to start) runs here.
+	struct thread_pool_job job;
+	while (thread_pool_take(pool, -1, &job))
+		thread_pool_run_job(job);
+
+	for (int i = 0; i < pool->num_threads + 1; i++)
+		thread_pool_deque_deinit(&pool->deques[i]);
+	pthread_mutex_destroy(&pool->sleep_lock);
+	pthread_cond_destroy(&pool->wake);
+	free(pool->deques);
+	free(pool->workers);
+	free(pool);
+}
+
+int thread_pool_num_threads(thread_pool *pool)
+{
+	return pool->num_threads;
+}
+
+void thread_pool_submit(thread_pool *pool, struct thread_pool_job job)
+{
+	if (pool->num_threads == 0) {
+		thread_pool_run_job(job);
+		return;
+	}
+
+	//Count the job before it becomes visible, so "queued" never drops below the real number of queued jobs.
+	int self = thread_pool_current == pool ? thread_pool_worker_index : -1;
+	atomic_fetch_add(&pool->queued, 1);
+	thread_pool_deque_push_back(&pool->deques[self >= 0 ? self : pool->num_threads], job);
+	pthread_mutex_lock(&pool->sleep_lock);
+	pthread_cond_signal(&pool->wake);
+	pthread_mutex_unlock(&pool->sleep_lock);
+}
+
+void thread_pool_parallel_for(thread_pool *pool, thread_pool_job_fn *fn, void *ctx, size_t num, size_t chunk_size, atomic_size_t *done)
+{
+	if (!chunk_size)
+		chunk_size = num ? num : 1;
+	if (done)
+		atomic_fetch_add(done, (num + chunk_size - 1) / chunk_size);
+	for (size_t begin = 0; begin < num; begin += chunk_size) {
+		size_t end = begin + chunk_size < num ? begin + chunk_size : num;
+		thread_pool_submit(pool, (struct thread_pool_job){.fn = fn, .ctx = ctx, .begin = begin, .end = end, .done = done});
+	}
+}
+
+void thread_pool_wait(thread_pool *pool, atomic_size_t *done)
+{
+	int self = thread_pool_current == pool ? thread_pool_worker_index : -1;
+	struct thread_pool_job job;
+	while (atomic_load(done)) {
+		if (thread_pool_take(pool, self, &job))
+			thread_pool_run_job(job);
+		else
+			sched_yield();
+	}
+}
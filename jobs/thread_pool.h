@@ -0,0 +1,49 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*
+A work-stealing pool of worker threads.
+
+Each worker owns a deque of jobs. Workers push and pop jobs at the back of their own deque,
+and when it runs dry they steal from the front of other workers' deques.
+Jobs submitted from outside the pool (usually the main thread) go to a shared deque that every worker steals from.
+
+A thread that waits on a counter with thread_pool_wait runs queued jobs while it waits,
+so waiting from inside a job (or on the main thread) does not leave a core idle.
+
+A pool with 0 worker threads runs every job immediately on the submitting thread, in submission order.
+This is useful as a deterministic single-threaded fallback.
+*/
+
+//A job runs fn(ctx, begin, end) over the half-open range [begin, end).
+#define thread_pool_job_fn(name) void name(void *ctx, size_t begin, size_t end)
+typedef thread_pool_job_fn(thread_pool_job_fn);
+
+struct thread_pool_job {
+	thread_pool_job_fn *fn;
+	void *ctx;
+	size_t begin, end;
+	//If not NULL, decremented after the job runs. Can be waited on with thread_pool_wait.
+	atomic_size_t *done;
+};
+
+typedef struct thread_pool thread_pool;
+
+//Create a pool with num_threads worker threads. 0 is valid, see above.
+thread_pool * thread_pool_new(int num_threads);
+//Wait for all queued jobs to finish, then stop and free the pool.
+void thread_pool_free(thread_pool *pool);
+//Number of worker threads in the pool.
+int thread_pool_num_threads(thread_pool *pool);
+//Queue a job. If job.done is not NULL, the caller should have already counted this job in it.
+void thread_pool_submit(thread_pool *pool, struct thread_pool_job job);
+//Split [0, num) into chunks of at most chunk_size, and queue a job for each.
+//*done is incremented by the number of chunks before they are queued.
+void thread_pool_parallel_for(thread_pool *pool, thread_pool_job_fn *fn, void *ctx, size_t num, size_t chunk_size, atomic_size_t *done);
+//Run queued jobs until *done reaches 0.
+void thread_pool_wait(thread_pool *pool, atomic_size_t *done);
+
+#endif
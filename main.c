@@ -22,6 +22,7 @@
 #include "experiments/visualizer_scene.h"
 #include "experiments/atmosphere/atmosphere_scene.h"
 #include "experiments/universe_scene/universe_scene.h"
+#include "experiments/universe_scene/universe_entities/gpu_planet.h"
 #include "experiments/spawngrid/spawngrid_scene.h"
 //Tests
 #include "test/test_main.h"
@@ -208,6 +209,16 @@ int main(int argc, char **argv)
 		result = test_main(argc, argv);
 		goto error;
 	}
+
+	//The atlas pass needs OpenGL, so it's checked here instead of with the tests. Runs under Mesa's software
+	//rasterizer with LIBGL_ALWAYS_SOFTWARE=1.
+	if (arg1 && !strcmp(arg1, "gpu_planet_atlas_check")) {
+		if (!(result = gpu_planet_init())) {
+			result = gpu_planet_atlas_check();
+			gpu_planet_deinit();
+		}
+		goto error;
+	}
 	
 	//When we receive SIGUSR1, reload the scene.
 	if (signal(SIGUSR1, reload_signal_handler) == SIG_ERR) {
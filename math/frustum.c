@@ -0,0 +1,58 @@
+#include "frustum.h"
+#include <math.h>
+
+void frustum_from_matrix(struct frustum *f, const float proj_view_mat[16], bool near_far)
+{
+	//Gribb and Hartmann: each plane is the bottom row plus or minus one of the others.
+	const float *m = proj_view_mat, *w = &m[12];
+	f->num_planes = near_far ? 6 : 4;
+	for (int i = 0; i < f->num_planes; i++) {
+		const float *row = &m[4 * (i / 2)];
+		float sign = i % 2 ? -1 : 1, len = 0;
+		for (int j = 0; j < 4; j++)
+			f->planes[i][j] = w[j] + sign * row[j];
+		for (int j = 0; j < 3; j++)
+			len += f->planes[i][j] * f->planes[i][j];
+		len = sqrtf(len);
+		for (int j = 0; j < 4; j++)
+			f->planes[i][j] /= len;
+	}
+	f->tested = f->culled = 0;
+}
+
+void frustum_recenter(struct frustum *f, const float origin[3])
+{
+	for (int i = 0; i < f->num_planes; i++)
+		f->planes[i][3] += f->planes[i][0] * origin[0] + f->planes[i][1] * origin[1] + f->planes[i][2] * origin[2];
+}
+
+bool frustum_test_sphere(struct frustum *f, const float center[3], float radius)
+{
+	f->tested++;
+	for (int i = 0; i < f->num_planes; i++) {
+		const float *p = f->planes[i];
+		if (p[0] * center[0] + p[1] * center[1] + p[2] * center[2] + p[3] < -radius) {
+			f->culled++;
+			return false;
+		}
+	}
+	return true;
+}
+
+size_t frustum_test_spheres(struct frustum *f, size_t num, const float *x, const float *y, const float *z, const float *radius, uint8_t *visible)
+{
+	for (size_t i = 0; i < num; i++)
+		visible[i] = 1;
+	//A plane at a time, so the inner loop is the same arithmetic on consecutive spheres and vectorizes.
+	for (int j = 0; j < f->num_planes; j++) {
+		float a = f->planes[j][0], b = f->planes[j][1], c = f->planes[j][2], d = f->planes[j][3];
+		for (size_t i = 0; i < num; i++)
+			visible[i] &= a * x[i] + b * y[i] + c * z[i] + d >= -radius[i];
+	}
+	size_t num_visible = 0;
+	for (size_t i = 0; i < num; i++)
+		num_visible += visible[i];
+	f->tested += num;
+	f->culled += num - num_visible;
+	return num_visible;
+}
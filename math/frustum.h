@@ -0,0 +1,40 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+/*
+View frustum culling against bounding spheres. No GL or glla in here, positions are float[3] (a vec3 cast to
+float * works).
+
+Planes come from a view-projection matrix, row-major as glUniformMatrix4fv reads it with transpose set, and
+face inwards: a point p is on the inside of plane i if planes[i][0..2] . p + planes[i][3] >= 0.
+
+The near and far planes assume OpenGL's -1 to 1 depth. With logarithmic depth they aren't the ones the shaders
+clip to, and make_projection_matrix doesn't map far to 1, so for those leave them out and test the 4 side planes.
+
+Everything in this engine is positioned relative to a sector, and the view matrix is relative to the eye's sector.
+frustum_recenter moves the planes so positions can be given relative to the eye itself, which stays precise for
+things that are near the eye however far it is from its sector's origin.
+*/
+
+enum { FRUSTUM_MAX_PLANES = 6 };
+
+struct frustum {
+	float planes[FRUSTUM_MAX_PLANES][4]; //Left, right, bottom, top, then near and far if included.
+	int num_planes;
+	//Spheres tested and culled since the frustum was made, for stats.
+	size_t tested, culled;
+};
+
+void frustum_from_matrix(struct frustum *f, const float proj_view_mat[16], bool near_far);
+//Make origin the frustum's origin, so positions are given relative to it.
+void frustum_recenter(struct frustum *f, const float origin[3]);
+//True if any of the sphere might be inside.
+bool frustum_test_sphere(struct frustum *f, const float center[3], float radius);
+//Tests num spheres, given as separate arrays. visible[i] is set to 1 if sphere i might be inside, otherwise 0.
+//Returns how many might be inside.
+size_t frustum_test_spheres(struct frustum *f, size_t num, const float *x, const float *y, const float *z, const float *radius, uint8_t *visible);
+
+#endif
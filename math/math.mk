@@ -1,4 +1,5 @@
 OBJECTS += \
 	math/geometry.o \
 	math/bpos.o \
-	math/utility.o
\ No newline at end of file
+	math/frustum.o \
+	math/utility.o
@@ -47,6 +47,15 @@ float frand(uint32_t *seed)
 	return res.f - 1.0f;
 }
 
+uint64_t crand64(uint64_t key, uint64_t counter)
+{
+	//SplitMix64, with the counter standing in for the generator's state.
+	uint64_t z = key + (counter + 1) * 0x9e3779b97f4a7c15ull;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+	return z ^ (z >> 31);
+}
+
 float fclamp(float value, float min, float max)
 {
 	return fmin(fmax(value, min), max);
@@ -18,6 +18,9 @@ float rand_float();
 float sfrand(uint32_t *seed);
 //Returns a random float between 0 and 1
 float frand(uint32_t *seed);
+//Counter-based random numbers: the result only depends on key and counter, there's no hidden state,
+//so a stream can be generated out of order or split across threads and still come out the same.
+uint64_t crand64(uint64_t key, uint64_t counter);
 //Returns value, clamped between min and max
 float fclamp(float value, float min, float max);
 
@@ -52,8 +52,17 @@ void meter_ogl_renderer_buffers_setup(meter_ctx *M)
 		total_label_chars += snprintf(NULL, 0, m->fmt, m->name, meter_value(m));
 	}
 	ogl->label_chars_num_indices = 5 * total_label_chars; //Save num indices for drawing later.
-	struct meter_vertex vbo[num_meter_verts + 4 * total_label_chars];
-	unsigned int ibo[ipm * M->num_meters + 5 * total_label_chars];
+	int num_vertices = num_meter_verts + 4 * total_label_chars;
+	int num_indices = ipm * M->num_meters + 5 * total_label_chars;
+	GLintptr vbo_offset;
+	stream_buffer_begin_frame(&ogl->vertices);
+	stream_buffer_begin_frame(&ogl->indices);
+	struct meter_vertex *vbo = stream_buffer_alloc(&ogl->vertices, num_vertices * sizeof(struct meter_vertex), &vbo_offset);
+	unsigned int *ibo = stream_buffer_alloc(&ogl->indices, num_indices * sizeof(unsigned int), &ogl->indices_offset);
+	if (!vbo || !ibo) {
+		ogl->meters_num_indices = ogl->label_chars_num_indices = 0;
+		return;
+	}
 
 
 	/*
@@ -80,7 +89,7 @@ void meter_ogl_renderer_buffers_setup(meter_ctx *M)
 		ibo[ipm*i + 10] = PRIMITIVE_RESTART_INDEX;
 		ibo[ipm*i + 15] = PRIMITIVE_RESTART_INDEX;
 		//Create indices for glyphs.
-		while (qs < LENGTH(ibo)) {
+		while (qs < num_indices) {
 			memcpy(&ibo[qs], (unsigned int[]){qi, qi+2, qi+1, qi+3, PRIMITIVE_RESTART_INDEX}, 5 * sizeof(unsigned int));
 			qs += 5;
 			qi += 4;
@@ -141,10 +150,12 @@ void meter_ogl_renderer_buffers_setup(meter_ctx *M)
 		}
 	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, ogl->vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vbo), vbo, GL_DYNAMIC_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ogl->ibo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(ibo), ibo, GL_DYNAMIC_DRAW);
+	stream_buffer_flush(&ogl->vertices);
+	stream_buffer_flush(&ogl->indices);
+	glBindBuffer(GL_ARRAY_BUFFER, ogl->vertices.buffer);
+	glVertexAttribPointer(ogl->pos_attr, 2, GL_FLOAT, GL_FALSE, sizeof(struct meter_vertex), (void *)(vbo_offset + offsetof(struct meter_vertex, pos)));
+	glVertexAttribPointer(ogl->tx_attr, 2, GL_FLOAT, GL_FALSE, sizeof(struct meter_vertex), (void *)(vbo_offset + offsetof(struct meter_vertex, tx)));
+	glVertexAttribPointer(ogl->col_attr, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(struct meter_vertex), (void *)(vbo_offset + offsetof(struct meter_vertex, color)));
 }
 
 int meter_ogl_renderer_draw_all(meter_ctx *M)
@@ -164,12 +175,12 @@ int meter_ogl_renderer_draw_all(meter_ctx *M)
 
 	//Draw meters
 	glUniform1i(ogl->textured_unif, false);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ogl->ibo);	
-	glDrawElements(GL_TRIANGLE_STRIP, ogl->meters_num_indices, GL_UNSIGNED_INT, NULL);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ogl->indices.buffer);
+	glDrawElements(GL_TRIANGLE_STRIP, ogl->meters_num_indices, GL_UNSIGNED_INT, (GLvoid *)ogl->indices_offset);
 
 	//Draw labels
 	glUniform1i(ogl->textured_unif, true);
-	glDrawElements(GL_TRIANGLE_STRIP, ogl->label_chars_num_indices, GL_UNSIGNED_INT, (GLvoid *)(sizeof(unsigned int) * ogl->meters_num_indices));
+	glDrawElements(GL_TRIANGLE_STRIP, ogl->label_chars_num_indices, GL_UNSIGNED_INT, (GLvoid *)(ogl->indices_offset + sizeof(unsigned int) * ogl->meters_num_indices));
 
 	glBindVertexArray(0);
 	return 0;
@@ -179,7 +190,8 @@ int meter_ogl_renderer_deinit(meter_ctx *M)
 {
 	struct meter_ogl_renderer_ctx *ogl = M->renderer.renderer_ctx;
 	glDeleteVertexArrays(1, &ogl->vao);
-	glDeleteBuffers(1, &ogl->vbo);
+	stream_buffer_deinit(&ogl->vertices);
+	stream_buffer_deinit(&ogl->indices);
 	glDeleteProgram(ogl->shader);
 	glDeleteTextures(1, &ogl->font_tex);
 	return 0;
@@ -190,8 +202,9 @@ int meter_ogl_renderer_init(meter_ctx *M)
 	struct meter_ogl_renderer_ctx *ogl = M->renderer.renderer_ctx;
 	glGenVertexArrays(1, &ogl->vao);
 	glBindVertexArray(ogl->vao);
-	glGenBuffers(1, &ogl->vbo);
-	glGenBuffers(1, &ogl->ibo);
+	//Vertices and indices for a few dozen meters, it grows if there are more.
+	stream_buffer_init(&ogl->vertices, "meter vertices", 1 << 16);
+	stream_buffer_init(&ogl->indices, "meter indices", 1 << 14);
 
 	/* Shader initialization */
 	lua_getglobal(L, "data_path");
@@ -233,13 +246,10 @@ int meter_ogl_renderer_init(meter_ctx *M)
 	ogl->col_attr = glGetAttribLocation(ogl->shader, "col");
 	ogl->tx_attr  = glGetAttribLocation(ogl->shader, "tx");
 
-	glBindBuffer(GL_ARRAY_BUFFER, ogl->vbo);
+	//Pointers are set with the vertices every frame, since they move around the stream buffer.
 	glEnableVertexAttribArray(ogl->pos_attr);
-	glVertexAttribPointer(ogl->pos_attr, 2, GL_FLOAT, GL_FALSE, sizeof(struct meter_vertex), 0);
 	glEnableVertexAttribArray(ogl->tx_attr);
-	glVertexAttribPointer(ogl->tx_attr, 2, GL_FLOAT, GL_FALSE, sizeof(struct meter_vertex), (void *)offsetof(struct meter_vertex, tx));
 	glEnableVertexAttribArray(ogl->col_attr);
-	glVertexAttribPointer(ogl->col_attr, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(struct meter_vertex), (void *)offsetof(struct meter_vertex, color));
 
 	//TODO(Gavin) Load these from a font configuration file.
 	ogl->font_tex = load_gl_texture(path);
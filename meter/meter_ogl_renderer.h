@@ -3,9 +3,12 @@
 
 #include "meter.h"
 #include "graphics.h"
+#include "stream_buffer.h"
 
 struct meter_ogl_renderer_ctx {
-	GLuint shader, vao, vbo, ibo, screen_res, font_tex, font_tex_unif, textured_unif;
+	GLuint shader, vao, screen_res, font_tex, font_tex_unif, textured_unif;
+	struct stream_buffer vertices, indices;
+	GLintptr indices_offset;
 	GLint pos_attr, col_attr, tx_attr;
 	int meters_num_indices, label_chars_num_indices;
 	struct {
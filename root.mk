@@ -2,6 +2,7 @@ OBJECTS += \
 	init.o \
 	input_event.o \
 	buffer_group.o \
+	stream_buffer.o \
 	lights.o \
 	shader_utils.o \
 	drawf.o \
@@ -0,0 +1,137 @@
+-- terrain --
+
+const int octaves = 5;
+const float terrain_scale = 7000000;
+
+//Value in w, grad in xyz
+vec4 fbm(in vec3 seed)
+{
+	vec4 ret_val = vec4(0);
+	float w = 0.5;
+	for (int i = 0; i < octaves; i++) {
+		float s = pow(4, i);
+		float w = pow(w, i);
+		ret_val += w * snoise_grad(s*seed);
+	}
+
+	return ret_val;
+}
+
+//Height above planet_radius in w, normal in xyz, of the terrain in the direction x (unit length).
+vec4 terrain(vec3 x, float planet_radius)
+{
+	vec4 val = fbm(x);
+	float R = planet_radius;
+	float s = terrain_scale;
+	vec3 g = val.xyz / (R + s * val.w); //gradient
+	vec3 h = g - dot(g, x)*x;
+	return vec4(normalize(x - s * h), s * val.w);
+}
+
+//Where vertex (j, r) of a tile is, j along row r, like the lerps from get_tri_lerp_vals.
+vec3 tile_position(vec3 corners[3], int rows, ivec2 vertex)
+{
+	float y = float(vertex.y) / rows;
+	float x = vertex.y > 0 ? float(vertex.x) / vertex.y : 0;
+	return mix(mix(corners[0], corners[1], y), mix(corners[0], corners[2], y), x);
+}
+
+-- atlas.vertex.GL33 --
+
+//A quad over the whole viewport, which is set to the tile's cell.
+void main()
+{
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+	gl_Position = vec4(corner * 2 - 1, 0, 1);
+}
+
+-- atlas.fragment.GL33 --
+
+uniform vec3 tile_pos[3]; //Big vertices, relative to the planet's center.
+uniform ivec2 cell_origin;
+uniform int rows; //Even, so the parent's vertices are the ones with even j and r.
+uniform float planet_radius;
+
+layout(location = 0) out vec2 height; //Height, and what it would be on the parent tile.
+layout(location = 1) out vec4 normal;
+
+float height_at(ivec2 vertex)
+{
+	return terrain(normalize(tile_position(tile_pos, rows, vertex)), planet_radius).w;
+}
+
+//Texel (j, r) holds vertex j of row r, so half the cell, above the diagonal, is left empty.
+void main()
+{
+	ivec2 vertex = ivec2(gl_FragCoord.xy) - cell_origin;
+	if (vertex.x > vertex.y) {
+		height = vec2(0);
+		normal = vec4(0.5, 0.5, 0.5, 0);
+		return;
+	}
+
+	vec4 t = terrain(normalize(tile_position(tile_pos, rows, vertex)), planet_radius);
+	height.x = t.w;
+	normal = vec4(t.xyz * 0.5 + 0.5, 1);
+
+	//Vertices the parent doesn't have are halfway along one of its edges, where it's flat. As tile_atlas_parent_vertices.
+	ivec2 odd = vertex & 1;
+	if (odd == ivec2(0))
+		height.y = t.w;
+	else
+		height.y = (height_at(vertex - odd) + height_at(vertex + odd)) / 2;
+}
+
+-- vertex.GL33 --
+
+uniform mat4 model_matrix;
+uniform mat4 model_view_projection_matrix;
+uniform int rows;
+uniform float log_depth_intermediate_factor;
+uniform float planet_radius;
+uniform vec3 planet_origin;
+uniform sampler2D height_atlas;
+uniform sampler2D normal_atlas;
+
+layout(location = 1) in vec3 vpos[3];
+layout(location = 4) in vec2 vtx[3];
+layout(location = 7) in vec2 vlerp;
+layout(location = 8) in vec3 vatlas; //The tile's cell's origin in the atlas, and its morph. x < 0 if it has no cell.
+
+out vec3 fposition;
+out vec2 ftx;
+out vec3 fnormal;
+out vec3 surface_position;
+
+void main()
+{
+	//camera-world-space
+	vec3 lpos = mix(vpos[0], vpos[1], vlerp.y);
+	vec3 rpos = mix(vpos[0], vpos[2], vlerp.y);
+	vec3 pos  = mix(lpos, rpos, vlerp.x);
+	vec3 x = normalize((pos-planet_origin)/planet_radius);
+
+	float height;
+	if (vatlas.x >= 0) {
+		//As tile_atlas_vertex_texel.
+		int r = int(round(vlerp.y * rows));
+		ivec2 texel = ivec2(vatlas.xy) + ivec2(round(vlerp.x * r), r);
+		vec2 h = texelFetch(height_atlas, texel, 0).xy;
+		height = mix(h.y, h.x, vatlas.z);
+		fnormal = texelFetch(normal_atlas, texel, 0).xyz * 2 - 1;
+	} else {
+		vec4 t = terrain(x, planet_radius);
+		height = t.w;
+		fnormal = t.xyz;
+	}
+	vec3 p = (planet_radius + height) * x + planet_origin;
+
+	vec2 ltx = mix(vtx[0], vtx[1], vlerp.y);
+	vec2 rtx = mix(vtx[0], vtx[2], vlerp.y);
+	ftx = mix(ltx, rtx, vlerp.x);
+
+	gl_Position = model_view_projection_matrix * vec4(p,1);
+	gl_Position.z = (log2(max(1e-6, 1.0 + gl_Position.z)) * log_depth_intermediate_factor - 1.0) * gl_Position.w;
+	fposition = vec3(model_matrix * vec4(p,1));
+	surface_position = p - planet_origin;
+}
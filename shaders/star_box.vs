@@ -1,7 +1,8 @@
 #version 330 
 
-in vec3 star_pos;
-uniform vec3 eye_box_offset;
+in ivec4 star_pos; //Offset within its bucket in xyz, quantized to 1/65536ths of the bucket. The bucket and brightness are in w.
+uniform vec3 eye_box_offset[27];
+uniform int box_vertex_stride; //Every box is drawn at once, each box_vertex_stride vertices after the last.
 uniform float bpos_size;
 uniform float star_box_size;
 uniform float log_depth_intermediate_factor;
@@ -10,9 +11,16 @@ uniform mat4 model_view_projection_matrix;
 out vec3 fpos;
 out vec3 fcol;
 
+const float buckets_per_axis = 16;
+
 void main()
 {
-	vec3 vpos = star_pos*bpos_size + eye_box_offset;
+	ivec3 bucket = ivec3(star_pos.w & 15, (star_pos.w >> 4) & 15, (star_pos.w >> 8) & 15);
+	//An aggregate stands in for 2^brightness stars, see space/star_lod.h.
+	float brightness = float(1 << ((star_pos.w >> 12) & 15));
+	float bucket_size = star_box_size / buckets_per_axis;
+	vec3 star = (vec3(bucket) + 0.5) * bucket_size - star_box_size / 2 + (vec3(star_pos.xyz) + 0.5) * (bucket_size / 65536);
+	vec3 vpos = star*bpos_size + eye_box_offset[gl_VertexID / box_vertex_stride];
 	float alpha = 1 - pow(length(vpos)/star_box_size/bpos_size, 8);
 	
 	gl_Position = model_view_projection_matrix * vec4(vpos, 1);
@@ -23,10 +31,10 @@ void main()
 	vec3 blue = vec3(0, 0.1, 0.98);
 	vec3 white = vec3(1.0);
 	fcol = (
-		0.5*(1 + sin(star_pos.x)) * teal + 
-		0.5*(1 + sin(star_pos.y)) * blue +
-		0.5*(1 + sin(star_pos.z)) * white) / 2.1;
-	fcol *= alpha;
+		0.5*(1 + sin(star.x)) * teal + 
+		0.5*(1 + sin(star.y)) * blue +
+		0.5*(1 + sin(star.z)) * white) / 2.1;
+	fcol *= alpha * brightness;
 
 	fpos = vpos;
 }
\ No newline at end of file
@@ -0,0 +1,166 @@
+#include "galaxy_density.h"
+#include <math.h>
+#include <string.h>
+#include <inttypes.h>
+
+static float galaxy_smoothstep(float edge0, float edge1, float x)
+{
+	float t = (x - edge0) / (edge1 - edge0);
+	t = t < 0 ? 0 : t > 1 ? 1 : t;
+	return t * t * (3 - 2 * t);
+}
+
+float galaxy_density_at(const struct galaxy_density *g, const float p[3])
+{
+	float l = sqrtf(p[0] * p[0] + p[2] * p[2]);
+	float len = sqrtf(l * l + p[1] * p[1]);
+	float bulge_density = powf(fmaxf(2 - len / g->bulge_mask_radius, 0), g->bulge_mask_power);
+	float r = atan2f(p[0], p[2]) + g->rotation / 3000 * l;
+	float s = powf(sinf(2 * r) * 0.5f + 0.5f, g->arm_width);
+	float d2 = l * l / g->bulge_width_squared;
+	return g->spiral_density *
+		fmaxf(s, bulge_density) * //Spiral and bulge
+		(1 - galaxy_smoothstep(0, g->disk_height / (1 + d2), fabsf(p[1]))) * //Galaxy profile
+		(1 - galaxy_smoothstep(0, g->diameter, 2 * l)); //Fade spiral out into disk shape
+}
+
+/*
+4 lanes at a time, which is what SSE2 and NEON do without any -march flags.
+Casting between vector types of the same size reinterprets the bits, __builtin_convertvector converts the values.
+*/
+typedef float galaxy_f4 __attribute__((vector_size(16)));
+typedef int32_t galaxy_i4 __attribute__((vector_size(16)));
+typedef uint32_t galaxy_u4 __attribute__((vector_size(16)));
+#define GALAXY_LANES 4
+
+//mask lanes are all ones or all zeros, as comparisons make them.
+static inline galaxy_f4 galaxy_select(galaxy_i4 mask, galaxy_f4 a, galaxy_f4 b)
+{
+	return (galaxy_f4)(((galaxy_u4)mask & (galaxy_u4)a) | (~(galaxy_u4)mask & (galaxy_u4)b));
+}
+
+static inline galaxy_f4 galaxy_max(galaxy_f4 a, galaxy_f4 b)
+{
+	return galaxy_select(a > b, a, b);
+}
+
+static inline galaxy_f4 galaxy_clamp01(galaxy_f4 a)
+{
+	galaxy_f4 zero = {0}, one = zero + 1;
+	return galaxy_select(a < zero, zero, galaxy_select(a > one, one, a));
+}
+
+static inline galaxy_f4 galaxy_abs(galaxy_f4 a)
+{
+	return (galaxy_f4)((galaxy_u4)a & 0x7fffffff);
+}
+
+static inline galaxy_f4 galaxy_floor(galaxy_f4 a)
+{
+	galaxy_i4 i = __builtin_convertvector(a, galaxy_i4); //Truncates towards zero
+	galaxy_f4 f = __builtin_convertvector(i, galaxy_f4);
+	return f - galaxy_select(f > a, f * 0 + 1, f * 0);
+}
+
+static inline galaxy_f4 galaxy_sqrt(galaxy_f4 x)
+{
+	//The old inverse square root trick, with two Newton steps. Zero comes out as zero.
+	galaxy_f4 y = (galaxy_f4)(0x5f3759df - ((galaxy_u4)x >> 1));
+	y = y * (1.5f - 0.5f * x * y * y);
+	y = y * (1.5f - 0.5f * x * y * y);
+	return x * y;
+}
+
+//x has to be positive.
+static inline galaxy_f4 galaxy_log2(galaxy_f4 x)
+{
+	galaxy_u4 bits = (galaxy_u4)x;
+	galaxy_f4 e = __builtin_convertvector((galaxy_i4)(bits >> 23) - 127, galaxy_f4);
+	galaxy_f4 m = (galaxy_f4)((bits & 0x7fffff) | 0x3f800000); //[1, 2)
+	//log(m) = 2 atanh((m - 1) / (m + 1)), and that's in [0, 1/3] so the series converges quickly.
+	galaxy_f4 t = (m - 1) / (m + 1), t2 = t * t;
+	galaxy_f4 series = t * (1 + t2 * (1.0f/3 + t2 * (1.0f/5 + t2 * (1.0f/7 + t2 * (1.0f/9)))));
+	return e + series * (float)(2 / M_LN2);
+}
+
+static inline galaxy_f4 galaxy_exp2(galaxy_f4 x)
+{
+	galaxy_f4 lo = {0}, hi = lo + 126;
+	lo -= 126;
+	x = galaxy_select(x < lo, lo, galaxy_select(x > hi, hi, x));
+	galaxy_f4 whole = galaxy_floor(x), f = (x - whole) * (float)M_LN2;
+	//e^f for f in [0, ln 2)
+	galaxy_f4 frac = 1 + f * (1 + f * (1.0f/2 + f * (1.0f/6 + f * (1.0f/24 + f * (1.0f/120 + f * (1.0f/720 + f * (1.0f/5040)))))));
+	galaxy_u4 scale = (galaxy_u4)(__builtin_convertvector(whole, galaxy_i4) + 127) << 23;
+	return frac * (galaxy_f4)scale;
+}
+
+//x^w for x >= 0, close enough to 0 for x = 0.
+static inline galaxy_f4 galaxy_pow(galaxy_f4 x, float w)
+{
+	galaxy_f4 tiny = {0};
+	tiny += 1e-30f;
+	return galaxy_exp2(w * galaxy_log2(galaxy_max(x, tiny)));
+}
+
+static inline void galaxy_sincos(galaxy_f4 a, galaxy_f4 *s, galaxy_f4 *c)
+{
+	//Reduce to [-pi/4, pi/4] and a quadrant, subtracting pi/2 in two parts to keep the low bits.
+	galaxy_f4 q = galaxy_floor(a * (float)(2 / M_PI) + 0.5f);
+	galaxy_f4 t = a - q * 1.5703125f - q * 4.8382679e-4f, t2 = t * t;
+	galaxy_f4 st = t * (1 - t2 * (1.0f/6 - t2 * (1.0f/120 - t2 * (1.0f/5040))));
+	galaxy_f4 ct = 1 - t2 * (1.0f/2 - t2 * (1.0f/24 - t2 * (1.0f/720 - t2 * (1.0f/40320))));
+	galaxy_u4 quadrant = (galaxy_u4)__builtin_convertvector(q, galaxy_i4);
+	galaxy_i4 swap = (galaxy_i4)((quadrant & 1) != 0);
+	*s = (galaxy_f4)((galaxy_u4)galaxy_select(swap, ct, st) ^ ((quadrant & 2) << 30));
+	*c = (galaxy_f4)((galaxy_u4)galaxy_select(swap, st, ct) ^ (((quadrant + 1) & 2) << 30));
+}
+
+static inline galaxy_f4 galaxy_smoothstep4(galaxy_f4 edge1, galaxy_f4 x)
+{
+	galaxy_f4 t = galaxy_clamp01(x / edge1);
+	return t * t * (3 - 2 * t);
+}
+
+static galaxy_f4 galaxy_density4(const struct galaxy_density *g, galaxy_f4 x, galaxy_f4 y, galaxy_f4 z)
+{
+	galaxy_f4 zero = {0};
+	galaxy_f4 l2 = x * x + z * z, l = galaxy_sqrt(l2), len = galaxy_sqrt(l2 + y * y);
+	galaxy_f4 bulge_density = galaxy_pow(galaxy_max(2 - len / g->bulge_mask_radius, zero), g->bulge_mask_power);
+
+	//sin(2 atan2(x, z) + phi) without the atan2: sin(2 theta) and cos(2 theta) come straight from x and z.
+	//At the center they're both 0, where atan2(0, 0) would give sin(phi) = 0 too.
+	galaxy_f4 inv_l2 = 1 / galaxy_select(l2 > zero, l2, zero + 1);
+	galaxy_f4 sin_2theta = 2 * x * z * inv_l2, cos_2theta = (z * z - x * x) * inv_l2, sin_phi, cos_phi;
+	galaxy_sincos(2 * (g->rotation / 3000) * l, &sin_phi, &cos_phi);
+	galaxy_f4 s = galaxy_pow((sin_2theta * cos_phi + cos_2theta * sin_phi) * 0.5f + 0.5f, g->arm_width);
+
+	galaxy_f4 d2 = l2 / g->bulge_width_squared;
+	return g->spiral_density *
+		galaxy_max(s, bulge_density) *
+		(1 - galaxy_smoothstep4(g->disk_height / (1 + d2), galaxy_abs(y))) *
+		(1 - galaxy_smoothstep4(zero + g->diameter, 2 * l));
+}
+
+void galaxy_density_batch(const struct galaxy_density *g, size_t num, const float *x, const float *y, const float *z, float *density)
+{
+	galaxy_f4 vx, vy, vz, d;
+	size_t i = 0;
+	for (; i + GALAXY_LANES <= num; i += GALAXY_LANES) {
+		memcpy(&vx, &x[i], sizeof(vx));
+		memcpy(&vy, &y[i], sizeof(vy));
+		memcpy(&vz, &z[i], sizeof(vz));
+		d = galaxy_density4(g, vx, vy, vz);
+		memcpy(&density[i], &d, sizeof(d));
+	}
+	if (i < num) {
+		//The last few, padded out with zeros.
+		size_t rest = num - i;
+		vx = vy = vz = (galaxy_f4){0};
+		memcpy(&vx, &x[i], rest * sizeof(float));
+		memcpy(&vy, &y[i], rest * sizeof(float));
+		memcpy(&vz, &z[i], rest * sizeof(float));
+		d = galaxy_density4(g, vx, vy, vz);
+		memcpy(&density[i], &d, rest * sizeof(float));
+	}
+}
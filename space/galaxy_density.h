@@ -0,0 +1,34 @@
+#ifndef GALAXY_DENSITY_H
+#define GALAXY_DENSITY_H
+#include <stddef.h>
+
+/*
+The galaxy's density, ported from galaxy_density in shaders/glsw/spiral.glsl so the CPU can place stars where
+the raymarched galaxy is bright: spiral arms, the bulge, the disk profile and its fade out to the rim.
+
+The shader's noise domain transformation is left out. It's there to give the render visual interest, and star
+placement only needs the large-scale shape.
+
+galaxy_density_batch evaluates whole batches of points 4 at a time with GCC vector extensions, using polynomial
+approximations instead of libm (and no atan2 at all). It agrees with galaxy_density_at to within 1e-4 of the
+peak density, and doesn't need any -march flags.
+*/
+
+//The galaxy_tweaks that matter for the density, as the spiral shader reads them.
+struct galaxy_density {
+	float arm_width; //tweaks1.x, the power the spiral is raised to, so higher is narrower.
+	float rotation; //How far the arms wind.
+	float diameter;
+	float spiral_density; //tweaks1.w, scales the whole thing. The peak density, outside the bulge.
+	float disk_height; //tweaks2.w
+	float bulge_mask_radius; //bulge.y
+	float bulge_mask_power; //bulge.z
+	float bulge_width_squared; //bulge.w
+};
+
+//Density at p, in galaxy units (the galaxy is diameter across, centered on the origin, with its disk in xz).
+float galaxy_density_at(const struct galaxy_density *g, const float p[3]);
+//Density at num points, given as separate x, y and z arrays.
+void galaxy_density_batch(const struct galaxy_density *g, size_t num, const float *x, const float *y, const float *z, float *density);
+
+#endif
@@ -92,6 +92,21 @@ struct galaxy_tweaks galaxy_load_tweaks(lua_State *L, const char *tweaks_table_n
 	return gt;
 }
 
+struct galaxy_density galaxy_density_from_tweaks(const struct galaxy_tweaks *gt)
+{
+	return (struct galaxy_density){
+		.arm_width = gt->arm_width,
+		.rotation = gt->rotation,
+		.diameter = gt->diameter,
+		.spiral_density = gt->spiral_density,
+		.disk_height = gt->disk_height,
+		.bulge_mask_radius = gt->bulge_mask_radius,
+		.bulge_mask_power = gt->bulge_mask_power,
+		//galaxy_load_tweaks never fills in bulge_width_squared, so square it here.
+		.bulge_width_squared = gt->bulge_width * gt->bulge_width,
+	};
+}
+
 void galaxy_meters_init(lua_State *L, meter_ctx *M, struct galaxy_tweaks *gt, float screen_width, float screen_height, meter_callback_fn clear_callback)
 {
 	/* Set up meter module */
@@ -6,6 +6,7 @@
 #include "buffer_group.h"
 #include "experiments/deferred_framebuffer.h"
 #include "luaengine/lua_configuration.h"
+#include "space/galaxy_density.h"
 
 struct blend_params {
 	GLenum blendfn, srcfact, dstfact;
@@ -67,6 +68,8 @@ struct galaxy_ogl {
 int buffer_galaxy_cube(struct buffer_group bg);
 
 struct galaxy_tweaks galaxy_load_tweaks(lua_State *L, const char *tweaks_table_name);
+//The parts of the tweaks that galaxy_density_at needs, for generating stars to match the rendered galaxy.
+struct galaxy_density galaxy_density_from_tweaks(const struct galaxy_tweaks *gt);
 int galaxy_shader_init(struct galaxy_ogl *gal);
 void galaxy_meters_init(lua_State *L, meter_ctx *M, struct galaxy_tweaks *gt, float screen_width, float screen_height, meter_callback_fn clear_callback);
 void galaxy_bind_cubemap();
@@ -15,16 +15,42 @@
 #include "open-simplex-noise-in-c/open-simplex-noise.h"
 #include "procedural_planet.h"
 #include "shader_utils.h"
+#include "stream_buffer.h"
+#include "terrain_noise.h"
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+//Matrices for drawing a tile on its own, when tiles aren't drawn on the GPU.
+struct proc_planet_tile_matrices {
+	GLfloat mm[16], mvpm[16], mvnm[16];
+};
+
+//The tiles proc_planet_frame_prepare chose, and everything the passes need to draw them.
+struct proc_planet_frame {
+	vec3 eye_pos;
+	float proj_view_mat[16];
+	vec3 planet_pos; //Relative to eye_sector.
+	float planet_radius;
+	bool gpu_tiles;
+	int num_tiles, max_tiles;
+	tri_tile **tiles;
+	struct proc_planet_tile_matrices *matrices; //Only filled in if !gpu_tiles.
+	//Where the tiles' instance attributes are, if gpu_tiles.
+	GLuint instance_buffer;
+	GLintptr instance_offset;
+};
+
 struct {
 	GLuint vao;
 	bool is_init;
-} proc_planets = {0, 0};
+	thread_pool *pool;
+	struct terrain_noise noise;
+	struct proc_planet_frame frame;
+	struct stream_buffer instances;
+} proc_planets = {0, 0, NULL};
 
 extern bpos_origin eye_sector;
 extern bpos_origin tri_sector;
@@ -33,44 +59,16 @@ extern float log_depth_intermediate_factor;
 extern vec3 sun_position;
 extern vec3 sun_color;
  
-//Adapted from http://www.glprogramming.com/red/chapter02.html
+//The icosahedron's vertex coordinates, as in terrain_lod.c.
 static const float x = 0.525731112119133606;
 static const float z = 0.850650808352039932;
-static const vec3 ico_v[] = {    
-	{-x,  0, z}, { x,  0,  z}, {-x, 0, -z}, { x, 0, -z}, {0,  z, x}, { 0,  z, -x},
-	{ 0, -z, x}, { 0, -z, -x}, { z, x,  0}, {-z, x,  0}, {z, -x, 0}, {-z, -x,  0}
-};
-
-static const int ico_i[] = {
-	1,0,4,   9,4,0,   9,5,4,   8,4,5,   4,8,1,  10,1,8,  10,8,3,  5,3,8,   3,5,2,  9,2,5,  
-	3,7,10,  6,10,7,  7,11,6,  0,6,11,  0,1,6,  10,6,1,  0,11,9,  2,9,11,  3,2,7,  11,7,2,
-};
-
-//Texture coordinates for each vertex of a face. Pairs of faces share a texture.
-static const float ico_tx[] = {
-	0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,  0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0, 
-	0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,  0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0, 
-	0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,  0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0, 
-	0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,  0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0, 
-	0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,  0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,
-};
-
-//In my debug view, these colors are applied to tiles based on the number of times they've been split.
-vec3 proc_planet_primary_color_by_depth[] = {
-	{1.0, 0.0, 0.0}, //Red
-	{0.5, 0.5, 0.0}, //Yellow
-	{0.0, 1.0, 0.0}, //Green
-	{0.0, 0.5, 0.5}, //Cyan
-	{0.0, 0.0, 1.0}, //Blue
-	{0.5, 0.0, 0.5}, //Purple
-};
-
-const vec3 proc_planet_up = (vec3){z/3, (z+z+x)/3, 0}; //Centroid of ico_i[3]
+const vec3 proc_planet_up = (vec3){z/3, (z+z+x)/3, 0}; //Centroid of the icosahedron's face 3
 //Originally made to get rid of the black dot at the poles. Weirdly, they disappeared when I tilted the axis.
 //Keep around and use on the tiles (and descendent tiles) of the poles to get rid of the black dots, should they reappear.
 //const vec3 proc_planet_not_up = (vec3){-(z+z+x)/3, z/3, 0};
 extern float screen_width;
 extern struct osn_context *osnctx;
+extern int open_simplex_noise_seed;
 
 /* Rows */
 
@@ -84,7 +82,7 @@ extern lua_State *L;
 /* OpenGL Variables */
 
 static GLuint ROWS;
-static GLuint SHADER, VAO, MM, MVPM, TEXSCALE, PRADIUS, LCOL, LPOS, EYEPOS, PORIGIN, VBO, INBO;
+static GLuint SHADER, VAO, MM, MVPM, TEXSCALE, PRADIUS, LCOL, LPOS, EYEPOS, PORIGIN, VBO;
 static GLint SAMPLER0, VLERPS_ATTR;
 static GLint POS_ATTR[3] = {1,2,3}, TX_ATTR[3] = {4,5,6};
 static GLuint proc_planet_tx = 0;
@@ -104,81 +102,126 @@ static tri_tile * tree_tile(quadtree_node *tree)
 	return (tri_tile *)tree->data;
 }
 
-static int splits_per_distance(float distance, float scale)
+static void proc_planet_finishing_touches(tri_tile *t, void *finishing_touches_context);
+
+//Highest the terrain can get above the tile it's on: every octave of noise at its highest.
+static float proc_planet_max_height(proc_planet *p)
 {
-	return fmax(fmin(log2(scale/distance), PROC_PLANET_TILE_MAX_SUBDIVISIONS), 0);
+	float sum_scales = 2 * (pow(4, p->num_elements) - 1) / 3;
+	return p->amplitude * sum_scales * p->radius / p->noise_radius;
 }
 
-static void tri_tile_split(tri_tile *t, tri_tile *out[DEFAULT_NUM_TRI_TILE_DIVS]);
+/* Tile memory */
 
-static bool above_horizon(tri_tile *tile, int depth, struct planet_terrain_context ctx)
+//A tile's mesh, and its copy on the GPU. Counted from when the tile's split starts generating.
+static size_t proc_planet_tile_bytes()
 {
-	ctx.cam_pos.offset = bpos_remap(ctx.cam_pos, (bpos_origin){0});
-	vec3 tile_pos = bpos_remap((bpos){tile->centroid, tile->offset}, (bpos_origin){0});
-	float altitude = fmax(vec3_mag(ctx.cam_pos.offset) - ctx.planet->radius, 0);
-	return nes30_buttons[INPUT_BUTTON_START] || 
-		distance_to_horizon(ctx.planet->radius, altitude) > (vec3_dist(ctx.cam_pos.offset, tile_pos) - tile->radius);
+	return sizeof(tri_tile) + 2 * sizeof(struct tri_tile_vertex) * num_tri_tile_vertices(PROC_PLANET_NUM_TILE_ROWS);
 }
 
-struct tile_cull_data {
-	vec3 tile_pos;
-	float tile_dist, altitude;
-};
+//Gives a tile's header and mesh back to its planet's arena, as a quadtree_free_fn.
+static void proc_planet_tile_free(void *data)
+{
+	tri_tile *t = data;
+	proc_planet *p = (proc_planet *)t->finishing_touches_context;
+	tile_arena_mesh_free(&p->arena, t->mesh);
+	t->mesh = NULL;
+	tri_tile_deinit(t);
+	tile_arena_header_free(&p->arena, t);
+}
+
+/* Tile generation */
+
+/*
+Splits generate their children's meshes on the thread pool, noise and all, leaving only the GL setup and upload
+for the main thread. Until they're uploaded the node has no children, so it keeps being drawn as it is.
+*/
 
-//TODO: See if I can factor out depth somehow.
-static int proc_planet_subdiv_depth(proc_planet *planet, tri_tile *tile, int depth, bpos cam_pos)
+static bool proc_planet_async()
 {
-	//Convert camera and tile position to planet-coordinates.
-	//These calculations might hit the limits of floating-point precision if the planet is really large.
-	cam_pos.offset = bpos_remap(cam_pos, (bpos_origin){0});
-	vec3 tile_pos = bpos_remap((bpos){tile->centroid, tile->offset}, (bpos_origin){0});
-	vec3 surface_pos = cam_pos.offset * planet->radius/vec3_mag(cam_pos.offset);
-
-	float altitude = vec3_mag(cam_pos.offset) - planet->radius;
-	float tile_dist = vec3_dist(surface_pos, tile_pos) - tile->radius;
-	float subdiv_dist = fmax(altitude, tile_dist);
-	float scale_factor = (screen_width * planet->edge_len) / (2 * PROC_PLANET_TILE_PIXELS_PER_TRI * PROC_PLANET_NUM_TILE_ROWS);
-
-	//Maybe I can handle this when preparing the drawlist, instead?
-	//TODO(Gavin): Some of this effort is duplicated in "above_horizon". See if I can refactor.
-	float horizon_dist = distance_to_horizon(planet->radius, fmax(altitude, 0));
-	float direct_dist = vec3_dist(cam_pos.offset, tile_pos) - tile->radius;
-	if (horizon_dist < direct_dist && !nes30_buttons[INPUT_BUTTON_START])
-		return 0; //Tiles beyond the horizon should not be split.
-
-	return splits_per_distance(subdiv_dist, scale_factor);
+	return proc_planets.pool && thread_pool_num_threads(proc_planets.pool) > 0;
 }
 
-static bool proc_planet_split_visit(quadtree_node *node, void *context)
+static thread_pool_job_fn(proc_planet_tile_gen_job)
 {
-	struct planet_terrain_context *ctx = (struct planet_terrain_context *)context;
-	tri_tile *tile = tree_tile(node);
-	ctx->visited++;
+	tri_tile **tiles = ctx;
+	for (size_t i = begin; i < end; i++)
+		tri_tile_mesh_gen(tiles[i], tiles[i]->offset, PROC_PLANET_NUM_TILE_ROWS, proc_planet_finishing_touches, tiles[i]->finishing_touches_context);
+}
 
-	//Cap the number of subdivisions per whole-tree traversal (per frame essentially)
-	if (node->depth == 0)
-		ctx->splits_left = ctx->splits_max;
+//Generate the tiles' meshes, one job each, counting them in done. Without a pool they're done on return.
+static void proc_planet_tile_gen(void *context, tri_tile **tiles, size_t num, atomic_size_t *done)
+{
+	if (proc_planets.pool)
+		thread_pool_parallel_for(proc_planets.pool, proc_planet_tile_gen_job, tiles, num, 1, done);
+	else
+		proc_planet_tile_gen_job(tiles, 0, num);
+}
 
-	int depth = proc_planet_subdiv_depth(ctx->planet, tile, node->depth, ctx->cam_pos);
+static void proc_planet_tile_gen_wait(void *context, atomic_size_t *done)
+{
+	if (proc_planets.pool)
+		thread_pool_wait(proc_planets.pool, done);
+}
 
-	if (depth > node->depth && !quadtree_node_has_children(node) && ctx->splits_left > 0) {
-		tri_tile *new_tiles[DEFAULT_NUM_TRI_TILE_DIVS];
-		tri_tile_split(tile, new_tiles);
-		quadtree_node_add_children(node, (void **)new_tiles);
-		ctx->splits_left--;
-	}
+static void proc_planet_tile_upload(void *context, tri_tile *t)
+{
+	tri_tile_gl_init(t);
+	tri_tile_buffer(t);
+}
 
-	if (nes30_buttons[INPUT_BUTTON_START])
-		tile->override_col = proc_planet_primary_color_by_depth[depth % LENGTH(proc_planet_primary_color_by_depth)];
-	else
-		tile->override_col = (vec3){1, 1, 1};
+/*
+Heights are a sum of octaves of noise, each warped by the heights so far. Rather than finite differences from
+two extra noise samples per octave, this carries the gradient of the height along with it, from the noise's own
+gradient by the chain rule, so each octave is one batched sample. The warp's own slope along the basis vectors
+is taken to first order, which is all the finite differences saw of it anyway.
+*/
+//Heights of num points on the noise sphere, at most PROC_PLANET_NOISE_CHUNK, with their gradients and the basis
+//vectors they're along. Each octave's share is left in octaves, if it's not NULL.
+static void proc_planet_octaves(int num_octaves, int num, const vec3 noise_surface[], float epsilon, vec3 basis_x[], vec3 basis_z[], float heights[], vec3 gradient[], float octaves[][PROC_PLANET_NOISE_CHUNK])
+{
+	float qx[PROC_PLANET_NOISE_CHUNK], qy[PROC_PLANET_NOISE_CHUNK], qz[PROC_PLANET_NOISE_CHUNK];
+	float n[PROC_PLANET_NOISE_CHUNK], nx[PROC_PLANET_NOISE_CHUNK], ny[PROC_PLANET_NOISE_CHUNK], nz[PROC_PLANET_NOISE_CHUNK];
 
-	return depth > node->depth;
+	for (int i = 0; i < num; i++) {
+		//Basis vectors
+		//TODO: Use a different "up" vector on the poles.
+		basis_x[i] = vec3_normalize(vec3_cross(proc_planet_up, noise_surface[i]));
+		basis_z[i] = vec3_normalize(vec3_cross(noise_surface[i], basis_x[i]));
+		heights[i] = 0;
+		gradient[i] = (vec3){0, 0, 0};
+	}
+
+	for (int j = 0; j < num_octaves; j++) {
+		float octave_scale = pow(2, j*2)*2;
+		float offset = 4529 * j;//random number
+		float scale = octave_scale * 0.00005;
+		for (int i = 0; i < num; i++) {
+			float turb_x = epsilon * vec3_dot(gradient[i], basis_x[i]), turb_z = epsilon * vec3_dot(gradient[i], basis_z[i]);
+			vec3 q = (vec3){heights[i], heights[i] + turb_x, heights[i] + turb_z} + noise_surface[i] * scale + offset;
+			qx[i] = q.x;
+			qy[i] = q.y;
+			qz[i] = q.z;
+		}
+		terrain_noise_batch(&proc_planets.noise, num, qx, qy, qz, n, nx, ny, nz);
+		for (int i = 0; i < num; i++) {
+			//Every component of the warp moves with the height, so the sample moves along gradient on each axis.
+			vec3 dn = (vec3){nx[i], ny[i], nz[i]};
+			vec3 dh = (gradient[i] * (nx[i] + ny[i] + nz[i]) + dn * scale) * 0.5f;
+			float h = (1 + n[i]) / 2;
+			if (octaves)
+				octaves[j][i] = h;
+			heights[i] += octave_scale * h;
+			gradient[i] += dh * octave_scale;
+		}
+	}
 }
 
-static float noise3(vec3 pos)
+//How far apart the noise's finite differences are, for a tile with corners edge_len apart.
+static float proc_planet_epsilon(float edge_len, float noise_radius, float planet_radius, int num_rows)
 {
-	return (1+open_simplex_noise3(osnctx, pos.x, pos.y, pos.z))/2;
+	//TODO: Check this value or make it empirical somehow.
+	return edge_len * (noise_radius / planet_radius / num_rows / 5);
 }
 
 static tri_tile * proc_planet_vertices_and_normals(struct element_properties *elements, int num_elements, tri_tile *t, height_map_func height, vec3 planet_pos, float noise_radius, float planet_radius, float amplitude)
@@ -187,61 +230,77 @@ static tri_tile * proc_planet_vertices_and_normals(struct element_properties *el
 	//vec3 whiteish = {0.96, .94, 0.96};
 	//vec3 orangeish = (vec3){255, 181, 112} / 255;
 
-	//TODO: Check this value or make it empirical somehow.
-	float epsilon = vec3_dist(t->big_vertices[0].position, t->big_vertices[2].position) * (noise_radius / planet_radius / t->num_rows / 5);
+	float epsilon = proc_planet_epsilon(vec3_dist(t->big_vertices[0].position, t->big_vertices[2].position), noise_radius, planet_radius, t->num_rows);
 
-	for (int i = 0; i < t->num_vertices; i++) {
-		//Points towards vertex from planet origin
-		vec3 pos = t->mesh[i].position - planet_pos;
-		float m = vec3_mag(pos);
-		//Point at the surface of our simulated smaller planet.
-		vec3 noise_surface = pos * (noise_radius/m);
+	float element_k[PROC_PLANET_MAX_NUM_ELEMENTS];
+	vec3 element_cmy[PROC_PLANET_MAX_NUM_ELEMENTS];
+	for (int j = 0; j < num_elements; j++)
+		rgb_to_cmyk(elements[j].color, &element_cmy[j], &element_k[j]);
 
-		//Basis vectors
-		//TODO: Use a different "up" vector on the poles.
-		vec3 x = vec3_normalize(vec3_cross(proc_planet_up, pos));
-		vec3 z = vec3_normalize(vec3_cross(pos, x));
-		vec3 y = vec3_normalize(pos);
-
-		//Create two points, scootched out along the basis vectors.
-		vec3 pos1 = x * epsilon + noise_surface;
-		vec3 pos2 = z * epsilon + noise_surface;
-		vec3 p0 = noise_surface * 0.00005, p1 = pos1 * 0.00005, p2 = pos2 * 0.00005;
-
-		vec3 cmy, sum_cmy = {0,0,0}; float k, sum_k = 0, sum_h = 0;
-		double ys[3] = {0};
-		//TODO(Gavin): Using noise gradient, can make this ~3 times faster (no finite differences).
-		for (int j = 0; j < num_elements; j++) {
-			float offset = 4529 * j;//random number
-			float scale = pow(2, j*2)*2;
-			vec3 turb = {ys[0], ys[1], ys[2]};
-			double h = noise3(turb + p0 * scale + offset);
-			rgb_to_cmyk(elements[j].color, &cmy, &k);
-			sum_h += h;
-			sum_cmy += cmy*h;
-			sum_k += k*h;
-			ys[0] += scale * h;
-			ys[1] += scale * noise3(turb + p1 * scale + offset);
-			ys[2] += scale * noise3(turb + p2 * scale + offset);
+	for (int first = 0; first < t->num_vertices; first += PROC_PLANET_NOISE_CHUNK) {
+		int num = t->num_vertices - first < PROC_PLANET_NOISE_CHUNK ? t->num_vertices - first : PROC_PLANET_NOISE_CHUNK;
+		vec3 noise_surface[PROC_PLANET_NOISE_CHUNK], basis_x[PROC_PLANET_NOISE_CHUNK], basis_z[PROC_PLANET_NOISE_CHUNK];
+		vec3 gradient[PROC_PLANET_NOISE_CHUNK];
+		float heights[PROC_PLANET_NOISE_CHUNK], octaves[PROC_PLANET_MAX_NUM_ELEMENTS][PROC_PLANET_NOISE_CHUNK];
+
+		for (int i = 0; i < num; i++) {
+			//Points towards vertex from planet origin
+			vec3 pos = t->mesh[first + i].position - planet_pos;
+			//Point at the surface of our simulated smaller planet.
+			noise_surface[i] = pos * (noise_radius/vec3_mag(pos));
+		}
+		proc_planet_octaves(num_elements, num, noise_surface, epsilon, basis_x, basis_z, heights, gradient, octaves);
+
+		for (int i = 0; i < num; i++) {
+			struct tri_tile_vertex *v = &t->mesh[first + i];
+			vec3 sum_cmy = {0, 0, 0};
+			float sum_k = 0, sum_h = 0;
+			for (int j = 0; j < num_elements; j++) {
+				float h = octaves[j][i];
+				sum_h += h;
+				sum_cmy += element_cmy[j] * h;
+				sum_k += element_k[j] * h;
+			}
+			cmyk_to_rgb(sum_cmy / sum_h, sum_k / sum_h, &v->color);
+			v->color /= 255;
+
+			//Two points scootched out along the basis vectors, raised by the height there.
+			vec3 y = vec3_normalize(noise_surface[i]);
+			vec3 surface = y * amplitude * heights[i] + noise_surface[i];
+			vec3 pos1 = y * amplitude * (heights[i] + epsilon * vec3_dot(gradient[i], basis_x[i])) + basis_x[i] * epsilon + noise_surface[i];
+			vec3 pos2 = y * amplitude * (heights[i] + epsilon * vec3_dot(gradient[i], basis_z[i])) + basis_z[i] * epsilon + noise_surface[i];
+
+			//Compute the normal.
+			v->normal = vec3_normalize(vec3_cross(pos1 - surface, pos2 - surface));
+			//Compute the new surface position.
+			//Scale back up to planet size.
+			v->position = surface * (vec3_mag(v->position - planet_pos)/noise_radius) + planet_pos;
 		}
-		cmy = sum_cmy / sum_h; k = sum_k / sum_h;
-		cmyk_to_rgb(cmy, k, &t->mesh[i].color);
-		t->mesh[i].color /= 255;
-
-		pos1          = y * amplitude * ys[1] + pos1;
-		pos2          = y * amplitude * ys[2] + pos2;
-		noise_surface = y * amplitude * ys[0] + noise_surface;
-
-		//Compute the normal.
-		t->mesh[i].normal = vec3_normalize(vec3_cross(pos1 - noise_surface, pos2 - noise_surface));
-		//Compute the new surface position.
-		//Scale back up to planet size.
-		t->mesh[i].position = noise_surface * (m/noise_radius) + planet_pos;
 	}
 
 	return t;
 }
 
+//Heights straight from the noise, for where no tile is deep enough to go by, as a terrain_query_fallback_fn. The
+//noise is warped as on the deepest tiles, so it's what they'd have.
+static void proc_planet_noise_heights(void *context, const vec3 directions[], int n, float out[])
+{
+	proc_planet *p = context;
+	float edge_len = p->edge_len / (1 << PROC_PLANET_TILE_MAX_SUBDIVISIONS);
+	float epsilon = proc_planet_epsilon(edge_len, p->noise_radius, p->radius, PROC_PLANET_NUM_TILE_ROWS);
+	for (int first = 0; first < n; first += PROC_PLANET_NOISE_CHUNK) {
+		int num = n - first < PROC_PLANET_NOISE_CHUNK ? n - first : PROC_PLANET_NOISE_CHUNK;
+		vec3 noise_surface[PROC_PLANET_NOISE_CHUNK], basis_x[PROC_PLANET_NOISE_CHUNK], basis_z[PROC_PLANET_NOISE_CHUNK];
+		vec3 gradient[PROC_PLANET_NOISE_CHUNK];
+		float heights[PROC_PLANET_NOISE_CHUNK];
+		for (int i = 0; i < num; i++)
+			noise_surface[i] = directions[first + i] * p->noise_radius;
+		proc_planet_octaves(p->num_elements, num, noise_surface, epsilon, basis_x, basis_z, heights, gradient, NULL);
+		for (int i = 0; i < num; i++)
+			out[first + i] = p->amplitude * heights[i] * p->radius / p->noise_radius;
+	}
+}
+
 static void proc_planet_finishing_touches(tri_tile *t, void *finishing_touches_context)
 {
 	//Retrieve tile's planet from finishing_touches_context.
@@ -262,35 +321,30 @@ static void proc_planet_finishing_touches(tri_tile *t, void *finishing_touches_c
 	proc_planet_vertices_and_normals(props, p->num_elements, t, p->height, planet_pos, p->noise_radius, p->radius, p->amplitude);
 }
 
-static void tri_tile_split(tri_tile *t, tri_tile *out[DEFAULT_NUM_TRI_TILE_DIVS])
+//The children of t, side by side in its planet's arena with their meshes, ready for tri_tile_mesh_gen.
+//Returns false if the arena is out of memory.
+static bool proc_planet_tile_split(void *context, tri_tile *t, struct tri_tile_big_vertex new_tile_vertices[DEFAULT_NUM_TRI_TILE_DIVS][3], tri_tile *out[DEFAULT_NUM_TRI_TILE_DIVS])
 {
-	struct tri_tile_big_vertex new_vertices[] = {
-		tri_tile_get_big_vert_average(t, 0, 1),
-		tri_tile_get_big_vert_average(t, 0, 2),
-		tri_tile_get_big_vert_average(t, 1, 2)
-	};
-
-	proc_planet *planet = (proc_planet *)t->finishing_touches_context;
-	vec3 planet_pos = bpos_remap((bpos){0}, t->offset);
-	for (int i = 0; i < 3; i++) {
-		vec3 d = new_vertices[i].position - planet_pos;
-		new_vertices[i].position = d * planet->radius/vec3_mag(d) + planet_pos;
+	proc_planet *planet = context;
+	tri_tile *children = tile_arena_headers(&planet->arena, DEFAULT_NUM_TRI_TILE_DIVS);
+	if (!children)
+		return false;
+	for (int i = 0; i < DEFAULT_NUM_TRI_TILE_DIVS; i++) {
+		out[i] = tri_tile_place(&children[i], new_tile_vertices[i]);
+		out[i]->offset = t->offset;
+		out[i]->finishing_touches_context = t->finishing_touches_context;
+		out[i]->mesh = tile_arena_mesh(&planet->arena);
 	}
-
-	struct tri_tile_big_vertex new_tile_vertices[DEFAULT_NUM_TRI_TILE_DIVS][3] = {
-		{t->big_vertices[0], new_vertices[0],    new_vertices[1]},
-		{new_vertices[0],    t->big_vertices[1], new_vertices[2]},
-		{new_vertices[0],    new_vertices[2],    new_vertices[1]},
-		{new_vertices[1],    new_vertices[2],    t->big_vertices[2]}
-	};
-
 	for (int i = 0; i < DEFAULT_NUM_TRI_TILE_DIVS; i++) {
-		out[i] = tri_tile_new(new_tile_vertices[i]);
-		tri_tile_init(out[i], t->offset, PROC_PLANET_NUM_TILE_ROWS, t->finishing_touches, t->finishing_touches_context);
-		//tri_tile_buffer(out[i]);
+		if (!out[i]->mesh) {
+			for (int j = 0; j < DEFAULT_NUM_TRI_TILE_DIVS; j++)
+				proc_planet_tile_free(out[j]);
+			return false;
+		}
 	}
 
 	printf("Dividing %p.\n", t);
+	return true;
 }
 
 static float fbm(vec3 p)
@@ -335,8 +389,11 @@ float proc_planet_height(vec3 pos, vec3 *variety)
 //Declaring these here for now, until I move them to a more permanent location.
 int get_tri_lerp_vals(float *lerps, int num_rows);
 GLuint load_gl_texture(char *path);
-int proc_planet_init()
+int proc_planet_init(thread_pool *pool)
 {
+	proc_planets.pool = pool;
+	terrain_noise_init(&proc_planets.noise, open_simplex_noise_seed);
+
 	if (!proc_planets.is_init) {
 		glGenVertexArrays(1, &proc_planets.vao);
 		glBindVertexArray(proc_planets.vao);
@@ -394,18 +451,17 @@ int proc_planet_init()
 	glBindBuffer(GL_ARRAY_BUFFER, VBO);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(tri_lerps), tri_lerps, GL_STATIC_DRAW);
 
-	glGenBuffers(1, &INBO);
-	glBindBuffer(GL_ARRAY_BUFFER, INBO);
+	//Room for one planet's worth of tiles a frame to start with.
+	stream_buffer_init(&proc_planets.instances, "planet instances", 5000 * sizeof(struct instance_attributes));
 	checkErrors("After gen indexed array buffer");
 
 	/* Vertex attributes */
 
+	//Pointers are set when drawing, since the instances move around the stream buffer.
 	int attr_div = 1;
 	for (int i = 0; i < 3; i++)
 	{
 		glEnableVertexAttribArray(POS_ATTR[i]);
-		glVertexAttribPointer(POS_ATTR[i], 3, GL_FLOAT, GL_FALSE,
-			sizeof(struct instance_attributes), (void *)(offsetof(struct instance_attributes, pos) + i*3*sizeof(float)));
 		glVertexAttribDivisor(POS_ATTR[i], attr_div);
 		checkErrors("After attr divisor for pos");
 	}
@@ -413,8 +469,6 @@ int proc_planet_init()
 	for (int i = 0; i < 3; i++)
 	{
 		glEnableVertexAttribArray(TX_ATTR[i]);
-		glVertexAttribPointer(TX_ATTR[i], 2, GL_FLOAT, GL_FALSE,
-			sizeof(struct instance_attributes), (void *)(offsetof(struct instance_attributes, tx) + i*2*sizeof(float)));
 		glVertexAttribDivisor(TX_ATTR[i], attr_div);
 		checkErrors("After attr divisor for attr");
 	}
@@ -462,6 +516,11 @@ void proc_planet_deinit()
 	glDeleteVertexArrays(1, &VAO);
 	glDeleteBuffers(1, &VBO);
 	glDeleteProgram(SHADER);
+	stream_buffer_deinit(&proc_planets.instances);
+
+	free(proc_planets.frame.tiles);
+	free(proc_planets.frame.matrices);
+	proc_planets.frame = (struct proc_planet_frame){0};
 }
 
 proc_planet * proc_planet_new(float radius, height_map_func height, int *elements, int num_elements)
@@ -473,32 +532,61 @@ proc_planet * proc_planet_new(float radius, height_map_func height, int *element
 		.noise_radius = radius/1000, //TODO: Determine the largest reasonable noise radius, map input radius to a good range.
 		.amplitude = TERRAIN_AMPLITUDE,
 		.edge_len = radius / sin(2.0*M_PI/5.0),
-		.height = height
+		.height = height,
 	};
 	for (int i = 0; i < num_elements; i++)
 		p->elements[i] = elements[i];
 	printf("Edge len: %f\n", p->edge_len);
+	tile_arena_init(&p->arena, sizeof(tri_tile), sizeof(struct tri_tile_vertex) * num_tri_tile_vertices(PROC_PLANET_NUM_TILE_ROWS));
 
 	uint32_t ticks = SDL_GetTicks();
 
 	//Initialize the planet terrain
+	tri_tile *faces[NUM_ICOSPHERE_FACES];
+	tri_tile *face_headers = tile_arena_headers(&p->arena, NUM_ICOSPHERE_FACES);
+	assert(face_headers);
 	for (int i = 0; i < NUM_ICOSPHERE_FACES; i++) {
 		struct tri_tile_big_vertex verts[3];
-		for (int j = 0; j < 3; j++)
-			verts[j] = (struct tri_tile_big_vertex){ico_v[ico_i[3*i+j]] * radius, {ico_tx[(6*i)+(2*j)], ico_tx[(6*i)+(2*j)+1]}};
-
-		p->tiles[i] = quadtree_new(tri_tile_new(verts), 0);
+		terrain_lod_face_vertices(i, radius, verts);
+		faces[i] = tri_tile_place(&face_headers[i], verts);
 		//Initialize tile with verts expressed relative to p->sector.
-		tri_tile_init((tri_tile *)p->tiles[i]->data, (bpos_origin){0, 0, 0}, PROC_PLANET_NUM_TILE_ROWS, &proc_planet_finishing_touches, p);
+		faces[i]->offset = (bpos_origin){0, 0, 0};
+		faces[i]->finishing_touches_context = p;
+		faces[i]->mesh = tile_arena_mesh(&p->arena);
+		assert(faces[i]->mesh);
 	}
+	//All 20 faces at once, the planet isn't usable until they're done anyway.
+	atomic_size_t faces_remaining = 0;
+	proc_planet_tile_gen(p, faces, NUM_ICOSPHERE_FACES, &faces_remaining);
+	proc_planet_tile_gen_wait(p, &faces_remaining);
 
 	uint32_t ticks2 = SDL_GetTicks();
 
 	for (int i = 0; i < NUM_ICOSPHERE_FACES; i++)
-		tri_tile_buffer(p->tiles[i]->data);
+		proc_planet_tile_upload(p, faces[i]);
 
 	uint32_t ticks3 = SDL_GetTicks();
 
+	struct terrain_lod_params params = {
+		.radius = radius,
+		.max_height = proc_planet_max_height(p),
+		.split_distance = (screen_width * p->edge_len) / (2 * PROC_PLANET_TILE_PIXELS_PER_TRI * PROC_PLANET_NUM_TILE_ROWS),
+		.max_subdivisions = PROC_PLANET_TILE_MAX_SUBDIVISIONS,
+		.tile_budget = (size_t)getglob(L, "planet_tile_budget_mb", PROC_PLANET_DEFAULT_TILE_BUDGET_MB) << 20,
+	};
+	struct terrain_lod_provider provider = {
+		.split = proc_planet_tile_split,
+		.generate = proc_planet_tile_gen,
+		.wait = proc_planet_tile_gen_wait,
+		.finish = proc_planet_tile_upload,
+		.free_tile = proc_planet_tile_free,
+		.tile_bytes = proc_planet_tile_bytes(),
+		.context = p,
+	};
+	terrain_lod_init(&p->lod, &params, &provider, faces, &p->arena.node_allocator);
+	//Shallower tiles are what's drawn from far away, too coarse to put anything on.
+	terrain_query_init(&p->heights, &p->lod, PROC_PLANET_TILE_MAX_SUBDIVISIONS, proc_planet_noise_heights, p);
+
 	p->ms_per_tile_gen    = (ticks2 - ticks)  / (float)NUM_ICOSPHERE_FACES;
 	p->ms_per_tile_buffer = (ticks3 - ticks2) / (float)NUM_ICOSPHERE_FACES;
 	printf("Planet took %f, %f ms to generate.\n", p->ms_per_tile_gen, p->ms_per_tile_buffer);
@@ -508,49 +596,25 @@ proc_planet * proc_planet_new(float radius, height_map_func height, int *element
 
 void proc_planet_free(proc_planet *p)
 {
-	for (int i = 0; i < NUM_ICOSPHERE_FACES; i++)
-		quadtree_free(p->tiles[i], (quadtree_free_fn)tri_tile_free);
+	terrain_lod_deinit(&p->lod);
+	tile_arena_deinit(&p->arena);
 	free(p);
 }
 
-static bool proc_planet_drawlist_visit(quadtree_node *node, void *context)
-{
-	struct planet_terrain_context *ctx = (struct planet_terrain_context *)context;
-	tri_tile *tile = tree_tile(node);
-	int depth = proc_planet_subdiv_depth(ctx->planet, tile, node->depth, ctx->cam_pos);
-
-	if (depth == node->depth || !quadtree_node_has_children(node)) {
-		if (ctx->num_tiles < ctx->max_tiles && above_horizon(tile, depth, *ctx))
-			ctx->tiles[ctx->num_tiles++] = tile;
-		// else
-		// 	ctx->excess_tiles = true;
-	}
-
-	return depth > node->depth;
-}
-
-int proc_planet_drawlist(proc_planet *p, tri_tile **tiles, int max_tiles, bpos cam_pos)
+int proc_planet_drawlist(proc_planet *p, tri_tile **tiles, int max_tiles, bpos cam_pos, struct frustum *frustum)
 {
-	struct planet_terrain_context context = {
-		.splits_max = fmax(15.0 / (4 * (p->ms_per_tile_gen + p->ms_per_tile_buffer)), 1), //Total number of splits for this call of drawlist.
+	//Generating on the main thread costs the frame, otherwise only uploading does and splits are capped by how
+	//many can be pending.
+	float ms_per_split = 4 * fmax(p->ms_per_tile_buffer + (proc_planet_async() ? 0 : p->ms_per_tile_gen), 0.25);
+	struct terrain_lod_view view = {
 		.cam_pos = cam_pos,
-		.planet = p,
-		.tiles = tiles,
-		.max_tiles = max_tiles
+		.frustum = frustum,
+		.max_splits = proc_planet_async() ? TERRAIN_LOD_MAX_PENDING_SPLITS : fmax(15.0 / ms_per_split, 1),
+		.max_uploads = fmax(15.0 / ms_per_split, 1),
+		.debug = nes30_buttons[INPUT_BUTTON_START],
 	};
 	//TODO: Check the distance here and draw an imposter instead of the whole planet if it's far enough.
-
-	for (int i = 0; i < NUM_ICOSPHERE_FACES; i++) {
-		quadtree_preorder_visit(p->tiles[i], proc_planet_split_visit, &context);
-		quadtree_preorder_visit(p->tiles[i], proc_planet_drawlist_visit, &context);
-		if (context.excess_tiles)
-			printf("Excess tiles.\n");
-		//TODO: Find a good way to implement prune with hysteresis.
-		//terrain_tree_prune(p->tiles[i], proc_planet_split_depth, &context, (terrain_tree_free_fn)tri_tile_free);
-	}
-
-	//printf("Num tiles drawn:%d\n", context.visited);
-	return context.num_tiles;
+	return terrain_lod_update(&p->lod, &view, tiles, max_tiles);
 }
 
 //Duplicate from draw.c for now
@@ -582,28 +646,81 @@ bool proc_planet_point_in_viewport(float *mvpm, float *vpos, float *out)
 	return tmp;;
 }
 
-void proc_planet_draw(amat4 eye_frame, float proj_view_mat[16], proc_planet *planets[], bpos planet_positions[], int num_planets)
+//Room for max_tiles in the frame's lists, keeping them if they're already big enough.
+static bool proc_planet_frame_reserve(struct proc_planet_frame *f, int max_tiles)
 {
+	if (f->max_tiles >= max_tiles)
+		return true;
+	tri_tile **tiles = realloc(f->tiles, max_tiles * sizeof(tri_tile *));
+	if (tiles)
+		f->tiles = tiles;
+	struct proc_planet_tile_matrices *matrices = realloc(f->matrices, max_tiles * sizeof(struct proc_planet_tile_matrices));
+	if (matrices)
+		f->matrices = matrices;
+	if (!tiles || !matrices) {
+		printf("Whoops, running out of memory.\n");
+		return false;
+	}
+	f->max_tiles = max_tiles;
+	return true;
+}
+
+void proc_planet_frame_prepare(amat4 eye_frame, float proj_view_mat[16], proc_planet *planets[], bpos planet_positions[], int num_planets)
+{
+	struct proc_planet_frame *f = &proc_planets.frame;
+	f->num_tiles = 0;
+	if (!num_planets)
+		return;
 	//Create a list of planet tiles to draw.
 	amat4 tri_frame  = {.a = MAT3_IDENT, .t = {0, 0, 0}};
 	int drawlist_max = 5000 * num_planets; //TODO(Gavin): Get a good estimate of this from actual number of runtime tiles.
-	tri_tile *drawlist[drawlist_max] __attribute__((aligned(64)));
+	if (!proc_planet_frame_reserve(f, drawlist_max))
+		drawlist_max = f->max_tiles;
+	tri_tile **drawlist = f->tiles;
 	//Index for the start of each planet's list of tiles, so I can assign uniforms per-planet.
 	int planet_tiles_start[num_planets + 1] __attribute__((aligned(64))); //Compiler bug!
 	int drawlist_count = 0;
+	//Logarithmic depth, so the side planes only. Tiles are tested relative to the eye.
+	struct frustum frustum;
+	frustum_from_matrix(&frustum, proj_view_mat, false);
+	frustum_recenter(&frustum, (float *)&eye_frame.t);
 	//Collect tiles for each planet, store in drawlist.
 	for (int i = 0; i < num_planets; i++) {
 		bpos pos = {eye_frame.t - planet_positions[i].offset, eye_sector - planet_positions[i].origin};
 		planet_tiles_start[i] = drawlist_count;
-		int planet_count = proc_planet_drawlist(planets[i], drawlist + drawlist_count, drawlist_max - drawlist_count, pos);
+		int planet_count = proc_planet_drawlist(planets[i], drawlist + drawlist_count, drawlist_max - drawlist_count, pos, &frustum);
 		drawlist_count += planet_count;
-		if (key_state[SDL_SCANCODE_2])
-			printf("Planet %2i drawing %10i tiles this frame.\n", i, planet_count);
+		if (key_state[SDL_SCANCODE_2]) {
+			struct terrain_lod_stats *s = &planets[i]->lod.stats;
+			printf("Planet %2i drawing %10i tiles this frame, %i culled by the frustum.\n", i, planet_count, s->culled_tiles);
+			printf("Planet %2i has %i tiles resident (%zu MB), %i collapsed, %i splits (%i pending), %i merges, %i expansions, %i evictions.\n",
+				i, s->resident_tiles, s->resident_bytes >> 20, planets[i]->lod.num_collapsed, s->splits, s->pending_splits, s->merges, s->expansions, s->evictions);
+			struct tile_arena_stats a = tile_arena_stats(&planets[i]->arena);
+			printf("Planet %2i arena has %zu headers, %zu nodes, %zu meshes (%zu free in %zu slabs, %zu reused), %zu MB reserved.\n",
+				i, a.headers, a.nodes, a.meshes, a.free_meshes, a.slabs, a.mesh_reuses, a.reserved_bytes >> 20);
+			struct terrain_query_stats *q = &planets[i]->heights.stats;
+			printf("Planet %2i answered %i height queries since last frame, %i from kept tiles, %i from the noise.\n", i, q->queries, q->hits, q->fallbacks);
+		}
+		planets[i]->heights.stats = (struct terrain_query_stats){0};
 	}
 	planet_tiles_start[num_planets] = drawlist_count;
 
-	if (getglobbool(L, "gpu_tiles", false) != key_state[SDL_SCANCODE_3]) {
-		struct instance_attributes planet_tile_data[drawlist_count] __attribute__((aligned(64))); //Compiler bug!
+	f->num_tiles = drawlist_count;
+	f->eye_pos = eye_frame.t;
+	memcpy(f->proj_view_mat, proj_view_mat, sizeof(f->proj_view_mat));
+	//This should be per-planet. Maybe pack into a vertex attribute? Otherwise each planet can be a separate draw call.
+	f->planet_pos = bpos_remap(planet_positions[0], eye_sector);
+	f->planet_radius = planets[0]->radius;
+	f->gpu_tiles = getglobbool(L, "gpu_tiles", false) != key_state[SDL_SCANCODE_3];
+
+	if (f->gpu_tiles) {
+		struct stream_buffer *sb = &proc_planets.instances;
+		stream_buffer_begin_frame(sb);
+		struct instance_attributes *planet_tile_data = stream_buffer_alloc(sb, drawlist_count * sizeof(struct instance_attributes), &f->instance_offset);
+		if (!planet_tile_data) {
+			f->num_tiles = 0;
+			return;
+		}
 
 		for (int i = 0; i < num_planets; i++) {
 			for (int j = planet_tiles_start[i]; j < planet_tiles_start[i+1]; j++) {
@@ -620,38 +737,12 @@ void proc_planet_draw(amat4 eye_frame, float proj_view_mat[16], proc_planet *pla
 			}
 		}
 
-		//To debug GPU tile alignment.
-		GLfloat mm[16];
-		amat4 gpu_model_matrix = {MAT3_IDENT, eye_frame.t};
-		amat4_to_array(gpu_model_matrix, mm);
-
-		glBindVertexArray(VAO);
-		glUseProgram(SHADER);
-
-		glUniform3f(LCOL, VEC3_COORDS(sun_color));
-		glUniform3f(LPOS, VEC3_COORDS(sun_position));
-		glUniform3f(EYEPOS, VEC3_COORDS(eye_frame.t));
-		checkErrors("After lighting uniforms");
-		
-		//This should be per-planet. Maybe pack into a vertex attribute? Otherwise each planet can be a separate draw call.
-		glUniform3f(PORIGIN, VEC3_COORDS(bpos_remap(planet_positions[0], eye_sector)));
-		glUniform1f(PRADIUS, planets[0]->radius);
-		glUniformMatrix4fv(MM, 1, true, mm);
-		glUniformMatrix4fv(MVPM, 1, true, proj_view_mat);
-		checkErrors("After uniforms");
-		glBindBuffer(GL_ARRAY_BUFFER, INBO);
-		checkErrors("After bind INBO");
-		//glBufferData(GL_ARRAY_BUFFER, sizeof(test_data), test_data, GL_DYNAMIC_DRAW);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(planet_tile_data), planet_tile_data, GL_DYNAMIC_DRAW);
+		//Written once here, every pass draws from it.
+		stream_buffer_flush(sb);
+		f->instance_buffer = sb->buffer;
 		checkErrors("After upload indexed array data");
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, proc_planet_tx);
-		glUniform1i(SAMPLER0, 0);
-		glUniform1i(ROWS, rows);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, get_shared_tri_tile_indices_buffer_object(rows));
-		checkErrors("After binding INBO");
-		glDrawElementsInstanced(GL_TRIANGLE_STRIP, num_tri_tile_indices(rows), GL_UNSIGNED_INT, NULL, drawlist_count);
-		checkErrors("After instanced draw");
+		if (key_state[SDL_SCANCODE_2])
+			stream_buffer_print_stats(sb);
 
 		// if (key_state[SDL_SCANCODE_4]) {
 		// 	for (int i = 0; i < drawlist_count; i++) {
@@ -668,123 +759,95 @@ void proc_planet_draw(amat4 eye_frame, float proj_view_mat[16], proc_planet *pla
 		// 		}
 		// 	}
 		// }
-
 	} else {
-		glUseProgram(effects.forward.handle);
 		for (int i = 0; i < num_planets; i++) {
 			for (int j = planet_tiles_start[i]; j < planet_tiles_start[i+1]; j++) {
 				tri_tile *t = drawlist[j];
 				bpos tile_pos = planet_positions[i];
 				tile_pos.offset = bpos_remap((bpos){tile_pos.offset, tile_pos.origin + t->offset}, eye_sector);
 				amat4 tile_frame = {tri_frame.a, tile_pos.offset};
-				GLfloat mm[16], mvpm[16], mvnm[16];
-
-				glBindVertexArray(t->vao);
+				struct proc_planet_tile_matrices *m = &f->matrices[j];
+				pp_prep_matrices(tile_frame, proj_view_mat, m->mm, m->mvpm, m->mvnm);
 
 				if (!t->buffered) //Last resort "BUFFER RIGHT NOW", will cause hiccups.
 					tri_tile_buffer(t);
-				
-				glUniform3fv(effects.forward.override_col, 1, (float *)&t->override_col);
-				pp_prep_matrices(tile_frame, proj_view_mat, mm, mvpm, mvnm);
-
-				glUniformMatrix4fv(effects.forward.model_matrix,                 1, true, mm);
-				glUniformMatrix4fv(effects.forward.model_view_projection_matrix, 1, true, mvpm);
-				glUniformMatrix4fv(effects.forward.model_view_normal_matrix,     1, true, mvnm);
-
-				glDrawElements(GL_TRIANGLE_STRIP, t->num_indices, GL_UNSIGNED_INT, NULL);
-				checkErrors("Drew a planet tile");
-
-				//Debug printing to figure out why GPU tiles aren't aligned right.
-				// if (key_state[SDL_SCANCODE_4]) {
-				// 	struct instance_attributes *ia = &(planet_tile_data[j]);
-
-				// 	for (int k = 0; k < 3; k++) {
-				// 		float clip_coords[3], gpu_clip_coords[3];
-				// 		vec3 tmp = t->big_vertices[k].position;
-				// 		float vpos[3] = {tmp.x, tmp.y, tmp.z};
-
-				// 		bool in_viewport     = proc_planet_point_in_viewport(mvpm, vpos, clip_coords);
-				// 		bool gpu_in_viewport = proc_planet_point_in_viewport(gpu_mvpm, ia->pos + 3*k, gpu_clip_coords);
-				// 		uint32_t hashes[2] = {float3_hash(clip_coords, 18) % 230 + 1, float3_hash(gpu_clip_coords, 18) % 230 + 1};
-				// 		//vec3 colors[] = {color_from_float3(clip_coords, 10), color_from_float3(gpu_clip_coords, 10)};
-
-				// 		printf(ANSI_NUMERIC_FCOLOR "%s%2i: % f, % f, % f" ANSI_COLOR_RESET "\n",
-				// 			hashes[0],
-				// 			in_viewport     ? "" : "~", j,     clip_coords[0],     clip_coords[1],     clip_coords[2]);
-				// 		printf(ANSI_NUMERIC_FCOLOR "%s%2i: % f, % f, % f" ANSI_COLOR_RESET "\n",
-				// 			hashes[1],
-				// 			gpu_in_viewport ? "" : "~", j, gpu_clip_coords[0], gpu_clip_coords[1], gpu_clip_coords[2]);
-				// 	}
-				// }
 			}
 		}
 	}
 }
 
-struct proc_planet_tile_raycast_context {
-	//Input
-	bpos pos;
-	//Output
-	tri_tile *intersecting_tile;
-	bpos intersection;
-};
-
-//Checks if a ray intersects with a planet tile.
-bool proc_planet_tile_raycast(quadtree_node *node, void *context)
+void proc_planet_draw()
 {
-	struct proc_planet_tile_raycast_context *ctx = (struct proc_planet_tile_raycast_context *)context;
-	tri_tile *t = tree_tile(node);
-	vec3 intersection;
-	vec3 local_start = bpos_remap(ctx->pos, t->offset);
-	vec3 local_end = bpos_remap((bpos){0}, t->offset);
-	vec3 vertices[3] = {t->big_vertices[0].position, t->big_vertices[1].position, t->big_vertices[2].position};
-	int result = ray_tri_intersect(local_start, local_end, vertices, &intersection);
-	if (result == 1) {
-		//t->override_col *= (vec3){0.1, 1.0, 1.0};
-		//printf("Tile intersection found! Tile: %i\n", t->tile_index);
-		ctx->intersecting_tile = t;
-		ctx->intersection.offset = intersection;
-		ctx->intersection.origin = t->offset;
+	struct proc_planet_frame *f = &proc_planets.frame;
+	if (!f->num_tiles)
+		return;
+
+	if (f->gpu_tiles) {
+		//To debug GPU tile alignment.
+		GLfloat mm[16];
+		amat4 gpu_model_matrix = {MAT3_IDENT, f->eye_pos};
+		amat4_to_array(gpu_model_matrix, mm);
+
+		glBindVertexArray(VAO);
+		glUseProgram(SHADER);
+		glBindBuffer(GL_ARRAY_BUFFER, f->instance_buffer);
+		for (int i = 0; i < 3; i++) {
+			glVertexAttribPointer(POS_ATTR[i], 3, GL_FLOAT, GL_FALSE, sizeof(struct instance_attributes),
+				(void *)(f->instance_offset + offsetof(struct instance_attributes, pos) + i*3*sizeof(float)));
+			glVertexAttribPointer(TX_ATTR[i], 2, GL_FLOAT, GL_FALSE, sizeof(struct instance_attributes),
+				(void *)(f->instance_offset + offsetof(struct instance_attributes, tx) + i*2*sizeof(float)));
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		checkErrors("After instance attribute pointers");
+
+		glUniform3f(LCOL, VEC3_COORDS(sun_color));
+		glUniform3f(LPOS, VEC3_COORDS(sun_position));
+		glUniform3f(EYEPOS, VEC3_COORDS(f->eye_pos));
+		checkErrors("After lighting uniforms");
+		
+		glUniform3f(PORIGIN, VEC3_COORDS(f->planet_pos));
+		glUniform1f(PRADIUS, f->planet_radius);
+		glUniformMatrix4fv(MM, 1, true, mm);
+		glUniformMatrix4fv(MVPM, 1, true, f->proj_view_mat);
+		checkErrors("After uniforms");
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, proc_planet_tx);
+		glUniform1i(SAMPLER0, 0);
+		glUniform1i(ROWS, rows);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, get_shared_tri_tile_indices_buffer_object(rows));
+		checkErrors("After binding INBO");
+		glDrawElementsInstanced(GL_TRIANGLE_STRIP, num_tri_tile_indices(rows), GL_UNSIGNED_INT, NULL, f->num_tiles);
+		checkErrors("After instanced draw");
+	} else {
+		glUseProgram(effects.forward.handle);
+		for (int j = 0; j < f->num_tiles; j++) {
+			tri_tile *t = f->tiles[j];
+			struct proc_planet_tile_matrices *m = &f->matrices[j];
+
+			glBindVertexArray(t->vao);
+			glUniform3fv(effects.forward.override_col, 1, (float *)&t->override_col);
+			glUniformMatrix4fv(effects.forward.model_matrix,                 1, true, m->mm);
+			glUniformMatrix4fv(effects.forward.model_view_projection_matrix, 1, true, m->mvpm);
+			glUniformMatrix4fv(effects.forward.model_view_normal_matrix,     1, true, m->mvnm);
+
+			glDrawElements(GL_TRIANGLE_STRIP, t->num_indices, GL_UNSIGNED_INT, NULL);
+			checkErrors("Drew a planet tile");
+		}
 	}
-	return result == 1;
 }
 
-//Raycast towards the planet center and find the altitude on the deepest terrain tile. O(log(n)) complexity in the number of planet tiles.
-float proc_planet_altitude(proc_planet *p, bpos start, bpos *intersection)
+void proc_planet_height_at(proc_planet *p, const bpos positions[], int n, float out[])
 {
-	//TODO: Don't loop through everything to find this.
-	float smallest_dist = INFINITY;
-	float smallest_tile_dist = INFINITY;
-	struct proc_planet_tile_raycast_context context = {
-		.pos = start,
-		.intersecting_tile = NULL
-	};
-	for (int i = 0; i < NUM_ICOSPHERE_FACES; i++) {
-		//Find the intersecting tiles.
-		quadtree_preorder_visit(p->tiles[i], proc_planet_tile_raycast, &context);
-		tri_tile *t = context.intersecting_tile;
-		if (t) {
-			//Remap ray start relative to tile origin.
-			vec3 local_start = bpos_remap(start, t->offset);
-			//Remap planet center relative to tile origin.
-			vec3 local_end = bpos_remap((bpos){0}, t->offset);
-			vec3 local_intersection;
-			float dist = tri_tile_raycast_depth(t, local_start, local_end, &local_intersection);
-
-			//Because we'll also find an intersection on the back of the planet, choose smallest distance.
-			if (dist < smallest_dist) {
-				smallest_dist = dist;
-				intersection->offset = local_intersection;
-				intersection->origin = t->offset; //Origin relative to planet center.
-			}
+	terrain_query_heights(&p->heights, positions, n, out);
+}
 
-			float tile_dist = vec3_dist(local_start, t->centroid);
-			if (tile_dist < smallest_tile_dist) {
-				smallest_tile_dist = tile_dist;
-				// *intersection = context.intersection;
-			}
-		}
-		context.intersecting_tile = NULL;
-	}
-	return smallest_dist;
+float proc_planet_altitude(proc_planet *p, bpos start, bpos *intersection)
+{
+	float height;
+	proc_planet_height_at(p, &start, 1, &height);
+	vec3 pos = bpos_remap(start, (bpos_origin){0, 0, 0});
+	float dist = vec3_mag(pos);
+	intersection->offset = pos * ((p->radius + height) / dist);
+	intersection->origin = (bpos_origin){0, 0, 0};
+	return dist - p->radius - height;
 }
@@ -4,8 +4,14 @@
 //#include "dynamic_terrain_tree.h"
 #include "datastructures/quadtree.h"
 #include "triangular_terrain_tile.h"
+#include "tile_arena.h"
+#include "terrain_lod.h"
+#include "terrain_query.h"
 #include "terrain_constants.h"
 #include "math/bpos.h"
+#include "math/frustum.h"
+#include "jobs/thread_pool.h"
+#include <stdatomic.h>
 
 /*
 MEGA TODO:
@@ -36,6 +42,8 @@ enum {
 	PROC_PLANET_NUM_TILE_ROWS = 128,
 	PROC_PLANET_TILE_PIXELS_PER_TRI = 5,
 	PROC_PLANET_TILE_MAX_SUBDIVISIONS = 7, //TODO(Gavin): Choose a number that sets the surface resolution to a nice number.
+	PROC_PLANET_DEFAULT_TILE_BUDGET_MB = 512, //Overridden by planet_tile_budget_mb in conf.lua.
+	PROC_PLANET_NOISE_CHUNK = 256, //Vertices whose noise is worked out together, each octave one batch.
 };
 
 typedef struct procedural_planet {
@@ -50,33 +58,34 @@ typedef struct procedural_planet {
 	vec3 color_family;
 	int elements[PROC_PLANET_MAX_NUM_ELEMENTS];
 	int num_elements;
-	quadtree_node *tiles[NUM_ICOSPHERE_FACES];
 	height_map_func height;
 	float ms_per_tile_gen, ms_per_tile_buffer;
+	struct terrain_lod lod; //Tiles' meshes are generated on the thread pool.
+	struct tile_arena arena; //Every tile's header and mesh, and every node but the roots.
+	struct terrain_query heights; //Ground under things, from the deepest tiles' meshes, or the noise.
 } proc_planet;
 
-struct planet_terrain_context {
-	int splits_left;
-	int splits_max;
-	bpos cam_pos;
-	proc_planet *planet;
-	int visited;
-	tri_tile **tiles;
-	int num_tiles;
-	int max_tiles;
-	bool excess_tiles;
-};
-
-int proc_planet_init();
+//Tiles are generated on pool, or inline if it's NULL.
+int proc_planet_init(thread_pool *pool);
 void proc_planet_deinit();
 proc_planet * proc_planet_new(float radius, height_map_func height, int *elements, int num_elements);
 
 void proc_planet_free(proc_planet *p);
-int proc_planet_drawlist(proc_planet *p, tri_tile **tiles, int max_tiles, bpos cam_pos);
-void proc_planet_draw(amat4 eye_frame, float proj_view_mat[16], proc_planet *planets[], bpos planet_positions[], int num_planets);
+//Tiles outside frustum aren't drawn or split, if it's not NULL. It needs to be centered on the camera.
+int proc_planet_drawlist(proc_planet *p, tri_tile **tiles, int max_tiles, bpos cam_pos, struct frustum *frustum);
+//Picks the tiles to draw this frame, splitting and merging as the camera moves, and gets them ready to draw.
+//Call it once a frame, before any proc_planet_draw.
+void proc_planet_frame_prepare(amat4 eye_frame, float proj_view_mat[16], proc_planet *planets[], bpos planet_positions[], int num_planets);
+//Draws the tiles the last proc_planet_frame_prepare picked, from its camera. Call it once for each pass.
+void proc_planet_draw();
 float proc_planet_height(vec3 pos, vec3 *variety);
 
-//Raycast towards the planet center and find the altitude on the deepest terrain tile. O(log(n)) complexity in the number of planet tiles.
+//Height above the planet's radius of the ground under each of n positions, relative to the planet's center.
+//Positions near the camera are read off the tiles, and the rest worked out from the noise, in one batch. Call it
+//from the thread that calls proc_planet_frame_prepare.
+void proc_planet_height_at(proc_planet *p, const bpos positions[], int n, float out[]);
+//How high start, relative to the planet's center, is above the ground, negative if it's under it. The point on
+//the ground under it goes in intersection.
 float proc_planet_altitude(proc_planet *p, bpos start, bpos *intersection);
 
 #endif
@@ -24,6 +24,7 @@
 #include "glsw_shaders.h"
 #include "luaengine/lua_configuration.h"
 #include "experiments/spiral_scene.h"
+#include "jobs/thread_pool.h"
 #include <stdio.h>
 #include <stdbool.h>
 #include <math.h>
@@ -60,6 +61,7 @@ vec3 sun_color     = {0.1, 0.8, 0.1};
 vec3 sun_position; // = bpos_remap((bpos){{0,0,0}, ssystem.origin}, eye_sector);
 struct point_light_attributes point_lights = {.num_lights = 0};
 struct star_box_ctx star_box_context;
+static thread_pool *space_pool = NULL; //Planet tiles and star boxes generate here.
 
 
 const float planet_radius = 6000000;
@@ -95,7 +97,7 @@ extern lua_State *L;
 scriptable_callback(star_box_script)
 {
 	Physical *camera = ((Entity *)entity->scriptable->context)->physical;
-	star_box_update(&star_box_context, camera->origin);
+	star_box_update(&star_box_context, camera->origin, camera->velocity.t / BPOS_CELL_SIZE);
 }
 
 void entities_init()
@@ -230,11 +232,12 @@ int space_scene_init()
 	checkErrors("Lights");
 	//stars_init();
 	checkErrors("Init stars");
-	star_box_init(&star_box_context, eye_sector);
+	space_pool = thread_pool_new(getglob(L, "worker_threads", 0));
+	star_box_init(&star_box_context, eye_sector, space_pool, NULL);
 	checkErrors("Init star_box");
 	debug_graphics_init();
 	checkErrors("Init debug_graphics");
-	proc_planet_init();
+	proc_planet_init(space_pool);
 	ssystem = solar_system_new(eye_sector);
 	solar_system_star = 0;
 
@@ -281,6 +284,9 @@ void space_scene_deinit()
 	//stars_deinit();
 	proc_planet_deinit();
 	star_box_deinit(&star_box_context);
+	//After the planets and star boxes, which wait on what's still generating.
+	thread_pool_free(space_pool);
+	space_pool = NULL;
 	debug_graphics_deinit();
 	point_lights.num_lights = 0;
 	spiral_scene_deinit();
@@ -335,6 +341,9 @@ void space_scene_render()
 		amat4_buf_mult(proj_mat, tmp, proj_view_mat);
 	}
 
+	//Planet detail is picked once a frame, then every pass draws the same tiles.
+	proc_planet_frame_prepare(eye_frame, proj_view_mat, ssystem.planets, ssystem.planet_positions, ssystem.num_planets);
+
 	//Depth buffer enabled for writing
 	glDepthMask(GL_TRUE);
 	glClearStencil(0);
@@ -380,7 +389,7 @@ void space_scene_render()
 		//glDisable(GL_CULL_FACE);
 
 		checkErrors("Before planets draw");
-		proc_planet_draw(eye_frame, proj_view_mat, ssystem.planets, ssystem.planet_positions, ssystem.num_planets);
+		proc_planet_draw();
 		//Reset override color in case proc_planet_draw set it.
 		glUniform3f(effects.forward.override_col, 1.0, 1.0, 1.0);
 
@@ -462,7 +471,7 @@ void space_scene_render()
 			// draw_forward_adjacent(&effects.outline, *ship_entity->drawable->bg, ship_entity->physical->position);
 
 			checkErrors("Before planets draw");
-			proc_planet_draw(eye_frame, proj_view_mat, ssystem.planets, ssystem.planet_positions, ssystem.num_planets);
+			proc_planet_draw();
 			//Reset override color in case proc_planet_draw set it.
 			glUniform3f(effects.forward.override_col, 1.0, 1.0, 1.0);
 
@@ -14,6 +14,8 @@
 #include <assert.h>
 #include <math.h>
 #include <stdbool.h>
+#include <time.h>
+#include <inttypes.h>
 
 /*
 Since each box has a bpos_origin, each star only needs to store its offset from that origin;
@@ -33,8 +35,12 @@ Epilogue: It worked!
 
 //HALF_BOX_SIZE and -HALF_BOX_SIZE need to be representable in an int32_t.
 #define STAR_BOX_SIZE 4294967296 //67108864 //8096 //The width of one edge of a star box, in bpos cell widths.
-#define STAR_SIZE (sizeof(int32_t) * 3)
+#define STAR_SIZE (sizeof(int16_t) * 3)
+#define STAR_VERTEX_SIZE (sizeof(int16_t) * STAR_LOD_VERTEX_SHORTS) //Quantized offset, then the bucket, see star_lod.h.
 #define HALF_BOX_SIZE (STAR_BOX_SIZE / 2)
+//Boxes further than this from the camera draw their aggregates instead of every star. That's always the far
+//corners of the 3x3x3, and the sides the camera isn't near.
+#define STAR_BOX_FULL_DETAIL_DIST (STAR_BOX_SIZE / 4)
 
 static bpos_origin star_box_round_pt(bpos_origin o, int64_t precision)
 {
@@ -43,241 +49,368 @@ static bpos_origin star_box_round_pt(bpos_origin o, int64_t precision)
 	return (o + precision / 2) & ~(precision-1);
 }
 
-/*
-let b = STAR_BOX_BUCKET_DIVS_PER_AXIS
-there are b^3 buckets, meaning indexes go from [0, b^3)
-let s = STAR_BOX_SIZE and h = HALF_BOX_SIZE
-a star at {h, h, h} should be in bucket b^3-1
-a star at {-h, -h, -h} should be in bucket 0
+uint32_t star_box_idx_from_star_idx(uint32_t star_idx)
+{
+	//TODO(Gavin) Check this for errors.
+	return star_idx / STAR_BOX_STARS_PER_BOX;
+}
 
+//Key each box's random stream on all three of its coordinates, so neighbouring boxes never share stars.
+static uint64_t star_box_key(qvec3 box_idx)
+{
+	uint64_t key = 0x53544152424f58ull; //"STARBOX"
+	for (int i = 0; i < 3; i++)
+		key = crand64(key, (uint64_t)box_idx[i]);
+	return key;
+}
+
+struct star_box_candidates {
+	uint64_t key;
+	const uint16_t *accepted; //Which candidates made it, NULL for all of them.
+};
 
+/*
+Only depends on box_idx, so a box comes out the same on any thread, in any order.
+Each candidate star is 96 random bits from crand64, used directly as its int32_t offsets. STAR_BOX_SIZE is 2^32,
+so that covers the whole box evenly, with no float rounding along the way.
 */
-uint32_t bucket_idx(int32_t star[3])
+static void star_box_candidate(uint64_t key, uint32_t i, int32_t star[3])
 {
-	uint32_t idx = 0;
-	for (int i = 0, d = 1; i < 3; i++, d *= STAR_BOX_BUCKET_DIVS_PER_AXIS)
-		idx += (star[i] + HALF_BOX_SIZE) * d / STAR_BOX_SIZE;
-	return idx;
+	uint64_t r1 = crand64(key, 2 * i), r2 = crand64(key, 2 * i + 1);
+	star[0] = (int32_t)(uint32_t)r1;
+	star[1] = (int32_t)(uint32_t)(r1 >> 32);
+	star[2] = (int32_t)(uint32_t)r2;
 }
 
-uint32_t star_box_idx_from_star_idx(uint32_t star_idx)
+static void star_box_star(void *ctx, uint32_t i, int32_t star[3])
 {
-	//TODO(Gavin) Check this for errors.
-	return star_idx / STAR_BOX_STARS_PER_BOX;
+	struct star_box_candidates *c = ctx;
+	star_box_candidate(c->key, c->accepted ? c->accepted[i] : i, star);
 }
 
-static void star_box_generate(struct star_box_ctx *sb, bpos_origin o, uint32_t box)
+/*
+With a galaxy, this is rejection sampling: each of the STAR_BOX_STARS_PER_BOX candidates is kept with probability
+density / spiral_density where it sits, so a box in an arm fills up and a box out in the void is left nearly
+empty. The bulge goes past spiral_density and just saturates. Densities are evaluated a batch at a time.
+Returns the number of stars.
+*/
+uint16_t star_box_generate(const struct galaxy_density *galaxy, qvec3 box_idx, int16_t *stars, uint16_t *buckets)
 {
-	vec3 c1 = -HALF_BOX_SIZE;
-	vec3 c2 =  HALF_BOX_SIZE;
-	uint32_t hash = hash_qvec3(o);
-	srand(hash);
-	srand_float(hash);
-	int32_t *stars = &sb->stars[STAR_BOX_STARS_PER_BOX * 3 * box];
-	uint32_t *buckets = &sb->start_indices[STAR_BOX_BUCKETS_PER_BOX * box];
-	//The number of stars in each bucket
-	uint32_t bucket_counts[STAR_BOX_BUCKETS_PER_BOX] = {0};
-
-	for (uint32_t i = 0; i < STAR_BOX_STARS_PER_BOX; i++) {
-		vec3 v = rand_box_vec3(c1, c2);
-		int32_t *star = &stars[3*i];
-		star[0] = v.x; star[1] = v.y; star[2] = v.z;
-		//memcpy(star, &v, STAR_SIZE);
-		//Count the number of stars that will go into each bucket.
-		bucket_counts[bucket_idx(star)]++;
+	struct star_box_candidates c = {.key = star_box_key(box_idx)};
+	uint32_t num = STAR_BOX_STARS_PER_BOX;
+	uint16_t accepted[STAR_BOX_STARS_PER_BOX];
+	if (galaxy) {
+		enum {batch = 256};
+		float x[batch], y[batch], z[batch], density[batch];
+		num = 0;
+		for (uint32_t begin = 0; begin < STAR_BOX_STARS_PER_BOX; begin += batch) {
+			uint32_t n = STAR_BOX_STARS_PER_BOX - begin < batch ? STAR_BOX_STARS_PER_BOX - begin : batch;
+			for (uint32_t j = 0; j < n; j++) {
+				int32_t star[3];
+				star_box_candidate(c.key, begin + j, star);
+				x[j] = (box_idx[0] + star[0] / (float)STAR_BOX_SIZE) * STAR_BOX_GALAXY_UNITS_PER_BOX;
+				y[j] = (box_idx[1] + star[1] / (float)STAR_BOX_SIZE) * STAR_BOX_GALAXY_UNITS_PER_BOX;
+				z[j] = (box_idx[2] + star[2] / (float)STAR_BOX_SIZE) * STAR_BOX_GALAXY_UNITS_PER_BOX;
+			}
+			galaxy_density_batch(galaxy, n, x, y, z, density);
+			for (uint32_t j = 0; j < n; j++) {
+				//The counters past the candidates' own, 24 bits is plenty for a probability.
+				float u = (crand64(c.key, 2 * STAR_BOX_STARS_PER_BOX + begin + j) >> 40) / (float)(1 << 24);
+				if (u * galaxy->spiral_density < density[j])
+					accepted[num++] = begin + j;
+			}
+		}
+		c.accepted = accepted;
 	}
+	//Sort them into buckets for star_index's queries, quantized within their bucket.
+	star_index_build(num, star_box_star, &c, stars, buckets);
+	return num;
+}
 
-	//Each bucket stores the start index of the stars within it.
-	uint32_t start = 0;
-	for (uint32_t i = 0; i < STAR_BOX_BUCKETS_PER_BOX; i++) {
-		buckets[i] = start;
-		start += bucket_counts[i];
+//Runs on a worker: generate boxes [begin, end) into their pending slots, then hand them back.
+static thread_pool_job_fn(star_box_generate_job)
+{
+	struct star_box_ctx *sb = ctx;
+	for (size_t box = begin; box < end; box++) {
+		struct star_box_pending *p = &sb->pending[box];
+		struct star_box_staging *st = p->staging;
+		p->num_stars = star_box_generate(sb->use_galaxy ? &sb->galaxy : NULL, p->box_idx, st->stars, st->start_indices);
+		p->num_aggregates = star_lod_aggregate(st->stars, st->start_indices, st->aggregates);
+		//Release, so the render thread sees the stars once it sees the state.
+		atomic_store_explicit(&p->state, STAR_BOX_READY, memory_order_release);
 	}
+}
 
-	#define FIRST_UNSORTED_IDX(bucket_idx) (buckets[bucket_idx+1] - bucket_counts[bucket_idx])
-	for (uint32_t i = 0; i < STAR_BOX_BUCKETS_PER_BOX; i++) {
-		while (bucket_counts[i] > 0) {
-			int32_t *star = &stars[FIRST_UNSORTED_IDX(i) * 3];
-			uint32_t sbi = bucket_idx(star);
-			int32_t *dest = &stars[FIRST_UNSORTED_IDX(sbi) * 3];
-
-			//Swap first unsorted in current bucket with first unsorted from destination bucket.
-			int32_t tmp_star[3];
-			memcpy(tmp_star, dest, STAR_SIZE);
-			memcpy(dest, star, STAR_SIZE);
-			memcpy(star, tmp_star, STAR_SIZE);
-			bucket_counts[sbi]--;
-		}
+//The current boxes, as star_index sees them.
+static void star_box_index_boxes(struct star_box_ctx *sb, struct star_index_box boxes[STAR_BOX_NUM_BOXES])
+{
+	for (int i = 0; i < STAR_BOX_NUM_BOXES; i++) {
+		boxes[i] = (struct star_index_box){
+			.stars = &sb->stars[i*3*STAR_BOX_STARS_PER_BOX],
+			.cell_starts = &sb->start_indices[i*(STAR_BOX_BUCKETS_PER_BOX + 1)],
+			.origin = {VEC3_COORDS(sb->origins[i])},
+		};
 	}
+}
 
-	//Validate buckets
-	// for (int i = 0; i < STAR_BOX_BUCKETS_PER_BOX; i++) {
-	// 	for (int j = buckets[i]; j < buckets[i+1]; j++) {
-	// 		if (bucket_idx(&stars[j*3]) != i)
-	// 			printf("Validating bucket %i [%i, %i), star %i should be in bucket %i.\n", i, buckets[i], buckets[i+1], j, bucket_idx(&stars[j*3]));
-	// 		//assert(bucket_idx(&stars[j*3]) == i);
-	// 	}
-	// }
+uint32_t star_box_find_nearest_star_idx(struct star_box_ctx *sb, bpos_origin pt, double *dist)
+{
+	uint32_t star_idx = -1;
+	double d = INFINITY;
+	star_box_find_nearest_stars(sb, pt, 1, &star_idx, &d);
+	if (dist)
+		*dist = d;
+	return star_idx;
 }
 
-static uint32_t idx_from_pt(bpos_origin pt)
+size_t star_box_find_nearest_stars(struct star_box_ctx *sb, bpos_origin pt, size_t k, uint32_t *star_idx, double *dist)
 {
-	qvec3 idx;
-	for (int i = 0; i < 3; i++) {
-		idx[i] = lldiv_floor(pt[i], STAR_BOX_SIZE).quot % 3;
-		idx[i] += 3*(idx[i] < 0);
-	}
-	return idx.x + idx.y * 3 + idx.z * 9;
+	struct star_index_box boxes[STAR_BOX_NUM_BOXES];
+	star_box_index_boxes(sb, boxes);
+	size_t num = star_index_knn(boxes, STAR_BOX_NUM_BOXES, STAR_BOX_STARS_PER_BOX, (int64_t[3]){VEC3_COORDS(pt)}, k, star_idx, dist);
+	for (size_t i = 0; dist && i < num; i++)
+		dist[i] = sqrt(dist[i]);
+	return num;
 }
 
-static void bucket_from_pt(struct star_box_ctx *sb, bpos_origin pt, uint32_t *box, uint32_t *bucket)
+size_t star_box_find_stars_in_radius(struct star_box_ctx *sb, bpos_origin pt, double radius, uint32_t *star_idx, size_t max)
 {
-	*box = idx_from_pt(star_box_round_pt(pt, STAR_BOX_SIZE));
-	qvec3 tmp = pt - sb->origins[*box]; //pt relative to box origin.
-	*bucket = bucket_idx((int32_t[3]){VEC3_COORDS(tmp)});
+	struct star_index_box boxes[STAR_BOX_NUM_BOXES];
+	star_box_index_boxes(sb, boxes);
+	return star_index_radius(boxes, STAR_BOX_NUM_BOXES, STAR_BOX_STARS_PER_BOX, (int64_t[3]){VEC3_COORDS(pt)}, radius, star_idx, max);
 }
 
-static void nearest_star_in_bucket(struct star_box_ctx *sb, uint32_t box, uint32_t bucket, qvec3 pt, uint32_t *star_idx, double *closest_dist)
+uint32_t star_box_find_star_in_cone(struct star_box_ctx *sb, bpos_origin pt, vec3 dir, double half_angle, double max_dist, double *dist)
 {
-	int32_t *stars = &sb->stars[STAR_BOX_STARS_PER_BOX * 3 * box];
-	uint32_t *buckets = &sb->start_indices[STAR_BOX_BUCKETS_PER_BOX * box];
-	for (uint32_t i = buckets[bucket]; i < buckets[bucket+1]; i++) {
-		qvec3 star = {stars[i*3], stars[i*3 + 1], stars[i*3 + 2]};
-		double star_dist = qvec3_distd(pt - sb->origins[box], star);
-
-		if (star_dist < *closest_dist) {
-			*closest_dist = star_dist;
-			*star_idx = i;
-		}
-	}
+	struct star_index_box boxes[STAR_BOX_NUM_BOXES];
+	star_box_index_boxes(sb, boxes);
+	return star_index_cone(boxes, STAR_BOX_NUM_BOXES, STAR_BOX_STARS_PER_BOX, (int64_t[3]){VEC3_COORDS(pt)},
+		(double[3]){VEC3_COORDS(dir)}, half_angle, max_dist, dist);
 }
 
-//Make this slow and branchy at first, can optimize later.
-uint32_t star_box_find_nearest_star_idx(struct star_box_ctx *sb, bpos_origin pt, double *dist)
+qvec3 star_box_get_star_origin(struct star_box_ctx *sb, uint32_t star_idx)
 {
-	/*
-	We start by searching b, the bucket p falls into, finding the nearest s.
-	Construct a sphere centered around p, just large enough to touch s.
-	Any bucket b' that the sphere intersects must be searched as well, as there
-	could be a nearer star in b'.
-
-	Let a = (s - p).
-	For each cardinal direction d,
-		Let p' = |a|d + p. If p' lies in a different bucket, search that bucket.
-	For each corner of b, c, let d = (c - p)/|c - p|.
-		Let p' = |a|d + p. If p' lies in a different bucket, search that bucket.
-	For each edge of b, e, let m be the point on e closest to p, and let d = (m - p)/|m - p|.
-		Let p' = |a|d + p. If p' lies in a different bucket, search that bucket.
-
-	Alternatively, I could just iterate through all 26 neighbor buckets and check every star.
-	*/
-
-	uint32_t box, bucket, spill_box, spill_bucket, star_idx = -1;
-	double closest_dist = INFINITY;
-	double bucket_width = sqrt(2) * (STAR_BOX_SIZE/STAR_BOX_BUCKET_DIVS_PER_AXIS);
-	bucket_from_pt(sb, pt, &box, &bucket);
-	nearest_star_in_bucket(sb, box, bucket, pt, &star_idx, &closest_dist);
-
-	//Vector from the center towards the 6 faces of a bucket cube.
-	qvec3 faces[] = {
-		{0, 0, -1}, {0, 0, 1}, {0, -1, 0}, {0, 1, 0}, {-1, 0, 0}, {1, 0, 0}
-	};
-
-	//Edges defined by indices of the two faces they are shared by.
-	uint32_t edges[12][2] = {
-		{0, 2}, {0, 3}, {0, 4}, {0, 5},
-		{1, 2}, {1, 3}, {1, 4}, {1, 5},
-		{3, 4}, {3, 5}, {2, 4}, {2, 5}
-	};
-
-	//Vertices defined by indices of the three faces they are shared by.
-	uint32_t vertices[8][3] = {
-		{0, 2, 4}, {0, 2, 5}, {0, 3, 4}, {0, 3, 5},
-		{1, 2, 4}, {1, 2, 5}, {1, 3, 4}, {1, 3, 5}
-	};
-
-	bool face_intersected[6] = {0};
-
-	for (uint32_t i = 0; i < LENGTH(faces); i++) {
-		//If we can shave a little distance off, we can avoid searching the bucket.
-		qvec3 offset = (closest_dist == INFINITY) ?
-			faces[i] * (int64_t)bucket_width :
-			faces[i] * (int64_t)closest_dist;
-		bucket_from_pt(sb, pt + offset, &spill_box, &spill_bucket);
-		if (spill_bucket == bucket && spill_box == box)
-			continue;
+	uint32_t box = star_box_idx_from_star_idx(star_idx);
+	uint32_t bucket = star_index_cell_of(&sb->start_indices[box*(STAR_BOX_BUCKETS_PER_BOX + 1)], star_idx % STAR_BOX_STARS_PER_BOX);
+	int32_t star[3];
+	star_index_decode(&sb->stars[star_idx * 3], bucket, star);
+	return sb->origins[box] + (qvec3){star[0], star[1], star[2]};
+}
 
-		face_intersected[i] = true;
-		nearest_star_in_bucket(sb, spill_box, spill_bucket, pt, &star_idx, &closest_dist);
-	}
+/*
+Find the star box for the observer position.
+For each box in 3x3x3 about that box, check that the origin matches.
 
-	for (int i = 0; i < LENGTH(edges); i++) {
-		if (!face_intersected[edges[i][0]] || !face_intersected[edges[i][1]])
-			continue;
+Each of the 27 slots also has a staging box with its own VBO, and the box it holds is generated on the
+thread pool, aggregates and all, into one of STAR_BOX_STAGING_BUFFERS buffers the slots share. While the observer stays put, the staging box is used to prefetch: the observer's position is
+extrapolated by its velocity, and any slot that would hold a different box there gets that box generated and
+uploaded ahead of time, a box or two per frame as they finish. Once the observer crosses over, the staged box
+is swapped in by copying its VBO into the slot's part of the shared VBO on the GPU, so the crossing frame itself
+does no generating or uploading.
+
+A crossing the prefetch didn't predict (or didn't finish in time) is a miss, and that slot's box gets generated
+on demand instead, showing up a few frames later. Until then the old box keeps drawing. So does a slot that
+can't get a staging buffer, until another slot's box is swapped in and gives one back. Crossed slots come first:
+they take buffers from staged prefetches, and nothing is prefetched while one is waiting. A prefetched box the
+observer stops short of or turns away from gives its buffer back too.
+*/
 
-		//Sphere surrounding pt definitely intersects this bucket, just search it.
-		qvec3 offset = (faces[edges[i][0]] + faces[edges[i][1]]) * (int64_t)bucket_width;
-		bucket_from_pt(sb, pt + offset, &spill_box, &spill_bucket);
-		nearest_star_in_bucket(sb, spill_box, spill_bucket, pt, &star_idx, &closest_dist);
-	}
+static double star_box_ms()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000.0 + t.tv_nsec / 1000000.0;
+}
 
-	for (int i = 0; i < LENGTH(vertices); i++) {
-		if (!face_intersected[vertices[i][0]] || !face_intersected[vertices[i][1]] || !face_intersected[vertices[i][2]])
-			continue;
+static bool star_box_idx_eq(qvec3 a, qvec3 b)
+{
+	return a.x == b.x && a.y == b.y && a.z == b.z;
+}
 
-		//Sphere surrounding pt definitely intersects this bucket, just search it.
-		qvec3 offset = (faces[vertices[i][0]] + faces[vertices[i][1]] + faces[vertices[i][2]]) * (int64_t)bucket_width;
-		bucket_from_pt(sb, pt + offset, &spill_box, &spill_bucket);
-		nearest_star_in_bucket(sb, spill_box, spill_bucket, pt, &star_idx, &closest_dist);
+//Returns false if every staging buffer is taken. A slot with a box staged already reuses its buffer.
+static bool star_box_stage(struct star_box_ctx *sb, uint32_t idx, qvec3 box_idx)
+{
+	struct star_box_pending *p = &sb->pending[idx];
+	if (!p->staging) {
+		if (!sb->num_free_staging)
+			return false;
+		p->staging = sb->free_staging[--sb->num_free_staging];
 	}
+	p->box_idx = box_idx;
+	atomic_store_explicit(&p->state, STAR_BOX_GENERATING, memory_order_relaxed);
+	if (sb->pool) {
+		atomic_fetch_add(&sb->jobs_remaining, 1);
+		thread_pool_submit(sb->pool, (struct thread_pool_job){
+			.fn = star_box_generate_job, .ctx = sb, .begin = idx, .end = idx + 1, .done = &sb->jobs_remaining});
+	} else {
+		star_box_generate_job(sb, idx, idx + 1);
+	}
+	return true;
+}
 
-	if (dist)
-		*dist = closest_dist;
+//Gives a staged slot's buffer back, leaving it idle.
+static void star_box_unstage(struct star_box_ctx *sb, uint32_t idx)
+{
+	struct star_box_pending *p = &sb->pending[idx];
+	sb->free_staging[sb->num_free_staging++] = p->staging;
+	p->staging = NULL;
+	atomic_store_explicit(&p->state, STAR_BOX_IDLE, memory_order_relaxed);
+}
 
-	return star_idx;
+//Unstages a slot that's only prefetching, so a crossed slot can have its buffer. Returns false if none is staged.
+static bool star_box_steal_staging(struct star_box_ctx *sb, const bool crossed[STAR_BOX_NUM_BOXES])
+{
+	for (uint32_t idx = 0; idx < STAR_BOX_NUM_BOXES; idx++) {
+		if (!crossed[idx] && atomic_load_explicit(&sb->pending[idx].state, memory_order_relaxed) == STAR_BOX_STAGED) {
+			star_box_unstage(sb, idx);
+			return true;
+		}
+	}
+	return false;
 }
 
-qvec3 star_box_get_star_origin(struct star_box_ctx *sb, uint32_t star_idx)
+//Laid out the way a slot of sb->vbo is, full detail first. That's 8 bytes a star on the GPU, where int32_t stars took 12.
+static void star_box_upload(uint32_t vbo, struct star_box_pending *p)
 {
-	uint32_t box = star_box_idx_from_star_idx(star_idx);
-	int32_t *star = &sb->stars[star_idx * 3];
-	return sb->origins[box] + (qvec3){star[0], star[1], star[2]};
+	static int16_t vertices[STAR_LOD_VERTEX_SHORTS*STAR_BOX_STARS_PER_BOX];
+	star_lod_vertices(p->staging->stars, p->staging->start_indices, vertices);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, STAR_VERTEX_SIZE*p->num_stars, vertices);
+	glBufferSubData(GL_ARRAY_BUFFER, STAR_VERTEX_SIZE*STAR_BOX_STARS_PER_BOX, STAR_VERTEX_SIZE*p->num_aggregates, p->staging->aggregates);
 }
 
-/*
-Find the star box for the observer position.
-For each box in 3x3x3 about that box, check that the origin matches.
-Generate any box that does not have a matching origin.
-*/
+static void star_box_swap_in(struct star_box_ctx *sb, uint32_t idx)
+{
+	struct star_box_pending *p = &sb->pending[idx];
+	GLintptr slot = STAR_VERTEX_SIZE * STAR_BOX_VERTICES_PER_BOX * idx;
+	glBindBuffer(GL_COPY_READ_BUFFER, sb->staged_vbos[idx]);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, sb->vbo);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, slot, STAR_VERTEX_SIZE*p->num_stars);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, STAR_VERTEX_SIZE*STAR_BOX_STARS_PER_BOX,
+		slot + STAR_VERTEX_SIZE*STAR_BOX_STARS_PER_BOX, STAR_VERTEX_SIZE*p->num_aggregates);
+	sb->origins[idx] = p->box_idx * STAR_BOX_SIZE;
+	sb->num_stars[idx] = p->num_stars;
+	sb->num_aggregates[idx] = p->num_aggregates;
+	memcpy(&sb->stars[idx*3*STAR_BOX_STARS_PER_BOX], p->staging->stars, p->num_stars * STAR_SIZE);
+	memcpy(&sb->start_indices[idx*(STAR_BOX_BUCKETS_PER_BOX + 1)], p->staging->start_indices, sizeof(p->staging->start_indices));
+	star_box_unstage(sb, idx);
+}
 
-void star_box_update(struct star_box_ctx *sb, bpos_origin observer)
+void star_box_update(struct star_box_ctx *sb, bpos_origin observer, vec3 velocity)
 {
+	double start_ms = star_box_ms();
 	bpos_origin center = star_box_round_pt(observer, STAR_BOX_SIZE);
 	bool any_changed = false;
+	uint32_t missing = 0, starved = 0;
+
+	//Where the observer will be, but never more than a box away along any axis, so the prediction is the next
+	//slab to cross into rather than one further out.
+	bpos_origin predicted = observer;
+	for (int i = 0; i < 3; i++)
+		predicted[i] += (int64_t)fclamp(velocity[i] * STAR_BOX_PREFETCH_UPDATES, -STAR_BOX_SIZE, STAR_BOX_SIZE);
 
+	qvec3 box_idxs[STAR_BOX_NUM_BOXES], next_box_idxs[STAR_BOX_NUM_BOXES];
+	bool crossed[STAR_BOX_NUM_BOXES];
 	for (uint32_t i = 0; i < 3; i++) {
 		for (uint32_t j = 0; j < 3; j++) {
 			for (uint32_t k = 0; k < 3; k++) {
 				//vector index of the box, an integer along each axis of the box continuum
-				qvec3 box_idx = qhypertoroidal_buffer_slot(observer, STAR_BOX_SIZE, 3, (qvec3){i,j,k});
-				bpos_origin new_origin = box_idx * STAR_BOX_SIZE;
 				uint32_t idx = i + j * 3 + k * 9;
-				if (memcmp(&new_origin, &sb->origins[idx], sizeof(new_origin))) {
-					any_changed = true;
-					printf("Replacing box at %i, new origin ", idx); qvec3_println(new_origin);
-					//Generate the stars for that star box.
-					sb->origins[idx] = new_origin;
-					star_box_generate(sb, box_idx, idx);
-					glBindBuffer(GL_ARRAY_BUFFER, sb->vbos[idx]);
-					glBufferData(GL_ARRAY_BUFFER, STAR_SIZE*STAR_BOX_STARS_PER_BOX, &sb->stars[idx*3*STAR_BOX_STARS_PER_BOX], GL_STATIC_DRAW);
-				}
+				box_idxs[idx] = qhypertoroidal_buffer_slot(observer, STAR_BOX_SIZE, 3, (qvec3){i,j,k});
+				next_box_idxs[idx] = qhypertoroidal_buffer_slot(predicted, STAR_BOX_SIZE, 3, (qvec3){i,j,k});
+				bpos_origin new_origin = box_idxs[idx] * STAR_BOX_SIZE;
+				crossed[idx] = memcmp(&new_origin, &sb->origins[idx], sizeof(new_origin));
+
+				//A staged box the observer isn't in or heading for any more, since it stopped or turned.
+				struct star_box_pending *p = &sb->pending[idx];
+				if (atomic_load_explicit(&p->state, memory_order_acquire) == STAR_BOX_STAGED &&
+					!star_box_idx_eq(p->box_idx, box_idxs[idx]) && !star_box_idx_eq(p->box_idx, next_box_idxs[idx]))
+					star_box_unstage(sb, idx);
 			}
 		}
 	}
 
+	//Crossed slots get staging buffers first, taking them from prefetches if they have to.
+	for (uint32_t idx = 0; idx < STAR_BOX_NUM_BOXES; idx++) {
+		if (!crossed[idx])
+			continue;
+		struct star_box_pending *p = &sb->pending[idx];
+		unsigned state = atomic_load_explicit(&p->state, memory_order_acquire);
+		bool busy = state == STAR_BOX_GENERATING || state == STAR_BOX_READY;
+		bool wanted = state != STAR_BOX_IDLE && star_box_idx_eq(p->box_idx, box_idxs[idx]);
+		//Generate the stars for that star box.
+		if (!wanted && !busy) {
+			if (star_box_stage(sb, idx, box_idxs[idx]) || (star_box_steal_staging(sb, crossed) && star_box_stage(sb, idx, box_idxs[idx]))) {
+				printf("Replacing box at %i, new origin ", idx); qvec3_println(box_idxs[idx] * STAR_BOX_SIZE);
+			} else {
+				starved++;
+			}
+		}
+		if (!(wanted && state == STAR_BOX_STAGED) && !p->missed) {
+			p->missed = true;
+			sb->stats.prefetch_misses++;
+		}
+	}
+
+	for (uint32_t idx = 0; idx < STAR_BOX_NUM_BOXES; idx++) {
+		struct star_box_pending *p = &sb->pending[idx];
+		unsigned state = atomic_load_explicit(&p->state, memory_order_acquire);
+		bool busy = state == STAR_BOX_GENERATING || state == STAR_BOX_READY;
+		qvec3 box_idx = box_idxs[idx], next_box_idx = next_box_idxs[idx];
+
+		//Prefetches only get the buffers no crossed slot is waiting for.
+		if (!crossed[idx] && !starved && !star_box_idx_eq(next_box_idx, box_idx) && !busy &&
+			(state == STAR_BOX_IDLE || !star_box_idx_eq(p->box_idx, next_box_idx))) {
+			if (star_box_stage(sb, idx, next_box_idx))
+				sb->stats.prefetches++;
+		}
+
+		//Upload boxes as they finish, into the staging VBO. A pool with no worker threads has already finished.
+		if (atomic_load_explicit(&p->state, memory_order_acquire) == STAR_BOX_READY) {
+			star_box_upload(sb->staged_vbos[idx], p);
+			atomic_store_explicit(&p->state, STAR_BOX_STAGED, memory_order_relaxed);
+		}
+
+		if (crossed[idx] && atomic_load_explicit(&p->state, memory_order_relaxed) == STAR_BOX_STAGED &&
+			star_box_idx_eq(p->box_idx, box_idx)) {
+			if (!p->missed)
+				sb->stats.prefetch_hits++;
+			p->missed = false;
+			any_changed = true;
+			star_box_swap_in(sb, idx);
+		} else if (crossed[idx]) {
+			missing++;
+		}
+	}
+
 	if (any_changed) {
 		printf("Updating stars, new center at "); qvec3_print(center); puts("");
 	}
+
+	sb->stats.last_missing = missing;
+	sb->stats.last_update_ms = star_box_ms() - start_ms;
+	if (sb->stats.last_update_ms > sb->stats.max_update_ms)
+		sb->stats.max_update_ms = sb->stats.last_update_ms;
+}
+
+void star_box_print_stats(struct star_box_ctx *sb)
+{
+	printf("Star box: %" PRIu64 " prefetched, %" PRIu64 " crossings hit, %" PRIu64 " missed, update %.3fms last, %.3fms worst\n",
+		sb->stats.prefetches, sb->stats.prefetch_hits, sb->stats.prefetch_misses, sb->stats.last_update_ms, sb->stats.max_update_ms);
+	//Against int32_t stars, with 32-bit bucket starts.
+	size_t old_star_size = sizeof(int32_t) * 3, old_bytes = STAR_BOX_NUM_BOXES * STAR_BOX_STARS_PER_BOX * old_star_size +
+		STAR_BOX_NUM_BOXES * (STAR_BOX_BUCKETS_PER_BOX + 1) * sizeof(uint32_t);
+	printf("Star box: %zu KB of stars and buckets (was %zu KB), %zu KB uploaded per box (was %zu KB)\n",
+		(sizeof(sb->stars) + sizeof(sb->start_indices)) / 1024, old_bytes / 1024,
+		STAR_VERTEX_SIZE * STAR_BOX_STARS_PER_BOX / 1024, old_star_size * STAR_BOX_STARS_PER_BOX / 1024);
+	size_t staging_bytes = STAR_BOX_STAGING_BUFFERS * sizeof(struct star_box_staging);
+	printf("Star box: %zu KB in the context, plus %zu KB in %i staging buffers, %i of them free\n",
+		sizeof(struct star_box_ctx) / 1024, staging_bytes / 1024, STAR_BOX_STAGING_BUFFERS, sb->num_free_staging);
+	uint32_t all_stars = 0;
+	for (int i = 0; i < STAR_BOX_NUM_BOXES; i++)
+		all_stars += sb->num_stars[i];
+	printf("Star box: last draw aggregated %u of %i boxes, %u vertices for %u stars\n",
+		sb->stats.last_aggregate_boxes, STAR_BOX_NUM_BOXES, sb->stats.last_vertices, all_stars);
 }
 
 struct star_box_ctx * star_box_new()
@@ -285,22 +418,49 @@ struct star_box_ctx * star_box_new()
 	return malloc(sizeof(struct star_box_ctx));
 }
 
-struct star_box_ctx * star_box_init(struct star_box_ctx *sb, bpos_origin observer)
+struct star_box_ctx * star_box_init(struct star_box_ctx *sb, bpos_origin observer, thread_pool *pool, const struct galaxy_density *galaxy)
 {
-	srand(101);
-	glGenVertexArrays(STAR_BOX_NUM_BOXES, sb->vaos);
-	glGenBuffers(STAR_BOX_NUM_BOXES, sb->vbos);
+	sb->pool = pool;
+	sb->use_galaxy = galaxy;
+	if (galaxy)
+		sb->galaxy = *galaxy;
+	atomic_init(&sb->jobs_remaining, 0);
+	sb->staging = malloc(STAR_BOX_STAGING_BUFFERS * sizeof(struct star_box_staging));
+	if (!sb->staging)
+		printf("Whoops, running out of memory.\n");
+	for (int i = 0; i < STAR_BOX_STAGING_BUFFERS; i++)
+		sb->free_staging[i] = &sb->staging[i];
+	sb->num_free_staging = STAR_BOX_STAGING_BUFFERS;
+	glGenVertexArrays(1, &sb->vao);
+	glGenBuffers(1, &sb->vbo);
+	glGenBuffers(STAR_BOX_NUM_BOXES, sb->staged_vbos);
+	glBindVertexArray(sb->vao);
+	glEnableVertexAttribArray(effects.star_box.star_pos);
+	glBindBuffer(GL_ARRAY_BUFFER, sb->vbo);
+	glBufferData(GL_ARRAY_BUFFER, STAR_VERTEX_SIZE*STAR_BOX_VERTICES_PER_BOX*STAR_BOX_NUM_BOXES, NULL, GL_STATIC_DRAW);
+	glVertexAttribIPointer(effects.star_box.star_pos, STAR_LOD_VERTEX_SHORTS, GL_SHORT, 0, NULL);
 	for (int i = 0; i < STAR_BOX_NUM_BOXES; i++) {
-		glBindVertexArray(sb->vaos[i]);
-		glEnableVertexAttribArray(effects.star_box.star_pos);
-		glBindBuffer(GL_ARRAY_BUFFER, sb->vbos[i]);
-		glVertexAttribPointer(effects.star_box.star_pos, 3, GL_INT, GL_FALSE, 0, NULL);
+		glBindBuffer(GL_ARRAY_BUFFER, sb->staged_vbos[i]);
+		glBufferData(GL_ARRAY_BUFFER, STAR_VERTEX_SIZE*STAR_BOX_VERTICES_PER_BOX, NULL, GL_STATIC_DRAW);
 		sb->origins[i] = observer + 42; //Subtle bug: An initial 0,0,0 origin would not be generated.
+		sb->num_stars[i] = sb->num_aggregates[i] = 0;
+		atomic_init(&sb->pending[i].state, STAR_BOX_IDLE);
+		sb->pending[i].missed = false;
+		sb->pending[i].staging = NULL;
 	}
-	star_box_update(sb, observer);
+	//Generate as many boxes at once as there are staging buffers, swap them in, and go again until all 27 are in.
+	do {
+		star_box_update(sb, observer, (vec3){0, 0, 0});
+		if (pool)
+			thread_pool_wait(pool, &sb->jobs_remaining);
+		star_box_update(sb, observer, (vec3){0, 0, 0});
+	} while (sb->stats.last_missing);
+	//The first generation isn't a prefetch, so it doesn't count.
+	sb->stats = (struct star_box_stats){0};
 	glUseProgram(effects.star_box.handle);
 	glUniform1f(effects.star_box.star_box_size, STAR_BOX_SIZE);
 	glUniform1f(effects.star_box.bpos_size, BPOS_CELL_SIZE);
+	glUniform1i(effects.star_box.box_vertex_stride, STAR_BOX_VERTICES_PER_BOX);
 	// glUniform1f(effects.star_box.log_depth_intermediate_factor, log_depth_intermediate_factor);
 	glBindVertexArray(0);
 	return sb;
@@ -308,8 +468,13 @@ struct star_box_ctx * star_box_init(struct star_box_ctx *sb, bpos_origin observe
 
 void star_box_deinit(struct star_box_ctx *sb)
 {
-	glDeleteVertexArrays(STAR_BOX_NUM_BOXES, sb->vaos);
-	glDeleteBuffers(STAR_BOX_NUM_BOXES, sb->vbos);
+	//Workers may still be writing into sb.
+	if (sb->pool)
+		thread_pool_wait(sb->pool, &sb->jobs_remaining);
+	glDeleteVertexArrays(1, &sb->vao);
+	glDeleteBuffers(1, &sb->vbo);
+	glDeleteBuffers(STAR_BOX_NUM_BOXES, sb->staged_vbos);
+	free(sb->staging);
 }
 
 void star_box_draw(struct star_box_ctx *sb, bpos_origin camera_origin, float proj_view_mat[16])
@@ -318,16 +483,31 @@ void star_box_draw(struct star_box_ctx *sb, bpos_origin camera_origin, float pro
 	glEnable(GL_BLEND); //We're going to blend the contribution from each individual star.
 	glBlendEquation(GL_FUNC_ADD); //The light contributions get blended additively.
 	glBlendFunc(GL_ONE, GL_ONE); //Just straight addition.
+	//Every box in one go, the shader working out which box a vertex is in from its index.
+	float e[3*STAR_BOX_NUM_BOXES];
+	GLint firsts[STAR_BOX_NUM_BOXES];
+	GLsizei counts[STAR_BOX_NUM_BOXES];
+	sb->stats.last_aggregate_boxes = sb->stats.last_vertices = 0;
 	for (int i = 0; i < STAR_BOX_NUM_BOXES; i++) {
-		glUseProgram(effects.star_box.handle);
-		glBindVertexArray(sb->vaos[i]);
-		glUniformMatrix4fv(effects.star_box.model_view_projection_matrix, 1, GL_TRUE, proj_view_mat);
 		vec3 eye_box_offset = bpos_disp(camera_origin, sb->origins[i]);
-		float e[] = {eye_box_offset.x, eye_box_offset.y, eye_box_offset.z};
-		glUniform3fv(effects.star_box.eye_box_offset, 1, e);
-		// glUniform3fv(effects.sb->eye_box_offset, 1, (float *)&eye_box_offset);
-		glDrawArrays(GL_POINTS, 0, STAR_BOX_STARS_PER_BOX);
+		e[3*i] = eye_box_offset.x;
+		e[3*i + 1] = eye_box_offset.y;
+		e[3*i + 2] = eye_box_offset.z;
+		firsts[i] = i * STAR_BOX_VERTICES_PER_BOX;
+		counts[i] = sb->num_stars[i];
+		if (star_lod_select((int64_t[3]){VEC3_COORDS(sb->origins[i])}, (int64_t[3]){VEC3_COORDS(camera_origin)},
+			STAR_BOX_FULL_DETAIL_DIST) == STAR_LOD_AGGREGATE) {
+			firsts[i] += STAR_BOX_STARS_PER_BOX;
+			counts[i] = sb->num_aggregates[i];
+			sb->stats.last_aggregate_boxes++;
+		}
+		sb->stats.last_vertices += counts[i];
 	}
+	glUseProgram(effects.star_box.handle);
+	glBindVertexArray(sb->vao);
+	glUniformMatrix4fv(effects.star_box.model_view_projection_matrix, 1, GL_TRUE, proj_view_mat);
+	glUniform3fv(effects.star_box.eye_box_offset, STAR_BOX_NUM_BOXES, e);
+	glMultiDrawArrays(GL_POINTS, firsts, counts, STAR_BOX_NUM_BOXES);
 	glDisable(GL_BLEND);
 }
 
@@ -2,31 +2,105 @@
 #define STAR_BOX_H
 #include "math/bpos.h"
 #include "entity/scriptable.h"
+#include "jobs/thread_pool.h"
+#include "space/star_index.h"
+#include "space/star_lod.h"
+#include "space/galaxy_density.h"
+#include <stdatomic.h>
 
 enum {
 	//TODO: Consider if I can just keep this small and multiply in the vertex shader.
-	STAR_BOX_STARS_PER_BOX = 10000, //The number of stars per "star box", of which there are STAR_BOX_NUM_BOXES.
+	STAR_BOX_STARS_PER_BOX = 10000, //The most stars per "star box", of which there are STAR_BOX_NUM_BOXES.
 	STAR_BOX_NUM_BOXES = 27,
-	STAR_BOX_BUCKET_DIVS_PER_AXIS = 16,
-	STAR_BOX_BUCKETS_PER_BOX = STAR_BOX_BUCKET_DIVS_PER_AXIS*STAR_BOX_BUCKET_DIVS_PER_AXIS*STAR_BOX_BUCKET_DIVS_PER_AXIS
+	STAR_BOX_BUCKETS_PER_BOX = STAR_INDEX_CELLS, //Stars are sorted into star_index's cells.
+	STAR_BOX_PREFETCH_UPDATES = 120, //How many updates ahead to extrapolate the observer's position when prefetching.
+	//Each box's slot in the VBO: a vertex per star, then its aggregates, see star_lod.h.
+	STAR_BOX_VERTICES_PER_BOX = STAR_BOX_STARS_PER_BOX + STAR_LOD_MAX_AGGREGATES,
+	//How many boxes can be generating or staged at once. Enough for the observer to cross a whole face of the 3x3x3.
+	STAR_BOX_STAGING_BUFFERS = 9,
+};
+_Static_assert(STAR_BOX_STARS_PER_BOX <= STAR_INDEX_MAX_STARS, "star_index's bucket starts are 16-bit.");
+//How much of the galaxy a star box covers, in the units of galaxy_density. Box (0, 0, 0) is at the galaxy's center.
+#define STAR_BOX_GALAXY_UNITS_PER_BOX 0.25f
+
+enum star_box_pending_state {
+	STAR_BOX_IDLE,
+	STAR_BOX_GENERATING,
+	STAR_BOX_READY, //Generated, waiting for star_box_update to upload it.
+	STAR_BOX_STAGED, //Uploaded to the staging VBO, waiting for the observer to cross into it.
+};
+
+//Where a box is generated before it's swapped in. Slots borrow one from the pool while they're generating or
+//staged, and give it back once the box is swapped in.
+struct star_box_staging {
+	int16_t stars[3*STAR_BOX_STARS_PER_BOX]; //Quantized within their bucket, see star_index.h.
+	uint16_t start_indices[STAR_BOX_BUCKETS_PER_BOX + 1]; //One past the end, so the last bucket has an end too.
+	int16_t aggregates[STAR_LOD_VERTEX_SHORTS*STAR_LOD_MAX_AGGREGATES];
+};
+
+//A slot's staging box. A worker only touches this while it's generating, and hands it back by setting state to
+//STAR_BOX_READY, so the render thread can keep drawing and searching the live box the whole time.
+struct star_box_pending {
+	atomic_uint state;
+	bool missed; //The observer crossed into this slot before its box was staged.
+	qvec3 box_idx;
+	uint16_t num_stars;
+	uint16_t num_aggregates;
+	struct star_box_staging *staging; //NULL while the slot is idle.
+};
+
+struct star_box_stats {
+	uint64_t prefetches; //Boxes generated ahead of the observer.
+	uint64_t prefetch_hits, prefetch_misses; //Box crossings that found the box staged already, or didn't.
+	double last_update_ms, max_update_ms; //Time spent in star_box_update, the worst being the frame spike.
+	uint32_t last_aggregate_boxes, last_vertices; //How many boxes the last draw aggregated, and the vertices it drew.
+	uint32_t last_missing; //Slots the observer is in whose box isn't swapped in yet, as of the last update.
 };
 
 struct star_box_ctx {
-	uint32_t       vaos[STAR_BOX_NUM_BOXES];
-	uint32_t       vbos[STAR_BOX_NUM_BOXES];
+	uint32_t vao;
+	uint32_t vbo; //Every box, STAR_BOX_VERTICES_PER_BOX apiece, so they all draw at once.
+	uint32_t staged_vbos[STAR_BOX_NUM_BOXES];
 	bpos_origin origins[STAR_BOX_NUM_BOXES];
-	int32_t       stars[STAR_BOX_NUM_BOXES*3*STAR_BOX_STARS_PER_BOX];
-	uint32_t start_indices[STAR_BOX_NUM_BOXES * STAR_BOX_BUCKETS_PER_BOX];
+	uint16_t  num_stars[STAR_BOX_NUM_BOXES]; //Each box's stars are at the start of its STAR_BOX_STARS_PER_BOX.
+	uint16_t num_aggregates[STAR_BOX_NUM_BOXES];
+	int16_t       stars[STAR_BOX_NUM_BOXES*3*STAR_BOX_STARS_PER_BOX];
+	uint16_t start_indices[STAR_BOX_NUM_BOXES * (STAR_BOX_BUCKETS_PER_BOX + 1)];
+	thread_pool *pool; //NULL generates boxes inline.
+	bool use_galaxy; //Otherwise every box gets STAR_BOX_STARS_PER_BOX stars, evenly spread.
+	struct galaxy_density galaxy;
+	atomic_size_t jobs_remaining;
+	struct star_box_pending pending[STAR_BOX_NUM_BOXES];
+	struct star_box_staging *staging; //STAR_BOX_STAGING_BUFFERS of them, only touched by the render thread.
+	struct star_box_staging *free_staging[STAR_BOX_STAGING_BUFFERS];
+	int num_free_staging;
+	struct star_box_stats stats;
 };
 
-void star_box_update(struct star_box_ctx *sb, bpos_origin observer);
+//Swap in boxes for any slot the observer has crossed into, and prefetch the boxes it's heading towards.
+//velocity is in bpos cells per update.
+void star_box_update(struct star_box_ctx *sb, bpos_origin observer, vec3 velocity);
+//Print the prefetch hit/miss counts and update times, and the memory the stars take.
+void star_box_print_stats(struct star_box_ctx *sb);
 void star_box_draw(struct star_box_ctx *sb, bpos_origin camera_origin, float proj_view_mat[16]);
 struct star_box_ctx * star_box_new();
 void star_box_free(struct star_box_ctx *sb);
-struct star_box_ctx * star_box_init(struct star_box_ctx *sb, bpos_origin observer);
+//Generate and upload every box around observer before returning. Later updates generate boxes on pool.
+//If galaxy is not NULL, it decides how many stars each part of each box gets.
+struct star_box_ctx * star_box_init(struct star_box_ctx *sb, bpos_origin observer, thread_pool *pool, const struct galaxy_density *galaxy);
 void star_box_deinit(struct star_box_ctx *sb);
 
+//Star indices count across all the boxes, so any of them can be passed to star_box_get_star_origin.
 uint32_t star_box_find_nearest_star_idx(struct star_box_ctx *sb, bpos_origin pt, double *dist);
+//The (up to) k stars nearest pt, nearest first. dist can be NULL. Returns how many were found.
+size_t star_box_find_nearest_stars(struct star_box_ctx *sb, bpos_origin pt, size_t k, uint32_t *star_idx, double *dist);
+//Every star within radius of pt. Returns how many there are, but only writes up to max.
+size_t star_box_find_stars_in_radius(struct star_box_ctx *sb, bpos_origin pt, double radius, uint32_t *star_idx, size_t max);
+//The nearest star within half_angle radians of looking along dir from pt, for picking. Returns UINT32_MAX if none.
+uint32_t star_box_find_star_in_cone(struct star_box_ctx *sb, bpos_origin pt, vec3 dir, double half_angle, double max_dist, double *dist);
+//Generate box_idx's stars, sorted into buckets for star_index, and return how many there are. Only depends on
+//box_idx and galaxy, which can be NULL, so a box comes out the same on any thread.
+uint16_t star_box_generate(const struct galaxy_density *galaxy, qvec3 box_idx, int16_t *stars, uint16_t *buckets);
 qvec3 star_box_get_star_origin(struct star_box_ctx *sb, uint32_t star_idx);
 uint32_t star_box_idx_from_star_idx(uint32_t star_idx);
 
@@ -0,0 +1,380 @@
+#include "star_index.h"
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#define STAR_INDEX_HALF_BOX (STAR_INDEX_BOX_SIZE / 2)
+#define STAR_INDEX_CELL_SIZE (STAR_INDEX_BOX_SIZE / STAR_INDEX_DIVS)
+#define STAR_INDEX_STEP ((double)(1 << STAR_INDEX_STEP_SHIFT))
+#define STAR_INDEX_MAX_BOXES 64
+
+//Spread the 4 bits of a cell coordinate out to every third bit, for interleaving.
+static const uint32_t star_index_spread[STAR_INDEX_DIVS] = {
+	0, 1, 8, 9, 64, 65, 72, 73, 512, 513, 520, 521, 576, 577, 584, 585
+};
+
+uint32_t star_index_morton(const int c[3])
+{
+	return star_index_spread[c[0]] | star_index_spread[c[1]] << 1 | star_index_spread[c[2]] << 2;
+}
+
+static int star_index_coord(int32_t v)
+{
+	//Flip the sign bit to get the offset from the box's low corner, the top bits are the cell.
+	return ((uint32_t)v ^ 0x80000000u) >> (32 - 4);
+}
+
+uint32_t star_index_cell(const int32_t star[3])
+{
+	int c[3] = {star_index_coord(star[0]), star_index_coord(star[1]), star_index_coord(star[2])};
+	return star_index_morton(c);
+}
+
+void star_index_cell_coords(uint32_t cell, int c[3])
+{
+	for (int a = 0; a < 3; a++) {
+		c[a] = 0;
+		for (int bit = 0; bit < 4; bit++)
+			c[a] |= (cell >> (3 * bit + a) & 1) << bit;
+	}
+}
+
+//Where a quantized offset of 0 puts a star along an axis of cell coordinate c: the middle of the cell,
+//plus half a step so every star is in the middle of its step.
+static double star_index_zero(int c)
+{
+	return c * STAR_INDEX_CELL_SIZE - STAR_INDEX_HALF_BOX + STAR_INDEX_CELL_SIZE / 2 + STAR_INDEX_STEP / 2;
+}
+
+void star_index_quantize(const int32_t star[3], int16_t q[3])
+{
+	for (int a = 0; a < 3; a++) {
+		uint32_t in_cell = ((uint32_t)star[a] ^ 0x80000000u) & ((1u << (32 - 4)) - 1);
+		q[a] = (int32_t)(in_cell >> STAR_INDEX_STEP_SHIFT) - 32768;
+	}
+}
+
+void star_index_decode(const int16_t q[3], uint32_t cell, int32_t star[3])
+{
+	int c[3];
+	star_index_cell_coords(cell, c);
+	for (int a = 0; a < 3; a++)
+		star[a] = (int32_t)(star_index_zero(c[a]) + q[a] * STAR_INDEX_STEP);
+}
+
+void star_index_build(uint32_t num, star_index_star_fn *star_fn, void *ctx, int16_t *stars, uint16_t *cell_starts)
+{
+	assert(num <= STAR_INDEX_MAX_STARS);
+	//The number of stars in each cell
+	uint32_t cell_counts[STAR_INDEX_CELLS] = {0};
+	int32_t star[3];
+	for (uint32_t i = 0; i < num; i++) {
+		star_fn(ctx, i, star);
+		cell_counts[star_index_cell(star)]++;
+	}
+
+	//Each cell stores the start index of the stars within it.
+	uint32_t start = 0;
+	for (uint32_t i = 0; i < STAR_INDEX_CELLS; i++) {
+		cell_starts[i] = start;
+		start += cell_counts[i];
+		cell_counts[i] = cell_starts[i]; //Now where the next star in the cell goes.
+	}
+	cell_starts[STAR_INDEX_CELLS] = start;
+
+	for (uint32_t i = 0; i < num; i++) {
+		star_fn(ctx, i, star);
+		star_index_quantize(star, &stars[3 * cell_counts[star_index_cell(star)]++]);
+	}
+}
+
+uint32_t star_index_cell_of(const uint16_t *cell_starts, uint32_t i)
+{
+	//The last cell starting at or before i. Empty cells start where the next one does, so that's never one of them.
+	uint32_t lo = 0, hi = STAR_INDEX_CELLS;
+	while (hi - lo > 1) {
+		uint32_t mid = (lo + hi) / 2;
+		if (cell_starts[mid] <= i)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static double star_index_axis_dist(double p, double lo, double hi)
+{
+	return p < lo ? lo - p : p > hi ? p - hi : 0;
+}
+
+static double star_index_cell_dist2(const int c[3], const double p[3])
+{
+	double d2 = 0;
+	for (int a = 0; a < 3; a++) {
+		double lo = c[a] * STAR_INDEX_CELL_SIZE - STAR_INDEX_HALF_BOX;
+		double d = star_index_axis_dist(p[a], lo, lo + STAR_INDEX_CELL_SIZE);
+		d2 += d * d;
+	}
+	return d2;
+}
+
+static double star_index_box_dist2(const double p[3])
+{
+	double d2 = 0;
+	for (int a = 0; a < 3; a++) {
+		double d = star_index_axis_dist(p[a], -STAR_INDEX_HALF_BOX, STAR_INDEX_HALF_BOX);
+		d2 += d * d;
+	}
+	return d2;
+}
+
+//p is relative to the star's cell zero, see star_index_cell_p.
+static double star_index_star_dist2(const int16_t *q, const double p[3])
+{
+	double dx = q[0] * STAR_INDEX_STEP - p[0], dy = q[1] * STAR_INDEX_STEP - p[1], dz = q[2] * STAR_INDEX_STEP - p[2];
+	return dx * dx + dy * dy + dz * dz;
+}
+
+//Box-relative p, made relative to where a quantized offset of 0 is in cell c.
+static void star_index_cell_p(const int c[3], const double p[3], double cell_p[3])
+{
+	for (int a = 0; a < 3; a++)
+		cell_p[a] = p[a] - star_index_zero(c[a]);
+}
+
+//Called on each cell that could hold something closer than *limit2, with p relative to the cell's zero.
+//base is the box's first star index, box * stars_per_box.
+typedef void star_index_visit_fn(void *ctx, const int16_t *stars, uint32_t begin, uint32_t end, uint32_t base, const double p[3]);
+
+/*
+Visit a box's cells in rings of growing Chebyshev distance around the cell nearest p.
+Everything outside ring r-1 is at least as far as the nearest inner face of that cube of cells
+(faces on the box's boundary have nothing past them), so once that's further than *limit2 we're done.
+*/
+static void star_index_visit_box(const struct star_index_box *box, uint32_t base, const double p[3],
+	const double *limit2, star_index_visit_fn *visit, void *ctx)
+{
+	int home[3];
+	for (int a = 0; a < 3; a++) {
+		double c = floor((p[a] + STAR_INDEX_HALF_BOX) / STAR_INDEX_CELL_SIZE);
+		home[a] = c < 0 ? 0 : c >= STAR_INDEX_DIVS ? STAR_INDEX_DIVS - 1 : c;
+	}
+
+	for (int r = 0; r < STAR_INDEX_DIVS; r++) {
+		if (r > 0) {
+			double bound = INFINITY;
+			for (int a = 0; a < 3; a++) {
+				int lo = home[a] - (r - 1), hi = home[a] + (r - 1);
+				if (lo > 0)
+					bound = fmin(bound, fmax(0, p[a] - (lo * STAR_INDEX_CELL_SIZE - STAR_INDEX_HALF_BOX)));
+				if (hi < STAR_INDEX_DIVS - 1)
+					bound = fmin(bound, fmax(0, ((hi + 1) * STAR_INDEX_CELL_SIZE - STAR_INDEX_HALF_BOX) - p[a]));
+			}
+			if (bound == INFINITY || bound * bound > *limit2)
+				return;
+		}
+
+		int lo[3], hi[3];
+		for (int a = 0; a < 3; a++) {
+			lo[a] = home[a] - r < 0 ? 0 : home[a] - r;
+			hi[a] = home[a] + r >= STAR_INDEX_DIVS ? STAR_INDEX_DIVS - 1 : home[a] + r;
+		}
+		int c[3];
+		for (c[0] = lo[0]; c[0] <= hi[0]; c[0]++) {
+			for (c[1] = lo[1]; c[1] <= hi[1]; c[1]++) {
+				bool on_ring = abs(c[0] - home[0]) == r || abs(c[1] - home[1]) == r;
+				//Inside the ring on x and y, only the two z ends are on it.
+				int step = on_ring || r == 0 ? 1 : 2 * r;
+				for (c[2] = home[2] - r; c[2] <= home[2] + r; c[2] += step) {
+					if (c[2] < lo[2] || c[2] > hi[2])
+						continue;
+					if (star_index_cell_dist2(c, p) > *limit2)
+						continue;
+					uint32_t cell = star_index_morton(c);
+					if (box->cell_starts[cell] < box->cell_starts[cell + 1]) {
+						double cell_p[3];
+						star_index_cell_p(c, p, cell_p);
+						visit(ctx, box->stars, box->cell_starts[cell], box->cell_starts[cell + 1], base, cell_p);
+					}
+				}
+			}
+		}
+	}
+}
+
+//Visit boxes nearest first, skipping any that are entirely further than *limit2.
+static void star_index_visit(const struct star_index_box *boxes, size_t num_boxes, uint32_t stars_per_box,
+	const int64_t pt[3], const double *limit2, star_index_visit_fn *visit, void *ctx)
+{
+	assert(num_boxes <= STAR_INDEX_MAX_BOXES);
+	double p[STAR_INDEX_MAX_BOXES][3], d2[STAR_INDEX_MAX_BOXES];
+	size_t order[STAR_INDEX_MAX_BOXES];
+	for (size_t b = 0; b < num_boxes; b++) {
+		for (int a = 0; a < 3; a++)
+			p[b][a] = (double)(pt[a] - boxes[b].origin[a]);
+		d2[b] = star_index_box_dist2(p[b]);
+		size_t i = b;
+		for (; i > 0 && d2[order[i - 1]] > d2[b]; i--)
+			order[i] = order[i - 1];
+		order[i] = b;
+	}
+	for (size_t i = 0; i < num_boxes; i++) {
+		size_t b = order[i];
+		if (d2[b] > *limit2)
+			break;
+		star_index_visit_box(&boxes[b], b * stars_per_box, p[b], limit2, visit, ctx);
+	}
+}
+
+struct star_index_knn_ctx {
+	size_t k, num;
+	uint32_t *star_idx;
+	double *dist2;
+	double limit2;
+};
+
+static void star_index_knn_visit(void *ctx, const int16_t *stars, uint32_t begin, uint32_t end, uint32_t base, const double p[3])
+{
+	struct star_index_knn_ctx *q = ctx;
+	for (uint32_t i = begin; i < end; i++) {
+		double d2 = star_index_star_dist2(&stars[3*i], p);
+		if (d2 >= q->limit2)
+			continue;
+		//Insertion into the sorted list of the best k so far.
+		size_t j = q->num < q->k ? q->num++ : q->k - 1;
+		for (; j > 0 && q->dist2[j - 1] > d2; j--) {
+			q->dist2[j] = q->dist2[j - 1];
+			q->star_idx[j] = q->star_idx[j - 1];
+		}
+		q->dist2[j] = d2;
+		q->star_idx[j] = base + i;
+		if (q->num == q->k)
+			q->limit2 = q->dist2[q->k - 1];
+	}
+}
+
+size_t star_index_knn(const struct star_index_box *boxes, size_t num_boxes, uint32_t stars_per_box,
+	const int64_t pt[3], size_t k, uint32_t *star_idx, double *dist2)
+{
+	if (!k)
+		return 0;
+	struct star_index_knn_ctx q = {
+		.k = k,
+		.star_idx = star_idx,
+		.dist2 = dist2 ? dist2 : malloc(k * sizeof(double)),
+		.limit2 = INFINITY,
+	};
+	if (!q.dist2) {
+		printf("Whoops, running out of memory.\n");
+		return 0;
+	}
+	star_index_visit(boxes, num_boxes, stars_per_box, pt, &q.limit2, star_index_knn_visit, &q);
+	if (!dist2)
+		free(q.dist2);
+	return q.num;
+}
+
+size_t star_index_radius(const struct star_index_box *boxes, size_t num_boxes, uint32_t stars_per_box,
+	const int64_t pt[3], double radius, uint32_t *star_idx, size_t max)
+{
+	double r2 = radius * radius;
+	size_t num = 0;
+	for (size_t b = 0; b < num_boxes; b++) {
+		const struct star_index_box *box = &boxes[b];
+		double p[3];
+		int lo[3], hi[3];
+		for (int a = 0; a < 3; a++) {
+			p[a] = (double)(pt[a] - box->origin[a]);
+			double l = floor((p[a] - radius + STAR_INDEX_HALF_BOX) / STAR_INDEX_CELL_SIZE);
+			double h = floor((p[a] + radius + STAR_INDEX_HALF_BOX) / STAR_INDEX_CELL_SIZE);
+			lo[a] = l < 0 ? 0 : l;
+			hi[a] = h >= STAR_INDEX_DIVS ? STAR_INDEX_DIVS - 1 : h;
+		}
+		if (star_index_box_dist2(p) > r2)
+			continue;
+		int c[3];
+		for (c[0] = lo[0]; c[0] <= hi[0]; c[0]++) {
+			for (c[1] = lo[1]; c[1] <= hi[1]; c[1]++) {
+				for (c[2] = lo[2]; c[2] <= hi[2]; c[2]++) {
+					if (star_index_cell_dist2(c, p) > r2)
+						continue;
+					uint32_t cell = star_index_morton(c);
+					double cell_p[3];
+					star_index_cell_p(c, p, cell_p);
+					for (uint32_t i = box->cell_starts[cell]; i < box->cell_starts[cell + 1]; i++) {
+						if (star_index_star_dist2(&box->stars[3*i], cell_p) > r2)
+							continue;
+						if (num < max)
+							star_idx[num] = b * stars_per_box + i;
+						num++;
+					}
+				}
+			}
+		}
+	}
+	return num;
+}
+
+struct star_index_cone_ctx {
+	double dir[3];
+	double cos_half_angle;
+	double limit2;
+	uint32_t star_idx;
+};
+
+static void star_index_cone_visit(void *ctx, const int16_t *stars, uint32_t begin, uint32_t end, uint32_t base, const double p[3])
+{
+	struct star_index_cone_ctx *q = ctx;
+
+	//Skip the whole cell if its bounding sphere is outside the cone: the angle to its center, less the angle
+	//the sphere covers from p, has to be within the cone's half angle.
+	double v[3], d = 0, t = 0;
+	for (int a = 0; a < 3; a++) {
+		v[a] = -STAR_INDEX_STEP / 2 - p[a]; //The cell's center is half a step before its zero.
+		d += v[a] * v[a];
+		t += v[a] * q->dir[a];
+	}
+	d = sqrt(d);
+	double r = STAR_INDEX_CELL_SIZE * sqrt(3) / 2;
+	if (d > r) {
+		double cos_center = t / d, sin_center = sqrt(fmax(0, 1 - cos_center * cos_center));
+		double cos_cover = sqrt(d * d - r * r) / d, sin_cover = r / d;
+		//cos(angle to center - angle covered), unless the cell covers more than the angle to its center.
+		double cos_nearest = cos_center * cos_cover + sin_center * sin_cover;
+		if (cos_center < cos_cover && cos_nearest < q->cos_half_angle)
+			return;
+	}
+
+	for (uint32_t i = begin; i < end; i++) {
+		const int16_t *star = &stars[3*i];
+		double d2 = star_index_star_dist2(star, p);
+		if (d2 >= q->limit2 || d2 == 0)
+			continue;
+		double along = 0;
+		for (int a = 0; a < 3; a++)
+			along += (star[a] * STAR_INDEX_STEP - p[a]) * q->dir[a];
+		if (along < 0 || along * along < d2 * q->cos_half_angle * q->cos_half_angle)
+			continue;
+		q->limit2 = d2;
+		q->star_idx = base + i;
+	}
+}
+
+uint32_t star_index_cone(const struct star_index_box *boxes, size_t num_boxes, uint32_t stars_per_box,
+	const int64_t pt[3], const double dir[3], double half_angle, double max_dist, double *dist)
+{
+	double len = sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+	struct star_index_cone_ctx q = {
+		.dir = {dir[0] / len, dir[1] / len, dir[2] / len},
+		.cos_half_angle = cos(half_angle),
+		//Just past max_dist, so a star exactly at max_dist still counts.
+		.limit2 = nextafter(max_dist * max_dist, INFINITY),
+		.star_idx = UINT32_MAX,
+	};
+	star_index_visit(boxes, num_boxes, stars_per_box, pt, &q.limit2, star_index_cone_visit, &q);
+	if (dist)
+		*dist = q.star_idx == UINT32_MAX ? INFINITY : sqrt(q.limit2);
+	return q.star_idx;
+}
@@ -0,0 +1,72 @@
+#ifndef STAR_INDEX_H
+#define STAR_INDEX_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+/*
+Spatial queries over the stars in a set of star boxes.
+
+Star positions are relative to the box origin, covering [-2^31, 2^31) on each axis. The box is split into a
+STAR_INDEX_DIVS^3 grid, and the stars are sorted by cell with the cells numbered in Morton (Z-order) order, so
+cells that are near each other in space are mostly near each other in memory. cell_starts[c] is the index of
+the first star in cell c, with one extra entry at the end.
+
+Since a star's cell follows from its index, each star only stores its offset within the cell, quantized to
+int16_t: cells are 2^28 wide, so that's steps of 2^12, tiny next to the 2^27 or so between neighbouring
+stars in a star box. Every star sits in the middle of its step. That's 6 bytes a star instead of 12.
+
+Queries take a point relative to some common origin (each box's origin is given relative to the same one),
+and return star indices as box * stars_per_box + index within the box, as star_box uses them.
+Distances are in the same units as the coordinates. Candidates are compared by squared distance, and whole
+cells and boxes are skipped as soon as they can't hold anything closer than what's already been found.
+*/
+
+#define STAR_INDEX_BOX_SIZE 4294967296.0 //Width of a box, 2^32.
+#define STAR_INDEX_MAX_STARS UINT16_MAX //Per box, so cell_starts fit in 16 bits.
+
+enum {
+	STAR_INDEX_DIVS = 16, //Cells along each axis of a box.
+	STAR_INDEX_CELLS = STAR_INDEX_DIVS * STAR_INDEX_DIVS * STAR_INDEX_DIVS,
+	STAR_INDEX_STEP_SHIFT = 12, //Quantized offsets count steps of 2^12.
+};
+
+struct star_index_box {
+	const int16_t *stars; //Quantized, 3 per star
+	const uint16_t *cell_starts; //STAR_INDEX_CELLS + 1 entries
+	int64_t origin[3];
+};
+
+//Write star i's box-relative position to star. Called twice per star while building, so it has to be repeatable.
+typedef void star_index_star_fn(void *ctx, uint32_t i, int32_t star[3]);
+
+//Morton-order cell that a box-relative star falls into.
+uint32_t star_index_cell(const int32_t star[3]);
+//The grid coordinates of a cell, each in [0, STAR_INDEX_DIVS).
+void star_index_cell_coords(uint32_t cell, int c[3]);
+//The Morton-order cell at grid coordinates c, the other way around.
+uint32_t star_index_morton(const int c[3]);
+//Quantize the num (up to STAR_INDEX_MAX_STARS) stars given by star_fn into stars, sorted by cell, and fill in
+//cell_starts (STAR_INDEX_CELLS + 1 entries). Stars in the same cell keep their order.
+void star_index_build(uint32_t num, star_index_star_fn *star_fn, void *ctx, int16_t *stars, uint16_t *cell_starts);
+//The cell holding the star at index i, from cell_starts.
+uint32_t star_index_cell_of(const uint16_t *cell_starts, uint32_t i);
+//Quantize a box-relative star within its cell, as star_index_build does.
+void star_index_quantize(const int32_t star[3], int16_t q[3]);
+//The box-relative position of a quantized star in cell.
+void star_index_decode(const int16_t q[3], uint32_t cell, int32_t star[3]);
+
+//Find the (up to) k stars nearest to pt, nearest first. Returns how many were found.
+//dist2 can be NULL, otherwise it gets each star's squared distance.
+size_t star_index_knn(const struct star_index_box *boxes, size_t num_boxes, uint32_t stars_per_box,
+	const int64_t pt[3], size_t k, uint32_t *star_idx, double *dist2);
+//Find the stars within radius of pt, in no particular order. Returns how many there are, but only writes up to max.
+size_t star_index_radius(const struct star_index_box *boxes, size_t num_boxes, uint32_t stars_per_box,
+	const int64_t pt[3], double radius, uint32_t *star_idx, size_t max);
+//Find the nearest star to pt that is within half_angle (radians, less than pi/2) of the ray from pt along dir,
+//and no further than max_dist. A star right at pt doesn't count. dir doesn't need to be normalized.
+//Returns UINT32_MAX if there isn't one.
+uint32_t star_index_cone(const struct star_index_box *boxes, size_t num_boxes, uint32_t stars_per_box,
+	const int64_t pt[3], const double dir[3], double half_angle, double max_dist, double *dist);
+
+#endif
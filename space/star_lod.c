@@ -0,0 +1,73 @@
+#include "star_lod.h"
+#include <math.h>
+#include <string.h>
+
+enum star_lod_level star_lod_select(const int64_t box_origin[3], const int64_t eye[3], double full_detail_dist)
+{
+	double d2 = 0;
+	for (int a = 0; a < 3; a++) {
+		double d = fabs((double)(eye[a] - box_origin[a])) - STAR_INDEX_BOX_SIZE / 2;
+		if (d > 0)
+			d2 += d * d;
+	}
+	return d2 > full_detail_dist * full_detail_dist ? STAR_LOD_AGGREGATE : STAR_LOD_FULL;
+}
+
+static int16_t star_lod_pack(uint32_t cell, int brightness)
+{
+	int c[3];
+	star_index_cell_coords(cell, c);
+	return (int16_t)(uint16_t)(c[0] | c[1] << 4 | c[2] << 8 | brightness << 12);
+}
+
+void star_lod_vertices(const int16_t *stars, const uint16_t *cell_starts, int16_t *vertices)
+{
+	for (uint32_t cell = 0; cell < STAR_INDEX_CELLS; cell++) {
+		int16_t packed = star_lod_pack(cell, 0);
+		for (uint32_t i = cell_starts[cell]; i < cell_starts[cell + 1]; i++) {
+			memcpy(&vertices[STAR_LOD_VERTEX_SHORTS*i], &stars[3*i], 3 * sizeof(int16_t));
+			vertices[STAR_LOD_VERTEX_SHORTS*i + 3] = packed;
+		}
+	}
+}
+
+uint16_t star_lod_aggregate(const int16_t *stars, const uint16_t *cell_starts, int16_t *vertices)
+{
+	uint16_t num = 0;
+	for (uint32_t block = 0; block < STAR_LOD_MAX_AGGREGATES; block++) {
+		uint32_t first = block << STAR_LOD_BLOCK_SHIFT, last = first + (1 << STAR_LOD_BLOCK_SHIFT);
+		uint32_t count = cell_starts[last] - cell_starts[first];
+		if (!count)
+			continue;
+
+		int64_t sum[3] = {0};
+		for (uint32_t cell = first; cell < last; cell++) {
+			for (uint32_t i = cell_starts[cell]; i < cell_starts[cell + 1]; i++) {
+				int32_t star[3];
+				star_index_decode(&stars[3*i], cell, star);
+				for (int a = 0; a < 3; a++)
+					sum[a] += star[a];
+			}
+		}
+		//The mean is inside the block, since the block is a cube, so it's inside one of the block's buckets.
+		int32_t mean[3];
+		for (int a = 0; a < 3; a++)
+			mean[a] = (int32_t)llround((double)sum[a] / count);
+		int brightness = (int)lround(log2(count));
+		if (brightness > STAR_LOD_MAX_BRIGHTNESS)
+			brightness = STAR_LOD_MAX_BRIGHTNESS;
+
+		int16_t *v = &vertices[STAR_LOD_VERTEX_SHORTS*num++];
+		star_index_quantize(mean, v);
+		v[3] = star_lod_pack(star_index_cell(mean), brightness);
+	}
+	return num;
+}
+
+void star_lod_decode(const int16_t vertex[STAR_LOD_VERTEX_SHORTS], int32_t star[3], int *brightness)
+{
+	uint16_t packed = vertex[3];
+	int c[3] = {packed & 15, packed >> 4 & 15, packed >> 8 & 15};
+	star_index_decode(vertex, star_index_morton(c), star);
+	*brightness = packed >> 12;
+}
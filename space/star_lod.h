@@ -0,0 +1,40 @@
+#ifndef STAR_LOD_H
+#define STAR_LOD_H
+#include "space/star_index.h"
+#include <inttypes.h>
+
+/*
+Levels of detail for drawing a box of stars, and the vertices for each. No GL in here.
+
+A vertex is 4 shorts: a star's quantized offset within its bucket (see star_index.h), then the bucket's grid
+coordinates x | y << 4 | z << 8 and a brightness level in the top 4 bits. The vertex shader can't get a star's
+bucket from its index the way star_index does, hence carrying it along.
+
+At full detail there's a vertex for every star, at brightness level 0. Aggregate boxes have one vertex for each
+2x2x2 block of buckets instead, since a block is 8 buckets in a row in Morton order. It's placed at the mean of
+the block's stars, and shines as brightly as all of them together, as a level of round(log2(count)).
+Every star is equally bright for now, so that's the brightness-weighted centroid and the total brightness.
+*/
+
+enum {
+	STAR_LOD_VERTEX_SHORTS = 4,
+	STAR_LOD_BLOCK_SHIFT = 3, //Buckets per aggregate, as a power of 2.
+	STAR_LOD_MAX_AGGREGATES = STAR_INDEX_CELLS >> STAR_LOD_BLOCK_SHIFT,
+	STAR_LOD_MAX_BRIGHTNESS = 15,
+};
+
+enum star_lod_level {
+	STAR_LOD_FULL,
+	STAR_LOD_AGGREGATE,
+};
+
+//Level of detail for a box, from how far eye is from the nearest point of it. Same units as star_index.
+enum star_lod_level star_lod_select(const int64_t box_origin[3], const int64_t eye[3], double full_detail_dist);
+//One vertex per star, for the cell_starts[STAR_INDEX_CELLS] stars as star_index_build leaves them.
+void star_lod_vertices(const int16_t *stars, const uint16_t *cell_starts, int16_t *vertices);
+//One vertex per non-empty block of buckets, up to STAR_LOD_MAX_AGGREGATES. Returns how many.
+uint16_t star_lod_aggregate(const int16_t *stars, const uint16_t *cell_starts, int16_t *vertices);
+//A vertex's box-relative position and brightness level, as the vertex shader reads it.
+void star_lod_decode(const int16_t vertex[STAR_LOD_VERTEX_SHORTS], int32_t star[3], int *brightness);
+
+#endif
@@ -0,0 +1,437 @@
+#include "terrain_lod.h"
+#include "macros.h"
+#include "math/utility.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//Adapted from http://www.glprogramming.com/red/chapter02.html
+static const float x = 0.525731112119133606;
+static const float z = 0.850650808352039932;
+static const vec3 ico_v[] = {
+	{-x,  0, z}, { x,  0,  z}, {-x, 0, -z}, { x, 0, -z}, {0,  z, x}, { 0,  z, -x},
+	{ 0, -z, x}, { 0, -z, -x}, { z, x,  0}, {-z, x,  0}, {z, -x, 0}, {-z, -x,  0}
+};
+
+static const int ico_i[] = {
+	1,0,4,   9,4,0,   9,5,4,   8,4,5,   4,8,1,  10,1,8,  10,8,3,  5,3,8,   3,5,2,  9,2,5,
+	3,7,10,  6,10,7,  7,11,6,  0,6,11,  0,1,6,  10,6,1,  0,11,9,  2,9,11,  3,2,7,  11,7,2,
+};
+
+//Texture coordinates for each vertex of a face. Pairs of faces share a texture.
+static const float ico_tx[] = {
+	0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,  0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,
+	0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,  0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,
+	0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,  0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,
+	0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,  0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,
+	0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,  0.0,0.0, 1.0,0.0, 0.0,1.0,  1.0,1.0, 0.0,1.0, 1.0,0.0,
+};
+
+//In my debug view, these colors are applied to tiles based on the number of times they've been split.
+static const vec3 terrain_lod_color_by_depth[] = {
+	{1.0, 0.0, 0.0}, //Red
+	{0.5, 0.5, 0.0}, //Yellow
+	{0.0, 1.0, 0.0}, //Green
+	{0.0, 0.5, 0.5}, //Cyan
+	{0.0, 0.0, 1.0}, //Blue
+	{0.5, 0.0, 0.5}, //Purple
+};
+
+struct terrain_lod_context {
+	struct terrain_lod *lod;
+	const struct terrain_lod_view *view;
+	int splits_left;
+	tri_tile **tiles;
+	int num_tiles;
+	int max_tiles;
+	float parent_levels[TERRAIN_LOD_MAX_DEPTH]; //Of the expanded nodes above the one being visited, by depth.
+};
+
+static tri_tile * tree_tile(quadtree_node *tree)
+{
+	return (tri_tile *)tree->data;
+}
+
+static float splits_per_distance(float distance, float scale, float max_subdivisions)
+{
+	return fmax(fmin(log2(scale/distance), max_subdivisions), 0);
+}
+
+static bool above_horizon(struct terrain_lod *lod, tri_tile *tile, const struct terrain_lod_view *view)
+{
+	vec3 cam_pos = bpos_remap(view->cam_pos, (bpos_origin){0});
+	vec3 tile_pos = bpos_remap((bpos){tile->centroid, tile->offset}, (bpos_origin){0});
+	float altitude = fmax(vec3_mag(cam_pos) - lod->params.radius, 0);
+	return view->debug || distance_to_horizon(lod->params.radius, altitude) > (vec3_dist(cam_pos, tile_pos) - tile->radius);
+}
+
+//A sphere around all of a tile's terrain, relative to the camera: the flat tile, bulged out onto the planet, plus
+//the highest the terrain goes. Returns the radius.
+static float terrain_lod_cull_sphere(struct terrain_lod *lod, tri_tile *tile, bpos cam_pos, float center[3])
+{
+	vec3 c = bpos_remap((bpos){tile->centroid, tile->offset}, cam_pos.origin) - cam_pos.offset;
+	vec3 planet_pos = bpos_remap((bpos){0}, tile->offset);
+	memcpy(center, &c, 3 * sizeof(float));
+	return tile->radius + (lod->params.radius - vec3_dist(tile->centroid, planet_pos)) + lod->params.max_height;
+}
+
+//How many times a tile at this distance should have been split, up to max_level. Fractional, so merging can lag
+//behind splitting.
+static float terrain_lod_subdiv_level(struct terrain_lod *lod, tri_tile *tile, const struct terrain_lod_view *view, float max_level)
+{
+	//Convert camera and tile position to planet-coordinates.
+	//These calculations might hit the limits of floating-point precision if the planet is really large.
+	float radius = lod->params.radius;
+	vec3 cam_pos = bpos_remap(view->cam_pos, (bpos_origin){0});
+	vec3 tile_pos = bpos_remap((bpos){tile->centroid, tile->offset}, (bpos_origin){0});
+	vec3 surface_pos = cam_pos * radius/vec3_mag(cam_pos);
+
+	float altitude = vec3_mag(cam_pos) - radius;
+	float tile_dist = vec3_dist(surface_pos, tile_pos) - tile->radius;
+	float subdiv_dist = fmax(altitude, tile_dist);
+
+	float horizon_dist = distance_to_horizon(radius, fmax(altitude, 0));
+	float direct_dist = vec3_dist(cam_pos, tile_pos) - tile->radius;
+	if (horizon_dist < direct_dist && !view->debug)
+		return 0; //Tiles beyond the horizon should not be split.
+
+	return splits_per_distance(subdiv_dist, lod->params.split_distance, max_level);
+}
+
+/* Tile memory */
+
+static void terrain_lod_tile_resident(struct terrain_lod *lod)
+{
+	lod->stats.resident_tiles++;
+	lod->stats.resident_bytes += lod->provider.tile_bytes;
+}
+
+static void terrain_lod_tile_release(struct terrain_lod *lod, tri_tile *t)
+{
+	lod->stats.resident_tiles--;
+	lod->stats.resident_bytes -= lod->provider.tile_bytes;
+	lod->provider.free_tile(t);
+}
+
+//Unlinks a collapsed node from wherever it is in the list, so its children are drawn again or freed.
+static void terrain_lod_collapsed_remove(struct terrain_lod *lod, quadtree_node *node)
+{
+	tri_tile *t = tree_tile(node);
+	if (t->collapsed_older)
+		tree_tile(t->collapsed_older)->collapsed_newer = t->collapsed_newer;
+	else
+		lod->oldest_collapsed = t->collapsed_newer;
+	if (t->collapsed_newer)
+		tree_tile(t->collapsed_newer)->collapsed_older = t->collapsed_older;
+	else
+		lod->newest_collapsed = t->collapsed_older;
+	t->collapsed = false;
+	t->collapsed_older = t->collapsed_newer = NULL;
+	lod->num_collapsed--;
+}
+
+//Merge node's children, keeping them in case the camera comes back.
+static void terrain_lod_collapse(struct terrain_lod *lod, quadtree_node *node)
+{
+	tri_tile *t = tree_tile(node);
+	t->collapsed = true;
+	t->collapsed_older = lod->newest_collapsed;
+	t->collapsed_newer = NULL;
+	if (lod->newest_collapsed)
+		tree_tile(lod->newest_collapsed)->collapsed_newer = node;
+	else
+		lod->oldest_collapsed = node;
+	lod->newest_collapsed = node;
+	lod->num_collapsed++;
+	lod->stats.merges++;
+}
+
+//Forgets a node in an evicted subtree, which may have been collapsed itself, or be waiting on its own split.
+static bool terrain_lod_forget_visit(quadtree_node *node, void *context)
+{
+	struct terrain_lod *lod = context;
+	if (tree_tile(node)->collapsed)
+		terrain_lod_collapsed_remove(lod, node);
+	for (int i = 0; i < TERRAIN_LOD_MAX_PENDING_SPLITS; i++)
+		if (lod->splits[i].in_use && lod->splits[i].node == node)
+			lod->splits[i].node = NULL;
+	lod->stats.resident_tiles--;
+	lod->stats.resident_bytes -= lod->provider.tile_bytes;
+	return true;
+}
+
+//Free collapsed subtrees until the tiles, and bytes more, fit in the budget again, oldest first.
+static void terrain_lod_evict(struct terrain_lod *lod, size_t bytes)
+{
+	while (lod->stats.resident_bytes + bytes > lod->params.tile_budget && lod->oldest_collapsed) {
+		quadtree_node *node = lod->oldest_collapsed;
+		terrain_lod_collapsed_remove(lod, node);
+		for (int i = 0; i < QUADTREE_NUM_CHILDREN; i++)
+			quadtree_preorder_visit(node->children[i], terrain_lod_forget_visit, lod);
+		quadtree_node_remove_children(node, lod->provider.free_tile);
+		lod->stats.evictions++;
+		lod->generation++;
+	}
+}
+
+//Splitting when there's nothing left to evict would go past the budget, so it waits for memory to free up.
+static bool terrain_lod_split_fits(struct terrain_lod *lod)
+{
+	size_t bytes = DEFAULT_NUM_TRI_TILE_DIVS * lod->provider.tile_bytes;
+	terrain_lod_evict(lod, bytes);
+	return lod->stats.resident_bytes + bytes <= lod->params.tile_budget;
+}
+
+/* Splitting */
+
+void terrain_lod_child_vertices(struct terrain_lod *lod, tri_tile *t, struct tri_tile_big_vertex out[DEFAULT_NUM_TRI_TILE_DIVS][3])
+{
+	struct tri_tile_big_vertex new_vertices[] = {
+		tri_tile_get_big_vert_average(t, 0, 1),
+		tri_tile_get_big_vert_average(t, 0, 2),
+		tri_tile_get_big_vert_average(t, 1, 2)
+	};
+
+	vec3 planet_pos = bpos_remap((bpos){0}, t->offset);
+	for (int i = 0; i < 3; i++) {
+		vec3 d = new_vertices[i].position - planet_pos;
+		new_vertices[i].position = d * lod->params.radius/vec3_mag(d) + planet_pos;
+	}
+
+	struct tri_tile_big_vertex new_tile_vertices[DEFAULT_NUM_TRI_TILE_DIVS][3] = {
+		{t->big_vertices[0], new_vertices[0],    new_vertices[1]},
+		{new_vertices[0],    t->big_vertices[1], new_vertices[2]},
+		{new_vertices[0],    new_vertices[2],    new_vertices[1]},
+		{new_vertices[1],    new_vertices[2],    t->big_vertices[2]}
+	};
+	memcpy(out, new_tile_vertices, sizeof(new_tile_vertices));
+}
+
+static bool terrain_lod_split_pending(struct terrain_lod *lod, quadtree_node *node)
+{
+	for (int i = 0; i < TERRAIN_LOD_MAX_PENDING_SPLITS; i++)
+		if (lod->splits[i].in_use && lod->splits[i].node == node)
+			return true;
+	return false;
+}
+
+static bool terrain_lod_split_start(struct terrain_lod *lod, quadtree_node *node)
+{
+	struct terrain_lod_split *split = NULL;
+	for (int i = 0; i < TERRAIN_LOD_MAX_PENDING_SPLITS && !split; i++)
+		if (!lod->splits[i].in_use)
+			split = &lod->splits[i];
+	if (!split || !terrain_lod_split_fits(lod))
+		return false;
+
+	struct tri_tile_big_vertex vertices[DEFAULT_NUM_TRI_TILE_DIVS][3];
+	terrain_lod_child_vertices(lod, tree_tile(node), vertices);
+	if (!lod->provider.split(lod->provider.context, tree_tile(node), vertices, split->tiles))
+		return false;
+
+	split->in_use = true;
+	split->node = node;
+	atomic_store(&split->jobs_remaining, 0);
+	for (int i = 0; i < DEFAULT_NUM_TRI_TILE_DIVS; i++)
+		terrain_lod_tile_resident(lod);
+	lod->stats.pending_splits++;
+	lod->provider.generate(lod->provider.context, split->tiles, DEFAULT_NUM_TRI_TILE_DIVS, &split->jobs_remaining);
+	return true;
+}
+
+//Give finished splits their children, at most max_uploads splits' worth.
+static void terrain_lod_split_finish(struct terrain_lod *lod, int max_uploads)
+{
+	for (int i = 0; i < TERRAIN_LOD_MAX_PENDING_SPLITS && max_uploads > 0; i++) {
+		struct terrain_lod_split *split = &lod->splits[i];
+		if (!split->in_use || atomic_load(&split->jobs_remaining))
+			continue;
+
+		if (split->node && quadtree_node_add_children(split->node, (void **)split->tiles)) {
+			for (int j = 0; j < DEFAULT_NUM_TRI_TILE_DIVS; j++)
+				lod->provider.finish(lod->provider.context, split->tiles[j]);
+			lod->stats.splits++;
+			max_uploads--;
+		} else {
+			for (int j = 0; j < DEFAULT_NUM_TRI_TILE_DIVS; j++)
+				terrain_lod_tile_release(lod, split->tiles[j]);
+		}
+		split->in_use = false;
+		lod->stats.pending_splits--;
+	}
+}
+
+/* Traversal */
+
+static bool terrain_lod_split_visit(quadtree_node *node, void *context)
+{
+	struct terrain_lod_context *ctx = context;
+	struct terrain_lod *lod = ctx->lod;
+	const struct terrain_lod_view *view = ctx->view;
+	tri_tile *tile = tree_tile(node);
+
+	//Cap the number of subdivisions per whole-tree traversal (per frame essentially)
+	if (node->depth == 0)
+		ctx->splits_left = view->max_splits;
+
+	float level = terrain_lod_subdiv_level(lod, tile, view, lod->params.max_subdivisions);
+	int depth = level;
+	bool has_children = quadtree_node_has_children(node);
+
+	if (has_children && !tile->collapsed && level < node->depth + 1 - TERRAIN_LOD_MERGE_HYSTERESIS) {
+		terrain_lod_collapse(lod, node);
+	} else if (depth > node->depth && tile->collapsed) {
+		terrain_lod_collapsed_remove(lod, node);
+		lod->stats.expansions++;
+	} else if (depth > node->depth && !has_children && ctx->splits_left > 0 && !terrain_lod_split_pending(lod, node)) {
+		//Off-screen tiles still merge as they get further away, but don't spend anything on new detail.
+		float center[3];
+		float radius = view->frustum ? terrain_lod_cull_sphere(lod, tile, view->cam_pos, center) : 0;
+		if ((!view->frustum || frustum_test_sphere(view->frustum, center, radius)) && terrain_lod_split_start(lod, node))
+			ctx->splits_left--;
+	}
+
+	if (view->debug)
+		tile->override_col = terrain_lod_color_by_depth[depth % LENGTH(terrain_lod_color_by_depth)];
+	else
+		tile->override_col = (vec3){1, 1, 1};
+
+	return quadtree_node_has_children(node) && !tile->collapsed;
+}
+
+//A family of tiles is split when their parent gets to their depth's level, and merged back half a level under that,
+//so morphing over the half level above it hides both. The parent decides, so siblings always match.
+static float terrain_lod_morph(float parent_level, int depth)
+{
+	return fmin(fmax(2 * (parent_level - depth), 0), 1);
+}
+
+static bool terrain_lod_drawlist_visit(quadtree_node *node, void *context)
+{
+	struct terrain_lod_context *ctx = context;
+	tri_tile *tile = tree_tile(node);
+	//The split pass has already decided, this just follows along.
+	bool expanded = quadtree_node_has_children(node) && !tile->collapsed;
+
+	if (!expanded && ctx->num_tiles < ctx->max_tiles && above_horizon(ctx->lod, tile, ctx->view)) {
+		if (ctx->view->morphs)
+			ctx->view->morphs[ctx->num_tiles] = node->depth ? terrain_lod_morph(ctx->parent_levels[node->depth - 1], node->depth) : 1;
+		ctx->tiles[ctx->num_tiles++] = tile;
+	}
+	//Preorder, so this is still here when the children are visited. The deepest tiles morph past max_subdivisions,
+	//where nothing splits anymore.
+	if (expanded && ctx->view->morphs)
+		ctx->parent_levels[node->depth] = terrain_lod_subdiv_level(ctx->lod, tile, ctx->view, node->depth + 1.5f);
+
+	return expanded;
+}
+
+//Room for num tiles' bounding spheres. Returns false if there's no memory for them.
+static bool terrain_lod_cull_reserve(struct terrain_lod *lod, int num)
+{
+	if (num <= lod->max_cull)
+		return true;
+	//One block, the four float arrays then the visible flags.
+	float *cull = realloc(lod->cull_x, num * (4 * sizeof(float) + sizeof(uint8_t)));
+	if (!cull) {
+		printf("Whoops, running out of memory.\n");
+		return false;
+	}
+	lod->cull_x = cull;
+	lod->cull_y = cull + num;
+	lod->cull_z = cull + 2 * num;
+	lod->cull_radius = cull + 3 * num;
+	lod->cull_visible = (uint8_t *)(cull + 4 * num);
+	lod->max_cull = num;
+	return true;
+}
+
+//Drops the tiles that are outside the frustum, testing them all together.
+static int terrain_lod_frustum_cull(struct terrain_lod *lod, tri_tile **tiles, float *morphs, int num_tiles, bpos cam_pos, struct frustum *frustum)
+{
+	if (!num_tiles || !terrain_lod_cull_reserve(lod, num_tiles))
+		return num_tiles;
+	for (int i = 0; i < num_tiles; i++) {
+		float center[3];
+		lod->cull_radius[i] = terrain_lod_cull_sphere(lod, tiles[i], cam_pos, center);
+		lod->cull_x[i] = center[0];
+		lod->cull_y[i] = center[1];
+		lod->cull_z[i] = center[2];
+	}
+	frustum_test_spheres(frustum, num_tiles, lod->cull_x, lod->cull_y, lod->cull_z, lod->cull_radius, lod->cull_visible);
+	int num_visible = 0;
+	for (int i = 0; i < num_tiles; i++) {
+		if (!lod->cull_visible[i])
+			continue;
+		if (morphs)
+			morphs[num_visible] = morphs[i];
+		tiles[num_visible++] = tiles[i];
+	}
+	return num_visible;
+}
+
+/* Public */
+
+void terrain_lod_face_vertices(int face, float radius, struct tri_tile_big_vertex out[3])
+{
+	for (int j = 0; j < 3; j++)
+		out[j] = (struct tri_tile_big_vertex){ico_v[ico_i[3*face+j]] * radius, {ico_tx[(6*face)+(2*j)], ico_tx[(6*face)+(2*j)+1]}};
+}
+
+void terrain_lod_init(struct terrain_lod *lod, const struct terrain_lod_params *params, const struct terrain_lod_provider *provider, tri_tile *faces[NUM_ICOSPHERE_FACES], const quadtree_allocator *node_allocator)
+{
+	assert(params->max_subdivisions <= TERRAIN_LOD_MAX_DEPTH);
+	*lod = (struct terrain_lod){
+		.params = *params,
+		.provider = *provider,
+	};
+	for (int i = 0; i < NUM_ICOSPHERE_FACES; i++) {
+		lod->roots[i] = quadtree_new(faces[i], 0);
+		lod->roots[i]->allocator = node_allocator;
+		terrain_lod_tile_resident(lod);
+	}
+}
+
+void terrain_lod_deinit(struct terrain_lod *lod)
+{
+	//The provider may still be generating tiles.
+	for (int i = 0; i < TERRAIN_LOD_MAX_PENDING_SPLITS; i++) {
+		if (lod->splits[i].in_use) {
+			lod->provider.wait(lod->provider.context, &lod->splits[i].jobs_remaining);
+			for (int j = 0; j < DEFAULT_NUM_TRI_TILE_DIVS; j++)
+				lod->provider.free_tile(lod->splits[i].tiles[j]);
+		}
+	}
+	for (int i = 0; i < NUM_ICOSPHERE_FACES; i++)
+		quadtree_free(lod->roots[i], lod->provider.free_tile);
+	free(lod->cull_x);
+	*lod = (struct terrain_lod){0};
+}
+
+int terrain_lod_update(struct terrain_lod *lod, const struct terrain_lod_view *view, tri_tile **tiles, int max_tiles)
+{
+	struct terrain_lod_context context = {
+		.lod = lod,
+		.view = view,
+		.tiles = tiles,
+		.max_tiles = max_tiles,
+	};
+	lod->stats.splits = lod->stats.merges = lod->stats.expansions = lod->stats.evictions = 0;
+	terrain_lod_split_finish(lod, view->max_uploads);
+
+	for (int i = 0; i < NUM_ICOSPHERE_FACES; i++) {
+		quadtree_preorder_visit(lod->roots[i], terrain_lod_split_visit, &context);
+		quadtree_preorder_visit(lod->roots[i], terrain_lod_drawlist_visit, &context);
+	}
+	terrain_lod_evict(lod, 0);
+
+	//Sized for the most the caller could ask for up front, so the drawlist growing doesn't reallocate every update.
+	if (view->frustum)
+		terrain_lod_cull_reserve(lod, max_tiles);
+	int num_tiles = view->frustum ? terrain_lod_frustum_cull(lod, tiles, view->morphs, context.num_tiles, view->cam_pos, view->frustum) : context.num_tiles;
+	lod->stats.visible_tiles = num_tiles;
+	lod->stats.culled_tiles = context.num_tiles - num_tiles;
+	return num_tiles;
+}
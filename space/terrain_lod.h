@@ -0,0 +1,120 @@
+#ifndef TERRAIN_LOD_H
+#define TERRAIN_LOD_H
+#include "datastructures/quadtree.h"
+#include "triangular_terrain_tile.h"
+#include "terrain_constants.h"
+#include "math/bpos.h"
+#include "math/frustum.h"
+#include <stdatomic.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+/*
+Level of detail for a planet's terrain, whatever kind of planet it is. The planet starts as the 20 faces of an
+icosahedron, each the root of a quadtree of tri_tiles that split into 4 as the camera gets closer, and merge
+again as it moves away. This picks which tiles to split, merge, evict and draw. What's in a tile, a mesh made on
+the CPU or heights on the GPU, is up to the planet, through a terrain_lod_provider.
+
+Splits happen as soon as a tile is close enough for its level, but merges wait until it's
+TERRAIN_LOD_MERGE_HYSTERESIS levels further than that. A merged tile's children stay in memory, so coming back to
+them costs nothing, until the tile budget runs out and they're evicted, least recently merged first.
+
+Splitting generates the children through the provider, possibly on other threads, and the node is drawn as it is
+until they're ready. No GL in here, so it can run headless.
+*/
+
+enum {
+	TERRAIN_LOD_MAX_PENDING_SPLITS = 16, //Splits generating at once, per planet.
+	TERRAIN_LOD_MAX_DEPTH = 24, //Most max_subdivisions can be. A tile that deep is 1/16M of a face across.
+};
+
+//How many subdivision levels under the split threshold a tile has to get before its children are merged. Half a
+//level is about 1.4 times the distance it split at, so hovering around the threshold doesn't thrash.
+#define TERRAIN_LOD_MERGE_HYSTERESIS 0.5f
+
+//Where a planet's tiles get their contents from. Everything but generate's work is called from the thread that
+//calls terrain_lod_update.
+struct terrain_lod_provider {
+	//Storage for a family of tiles with these big vertices, and the offset and finishing touches context of parent.
+	//Returns false if there's no memory for them.
+	bool (*split)(void *context, tri_tile *parent, struct tri_tile_big_vertex vertices[DEFAULT_NUM_TRI_TILE_DIVS][3], tri_tile *out[DEFAULT_NUM_TRI_TILE_DIVS]);
+	//Fill num tiles in, counting the work still to do in *remaining like thread_pool_parallel_for does.
+	void (*generate)(void *context, tri_tile **tiles, size_t num, atomic_size_t *remaining);
+	//Block until *remaining is 0.
+	void (*wait)(void *context, atomic_size_t *remaining);
+	//A generated tile, on the way into the tree. Uploading goes here.
+	void (*finish)(void *context, tri_tile *tile);
+	//Gives back everything split made for a tile.
+	quadtree_free_fn free_tile;
+	size_t tile_bytes; //What one tile costs in memory, CPU and GPU, to count against the budget.
+	void *context;
+};
+
+struct terrain_lod_params {
+	float radius;
+	float max_height; //Highest the terrain can get above radius, so tiles aren't culled while hills still show.
+	//Height above the surface a face splits at. It splits once more every time that halves.
+	float split_distance;
+	int max_subdivisions; //Up to TERRAIN_LOD_MAX_DEPTH.
+	size_t tile_budget; //In bytes. Merged subtrees are evicted past this.
+};
+
+//Where the LOD is being seen from, for one update.
+struct terrain_lod_view {
+	bpos cam_pos; //Relative to the planet's center.
+	struct frustum *frustum; //Centered on the camera, see frustum_recenter. NULL to skip frustum culling.
+	int max_splits; //Splits each face can start.
+	int max_uploads; //Finished splits to give to the tree.
+	//If not NULL, filled in alongside the tiles with how far each has morphed from its parent's shape, from 0 as it
+	//is when it's split to 1 half a level later, so neither splits nor merges pop.
+	float *morphs;
+	bool debug; //Color tiles by level, and draw and split them beyond the horizon.
+};
+
+//A split whose children are generating. The node is drawn as it is until they're ready.
+struct terrain_lod_split {
+	quadtree_node *node; //NULL if the node was evicted meanwhile, so the children just get freed.
+	tri_tile *tiles[DEFAULT_NUM_TRI_TILE_DIVS];
+	atomic_size_t jobs_remaining;
+	bool in_use;
+};
+
+struct terrain_lod_stats {
+	int resident_tiles;
+	size_t resident_bytes;
+	//Last update
+	int splits, merges, expansions, evictions;
+	int pending_splits;
+	int visible_tiles, culled_tiles; //Drawlist tiles inside and outside the view frustum.
+};
+
+struct terrain_lod {
+	struct terrain_lod_params params;
+	struct terrain_lod_provider provider;
+	quadtree_node *roots[NUM_ICOSPHERE_FACES];
+	//Tiles whose children have been merged, linked through their tiles from the least recently merged.
+	quadtree_node *oldest_collapsed, *newest_collapsed;
+	int num_collapsed;
+	struct terrain_lod_split splits[TERRAIN_LOD_MAX_PENDING_SPLITS];
+	struct terrain_lod_stats stats;
+	//Each drawlist tile's bounding sphere, laid out for frustum_test_spheres. Grown to the caller's max_tiles.
+	float *cull_x, *cull_y, *cull_z, *cull_radius;
+	uint8_t *cull_visible;
+	int max_cull;
+	uint32_t generation; //Bumped whenever tiles in the tree are freed, for anything holding on to them between updates.
+};
+
+//The big vertices of one of the icosahedron's faces, on a sphere of radius.
+void terrain_lod_face_vertices(int face, float radius, struct tri_tile_big_vertex out[3]);
+//Corners of t's children, in the order splits make them, with the new ones pushed out onto the planet.
+void terrain_lod_child_vertices(struct terrain_lod *lod, tri_tile *t, struct tri_tile_big_vertex out[DEFAULT_NUM_TRI_TILE_DIVS][3]);
+//Takes ownership of faces, which must be generated and finished already. Nodes come from node_allocator, or
+//malloc if it's NULL.
+void terrain_lod_init(struct terrain_lod *lod, const struct terrain_lod_params *params, const struct terrain_lod_provider *provider, tri_tile *faces[NUM_ICOSPHERE_FACES], const quadtree_allocator *node_allocator);
+//Waits for pending splits, and frees every tile.
+void terrain_lod_deinit(struct terrain_lod *lod);
+//Splits, merges and evicts for view, then lists the tiles to draw, at most max_tiles, and their morphs if the view
+//wants them. Returns how many.
+int terrain_lod_update(struct terrain_lod *lod, const struct terrain_lod_view *view, tri_tile **tiles, int max_tiles);
+
+#endif
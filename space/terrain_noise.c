@@ -0,0 +1,184 @@
+#include "terrain_noise.h"
+#include <math.h>
+#include <string.h>
+
+#define TERRAIN_NOISE_STRETCH (-1.0f / 6) //(1 / sqrt(3 + 1) - 1) / 3
+#define TERRAIN_NOISE_NORM (1.0f / 103)
+
+static const int8_t terrain_noise_gradients[] = {
+	-11,  4,  4,     -4,  11,  4,    -4,  4,  11,
+	 11,  4,  4,      4,  11,  4,     4,  4,  11,
+	-11, -4,  4,     -4, -11,  4,    -4, -4,  11,
+	 11, -4,  4,      4, -11,  4,     4, -4,  11,
+	-11,  4, -4,     -4,  11, -4,    -4,  4, -11,
+	 11,  4, -4,      4,  11, -4,     4,  4, -11,
+	-11, -4, -4,     -4, -11, -4,    -4, -4, -11,
+	 11, -4, -4,      4, -11, -4,     4, -4, -11,
+};
+
+/*
+Every lattice point that can be within range of a sample, relative to the sample's cell in the stretched
+lattice. Each is within the kernel's radius of part of the cell. The first few cover most samples.
+*/
+static const int8_t terrain_noise_candidates[][3] = {
+	{0, 0, 1}, {0, 1, 0}, {1, 0, 0}, {0, 1, 1}, {1, 0, 1}, {1, 1, 0}, {0, 0, 0}, {1, 1, 1},
+	{0, 0, 2}, {0, 2, 0}, {2, 0, 0}, {-1, 1, 1}, {1, -1, 1}, {1, 1, -1},
+	{-1, 0, 1}, {-1, 1, 0}, {0, -1, 1}, {0, 1, -1}, {1, -1, 0}, {1, 0, -1},
+	{0, 1, 2}, {0, 2, 1}, {1, 0, 2}, {1, 2, 0}, {2, 0, 1}, {2, 1, 0},
+};
+#define TERRAIN_NOISE_CANDIDATES (sizeof(terrain_noise_candidates) / sizeof(terrain_noise_candidates[0]))
+
+void terrain_noise_init(struct terrain_noise *tn, int64_t seed)
+{
+	//Shuffled the same way open-simplex-noise-in-c does it, with its LCG.
+	int16_t source[256];
+	for (int i = 0; i < 256; i++)
+		source[i] = i;
+	uint64_t s = seed;
+	for (int i = 0; i < 3; i++)
+		s = s * 6364136223846793005ull + 1442695040888963407ull;
+	for (int i = 255; i >= 0; i--) {
+		s = s * 6364136223846793005ull + 1442695040888963407ull;
+		int r = (int)((int64_t)(s + 31) % (i + 1));
+		if (r < 0)
+			r += i + 1;
+		tn->perm[i] = source[r];
+		tn->grad_index[i] = (tn->perm[i] % (sizeof(terrain_noise_gradients) / 3)) * 3;
+		source[r] = source[i];
+	}
+}
+
+static const int8_t * terrain_noise_gradient(const struct terrain_noise *tn, int x, int y, int z)
+{
+	return &terrain_noise_gradients[tn->grad_index[(tn->perm[(tn->perm[x & 0xFF] + y) & 0xFF] + z) & 0xFF]];
+}
+
+/*
+The offset from the cell's lattice point is worked out relative to the cell, since the samples are far enough
+from the origin that subtracting the lattice point's position outright would lose precision. A lattice point's
+position is itself plus (x + y + z) / 3 on each axis, and splitting that sum into thirds keeps it exact.
+*/
+float terrain_noise_at(const struct terrain_noise *tn, const float p[3], float gradient[3])
+{
+	float stretch = (p[0] + p[1] + p[2]) * TERRAIN_NOISE_STRETCH;
+	int cell[3];
+	for (int a = 0; a < 3; a++)
+		cell[a] = (int)floorf(p[a] + stretch);
+	int sum = cell[0] + cell[1] + cell[2];
+	int thirds = (int)floorf(sum / 3.0f), rest = sum - 3 * thirds;
+	float d0[3];
+	for (int a = 0; a < 3; a++)
+		d0[a] = (p[a] - (float)(cell[a] + thirds)) - rest / 3.0f;
+
+	float value = 0, g[3] = {0};
+	for (size_t c = 0; c < TERRAIN_NOISE_CANDIDATES; c++) {
+		const int8_t *o = terrain_noise_candidates[c];
+		float squish = (o[0] + o[1] + o[2]) / 3.0f, d[3];
+		for (int a = 0; a < 3; a++)
+			d[a] = d0[a] - (o[a] + squish);
+		float attn = 2 - d[0] * d[0] - d[1] * d[1] - d[2] * d[2];
+		if (attn <= 0)
+			continue;
+		const int8_t *grad = terrain_noise_gradient(tn, cell[0] + o[0], cell[1] + o[1], cell[2] + o[2]);
+		float extrapolation = grad[0] * d[0] + grad[1] * d[1] + grad[2] * d[2];
+		float attn2 = attn * attn, attn4 = attn2 * attn2;
+		value += attn4 * extrapolation;
+		//d(attn^4)/dd = -8 attn^3 d
+		for (int a = 0; a < 3; a++)
+			g[a] += attn4 * grad[a] - 8 * attn2 * attn * extrapolation * d[a];
+	}
+	if (gradient)
+		for (int a = 0; a < 3; a++)
+			gradient[a] = g[a] * TERRAIN_NOISE_NORM;
+	return value * TERRAIN_NOISE_NORM;
+}
+
+typedef float terrain_f4 __attribute__((vector_size(16)));
+typedef int32_t terrain_i4 __attribute__((vector_size(16)));
+#define TERRAIN_LANES 4
+
+static inline terrain_f4 terrain_floor(terrain_f4 a)
+{
+	terrain_i4 i = __builtin_convertvector(a, terrain_i4); //Truncates towards zero
+	terrain_f4 f = __builtin_convertvector(i, terrain_f4);
+	terrain_f4 zero = {0};
+	return f - (terrain_f4)((terrain_i4)(zero + 1) & (f > a));
+}
+
+static void terrain_noise4(const struct terrain_noise *tn, terrain_f4 x, terrain_f4 y, terrain_f4 z,
+	terrain_f4 *value, terrain_f4 *gx, terrain_f4 *gy, terrain_f4 *gz)
+{
+	terrain_f4 zero = {0}, stretch = (x + y + z) * TERRAIN_NOISE_STRETCH;
+	terrain_i4 cx = __builtin_convertvector(terrain_floor(x + stretch), terrain_i4);
+	terrain_i4 cy = __builtin_convertvector(terrain_floor(y + stretch), terrain_i4);
+	terrain_i4 cz = __builtin_convertvector(terrain_floor(z + stretch), terrain_i4);
+	terrain_i4 sum = cx + cy + cz;
+	terrain_i4 thirds = __builtin_convertvector(terrain_floor(__builtin_convertvector(sum, terrain_f4) / 3), terrain_i4);
+	terrain_f4 rest = __builtin_convertvector(sum - 3 * thirds, terrain_f4) / 3;
+	terrain_f4 dx0 = (x - __builtin_convertvector(cx + thirds, terrain_f4)) - rest;
+	terrain_f4 dy0 = (y - __builtin_convertvector(cy + thirds, terrain_f4)) - rest;
+	terrain_f4 dz0 = (z - __builtin_convertvector(cz + thirds, terrain_f4)) - rest;
+
+	terrain_f4 v = zero, sx = zero, sy = zero, sz = zero;
+	for (size_t c = 0; c < TERRAIN_NOISE_CANDIDATES; c++) {
+		const int8_t *o = terrain_noise_candidates[c];
+		float squish = (o[0] + o[1] + o[2]) / 3.0f;
+		terrain_f4 dx = dx0 - (o[0] + squish), dy = dy0 - (o[1] + squish), dz = dz0 - (o[2] + squish);
+		terrain_f4 attn = 2 - dx * dx - dy * dy - dz * dz;
+		terrain_i4 in_range = attn > zero;
+		//Most candidates are out of range of all 4 points, skip the gradient lookups for those.
+		if (!(in_range[0] | in_range[1] | in_range[2] | in_range[3]))
+			continue;
+		attn = (terrain_f4)(in_range & (terrain_i4)attn);
+
+		terrain_f4 grad_x, grad_y, grad_z;
+		for (int l = 0; l < TERRAIN_LANES; l++) {
+			const int8_t *grad = terrain_noise_gradient(tn, cx[l] + o[0], cy[l] + o[1], cz[l] + o[2]);
+			grad_x[l] = grad[0];
+			grad_y[l] = grad[1];
+			grad_z[l] = grad[2];
+		}
+		terrain_f4 extrapolation = grad_x * dx + grad_y * dy + grad_z * dz;
+		terrain_f4 attn2 = attn * attn, attn4 = attn2 * attn2, falloff = -8 * attn2 * attn * extrapolation;
+		v += attn4 * extrapolation;
+		sx += attn4 * grad_x + falloff * dx;
+		sy += attn4 * grad_y + falloff * dy;
+		sz += attn4 * grad_z + falloff * dz;
+	}
+	*value = v * TERRAIN_NOISE_NORM;
+	*gx = sx * TERRAIN_NOISE_NORM;
+	*gy = sy * TERRAIN_NOISE_NORM;
+	*gz = sz * TERRAIN_NOISE_NORM;
+}
+
+void terrain_noise_batch(const struct terrain_noise *tn, size_t num, const float *x, const float *y, const float *z,
+	float *value, float *gx, float *gy, float *gz)
+{
+	terrain_f4 vx, vy, vz, v, dx, dy, dz;
+	size_t i = 0;
+	for (; i + TERRAIN_LANES <= num; i += TERRAIN_LANES) {
+		memcpy(&vx, &x[i], sizeof(vx));
+		memcpy(&vy, &y[i], sizeof(vy));
+		memcpy(&vz, &z[i], sizeof(vz));
+		terrain_noise4(tn, vx, vy, vz, &v, &dx, &dy, &dz);
+		memcpy(&value[i], &v, sizeof(v));
+		memcpy(&gx[i], &dx, sizeof(dx));
+		memcpy(&gy[i], &dy, sizeof(dy));
+		memcpy(&gz[i], &dz, sizeof(dz));
+	}
+	if (i < num) {
+		//The last few, padded out by repeating the last point so the padding lanes share its lattice lookups.
+		size_t rest = num - i;
+		for (size_t l = 0; l < TERRAIN_LANES; l++) {
+			size_t j = l < rest ? i + l : num - 1;
+			vx[l] = x[j];
+			vy[l] = y[j];
+			vz[l] = z[j];
+		}
+		terrain_noise4(tn, vx, vy, vz, &v, &dx, &dy, &dz);
+		memcpy(&value[i], &v, rest * sizeof(float));
+		memcpy(&gx[i], &dx, rest * sizeof(float));
+		memcpy(&gy[i], &dy, rest * sizeof(float));
+		memcpy(&gz[i], &dz, rest * sizeof(float));
+	}
+}
@@ -0,0 +1,29 @@
+#ifndef TERRAIN_NOISE_H
+#define TERRAIN_NOISE_H
+#include <stddef.h>
+#include <inttypes.h>
+
+/*
+3D OpenSimplex noise with its analytic gradient, for generating terrain a row of vertices at a time.
+
+It uses the same lattice, gradient set, normalization and seeding as open-simplex-noise-in-c. Rather than
+working out which lattice points can reach a sample region by region, it sums every one of the 26 that ever
+can, and points out of range add nothing. That lets 4 lanes share one code path.
+
+terrain_noise_batch does 4 points at a time with GCC vector extensions, like galaxy_density_batch, so it runs
+on SSE2 or NEON with no -march flags. terrain_noise_at is the scalar version of the same thing.
+*/
+
+struct terrain_noise {
+	int16_t perm[256];
+	int16_t grad_index[256]; //Into the gradient table, for each permuted lattice hash.
+};
+
+void terrain_noise_init(struct terrain_noise *tn, int64_t seed);
+//Noise at p, in about [-1, 1]. Its gradient is written to gradient, if that's not NULL.
+float terrain_noise_at(const struct terrain_noise *tn, const float p[3], float gradient[3]);
+//Noise and gradients at num points, given as separate x, y and z arrays. The gradient arrays can't be NULL.
+void terrain_noise_batch(const struct terrain_noise *tn, size_t num, const float *x, const float *y, const float *z,
+	float *value, float *gx, float *gy, float *gz);
+
+#endif
@@ -0,0 +1,184 @@
+#include "terrain_query.h"
+#include <math.h>
+#include <string.h>
+
+static tri_tile * tree_tile(quadtree_node *node)
+{
+	return (tri_tile *)node->data;
+}
+
+//Barycentric coordinates, in terms of t's corners, of where direction d from the planet's center passes through
+//the plane they're on. Returns the smallest, which is negative if d misses t, and -INFINITY if it points away.
+static float terrain_query_barycentric(tri_tile *t, vec3 d, float out[3])
+{
+	vec3 center = bpos_remap((bpos){0}, t->offset);
+	vec3 a[3];
+	for (int i = 0; i < 3; i++)
+		a[i] = t->big_vertices[i].position - center;
+	//Each corner's weight is the volume d makes with the other two, so winding doesn't matter once they're summed.
+	float sum = 0;
+	for (int i = 0; i < 3; i++) {
+		out[i] = vec3_dot(d, vec3_cross(a[(i + 1) % 3], a[(i + 2) % 3]));
+		sum += out[i];
+	}
+	if (!(sum * vec3_dot(a[0], vec3_cross(a[1], a[2])) > 0))
+		return -INFINITY;
+	for (int i = 0; i < 3; i++)
+		out[i] /= sum;
+	return fmin(fmin(out[0], out[1]), out[2]);
+}
+
+//Of the nodes, the one whose tile has a mesh and is most squarely under d. NULL if none of them have meshes.
+static quadtree_node * terrain_query_pick(quadtree_node *nodes[], int num, vec3 d, float lerps[3])
+{
+	quadtree_node *best = NULL;
+	float best_score = -INFINITY;
+	for (int i = 0; i < num; i++) {
+		tri_tile *t = tree_tile(nodes[i]);
+		if (!t->mesh)
+			continue;
+		float node_lerps[3];
+		float score = terrain_query_barycentric(t, d, node_lerps);
+		//Siblings' edges line up, so d is in one of them, give or take rounding, which picking the best covers.
+		if (!best || score > best_score) {
+			best = nodes[i];
+			best_score = score;
+			memcpy(lerps, node_lerps, sizeof(node_lerps));
+		}
+	}
+	return best;
+}
+
+//The deepest tile with a mesh under d, from node, which is under d, down.
+static quadtree_node * terrain_query_descend(quadtree_node *node, vec3 d, float lerps[3])
+{
+	while (quadtree_node_has_children(node)) {
+		float child_lerps[3];
+		quadtree_node *child = terrain_query_pick(node->children, QUADTREE_NUM_CHILDREN, d, child_lerps);
+		if (!child)
+			break;
+		node = child;
+		memcpy(lerps, child_lerps, sizeof(child_lerps));
+	}
+	return node;
+}
+
+//Puts node first in the patches, from wherever it was, dropping the least recently used one if it's new and
+//they're full.
+static void terrain_query_keep(struct terrain_query *q, quadtree_node *node)
+{
+	int i = 0;
+	while (i < q->num_patches && q->patches[i] != node)
+		i++;
+	if (i == q->num_patches && q->num_patches < TERRAIN_QUERY_PATCHES)
+		q->num_patches++;
+	if (i == TERRAIN_QUERY_PATCHES)
+		i--;
+	memmove(&q->patches[1], &q->patches[0], i * sizeof(quadtree_node *));
+	q->patches[0] = node;
+}
+
+//The deepest tile with a mesh under d, and d's barycentric coordinates on it. NULL if not even the faces have meshes.
+static quadtree_node * terrain_query_find(struct terrain_query *q, vec3 d, float lerps[3])
+{
+	for (int i = 0; i < q->num_patches; i++) {
+		if (terrain_query_barycentric(tree_tile(q->patches[i]), d, lerps) >= 0) {
+			quadtree_node *node = terrain_query_descend(q->patches[i], d, lerps);
+			//The deeper tile replaces this one, and may be further down the patches already, where keeping it finds it.
+			if (node != q->patches[i]) {
+				memmove(&q->patches[i], &q->patches[i + 1], (q->num_patches - i - 1) * sizeof(quadtree_node *));
+				q->num_patches--;
+			}
+			q->stats.hits++;
+			terrain_query_keep(q, node);
+			return node;
+		}
+	}
+
+	quadtree_node *node = terrain_query_pick(q->lod->roots, NUM_ICOSPHERE_FACES, d, lerps);
+	if (!node)
+		return NULL;
+	node = terrain_query_descend(node, d, lerps);
+	q->stats.misses++;
+	terrain_query_keep(q, node);
+	return node;
+}
+
+static float terrain_query_vertex_height(tri_tile *t, vec3 center, float radius, int a, int b)
+{
+	//Vertex j of row r is r - j rows from corner 0 towards corner 1, and j towards corner 2.
+	int r = a + b, j = b;
+	return vec3_mag(t->mesh[r * (r + 1) / 2 + j].position - center) - radius;
+}
+
+//Interpolated across whichever of the mesh's triangles the barycentric coordinates lerps are in.
+static float terrain_query_mesh_height(tri_tile *t, const float lerps[3], float radius)
+{
+	vec3 center = bpos_remap((bpos){0}, t->offset);
+	int rows = t->num_rows;
+	//In rows from corner 0 towards corners 1 and 2, which puts the mesh's vertices on whole numbers.
+	float a = fmax(lerps[1], 0) * rows, b = fmax(lerps[2], 0) * rows;
+	if (a + b > rows) {
+		float s = rows / (a + b);
+		a *= s;
+		b *= s;
+	}
+	int i = fmin(floor(a), rows - 1);
+	int k = fmin(floor(b), rows - 1 - i);
+	float fa = a - i, fb = b - k;
+
+	if (fa + fb <= 1 || i + k + 2 > rows)
+		return (1 - fa - fb) * terrain_query_vertex_height(t, center, radius, i, k)
+			+ fa * terrain_query_vertex_height(t, center, radius, i + 1, k)
+			+ fb * terrain_query_vertex_height(t, center, radius, i, k + 1);
+	return (fa + fb - 1) * terrain_query_vertex_height(t, center, radius, i + 1, k + 1)
+		+ (1 - fb) * terrain_query_vertex_height(t, center, radius, i + 1, k)
+		+ (1 - fa) * terrain_query_vertex_height(t, center, radius, i, k + 1);
+}
+
+void terrain_query_init(struct terrain_query *q, struct terrain_lod *lod, int min_depth, terrain_query_fallback_fn fallback, void *context)
+{
+	*q = (struct terrain_query){
+		.lod = lod,
+		.min_depth = min_depth,
+		.fallback = fallback,
+		.context = context,
+		.generation = lod->generation,
+	};
+}
+
+void terrain_query_heights(struct terrain_query *q, const bpos positions[], int n, float out[])
+{
+	if (q->generation != q->lod->generation) {
+		q->num_patches = 0;
+		q->generation = q->lod->generation;
+	}
+	float radius = q->lod->params.radius;
+
+	for (int first = 0; first < n; first += TERRAIN_QUERY_CHUNK) {
+		int num = n - first < TERRAIN_QUERY_CHUNK ? n - first : TERRAIN_QUERY_CHUNK;
+		vec3 directions[TERRAIN_QUERY_CHUNK];
+		float heights[TERRAIN_QUERY_CHUNK];
+		int fallbacks[TERRAIN_QUERY_CHUNK];
+		int num_fallbacks = 0;
+
+		for (int i = first; i < first + num; i++) {
+			vec3 d = vec3_normalize(bpos_remap(positions[i], (bpos_origin){0, 0, 0}));
+			float lerps[3];
+			quadtree_node *node = terrain_query_find(q, d, lerps);
+			if (node && node->depth >= q->min_depth) {
+				out[i] = terrain_query_mesh_height(tree_tile(node), lerps, radius);
+			} else {
+				directions[num_fallbacks] = d;
+				fallbacks[num_fallbacks++] = i;
+			}
+		}
+
+		if (num_fallbacks)
+			q->fallback(q->context, directions, num_fallbacks, heights);
+		for (int i = 0; i < num_fallbacks; i++)
+			out[fallbacks[i]] = heights[i];
+		q->stats.fallbacks += num_fallbacks;
+	}
+	q->stats.queries += n;
+}
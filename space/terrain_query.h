@@ -0,0 +1,53 @@
+#ifndef TERRAIN_QUERY_H
+#define TERRAIN_QUERY_H
+#include "terrain_lod.h"
+#include "math/bpos.h"
+#include <inttypes.h>
+
+/*
+How high the ground is under things on a planet, for collision, and for putting trees and such on the surface.
+Thousands of these a frame have to be cheap, so rather than raycasting, each position is looked up in the tiles
+the planet already has: the deepest tile whose corners, seen from the planet's center, surround it. Its mesh's
+heights are interpolated across the triangle the position is over. Tiles without meshes, or too shallow to
+stand on, leave it to a fallback, batched, which works the height out from scratch.
+
+Things that ask for heights are usually near where they asked last time, so the tiles the last few queries ended
+up on are kept, most recently used first, and checked before going down from the faces. A kept tile that's
+been split since is gone down from, so only freed tiles make them stale, which terrain_lod's generation tells.
+
+No GL in here, so it runs headless. Not thread-safe, call it from the thread that updates the LOD.
+*/
+
+enum {
+	TERRAIN_QUERY_PATCHES = 16, //Tiles kept from recent queries.
+	TERRAIN_QUERY_CHUNK = 256, //Positions whose fallbacks are worked out together.
+};
+
+//Heights above the planet's radius in the directions, which are unit length.
+typedef void (*terrain_query_fallback_fn)(void *context, const vec3 directions[], int n, float out[]);
+
+//Since it was initialized. Zero it to start counting again.
+struct terrain_query_stats {
+	int queries;
+	int hits, misses; //Found under a kept tile, or by going down from the faces.
+	int fallbacks;
+};
+
+struct terrain_query {
+	struct terrain_lod *lod;
+	int min_depth; //Tiles shallower than this are too coarse to go by, and the fallback is used instead.
+	terrain_query_fallback_fn fallback;
+	void *context;
+	quadtree_node *patches[TERRAIN_QUERY_PATCHES]; //Most recently used first.
+	int num_patches;
+	uint32_t generation; //lod's, when the patches were kept.
+	struct terrain_query_stats stats;
+};
+
+//Queries on lod's tiles. There's nothing to deinit, but it mustn't outlive lod.
+void terrain_query_init(struct terrain_query *q, struct terrain_lod *lod, int min_depth, terrain_query_fallback_fn fallback, void *context);
+//Height above the planet's radius of the ground under each of n positions, relative to the planet's center, on
+//the line through it.
+void terrain_query_heights(struct terrain_query *q, const bpos positions[], int n, float out[]);
+
+#endif
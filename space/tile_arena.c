@@ -0,0 +1,105 @@
+#include "tile_arena.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static quadtree_node * tile_arena_alloc_children(void *context)
+{
+	struct tile_arena *a = context;
+	return chunkpool_add_run(&a->nodes, QUADTREE_NUM_CHILDREN, NULL);
+}
+
+static void tile_arena_free_node(quadtree_node *node, void *context)
+{
+	struct tile_arena *a = context;
+	chunkpool_remove_ptr(&a->nodes, node);
+}
+
+void tile_arena_init(struct tile_arena *a, size_t header_size, size_t mesh_size)
+{
+	*a = (struct tile_arena){
+		.mesh_size = mesh_size,
+		.headers = chunkpool_new(0, header_size),
+		.nodes = chunkpool_new(0, sizeof(quadtree_node)),
+		.slabs = mempool_new(4, sizeof(void *)),
+		.free_meshes = mempool_new(4 * TILE_ARENA_MESHES_PER_SLAB, sizeof(void *)),
+		.node_allocator = {tile_arena_alloc_children, tile_arena_free_node, a},
+	};
+}
+
+void tile_arena_deinit(struct tile_arena *a)
+{
+	chunkpool_delete(&a->headers);
+	chunkpool_delete(&a->nodes);
+	for (size_t i = 0; i < a->slabs.num; i++)
+		free(*(void **)mempool_get(&a->slabs, i));
+	mempool_delete(&a->slabs);
+	mempool_delete(&a->free_meshes);
+}
+
+void * tile_arena_headers(struct tile_arena *a, size_t num)
+{
+	return chunkpool_add_run(&a->headers, num, NULL);
+}
+
+void tile_arena_header_free(struct tile_arena *a, void *header)
+{
+	chunkpool_remove_ptr(&a->headers, header);
+}
+
+static bool tile_arena_add_slab(struct tile_arena *a)
+{
+	unsigned char *slab = malloc(TILE_ARENA_MESHES_PER_SLAB * a->mesh_size);
+	//Room on the free list for every mesh there is, so freeing one never has to allocate.
+	size_t max_meshes = (a->slabs.num + 1) * TILE_ARENA_MESHES_PER_SLAB;
+	if (!slab || (a->slabs.num == a->slabs.max && !mempool_resize(&a->slabs, 2 * a->slabs.max))
+		|| (a->free_meshes.max < max_meshes && !mempool_resize(&a->free_meshes, 2 * max_meshes))) {
+		printf("Whoops, running out of memory.\n");
+		free(slab);
+		return false;
+	}
+	mempool_add(&a->slabs, &slab);
+	a->fresh_meshes = TILE_ARENA_MESHES_PER_SLAB;
+	//Backwards, so they're handed out in address order.
+	for (int i = TILE_ARENA_MESHES_PER_SLAB; i-- > 0;) {
+		void *mesh = slab + i * a->mesh_size;
+		mempool_add(&a->free_meshes, &mesh);
+	}
+	return true;
+}
+
+void * tile_arena_mesh(struct tile_arena *a)
+{
+	if (!a->free_meshes.num && !tile_arena_add_slab(a))
+		return NULL;
+	//A new slab's meshes are only added to an empty free list, so the fresh ones are always at the bottom.
+	if (a->free_meshes.num > a->fresh_meshes)
+		a->mesh_reuses++;
+	else
+		a->fresh_meshes--;
+	void *mesh;
+	mempool_pop(&a->free_meshes, &mesh);
+	a->num_meshes++;
+	return mesh;
+}
+
+void tile_arena_mesh_free(struct tile_arena *a, void *mesh)
+{
+	if (!mesh)
+		return;
+	mempool_add(&a->free_meshes, &mesh);
+	a->num_meshes--;
+}
+
+struct tile_arena_stats tile_arena_stats(const struct tile_arena *a)
+{
+	return (struct tile_arena_stats){
+		.headers = a->headers.num,
+		.nodes = a->nodes.num,
+		.meshes = a->num_meshes,
+		.free_meshes = a->free_meshes.num,
+		.slabs = a->slabs.num,
+		.reserved_bytes = (a->headers.chunks.num + a->nodes.chunks.num) * CHUNKPOOL_CHUNK_SIZE
+			+ a->slabs.num * TILE_ARENA_MESHES_PER_SLAB * a->mesh_size,
+		.mesh_reuses = a->mesh_reuses,
+	};
+}
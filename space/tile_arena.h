@@ -0,0 +1,52 @@
+#ifndef TILE_ARENA_H
+#define TILE_ARENA_H
+#include "datastructures/chunkpool.h"
+#include "datastructures/mempool.h"
+#include "datastructures/quadtree.h"
+#include <stddef.h>
+
+/*
+Storage for a planet's terrain tiles: their headers, their quadtree nodes and their meshes. All three are fixed
+sizes, and they come and go by the thousand as the camera moves. No GL in here.
+
+Headers and nodes live in chunkpools and are allocated a family at a time, siblings in consecutive slots, so a
+preorder walk over the tree reads memory in order. Meshes are too big for a chunkpool chunk, so they're carved
+out of slabs, TILE_ARENA_MESHES_PER_SLAB at a time, and freed ones wait on a free list for the next tile.
+Nothing goes back to the system until the arena is deleted. The planet's tile budget bounds how much it holds.
+
+Not thread-safe. Allocate on the planet's own thread, and hand meshes to workers ready-made.
+*/
+
+enum { TILE_ARENA_MESHES_PER_SLAB = 8 };
+
+struct tile_arena_stats {
+	size_t headers, nodes, meshes; //In use.
+	size_t free_meshes, slabs;
+	size_t reserved_bytes; //Everything the arena has from the system, in use or not.
+	size_t mesh_reuses; //Meshes handed out from the free list rather than a new slab, ever.
+};
+
+struct tile_arena {
+	size_t mesh_size;
+	struct chunkpool headers, nodes;
+	struct mempool slabs; //Pointers to slabs of meshes.
+	struct mempool free_meshes; //Pointers to free meshes, as a stack.
+	size_t num_meshes, mesh_reuses;
+	size_t fresh_meshes; //Meshes on the free list that have never been handed out.
+	quadtree_allocator node_allocator; //Nodes from this arena, for quadtree_node.allocator.
+};
+
+//Headers are header_size bytes and meshes mesh_size bytes. The arena can't move once it's handing out nodes.
+void tile_arena_init(struct tile_arena *a, size_t header_size, size_t mesh_size);
+//Frees everything, whether it was freed to the arena or not.
+void tile_arena_deinit(struct tile_arena *a);
+//num headers in a row, which can be used as an array and are freed one at a time. NULL if out of memory.
+void * tile_arena_headers(struct tile_arena *a, size_t num);
+void tile_arena_header_free(struct tile_arena *a, void *header);
+//A mesh of mesh_size bytes, or NULL if out of memory.
+void * tile_arena_mesh(struct tile_arena *a);
+//Accepts NULL, like free.
+void tile_arena_mesh_free(struct tile_arena *a, void *mesh);
+struct tile_arena_stats tile_arena_stats(const struct tile_arena *a);
+
+#endif
@@ -0,0 +1,163 @@
+#include "tile_atlas.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void tile_atlas_unlink(struct tile_atlas *a, int i)
+{
+	struct tile_atlas_cell *c = &a->cells[i];
+	if (c->prev >= 0)
+		a->cells[c->prev].next = c->next;
+	else
+		a->oldest = c->next;
+	if (c->next >= 0)
+		a->cells[c->next].prev = c->prev;
+	else
+		a->newest = c->prev;
+	c->prev = c->next = -1;
+}
+
+static void tile_atlas_link_newest(struct tile_atlas *a, int i)
+{
+	struct tile_atlas_cell *c = &a->cells[i];
+	c->prev = a->newest;
+	c->next = -1;
+	if (a->newest >= 0)
+		a->cells[a->newest].next = i;
+	else
+		a->oldest = i;
+	a->newest = i;
+}
+
+//Free cells go first in line, so they're used before anything is evicted.
+static void tile_atlas_link_oldest(struct tile_atlas *a, int i)
+{
+	struct tile_atlas_cell *c = &a->cells[i];
+	c->prev = -1;
+	c->next = a->oldest;
+	if (a->oldest >= 0)
+		a->cells[a->oldest].prev = i;
+	else
+		a->newest = i;
+	a->oldest = i;
+}
+
+bool tile_atlas_init(struct tile_atlas *a, int cells_per_side, int cell_size)
+{
+	*a = (struct tile_atlas){
+		.cells_per_side = cells_per_side,
+		.cell_size = cell_size,
+		.num_cells = cells_per_side * cells_per_side,
+		.oldest = -1,
+		.newest = -1,
+		.frame = 1, //Free cells have frame 0, so they never count as touched this frame.
+	};
+	a->cells = calloc(a->num_cells, sizeof(struct tile_atlas_cell));
+	if (!a->cells) {
+		printf("Whoops, running out of memory.\n");
+		a->num_cells = 0;
+		return false;
+	}
+	a->slots = hmempool_new(a->num_cells, sizeof(struct tile_atlas_slot));
+	for (int i = 0; i < a->num_cells; i++)
+		tile_atlas_link_newest(a, i);
+	return true;
+}
+
+void tile_atlas_deinit(struct tile_atlas *a)
+{
+	if (a->cells)
+		hmempool_delete(&a->slots);
+	free(a->cells);
+	*a = (struct tile_atlas){0};
+}
+
+void tile_atlas_next_frame(struct tile_atlas *a)
+{
+	a->stats = (struct tile_atlas_stats){.used = a->stats.used};
+	a->frame++;
+}
+
+struct tile_atlas_slot * tile_atlas_touch(struct tile_atlas *a, uint32_t h)
+{
+	struct tile_atlas_slot *s = hmempool_get(&a->slots, h);
+	if (!s)
+		return NULL;
+	a->cells[s->cell].frame = a->frame;
+	tile_atlas_unlink(a, s->cell);
+	tile_atlas_link_newest(a, s->cell);
+	a->stats.hits++;
+	return s;
+}
+
+struct tile_atlas_slot * tile_atlas_get(struct tile_atlas *a, uint32_t h)
+{
+	return hmempool_get(&a->slots, h);
+}
+
+uint32_t tile_atlas_alloc(struct tile_atlas *a, uint32_t *owner)
+{
+	int i = a->oldest;
+	if (i < 0 || a->cells[i].frame == a->frame) {
+		a->stats.misses++;
+		return *owner = 0;
+	}
+	struct tile_atlas_cell *c = &a->cells[i];
+	if (c->handle) {
+		hmempool_remove(&a->slots, c->handle);
+		*c->owner = 0;
+		a->stats.evictions++;
+	} else {
+		a->stats.used++;
+	}
+	struct tile_atlas_slot slot = {
+		.cell = i,
+		.origin = {(i % a->cells_per_side) * a->cell_size, (i / a->cells_per_side) * a->cell_size},
+	};
+	c->handle = hmempool_add(&a->slots, &slot);
+	c->owner = owner;
+	c->frame = a->frame;
+	tile_atlas_unlink(a, i);
+	tile_atlas_link_newest(a, i);
+	a->stats.allocations++;
+	return *owner = c->handle;
+}
+
+void tile_atlas_free(struct tile_atlas *a, uint32_t h)
+{
+	struct tile_atlas_slot *s = hmempool_get(&a->slots, h);
+	if (!s)
+		return;
+	int i = s->cell;
+	hmempool_remove(&a->slots, h);
+	a->cells[i].handle = 0;
+	a->cells[i].owner = NULL;
+	a->cells[i].frame = 0;
+	tile_atlas_unlink(a, i);
+	tile_atlas_link_oldest(a, i);
+	a->stats.used--;
+}
+
+void tile_atlas_instance(struct tile_atlas *a, uint32_t h, float morph, float out[3])
+{
+	struct tile_atlas_slot *s = tile_atlas_get(a, h);
+	out[0] = s ? s->origin[0] : -1;
+	out[1] = s ? s->origin[1] : -1;
+	out[2] = morph;
+}
+
+void tile_atlas_vertex_texel(const float instance[3], int rows, const float lerp[2], int out[2])
+{
+	int r = roundf(lerp[1] * rows);
+	out[0] = instance[0] + roundf(lerp[0] * r);
+	out[1] = instance[1] + r;
+}
+
+void tile_atlas_parent_vertices(int j, int r, int out[2][2])
+{
+	int dj = j & 1, dr = r & 1;
+	out[0][0] = j - dj;
+	out[0][1] = r - dr;
+	out[1][0] = j + dj;
+	out[1][1] = r + dr;
+}
@@ -0,0 +1,80 @@
+#ifndef TILE_ATLAS_H
+#define TILE_ATLAS_H
+#include "datastructures/hmempool.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <inttypes.h>
+
+/*
+Slots in a texture atlas of per-tile data, like gpu_planet's heightmaps. The atlas is a square of square cells,
+one tile to a cell. No GL in here, this only decides which tile gets which cell, so it runs headless.
+
+Slots are handed out as hmempool handles, which the tile keeps where it tells tile_atlas_alloc to put them. A slot
+lasts until it's freed or evicted, and eviction zeroes the owner's handle, so the tile finds out the next time it's
+drawn. The handle's generation alone won't do, since it wraps around after 128 evictions of the same cell, and a
+tile can sit in the tree undrawn for longer than that. Touched slots are never evicted in the same frame. When every slot has been touched
+this frame, the atlas is full, and tiles without one have to make do until it isn't.
+
+Cells are kept in least recently touched order, free ones first, so eviction takes whatever's been off screen the
+longest.
+
+In a cell, texel (j, r) is vertex j of row r of the tile, so a tile with n rows needs cells n + 1 texels square, and
+only uses the half with j <= r. The tile_atlas_*texel and parent functions are what gpu_planet's shaders do with
+that, here so they can be checked without a GPU.
+*/
+
+//What a handle gets.
+struct tile_atlas_slot {
+	int cell;
+	int origin[2]; //Texel coordinates of the cell's bottom-left corner.
+};
+
+struct tile_atlas_cell {
+	uint32_t handle; //0 if free.
+	uint32_t *owner; //Where the handle is kept, zeroed on eviction. NULL if free.
+	uint32_t frame; //Last touched.
+	int prev, next; //In least recently touched order, -1 at the ends.
+};
+
+struct tile_atlas_stats {
+	int used;
+	//This frame
+	int hits, allocations, evictions, misses; //Misses are allocations that failed because the atlas was full.
+};
+
+struct tile_atlas {
+	int cells_per_side, cell_size; //cell_size in texels.
+	int num_cells;
+	struct hmempool slots;
+	struct tile_atlas_cell *cells;
+	int oldest, newest; //Ends of the least recently touched list.
+	uint32_t frame;
+	struct tile_atlas_stats stats;
+};
+
+//An atlas of cells_per_side^2 cells, each cell_size texels square. Returns false if there's no memory for it.
+bool tile_atlas_init(struct tile_atlas *a, int cells_per_side, int cell_size);
+void tile_atlas_deinit(struct tile_atlas *a);
+//Start a new frame. Slots touched before this can be evicted again.
+void tile_atlas_next_frame(struct tile_atlas *a);
+//The slot, marked used this frame, or NULL if it's been evicted. h can be 0.
+struct tile_atlas_slot * tile_atlas_touch(struct tile_atlas *a, uint32_t h);
+//The slot, without touching it, or NULL if it's been evicted.
+struct tile_atlas_slot * tile_atlas_get(struct tile_atlas *a, uint32_t h);
+//A handle to a slot, touched, evicting the least recently touched one if there are no free ones. What's in its
+//cell is whatever was left there. It's put in *owner, which has to stay put until the slot's freed, and returned.
+//0 if every slot has been touched this frame.
+uint32_t tile_atlas_alloc(struct tile_atlas *a, uint32_t *owner);
+//Give back h's slot, unless it's been evicted already.
+void tile_atlas_free(struct tile_atlas *a, uint32_t h);
+
+//What a tile's instance tells the vertex shader: its cell's origin, or -1s if h has no slot, then its morph.
+void tile_atlas_instance(struct tile_atlas *a, uint32_t h, float morph, float out[3]);
+//The texel the vertex shader reads for a tile with instance, at lerp from get_tri_lerp_vals for rows rows.
+void tile_atlas_vertex_texel(const float instance[3], int rows, const float lerp[2], int out[2]);
+//The two vertices, as (j, r), whose heights average to vertex (j, r)'s on the parent tile, with rows even. The
+//parent has the vertices with j and r both even, so for those it's (j, r) twice, and the rest are halfway along one
+//of its edges.
+void tile_atlas_parent_vertices(int j, int r, int out[2][2]);
+
+#endif
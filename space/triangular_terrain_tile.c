@@ -69,11 +69,19 @@ GLuint get_shared_tri_tile_indices_buffer_object(int num_rows)
 tri_tile * tri_tile_new(const struct tri_tile_big_vertex big_vertices[3])
 //tri_tile * tri_tile_new(vec3 vertices[3])
 {
-	static int tile_index = 0;
-	//Could be replaced with a custom allocator in the future.
 	tri_tile *t = malloc(sizeof(tri_tile));
 	assert(t);
+	return tri_tile_place(t, big_vertices);
+}
+
+tri_tile * tri_tile_place(tri_tile *t, const struct tri_tile_big_vertex big_vertices[3])
+{
+	static int tile_index = 0;
+	t->mesh = NULL;
 	t->is_init = false;
+	t->collapsed = false;
+	t->collapsed_older = t->collapsed_newer = NULL;
+	t->atlas_slot = 0;
 	t->tile_index = tile_index++;
 	memcpy(t->big_vertices, big_vertices, 3*sizeof(struct tri_tile_big_vertex));
 	t->centroid = (t->big_vertices[0].position + t->big_vertices[1].position + t->big_vertices[2].position) / 3.0;
@@ -86,7 +94,6 @@ tri_tile * tri_tile_new(const struct tri_tile_big_vertex big_vertices[3])
 	return t;
 }
 
-//TODO(Gavin): Split this into tile data, mesh generation, and OpenGL setup functions.
 //Creates storage for the positions, normals, and colors, as well as OpenGL handles.
 //Should be freed by the caller, using tri_tile_free.
 tri_tile * tri_tile_init(tri_tile *t, qvec3 offset, int num_rows, void (finishing_touches)(tri_tile *, void *), void *finishing_touches_context)
@@ -94,34 +101,25 @@ tri_tile * tri_tile_init(tri_tile *t, qvec3 offset, int num_rows, void (finishin
 	assert(!t->is_init);
 	if (t->is_init) return t;
 
+	tri_tile_mesh_gen(t, offset, num_rows, finishing_touches, finishing_touches_context);
+	tri_tile_gl_init(t);
+	return t;
+}
+
+//No OpenGL in here, so it can run on any thread.
+tri_tile * tri_tile_mesh_gen(tri_tile *t, qvec3 offset, int num_rows, void (finishing_touches)(tri_tile *, void *), void *finishing_touches_context)
+{
 	//Get counts.
 	t->num_indices = num_tri_tile_indices(num_rows);
 	t->num_vertices = num_tri_tile_vertices(num_rows);
 	t->num_rows = num_rows;
-	t->mesh = (struct tri_tile_vertex *)malloc(sizeof(struct tri_tile_vertex) * t->num_vertices);
+	if (!t->mesh)
+		t->mesh = (struct tri_tile_vertex *)malloc(sizeof(struct tri_tile_vertex) * t->num_vertices);
 	if (!t->mesh)
 		printf("Malloc didn't work lol\n");
-
-	glGenVertexArrays(1, &t->vao);
-	glBindVertexArray(t->vao);
-
-	glGenBuffers(1, &t->mesh_buffer);
-	glEnableVertexAttribArray(effects.forward.vPos);
-	glEnableVertexAttribArray(effects.forward.vNormal);
-	glEnableVertexAttribArray(effects.forward.vColor);
-	glBindBuffer(GL_ARRAY_BUFFER, t->mesh_buffer);
-	glVertexAttribPointer(effects.forward.vPos, 3, GL_FLOAT, GL_FALSE,
-		sizeof(struct tri_tile_vertex), (void *)offsetof(struct tri_tile_vertex, position));
-	glVertexAttribPointer(effects.forward.vNormal, 3, GL_FLOAT, GL_FALSE,
-		sizeof(struct tri_tile_vertex), (void *)offsetof(struct tri_tile_vertex, normal));
-	glVertexAttribPointer(effects.forward.vColor, 3, GL_FLOAT, GL_FALSE,
-		sizeof(struct tri_tile_vertex), (void *)offsetof(struct tri_tile_vertex, color));
-
+	t->vao = t->mesh_buffer = 0;
 	t->buffered = false;
 
-	//Get an appropriately expanded index buffer.
-	t->ibo = get_shared_tri_tile_indices_buffer_object(num_rows);
-
 	t->override_col = (vec3){1.0, 1.0, 1.0};
 	t->offset = offset;
 	bpos_split_fix(&t->centroid, &t->offset);
@@ -145,6 +143,27 @@ tri_tile * tri_tile_init(tri_tile *t, qvec3 offset, int num_rows, void (finishin
 	return t;
 }
 
+void tri_tile_gl_init(tri_tile *t)
+{
+	glGenVertexArrays(1, &t->vao);
+	glBindVertexArray(t->vao);
+
+	glGenBuffers(1, &t->mesh_buffer);
+	glEnableVertexAttribArray(effects.forward.vPos);
+	glEnableVertexAttribArray(effects.forward.vNormal);
+	glEnableVertexAttribArray(effects.forward.vColor);
+	glBindBuffer(GL_ARRAY_BUFFER, t->mesh_buffer);
+	glVertexAttribPointer(effects.forward.vPos, 3, GL_FLOAT, GL_FALSE,
+		sizeof(struct tri_tile_vertex), (void *)offsetof(struct tri_tile_vertex, position));
+	glVertexAttribPointer(effects.forward.vNormal, 3, GL_FLOAT, GL_FALSE,
+		sizeof(struct tri_tile_vertex), (void *)offsetof(struct tri_tile_vertex, normal));
+	glVertexAttribPointer(effects.forward.vColor, 3, GL_FLOAT, GL_FALSE,
+		sizeof(struct tri_tile_vertex), (void *)offsetof(struct tri_tile_vertex, color));
+
+	//Get an appropriately expanded index buffer.
+	t->ibo = get_shared_tri_tile_indices_buffer_object(t->num_rows);
+}
+
 //Frees the dynamic storage and OpenGL objects held by a terrain struct.
 void tri_tile_deinit(tri_tile *t)
 {
@@ -152,6 +171,7 @@ void tri_tile_deinit(tri_tile *t)
 		free(t->mesh);
 		//free(t->indices);
 		//glDeleteBuffers(1, &t->bg.ibo);
+		//Zero when tri_tile_gl_init never ran, which GL ignores.
 		glDeleteVertexArrays(1, &t->vao);
 		glDeleteBuffers(1, &t->mesh_buffer);
 		//glDeleteBuffers(LENGTH(t->bg.buffer_handles), t->bg.buffer_handles);
@@ -6,11 +6,13 @@
 #include "open-simplex-noise-in-c/open-simplex-noise.h"
 #include "mesh.h"
 #include <stdbool.h>
+#include <inttypes.h>
 
 //Heightmap function pointers.
 typedef float (*height_map_func)(vec3, vec3 *);
 typedef vec3 (*position_map_func)(vec3);
 typedef struct triangular_terrain_tile tri_tile;
+struct quadtree_node;
 
 struct tri_tile_vertex {
 	vec3 position, normal, color;
@@ -47,6 +49,13 @@ struct triangular_terrain_tile {
 	bool buffered;
 	//Has init_triangular_tile been called on this yet?
 	bool is_init;
+	//Set by terrain_lod when it merges this tile's children, for either kind of planet: they're kept around, but this
+	//tile is drawn instead.
+	bool collapsed;
+	//While collapsed, the nodes on either side of this one in terrain_lod's list of collapsed tiles.
+	struct quadtree_node *collapsed_older, *collapsed_newer;
+	//Handle to gpu_planet's slot for this tile in its heightmap atlas, 0 if it has none.
+	uint32_t atlas_slot;
 	//int depth;
 	int tile_index;
 };
@@ -55,7 +64,16 @@ void tri_tile_raycast_test();
 
 tri_tile * tri_tile_new(const struct tri_tile_big_vertex big_vertices[3]);
 //tri_tile * tri_tile_new(vec3 vertices[3]);
+//tri_tile_new in storage from somewhere else, which tri_tile_free mustn't be used on. Only tri_tile_deinit.
+tri_tile * tri_tile_place(tri_tile *t, const struct tri_tile_big_vertex big_vertices[3]);
+//tri_tile_mesh_gen, then tri_tile_gl_init.
 tri_tile * tri_tile_init(tri_tile *t, bpos_origin sector, int num_rows, void (finishing_touches)(tri_tile *, void *), void *finishing_touches_context);
+//The CPU half of tri_tile_init: allocate and generate the mesh, and run finishing_touches on it. Thread-safe, as
+//long as finishing_touches is. If t->mesh is already set, it's used as is, and t->mesh needs to be set back to
+//NULL before tri_tile_deinit to keep it from being freed.
+tri_tile * tri_tile_mesh_gen(tri_tile *t, bpos_origin sector, int num_rows, void (finishing_touches)(tri_tile *, void *), void *finishing_touches_context);
+//The OpenGL half of tri_tile_init, for the thread with the context. The mesh still needs tri_tile_buffer after.
+void tri_tile_gl_init(tri_tile *t);
 void tri_tile_deinit(tri_tile *t);
 void tri_tile_free(tri_tile *t);
 
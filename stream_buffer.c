@@ -0,0 +1,137 @@
+#include "stream_buffer.h"
+#include "shader_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+//Storage is made and written through GL_COPY_WRITE_BUFFER, so whatever's bound to GL_ARRAY_BUFFER or the current
+//VAO's GL_ELEMENT_ARRAY_BUFFER is left alone.
+static bool stream_buffer_create(struct stream_buffer *sb, size_t region_size)
+{
+	sb->region_size = region_size;
+	sb->region = 0;
+	sb->used = sb->flushed = 0;
+	glGenBuffers(1, &sb->buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, sb->buffer);
+	if (sb->persistent) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, STREAM_BUFFER_REGIONS * region_size, NULL, flags);
+		sb->data = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, STREAM_BUFFER_REGIONS * region_size, flags);
+	} else {
+		glBufferData(GL_COPY_WRITE_BUFFER, region_size, NULL, GL_STREAM_DRAW);
+		sb->data = malloc(region_size);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	checkErrors("After creating stream buffer");
+	return sb->data;
+}
+
+static void stream_buffer_destroy(struct stream_buffer *sb)
+{
+	for (int i = 0; i < STREAM_BUFFER_REGIONS; i++) {
+		if (sb->fences[i])
+			glDeleteSync(sb->fences[i]);
+		sb->fences[i] = 0;
+	}
+	if (sb->persistent) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, sb->buffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	} else {
+		free(sb->data);
+	}
+	//The GPU may still be drawing from it, but GL keeps it around until it's done.
+	glDeleteBuffers(1, &sb->buffer);
+	sb->buffer = 0;
+	sb->data = NULL;
+}
+
+void stream_buffer_init(struct stream_buffer *sb, const char *name, size_t region_size)
+{
+	*sb = (struct stream_buffer){.name = name};
+#ifndef __EMSCRIPTEN__
+	sb->persistent = GLEW_ARB_buffer_storage;
+#endif
+	if (!stream_buffer_create(sb, region_size))
+		printf("Whoops, running out of memory.\n");
+}
+
+void stream_buffer_deinit(struct stream_buffer *sb)
+{
+	stream_buffer_destroy(sb);
+}
+
+void stream_buffer_begin_frame(struct stream_buffer *sb)
+{
+	sb->stats.last_frame_bytes = sb->stats.frame_bytes;
+	sb->stats.frame_bytes = 0;
+	sb->used = sb->flushed = 0;
+	if (!sb->persistent)
+		return;
+
+	if (sb->fences[sb->region])
+		glDeleteSync(sb->fences[sb->region]);
+	sb->fences[sb->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	sb->region = (sb->region + 1) % STREAM_BUFFER_REGIONS;
+
+	GLsync fence = sb->fences[sb->region];
+	if (!fence)
+		return;
+	GLenum status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	if (status == GL_TIMEOUT_EXPIRED) {
+		sb->stats.stalls++;
+		do
+			status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		while (status == GL_TIMEOUT_EXPIRED);
+	}
+	glDeleteSync(fence);
+	sb->fences[sb->region] = 0;
+}
+
+void * stream_buffer_alloc(struct stream_buffer *sb, size_t size, GLintptr *offset)
+{
+	//Making the buffer failed, at init or on a resize, so there's nowhere to write.
+	if (!sb->data)
+		return NULL;
+	size_t start = (sb->used + STREAM_BUFFER_ALIGNMENT - 1) & ~(size_t)(STREAM_BUFFER_ALIGNMENT - 1);
+	if (start + size > sb->region_size) {
+		//Whatever was written before this still gets drawn from the old buffer.
+		stream_buffer_flush(sb);
+		size_t region_size = sb->region_size;
+		while (region_size < size)
+			region_size *= 2;
+		stream_buffer_destroy(sb);
+		if (!stream_buffer_create(sb, 2 * region_size)) {
+			printf("Whoops, running out of memory.\n");
+			return NULL;
+		}
+		sb->stats.resizes++;
+		start = 0;
+	}
+
+	sb->used = start + size;
+	sb->stats.frame_bytes += size;
+	sb->stats.total_bytes += size;
+	*offset = sb->persistent ? sb->region * sb->region_size + start : start;
+	return sb->persistent ? sb->data + *offset : sb->data + start;
+}
+
+void stream_buffer_flush(struct stream_buffer *sb)
+{
+	//Coherent mapping makes writes visible to commands issued after them.
+	if (sb->persistent || sb->flushed == sb->used)
+		return;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, sb->buffer);
+	if (!sb->flushed)
+		glBufferData(GL_COPY_WRITE_BUFFER, sb->region_size, NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, sb->flushed, sb->used - sb->flushed, sb->data + sb->flushed);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	sb->flushed = sb->used;
+}
+
+void stream_buffer_print_stats(struct stream_buffer *sb)
+{
+	struct stream_buffer_stats *s = &sb->stats;
+	printf("Stream buffer %s (%s) streamed %zu KB last frame, %zu MB total, in %zu KB regions. %i stalls, %i resizes.\n",
+		sb->name, sb->persistent ? "persistent" : "orphaning", s->last_frame_bytes >> 10, s->total_bytes >> 20,
+		sb->region_size >> 10, s->stalls, s->resizes);
+}
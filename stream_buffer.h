@@ -0,0 +1,59 @@
+#ifndef STREAM_BUFFER_H
+#define STREAM_BUFFER_H
+#include "graphics.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+A buffer for vertex data that's written by the CPU every frame and drawn once or a few times, like planet tile
+instances, meter quads and debug lines.
+
+With ARB_buffer_storage, it's a ring of STREAM_BUFFER_REGIONS regions in one buffer that stays mapped. Each frame
+writes straight into the next region, and a fence on every region keeps the CPU from writing over one the GPU is
+still drawing from. A frame only waits if the GPU is more than STREAM_BUFFER_REGIONS - 1 frames behind, and that
+counts as a stall.
+
+Without it, writes go to memory on the CPU, and flushing them orphans the buffer on the frame's first flush and
+uploads them with glBufferSubData. The driver hands out fresh storage instead of waiting, or should.
+
+Either way, every frame starts with stream_buffer_begin_frame, then any number of allocs, each written to and
+flushed before drawing from it. An alloc too big for what's left of the region moves everything to a bigger
+buffer, so bind sb->buffer after every flush, and don't write to an earlier alloc after that.
+*/
+
+enum {
+	STREAM_BUFFER_REGIONS = 3,    //Frames in flight.
+	STREAM_BUFFER_ALIGNMENT = 64, //Of every alloc, for attribute offsets and cache lines.
+};
+
+struct stream_buffer_stats {
+	size_t frame_bytes, last_frame_bytes, total_bytes; //Allocated for drawing, this frame, last frame and ever.
+	int stalls; //Frames that waited on the GPU to finish with their region.
+	int resizes;
+};
+
+struct stream_buffer {
+	GLuint buffer;
+	bool persistent; //Mapped ring, rather than orphaning.
+	size_t region_size;
+	int region;
+	size_t used, flushed; //Bytes allocated and flushed in this frame's region.
+	unsigned char *data; //Mapped buffer if persistent, otherwise CPU memory for one region.
+	GLsync fences[STREAM_BUFFER_REGIONS];
+	const char *name; //For stats.
+	struct stream_buffer_stats stats;
+};
+
+//region_size is the most one frame is expected to write. It grows if that's not enough.
+void stream_buffer_init(struct stream_buffer *sb, const char *name, size_t region_size);
+void stream_buffer_deinit(struct stream_buffer *sb);
+//Fences the last frame's writes, and moves on to a region the GPU is done with, waiting for it if need be.
+void stream_buffer_begin_frame(struct stream_buffer *sb);
+//Space for size bytes in this frame's region. *offset is where they'll be in sb->buffer. NULL if the buffer
+//couldn't be made.
+void * stream_buffer_alloc(struct stream_buffer *sb, size_t size, GLintptr *offset);
+//Makes what's been written since the last flush visible to the GPU.
+void stream_buffer_flush(struct stream_buffer *sb);
+void stream_buffer_print_stats(struct stream_buffer *sb);
+
+#endif
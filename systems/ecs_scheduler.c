@@ -0,0 +1,167 @@
+#include "ecs_scheduler.h"
+#include "datastructures/ecs.h"
+#include "jobs/thread_pool.h"
+#include "macros.h"
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+static double ecs_scheduler_ms()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000.0 + t.tv_nsec / 1000000.0;
+}
+
+static bool ecs_ctypes_intersect(const uint32_t *a, size_t num_a, const uint32_t *b, size_t num_b)
+{
+	for (size_t i = 0; i < num_a; i++)
+		for (size_t j = 0; j < num_b; j++)
+			if (a[i] == b[j])
+				return true;
+	return false;
+}
+
+static bool ecs_systems_conflict(struct ecs_system *a, struct ecs_system *b)
+{
+	return ecs_ctypes_intersect(a->writes, a->num_writes, b->writes, b->num_writes) ||
+	       ecs_ctypes_intersect(a->writes, a->num_writes, b->reads,  b->num_reads) ||
+	       ecs_ctypes_intersect(a->reads,  a->num_reads,  b->writes, b->num_writes);
+}
+
+void ecs_scheduler_init(struct ecs_scheduler *s, ecs_ctx *E, thread_pool *pool)
+{
+	memset(s, 0, sizeof(*s));
+	s->E = E;
+	s->pool = pool && thread_pool_num_threads(pool) ? pool : NULL;
+}
+
+uint32_t ecs_scheduler_add(struct ecs_scheduler *s, struct ecs_system system)
+{
+	assert(s->num_systems < ECS_SCHEDULER_MAX_SYSTEMS);
+	assert(!system.run != !system.run_chunk);
+	assert(system.num_reads <= ECS_SYSTEM_MAX_ACCESS && system.num_writes <= ECS_SYSTEM_MAX_ACCESS);
+	//Stable component types aren't contiguous, there is no component list to split into chunks.
+	assert(!system.run_chunk || !ecs_component_is_stable(s->E, system.chunk_ctype));
+	s->systems[s->num_systems] = (struct ecs_scheduled_system){.system = system, .s = s};
+	return s->num_systems++;
+}
+
+static void ecs_scheduler_release(struct ecs_scheduled_system *ss);
+
+//Called by whichever thread finishes the last piece of a system.
+static void ecs_scheduler_complete(struct ecs_scheduled_system *ss)
+{
+	struct ecs_scheduler *s = ss->s;
+	double ms = ecs_scheduler_ms() - ss->start;
+	ss->timing.last_ms = ms;
+	ss->timing.total_ms += ms;
+	ss->timing.max_ms = ms > ss->timing.max_ms ? ms : ss->timing.max_ms;
+	ss->timing.runs++;
+
+	for (size_t j = 0; j < s->num_systems; j++)
+		if ((ss->dependents >> j) & 1 && atomic_fetch_sub(&s->systems[j].deps_remaining, 1) == 1)
+			ecs_scheduler_release(&s->systems[j]);
+	//Dependents are released before this, so the frame can't look finished while they are pending.
+	atomic_fetch_sub(&s->frame_remaining, 1);
+}
+
+static thread_pool_job_fn(ecs_scheduler_run_job)
+{
+	struct ecs_scheduled_system *ss = ctx;
+	ss->system.run(ss->s->E, ss->system.ctx, ss->s->dt);
+	ecs_scheduler_complete(ss);
+}
+
+static thread_pool_job_fn(ecs_scheduler_chunk_job)
+{
+	struct ecs_scheduled_system *ss = ctx;
+	ss->system.run_chunk(ss->s->E, ss->system.ctx, ss->s->dt, ss->components, ss->itoh, begin, end);
+	if (atomic_fetch_sub(&ss->chunks_remaining, 1) == 1)
+		ecs_scheduler_complete(ss);
+}
+
+//Queue up a system whose dependencies are all done.
+static void ecs_scheduler_release(struct ecs_scheduled_system *ss)
+{
+	struct ecs_scheduler *s = ss->s;
+	ss->start = ecs_scheduler_ms();
+	if (ss->system.run) {
+		thread_pool_submit(s->pool, (struct thread_pool_job){.fn = ecs_scheduler_run_job, .ctx = ss, .begin = 0, .end = 1});
+		return;
+	}
+
+	ss->num_components = 0;
+	ss->components = ecs_components(s->E, ss->system.chunk_ctype, &ss->num_components);
+	ss->itoh = ecs_component_itoh(s->E, ss->system.chunk_ctype);
+	if (!ss->num_components) {
+		ecs_scheduler_complete(ss);
+		return;
+	}
+	size_t chunk = ss->system.chunk_size ? ss->system.chunk_size : ss->num_components;
+	atomic_store(&ss->chunks_remaining, (ss->num_components + chunk - 1) / chunk);
+	thread_pool_parallel_for(s->pool, ecs_scheduler_chunk_job, ss, ss->num_components, chunk, NULL);
+}
+
+void ecs_scheduler_run(struct ecs_scheduler *s, float dt)
+{
+	s->dt = dt;
+
+	//Single-threaded fallback, registration order already satisfies every dependency.
+	if (!s->pool) {
+		for (size_t i = 0; i < s->num_systems; i++) {
+			struct ecs_scheduled_system *ss = &s->systems[i];
+			ss->dependents = 0;
+			atomic_store(&s->frame_remaining, 1);
+			ss->start = ecs_scheduler_ms();
+			if (ss->system.run) {
+				ss->system.run(s->E, ss->system.ctx, dt);
+			} else {
+				size_t num = 0;
+				void *components = ecs_components(s->E, ss->system.chunk_ctype, &num);
+				const uint32_t *itoh = ecs_component_itoh(s->E, ss->system.chunk_ctype);
+				size_t chunk = ss->system.chunk_size ? ss->system.chunk_size : num;
+				for (size_t begin = 0; begin < num; begin += chunk)
+					ss->system.run_chunk(s->E, ss->system.ctx, dt, components, itoh, begin, begin + chunk < num ? begin + chunk : num);
+			}
+			ecs_scheduler_complete(ss);
+		}
+		return;
+	}
+
+	//Build this frame's dependency DAG. Edges only point from earlier to later systems, so it can't have cycles.
+	for (size_t i = 0; i < s->num_systems; i++) {
+		s->systems[i].dependents = 0;
+		atomic_store(&s->systems[i].deps_remaining, 0);
+	}
+	for (size_t i = 0; i < s->num_systems; i++) {
+		for (size_t j = i + 1; j < s->num_systems; j++) {
+			if (ecs_systems_conflict(&s->systems[i].system, &s->systems[j].system)) {
+				s->systems[i].dependents |= (uint64_t)1 << j;
+				atomic_fetch_add(&s->systems[j].deps_remaining, 1);
+			}
+		}
+	}
+
+	//Find the roots before releasing any, since released systems can finish and release others right away.
+	uint64_t roots = 0;
+	for (size_t i = 0; i < s->num_systems; i++)
+		if (!atomic_load(&s->systems[i].deps_remaining))
+			roots |= (uint64_t)1 << i;
+	atomic_store(&s->frame_remaining, s->num_systems);
+	for (size_t i = 0; i < s->num_systems; i++)
+		if ((roots >> i) & 1)
+			ecs_scheduler_release(&s->systems[i]);
+	thread_pool_wait(s->pool, &s->frame_remaining);
+}
+
+void ecs_scheduler_print_timings(struct ecs_scheduler *s)
+{
+	printf("%-24s %10s %10s %10s %8s\n", "System", "Last ms", "Avg ms", "Max ms", "Runs");
+	for (size_t i = 0; i < s->num_systems; i++) {
+		struct ecs_scheduled_system *ss = &s->systems[i];
+		printf("%-24s %10.3f %10.3f %10.3f %8" PRIu64 "\n", ss->system.name ? ss->system.name : "(unnamed)",
+			ss->timing.last_ms, ss->timing.runs ? ss->timing.total_ms / ss->timing.runs : 0.0, ss->timing.max_ms, ss->timing.runs);
+	}
+}
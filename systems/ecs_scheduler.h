@@ -0,0 +1,80 @@
+#ifndef ECS_SCHEDULER_H
+#define ECS_SCHEDULER_H
+#include "datastructures/ecs.h"
+#include "jobs/thread_pool.h"
+#include <stdatomic.h>
+#include <inttypes.h>
+
+/*
+Runs registered systems over an ecs_ctx once per frame.
+
+Each system declares which ctypes it reads and writes. Every frame, the scheduler builds a DAG where a system
+depends on each earlier-registered system it conflicts with (one writes a ctype the other reads or writes),
+and runs systems as soon as their dependencies are done, on a thread_pool.
+Without a pool (or with a 0-thread pool) systems run one after another in registration order, which is deterministic.
+
+Systems that set run_chunk are called over chunks of chunk_size components of type chunk_ctype, and the chunks
+are spread over the workers. Systems must not add or remove components while running, use an ecs_cmdbuf instead.
+Systems also run on worker threads, so they should not touch OpenGL or SDL state.
+*/
+
+#define ECS_SYSTEM_MAX_ACCESS 8
+#define ECS_SCHEDULER_MAX_SYSTEMS 64
+
+#define ecs_system_fn(name) void name(ecs_ctx *E, void *ctx, float dt)
+typedef ecs_system_fn(ecs_system_fn);
+//components is the list returned by ecs_components for chunk_ctype, itoh is its index-to-handle table.
+#define ecs_system_chunk_fn(name) void name(ecs_ctx *E, void *ctx, float dt, void *components, const uint32_t *itoh, size_t begin, size_t end)
+typedef ecs_system_chunk_fn(ecs_system_chunk_fn);
+
+struct ecs_system {
+	const char *name;
+	size_t num_reads, num_writes;
+	uint32_t reads[ECS_SYSTEM_MAX_ACCESS];
+	uint32_t writes[ECS_SYSTEM_MAX_ACCESS];
+	//Set exactly one of run or run_chunk.
+	ecs_system_fn *run;
+	ecs_system_chunk_fn *run_chunk;
+	uint32_t chunk_ctype; //Should also be listed in reads or writes. Can't be a stable component type.
+	size_t chunk_size; //0 means one chunk.
+	void *ctx;
+};
+
+struct ecs_system_timing {
+	double last_ms, max_ms, total_ms; //Wall time from when the system became ready until its last chunk finished.
+	uint64_t runs;
+};
+
+struct ecs_scheduled_system {
+	struct ecs_system system;
+	struct ecs_system_timing timing;
+	//Per-frame state.
+	uint64_t dependents; //Bit i set means system i waits on this one.
+	atomic_size_t deps_remaining, chunks_remaining;
+	double start;
+	size_t num_components;
+	void *components;
+	const uint32_t *itoh;
+	struct ecs_scheduler *s;
+};
+
+struct ecs_scheduler {
+	ecs_ctx *E;
+	thread_pool *pool; //May be NULL, for single-threaded mode.
+	size_t num_systems;
+	struct ecs_scheduled_system systems[ECS_SCHEDULER_MAX_SYSTEMS];
+	float dt;
+	atomic_size_t frame_remaining;
+};
+
+//Create a scheduler for E. If pool is NULL, systems run on the calling thread in registration order.
+//The pool is not owned by the scheduler.
+void ecs_scheduler_init(struct ecs_scheduler *s, ecs_ctx *E, thread_pool *pool);
+//Register a system, returns its index. Systems registered earlier win conflicts (run first).
+uint32_t ecs_scheduler_add(struct ecs_scheduler *s, struct ecs_system system);
+//Run every registered system once, returns once they have all finished.
+void ecs_scheduler_run(struct ecs_scheduler *s, float dt);
+//Print the timing report for each system.
+void ecs_scheduler_print_timings(struct ecs_scheduler *s);
+
+#endif
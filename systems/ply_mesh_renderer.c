@@ -1,7 +1,7 @@
 #include "models/ply_mesh.h"
 #include "systems/ply_mesh_renderer.h"
 #include "components/components.h"
-#include "datastructures/hashtable.h"
+#include "datastructures/hashmap.h"
 
 /*
 This system will know how to render an entity with a PlyMesh component and a Physical component into a framebuffer.
@@ -65,7 +65,7 @@ struct ply_mesh_ctx {
 struct ply_mesh_renderer_ctx ply_mesh_renderer_new(size_t num_meshes)
 {
 	return (struct ply_mesh_renderer_ctx){
-		.mesh_cache = hashtable_new(num_meshes),
+		.mesh_cache = hashmap_new(num_meshes, NULL),
 		.mesh_handles = hmempool_new(num_meshes, sizeof(struct ply_mesh_ctx))
 	};
 }
@@ -76,12 +76,12 @@ void ply_mesh_renderer_delete(struct ply_mesh_renderer_ctx *ctx)
 	for (int i = 0; i < pool->num; i++)
 		ply_mesh_free(((struct ply_mesh_ctx *)pool->pool)[i].mesh);
 	hmempool_delete(&ctx->mesh_handles);
-	hashtable_free(ctx->mesh_cache, NULL, NULL);
+	hashmap_delete(&ctx->mesh_cache, NULL, NULL);
 }
 
 uint32_t ply_mesh_renderer_get_mesh(struct ply_mesh_renderer_ctx *ctx, const char *filename)
 {
-	hashtable_listnode *node = hashtable_find(ctx->mesh_cache, filename, true);
+	struct hashmap_entry *node = hashmap_find(&ctx->mesh_cache, filename, true);
 	if (node) {
 		if (!node->handle)
 			node->handle = hmempool_add(&ctx->mesh_handles,
@@ -91,8 +91,8 @@ uint32_t ply_mesh_renderer_get_mesh(struct ply_mesh_renderer_ctx *ctx, const cha
 		return node->handle;
 	}
 
-	//Something went wrong with creating the hashtable listnode
-	fprintf(stderr, "Could not find or create PLY mesh cache hashtable listnode.\n");
+	//Something went wrong with creating the mesh cache entry
+	fprintf(stderr, "Could not find or create PLY mesh cache entry.\n");
 	return 0;
 }
 
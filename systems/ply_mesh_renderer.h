@@ -1,11 +1,11 @@
 #ifndef PLY_MESH_RENDERER_H
 #define PLY_MESH_RENDERER_H
 #include <inttypes.h>
-#include "datastructures/hashtable.h"
+#include "datastructures/hashmap.h"
 #include "datastructures/hmempool.h"
 
 struct ply_mesh_renderer_ctx {
-	hashtable *mesh_cache;
+	struct hashmap mesh_cache;
 	struct hmempool mesh_handles;
 };
 typedef uint32_t ply_mesh_handle;
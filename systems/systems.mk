@@ -1,3 +1,3 @@
 OBJECTS += \
-	systems/ply_mesh_renderer.o
-
+	systems/ply_mesh_renderer.o \
+	systems/ecs_scheduler.o \
@@ -0,0 +1,160 @@
+#include "test/test_main.h"
+#include "datastructures/chunkpool.h"
+#include "datastructures/hmempool.h"
+#include <string.h>
+#include <stdlib.h>
+
+int chunkpool_test_add_remove()
+{
+	int nf = 0; //Number of failures
+	enum {num = 5000};
+	struct chunkpool cp = chunkpool_new(16, sizeof(int));
+	int *ptrs[num];
+	uint32_t indices[num];
+	for (int i = 0; i < num; i++)
+		ptrs[i] = chunkpool_add(&cp, &i, &indices[i]);
+	TEST_SOFT_ASSERT(nf, cp.num == num);
+	TEST_SOFT_ASSERT(nf, cp.chunks.num > 1);
+
+	//Remove every third item, everything else stays exactly where it was.
+	for (int i = 0; i < num; i += 3)
+		chunkpool_remove(&cp, indices[i]);
+	for (int i = 0; i < num; i++) {
+		int *p = chunkpool_get(&cp, indices[i]);
+		if (i % 3 == 0 ? p != NULL : (p != ptrs[i] || *p != i || chunkpool_index_of(&cp, p) != indices[i])) {
+			nf++;
+			break;
+		}
+	}
+
+	//Holes are reused before any new chunks are allocated.
+	size_t num_chunks = cp.chunks.num;
+	for (int i = 0; i < num; i += 3)
+		ptrs[i] = chunkpool_add(&cp, &i, &indices[i]);
+	TEST_SOFT_ASSERT(nf, cp.chunks.num == num_chunks);
+	TEST_SOFT_ASSERT(nf, cp.num == num);
+
+	chunkpool_remove_ptr(&cp, ptrs[1]);
+	TEST_SOFT_ASSERT(nf, chunkpool_get(&cp, indices[1]) == NULL);
+
+	chunkpool_delete(&cp);
+	return nf;
+}
+
+int chunkpool_test_runs()
+{
+	int nf = 0; //Number of failures
+	enum {num = 3000};
+	struct chunkpool cp = chunkpool_new(num, 3 * sizeof(float));
+	uint32_t indices[num];
+	for (int i = 0; i < num; i++)
+		chunkpool_add(&cp, (float[]){i, i, i}, &indices[i]);
+	//Punch holes of varying length, including ones that cross bitmap words and chunks.
+	for (int i = 0; i < num; i++)
+		if ((i / 7) % 3 == 1 || (i > 1000 && i < 1500))
+			chunkpool_remove(&cp, indices[i]);
+
+	struct chunkpool_iter it;
+	chunkpool_iter_init(&it, &cp);
+	size_t run, visited = 0, runs = 0;
+	uint32_t first;
+	long long sum = 0, expected = 0;
+	float *items;
+	while ((items = chunkpool_next_run(&it, &run, &first))) {
+		runs++;
+		for (size_t i = 0; i < run; i++) {
+			if (chunkpool_get(&cp, first + i) != &items[3 * i])
+				nf++;
+			sum += items[3 * i];
+		}
+		visited += run;
+	}
+	for (int i = 0; i < num; i++)
+		if (chunkpool_get(&cp, indices[i]))
+			expected += i;
+	TEST_SOFT_ASSERT(nf, visited == cp.num);
+	TEST_SOFT_ASSERT(nf, sum == expected);
+	TEST_SOFT_ASSERT(nf, runs < visited);
+
+	chunkpool_delete(&cp);
+	return nf;
+}
+
+struct chunkpool_bench_particle {
+	float pos[3], vel[3];
+};
+
+int chunkpool_bench()
+{
+	int nf = 0; //Number of failures
+	const int num = 100000, passes = 50, churn = 1000000;
+	struct chunkpool_bench_particle init = {{0, 0, 0}, {1, 2, 3}};
+	struct hmempool hm = hmempool_new(num, sizeof(struct chunkpool_bench_particle));
+	struct chunkpool cp = chunkpool_new(num, sizeof(struct chunkpool_bench_particle));
+	uint32_t *handles = malloc(num * sizeof(uint32_t));
+	uint32_t *indices = malloc(num * sizeof(uint32_t));
+	for (int i = 0; i < num; i++) {
+		handles[i] = hmempool_add(&hm, &init);
+		chunkpool_add(&cp, &init, &indices[i]);
+	}
+
+	//Churn: remove a random item and add a new one in its place.
+	srand(1);
+	double start = test_time_seconds();
+	for (int i = 0; i < churn; i++) {
+		int j = rand() % num;
+		hmempool_remove(&hm, handles[j]);
+		handles[j] = hmempool_add(&hm, &init);
+	}
+	double hmempool_churn_time = test_time_seconds() - start;
+	srand(1);
+	start = test_time_seconds();
+	for (int i = 0; i < churn; i++) {
+		int j = rand() % num;
+		chunkpool_remove(&cp, indices[j]);
+		chunkpool_add(&cp, &init, &indices[j]);
+	}
+	double chunkpool_churn_time = test_time_seconds() - start;
+
+	//Leave a quarter of the chunkpool as holes, the hmempool stays dense either way.
+	for (int i = 0; i < num; i += 4) {
+		hmempool_remove(&hm, handles[i]);
+		chunkpool_remove(&cp, indices[i]);
+	}
+
+	start = test_time_seconds();
+	for (int pass = 0; pass < passes; pass++) {
+		struct chunkpool_bench_particle *p = (struct chunkpool_bench_particle *)hm.pool.pool;
+		for (size_t i = 0; i < hm.pool.num; i++)
+			for (int k = 0; k < 3; k++)
+				p[i].pos[k] += p[i].vel[k];
+	}
+	double hmempool_iter_time = test_time_seconds() - start;
+	start = test_time_seconds();
+	for (int pass = 0; pass < passes; pass++) {
+		struct chunkpool_iter it;
+		chunkpool_iter_init(&it, &cp);
+		struct chunkpool_bench_particle *p;
+		size_t run;
+		while ((p = chunkpool_next_run(&it, &run, NULL)))
+			for (size_t i = 0; i < run; i++)
+				for (int k = 0; k < 3; k++)
+					p[i].pos[k] += p[i].vel[k];
+	}
+	double chunkpool_iter_time = test_time_seconds() - start;
+
+	TEST_SOFT_ASSERT(nf, hm.pool.num == cp.num);
+	struct chunkpool_bench_particle *p = chunkpool_get(&cp, indices[1]);
+	TEST_SOFT_ASSERT(nf, p && p->pos[2] == passes * 3);
+
+	printf(ANSI_COLOR_CYAN "chunkpool_bench: %d items, %d churn ops hmempool %.2fms vs chunkpool %.2fms, "
+		"%d passes (25%% holes) hmempool %.2fms vs chunkpool %.2fms" ANSI_COLOR_RESET "\n",
+		num, churn, hmempool_churn_time * 1000, chunkpool_churn_time * 1000,
+		passes, hmempool_iter_time * 1000, chunkpool_iter_time * 1000);
+
+	free(handles);
+	free(indices);
+	hmempool_delete(&hm);
+	chunkpool_delete(&cp);
+	return nf;
+}
@@ -95,4 +95,403 @@ int ecs_test_1()
 	ecs_free(E);
 
 	return nf;
-}
\ No newline at end of file
+}
+int ecs_test_query()
+{
+	int nf = 0; //Number of failures
+	uint32_t entities[8];
+	ecs_ctx e = ecs_new(LENGTH(entities), 2);
+	ecs_ctx *E = &e;
+	uint32_t ca = ecs_component_register(E, LENGTH(entities), sizeof(int));
+	uint32_t cb = ecs_component_register(E, LENGTH(entities), sizeof(int));
+	for (int i = 0; i < LENGTH(entities); i++)
+		entities[i] = ecs_entity_add(E);
+
+	//Even entities get both components, odd entities only get "a".
+	for (int i = 0; i < LENGTH(entities); i++)
+		*(int *)ecs_entity_add_component(E, entities[i], ca) = i;
+	struct ecs_query *q = ecs_query_new(E, (uint32_t[]){ca, cb}, 2);
+	TEST_SOFT_ASSERT(nf, ecs_query_num(q) == 0)
+	for (int i = 0; i < LENGTH(entities); i += 2)
+		*(int *)ecs_entity_add_component(E, entities[i], cb) = 10 * i;
+	TEST_SOFT_ASSERT(nf, ecs_query_num(q) == LENGTH(entities) / 2)
+
+	//Shuffle things around in the "a" pool, the query should follow along.
+	ecs_entity_remove_component(E, entities[0], ca);
+	ecs_entity_remove(E, entities[3]);
+	TEST_SOFT_ASSERT(nf, ecs_query_num(q) == LENGTH(entities) / 2 - 1)
+
+	struct ecs_query_iter it;
+	int seen = 0;
+	ecs_query_iter_init(&it, E, q);
+	while (ecs_query_next(&it)) {
+		for (int i = 0; i < it.num; i++) {
+			int a = *(int *)it.components[0][i], b = *(int *)it.components[1][i];
+			TEST_SOFT_ASSERT(nf, b == 10 * a)
+			TEST_SOFT_ASSERT(nf, it.components[0][i] == ecs_entity_get_component(E, it.eids[i], ca))
+			seen++;
+		}
+	}
+	TEST_SOFT_ASSERT(nf, seen == LENGTH(entities) / 2 - 1)
+
+	//A query created after the fact picks up existing matches.
+	struct ecs_query *q2 = ecs_query_new(E, (uint32_t[]){cb}, 1);
+	TEST_SOFT_ASSERT(nf, ecs_query_num(q2) == LENGTH(entities) / 2)
+	ecs_query_delete(E, q2);
+
+	ecs_component_unregister(E, cb);
+	TEST_SOFT_ASSERT(nf, ecs_query_num(q) == 0)
+
+	ecs_free(E);
+	return nf;
+}
+
+int ecs_test_generations()
+{
+	int nf = 0; //Number of failures
+	ecs_ctx e = ecs_new(2, 1);
+	ecs_ctx *E = &e;
+	uint32_t ctype = ecs_component_register(E, 2, sizeof(int));
+	uint32_t old = ecs_entity_add(E);
+	*(int *)ecs_entity_add_component(E, old, ctype) = 1;
+	ecs_entity_remove(E, old);
+
+	//The new entity reuses the slot, but the old eid should not alias it.
+	uint32_t new = ecs_entity_add(E);
+	*(int *)ecs_entity_add_component(E, new, ctype) = 2;
+	TEST_SOFT_ASSERT(nf, ecs_eid_slot(old) == ecs_eid_slot(new))
+	TEST_SOFT_ASSERT(nf, !ecs_eid_used(E, old))
+	TEST_SOFT_ASSERT(nf, ecs_eid_used(E, new))
+	TEST_SOFT_ASSERT(nf, ecs_entity_get_component(E, old, ctype) == NULL)
+	TEST_SOFT_ASSERT(nf, *(int *)ecs_entity_get_component(E, new, ctype) == 2)
+	//Removing the stale eid again must not touch the new entity.
+	ecs_entity_remove(E, old);
+	TEST_SOFT_ASSERT(nf, ecs_eid_used(E, new))
+
+	uint32_t eids[] = {old, new, 0, ECS_EID_SLOT_MASK};
+	uint64_t mask[1];
+	TEST_SOFT_ASSERT(nf, ecs_entities_alive(E, eids, LENGTH(eids), mask) == 1)
+	TEST_SOFT_ASSERT(nf, mask[0] == 2)
+
+	ecs_free(E);
+	return nf;
+}
+
+struct ecs_bench_position {float x, y, z;};
+struct ecs_bench_velocity {float x, y, z;};
+struct ecs_bench_mass {float m;};
+
+//Compares a query against the "iterate one pool, ecs_entity_get_component the rest" pattern.
+int ecs_bench_query()
+{
+	int nf = 0; //Number of failures
+	const int num = 100000, passes = 20;
+	ecs_ctx e = ecs_new(num, 3);
+	ecs_ctx *E = &e;
+	uint32_t cp = ecs_component_register(E, num, sizeof(struct ecs_bench_position));
+	uint32_t cv = ecs_component_register(E, num, sizeof(struct ecs_bench_velocity));
+	uint32_t cm = ecs_component_register(E, num, sizeof(struct ecs_bench_mass));
+	uint32_t *entities = malloc(num * sizeof(uint32_t));
+	for (int i = 0; i < num; i++)
+		entities[i] = ecs_entity_add(E);
+
+	//Attach components in a different order per type, so the pools aren't trivially aligned.
+	srand(1);
+	for (int i = 0; i < num; i++)
+		*(struct ecs_bench_position *)ecs_entity_add_component(E, entities[i], cp) = (struct ecs_bench_position){i, 0, 0};
+	for (int i = num; i-- > 0;)
+		*(struct ecs_bench_velocity *)ecs_entity_add_component(E, entities[i], cv) = (struct ecs_bench_velocity){1, 2, 3};
+	for (int i = 0; i < num; i++) {
+		int j = rand() % num, tmp = entities[i];
+		entities[i] = entities[j];
+		entities[j] = tmp;
+	}
+	for (int i = 0; i < num; i++)
+		*(struct ecs_bench_mass *)ecs_entity_add_component(E, entities[i], cm) = (struct ecs_bench_mass){2};
+
+	double start = test_time_seconds();
+	for (int pass = 0; pass < passes; pass++) {
+		size_t num_masses = 0;
+		struct ecs_bench_mass *masses = ecs_components(E, cm, &num_masses);
+		const uint32_t *masses_itoh = ecs_component_itoh(E, cm);
+		for (int i = 0; i < num_masses; i++) {
+			struct ecs_bench_position *p = ecs_entity_get_component(E, masses_itoh[i], cp);
+			struct ecs_bench_velocity *v = ecs_entity_get_component(E, masses_itoh[i], cv);
+			p->x += v->x / masses[i].m;
+			p->y += v->y / masses[i].m;
+			p->z += v->z / masses[i].m;
+		}
+	}
+	double get_component_time = test_time_seconds() - start;
+
+	struct ecs_query *q = ecs_query_new(E, (uint32_t[]){cp, cv, cm}, 3);
+	start = test_time_seconds();
+	for (int pass = 0; pass < passes; pass++) {
+		struct ecs_query_iter it;
+		ecs_query_iter_init(&it, E, q);
+		while (ecs_query_next(&it)) {
+			for (int i = 0; i < it.num; i++) {
+				struct ecs_bench_position *p = it.components[0][i];
+				struct ecs_bench_velocity *v = it.components[1][i];
+				struct ecs_bench_mass *m = it.components[2][i];
+				p->x += v->x / m->m;
+				p->y += v->y / m->m;
+				p->z += v->z / m->m;
+			}
+		}
+	}
+	double query_time = test_time_seconds() - start;
+
+	//Both loops should have applied the same update to every entity.
+	for (int i = 0; i < num; i++) {
+		struct ecs_bench_position *p = ecs_entity_get_component(E, entities[i], cp);
+		if (p->y != passes * 2 || p->z != passes * 3) {
+			nf++;
+			break;
+		}
+	}
+
+	printf(ANSI_COLOR_CYAN "ecs_bench_query: %d entities x %d passes, get_component %.2fms, query %.2fms" ANSI_COLOR_RESET "\n",
+		num, passes, get_component_time * 1000, query_time * 1000);
+
+	free(entities);
+	ecs_free(E);
+	return nf;
+}
+
+static ecs_c_constructor_destructor(ecs_test_spawn_count)
+{
+	(*(int *)userdata)++;
+}
+
+int ecs_test_spawn()
+{
+	int nf = 0; //Number of failures
+	enum {num = 1000};
+	ecs_ctx e = ecs_new(4, 3);
+	ecs_ctx *E = &e;
+	int constructed = 0, destructed = 0;
+	uint32_t cp = ecs_component_register(E, 4, sizeof(struct ecs_bench_position));
+	uint32_t cm = ecs_component_register(E, 4, sizeof(struct ecs_bench_mass));
+	ecs_component_set_construct_destruct(E, cm, ecs_test_spawn_count, NULL, &constructed);
+	ecs_component_set_construct_destruct(E, cp, NULL, ecs_test_spawn_count, &destructed);
+	uint32_t before = ecs_entity_add(E);
+	ecs_entity_add_component(E, before, cp);
+	struct ecs_query *q = ecs_query_new(E, (uint32_t[]){cp, cm}, 2);
+
+	struct ecs_bench_position *positions = malloc(num * sizeof(struct ecs_bench_position));
+	for (int i = 0; i < num; i++)
+		positions[i] = (struct ecs_bench_position){i, -i, 1};
+	uint32_t eids[num];
+	ecs_entities_spawn_construct(E, num, (uint32_t[]){cp, cm}, 2, (const void *[]){positions, NULL}, eids);
+	TEST_SOFT_ASSERT(nf, ecs_entities_num(E) == num + 1);
+	TEST_SOFT_ASSERT(nf, constructed == num);
+	TEST_SOFT_ASSERT(nf, ecs_query_num(q) == num);
+	for (int i = 0; i < num; i++) {
+		struct ecs_bench_position *p = ecs_entity_get_component(E, eids[i], cp);
+		struct ecs_bench_mass *m = ecs_entity_get_component(E, eids[i], cm);
+		if (!p || !m || p->x != i || p->y != -i || m->m != 0) {
+			nf++;
+			break;
+		}
+	}
+
+	//Despawn every other entity, plus a stale duplicate, and make sure the rest are untouched.
+	uint32_t odd[num / 2 + 1];
+	for (int i = 0; i < num / 2; i++)
+		odd[i] = eids[2 * i + 1];
+	odd[num / 2] = eids[1];
+	ecs_entities_destruct_despawn(E, odd, num / 2 + 1);
+	TEST_SOFT_ASSERT(nf, destructed == num / 2);
+	TEST_SOFT_ASSERT(nf, ecs_entities_num(E) == num / 2 + 1);
+	TEST_SOFT_ASSERT(nf, ecs_query_num(q) == num / 2);
+	TEST_SOFT_ASSERT(nf, !ecs_eid_used(E, eids[1]));
+	TEST_SOFT_ASSERT(nf, ecs_entity_get_component(E, before, cp) != NULL);
+	for (int i = 0; i < num; i += 2) {
+		struct ecs_bench_position *p = ecs_entity_get_component(E, eids[i], cp);
+		if (!p || p->x != i) {
+			nf++;
+			break;
+		}
+	}
+
+	ecs_entities_despawn(E, eids, num);
+	TEST_SOFT_ASSERT(nf, ecs_entities_num(E) == 1);
+	TEST_SOFT_ASSERT(nf, ecs_query_num(q) == 0);
+
+	free(positions);
+	ecs_free(E);
+	return nf;
+}
+
+int ecs_bench_spawn()
+{
+	int nf = 0; //Number of failures
+	const int num = 100000;
+	uint32_t *eids = malloc(num * sizeof(uint32_t));
+	struct ecs_bench_position *positions = malloc(num * sizeof(struct ecs_bench_position));
+	struct ecs_bench_velocity *velocities = malloc(num * sizeof(struct ecs_bench_velocity));
+	struct ecs_bench_mass *masses = malloc(num * sizeof(struct ecs_bench_mass));
+	for (int i = 0; i < num; i++) {
+		positions[i] = (struct ecs_bench_position){i, 0, 0};
+		velocities[i] = (struct ecs_bench_velocity){1, 2, 3};
+		masses[i] = (struct ecs_bench_mass){2};
+	}
+
+	//Both contexts start small, so the per-entity path pays for its repeated doubling.
+	ecs_ctx e1 = ecs_new(16, 3);
+	uint32_t cp = ecs_component_register(&e1, 16, sizeof(struct ecs_bench_position));
+	uint32_t cv = ecs_component_register(&e1, 16, sizeof(struct ecs_bench_velocity));
+	uint32_t cm = ecs_component_register(&e1, 16, sizeof(struct ecs_bench_mass));
+	double start = test_time_seconds();
+	for (int i = 0; i < num; i++) {
+		eids[i] = ecs_entity_add(&e1);
+		ecs_entity_add_copy_component(&e1, eids[i], cp, &positions[i]);
+		ecs_entity_add_copy_component(&e1, eids[i], cv, &velocities[i]);
+		ecs_entity_add_copy_component(&e1, eids[i], cm, &masses[i]);
+	}
+	double add_time = test_time_seconds() - start;
+	start = test_time_seconds();
+	for (int i = 0; i < num; i++)
+		ecs_entity_remove(&e1, eids[i]);
+	double remove_time = test_time_seconds() - start;
+	ecs_free(&e1);
+
+	ecs_ctx e2 = ecs_new(16, 3);
+	cp = ecs_component_register(&e2, 16, sizeof(struct ecs_bench_position));
+	cv = ecs_component_register(&e2, 16, sizeof(struct ecs_bench_velocity));
+	cm = ecs_component_register(&e2, 16, sizeof(struct ecs_bench_mass));
+	start = test_time_seconds();
+	ecs_entities_spawn(&e2, num, (uint32_t[]){cp, cv, cm}, 3, (const void *[]){positions, velocities, masses}, eids);
+	double spawn_time = test_time_seconds() - start;
+	TEST_SOFT_ASSERT(nf, ecs_entities_num(&e2) == num);
+	TEST_SOFT_ASSERT(nf, ((struct ecs_bench_position *)ecs_entity_get_component(&e2, eids[num - 1], cp))->x == num - 1);
+	start = test_time_seconds();
+	ecs_entities_despawn(&e2, eids, num);
+	double despawn_time = test_time_seconds() - start;
+	TEST_SOFT_ASSERT(nf, ecs_entities_num(&e2) == 0);
+	ecs_free(&e2);
+
+	printf(ANSI_COLOR_CYAN "ecs_bench_spawn: %d entities x 3 components, add %.2fms vs spawn %.2fms, remove %.2fms vs despawn %.2fms" ANSI_COLOR_RESET "\n",
+		num, add_time * 1000, spawn_time * 1000, remove_time * 1000, despawn_time * 1000);
+
+	free(eids);
+	free(positions);
+	free(velocities);
+	free(masses);
+	return nf;
+}
+
+int ecs_test_stable_component()
+{
+	int nf = 0; //Number of failures
+	enum {num = 100};
+	ecs_ctx e = ecs_new(4, 2);
+	ecs_ctx *E = &e;
+	int destructed = 0;
+	uint32_t cp = ecs_component_register_stable(E, 4, sizeof(struct ecs_bench_position));
+	uint32_t cm = ecs_component_register(E, 4, sizeof(struct ecs_bench_mass));
+	ecs_component_set_construct_destruct(E, cp, NULL, ecs_test_spawn_count, &destructed);
+	struct ecs_query *q = ecs_query_new(E, (uint32_t[]){cp, cm}, 2);
+	TEST_SOFT_ASSERT(nf, ecs_component_is_stable(E, cp) && !ecs_component_is_stable(E, cm));
+	TEST_SOFT_ASSERT(nf, ecs_component_size(E, cp) == sizeof(struct ecs_bench_position));
+
+	uint32_t eids[num];
+	struct ecs_bench_position *ptrs[num];
+	for (int i = 0; i < num; i++) {
+		eids[i] = ecs_entity_add(E);
+		ptrs[i] = ecs_entity_add_copy_component(E, eids[i], cp, &(struct ecs_bench_position){i, 0, 0});
+		ecs_entity_add_component(E, eids[i], cm);
+	}
+	size_t n = 0;
+	TEST_SOFT_ASSERT(nf, ecs_components(E, cp, &n) == NULL);
+
+	//Removing entities would move other components around in a regular pool, not here.
+	for (int i = 0; i < num; i += 2)
+		ecs_entity_destruct_remove(E, eids[i]);
+	TEST_SOFT_ASSERT(nf, destructed == num / 2);
+	TEST_SOFT_ASSERT(nf, ecs_component_chunkpool(E, cp)->num == num / 2);
+	for (int i = 1; i < num; i += 2) {
+		if (ecs_entity_get_component(E, eids[i], cp) != ptrs[i] || ptrs[i]->x != i) {
+			nf++;
+			break;
+		}
+	}
+
+	//Queries hand out the same stable pointers.
+	struct ecs_query_iter it;
+	ecs_query_iter_init(&it, E, q);
+	size_t matched = 0;
+	while (ecs_query_next(&it)) {
+		for (size_t i = 0; i < it.num; i++) {
+			if (it.components[0][i] != ecs_entity_get_component(E, it.eids[i], cp))
+				nf++;
+			matched++;
+		}
+	}
+	TEST_SOFT_ASSERT(nf, matched == num / 2);
+
+	ecs_free(E);
+	return nf;
+}
+
+int ecs_test_change_tracking()
+{
+	int nf = 0; //Number of failures
+	enum {num = 50};
+	ecs_ctx e = ecs_new(8, 2);
+	ecs_ctx *E = &e;
+	uint32_t cp = ecs_component_register(E, 8, sizeof(struct ecs_bench_position));
+	uint32_t cm = ecs_component_register_stable(E, 8, sizeof(struct ecs_bench_mass));
+	uint32_t eids[num];
+	for (int i = 0; i < num; i++) {
+		eids[i] = ecs_entity_add(E);
+		ecs_entity_add_component(E, eids[i], cp);
+		ecs_entity_add_component(E, eids[i], cm);
+	}
+
+	//Everything counts as changed for a cache that hasn't seen anything yet.
+	struct ecs_changed_iter it;
+	uint32_t eid;
+	size_t changed = 0;
+	ecs_components_changed_since(&it, E, cp, 0);
+	while (ecs_changed_next(&it, &eid))
+		changed++;
+	TEST_SOFT_ASSERT(nf, changed == num);
+
+	uint32_t since = ecs_tick(E);
+	ecs_components_changed_since(&it, E, cp, since);
+	TEST_SOFT_ASSERT(nf, ecs_changed_next(&it, &eid) == NULL);
+
+	//Write a few, through both paths, and remove one of them.
+	((struct ecs_bench_position *)ecs_component_write(E, eids[3], cp))->x = 3;
+	ecs_component_mark_written(E, eids[7], cp);
+	ecs_component_write(E, eids[9], cp);
+	ecs_component_write(E, eids[11], cm);
+	ecs_entity_remove(E, eids[9]);
+	TEST_SOFT_ASSERT(nf, ecs_component_changed_since(E, eids[3], cp, since));
+	TEST_SOFT_ASSERT(nf, !ecs_component_changed_since(E, eids[4], cp, since));
+	TEST_SOFT_ASSERT(nf, !ecs_component_changed_since(E, eids[9], cp, since));
+	TEST_SOFT_ASSERT(nf, !ecs_component_changed_since(E, eids[11], cp, since));
+	uint32_t seen = 0;
+	ecs_components_changed_since(&it, E, cp, since);
+	struct ecs_bench_position *p;
+	while ((p = ecs_changed_next(&it, &eid))) {
+		seen |= eid == eids[3] ? 1 : eid == eids[7] ? 2 : 4;
+		if (eid == eids[3] && p->x != 3)
+			nf++;
+	}
+	TEST_SOFT_ASSERT(nf, seen == 3);
+	ecs_components_changed_since(&it, E, cm, since);
+	TEST_SOFT_ASSERT(nf, ecs_changed_next(&it, &eid) == ecs_entity_get_component(E, eids[11], cm) && eid == eids[11]);
+	TEST_SOFT_ASSERT(nf, ecs_changed_next(&it, &eid) == NULL);
+
+	//A newly added component is a change too, even in a slot that was written before.
+	since = ecs_tick(E);
+	uint32_t added = ecs_entity_add(E);
+	ecs_entity_add_component(E, added, cp);
+	TEST_SOFT_ASSERT(nf, ecs_component_changed_since(E, added, cp, since));
+
+	ecs_free(E);
+	return nf;
+}
@@ -0,0 +1,60 @@
+#include "test/test_main.h"
+#include "datastructures/ecs.h"
+#include "datastructures/ecs_cmdbuf.h"
+#include <string.h>
+#include <stdlib.h>
+
+int ecs_cmdbuf_test_flush()
+{
+	int nf = 0; //Number of failures
+	ecs_ctx e = ecs_new(4, 2);
+	ecs_ctx *E = &e;
+	uint32_t cnum = ecs_component_register(E, 2, sizeof(int));
+	uint32_t ctag = ecs_component_register(E, 2, sizeof(int));
+	struct ecs_cmdbuf cmdbuf = ecs_cmdbuf_new(E, 4, 4 * sizeof(int));
+	struct ecs_cmdbuf *cb = &cmdbuf;
+
+	uint32_t first = ecs_entity_add(E);
+	*(int *)ecs_entity_add_component(E, first, cnum) = -1;
+
+	//Spawn more entities than the ECS or the command buffer have room for.
+	enum {num = 100};
+	uint32_t pending[num];
+	for (int i = 0; i < num; i++) {
+		pending[i] = ecs_cmdbuf_entity_add(cb);
+		ecs_cmdbuf_add_copy_component(cb, pending[i], cnum, &i);
+		if (i % 2)
+			*(int *)ecs_cmdbuf_add_component(cb, pending[i], ctag) = i;
+	}
+	ecs_cmdbuf_remove_component(cb, first, cnum);
+	//Nothing happens until the flush.
+	TEST_SOFT_ASSERT(nf, ecs_entities_num(E) == 1)
+	TEST_SOFT_ASSERT(nf, ecs_entity_get_component(E, first, cnum))
+
+	ecs_cmdbuf_flush(cb);
+	TEST_SOFT_ASSERT(nf, ecs_entities_num(E) == num + 1)
+	TEST_SOFT_ASSERT(nf, !ecs_entity_get_component(E, first, cnum))
+	for (int i = 0; i < num; i++) {
+		uint32_t eid = ecs_cmdbuf_resolve(cb, pending[i]);
+		int *n = ecs_entity_get_component(E, eid, cnum), *t = ecs_entity_get_component(E, eid, ctag);
+		TEST_SOFT_ASSERT(nf, n && *n == i)
+		TEST_SOFT_ASSERT(nf, (i & 1) ? t && *t == i : !t)
+	}
+
+	//Remove every other entity, the removals are applied after component commands.
+	for (int i = 0; i < num; i += 2) {
+		uint32_t eid = ecs_cmdbuf_resolve(cb, pending[i]);
+		ecs_cmdbuf_entity_remove(cb, eid);
+		ecs_cmdbuf_add_copy_component(cb, eid, ctag, &i);
+	}
+	ecs_cmdbuf_flush(cb);
+	TEST_SOFT_ASSERT(nf, ecs_entities_num(E) == num / 2 + 1)
+
+	size_t num_tags = 0;
+	ecs_components(E, ctag, &num_tags);
+	TEST_SOFT_ASSERT(nf, num_tags == num / 2)
+
+	ecs_cmdbuf_delete(cb);
+	ecs_free(E);
+	return nf;
+}
@@ -0,0 +1,108 @@
+#include "test/test_main.h"
+#include "datastructures/ecs.h"
+#include "systems/ecs_scheduler.h"
+#include "jobs/thread_pool.h"
+#include <string.h>
+#include <stdlib.h>
+
+static thread_pool_job_fn(thread_pool_test_square)
+{
+	int *squares = ctx;
+	for (size_t i = begin; i < end; i++)
+		squares[i] = (i % 1000) * (i % 1000);
+}
+
+int thread_pool_test_parallel_for()
+{
+	int nf = 0; //Number of failures
+	enum {num = 100000};
+	int *squares = calloc(num, sizeof(int));
+	thread_pool *pool = thread_pool_new(4);
+	atomic_size_t done;
+	atomic_init(&done, 0);
+	thread_pool_parallel_for(pool, thread_pool_test_square, squares, num, 1000, &done);
+	thread_pool_wait(pool, &done);
+	for (int i = 0; i < num; i++)
+		if (squares[i] != (i % 1000) * (i % 1000))
+			nf++;
+	thread_pool_free(pool);
+	free(squares);
+	return nf;
+}
+
+struct ecs_scheduler_test_ctx {
+	uint32_t ca, cb;
+	long long sum;
+};
+
+static ecs_system_chunk_fn(ecs_scheduler_test_write_a)
+{
+	int *a = components;
+	for (size_t i = begin; i < end; i++)
+		a[i] = itoh[i] + (int)dt;
+}
+
+static ecs_system_chunk_fn(ecs_scheduler_test_a_to_b)
+{
+	struct ecs_scheduler_test_ctx *t = ctx;
+	int *b = components;
+	for (size_t i = begin; i < end; i++)
+		b[i] = 2 * *(int *)ecs_entity_get_component(E, itoh[i], t->ca);
+}
+
+static ecs_system_fn(ecs_scheduler_test_sum_b)
+{
+	struct ecs_scheduler_test_ctx *t = ctx;
+	size_t num = 0;
+	int *b = ecs_components(E, t->cb, &num);
+	t->sum = 0;
+	for (size_t i = 0; i < num; i++)
+		t->sum += b[i];
+}
+
+static long long ecs_scheduler_test_frames(thread_pool *pool, int frames)
+{
+	enum {num = 20000};
+	ecs_ctx e = ecs_new(num, 2);
+	ecs_ctx *E = &e;
+	struct ecs_scheduler_test_ctx t = {
+		.ca = ecs_component_register(E, num, sizeof(int)),
+		.cb = ecs_component_register(E, num, sizeof(int)),
+	};
+	for (int i = 0; i < num; i++) {
+		uint32_t eid = ecs_entity_add(E);
+		ecs_entity_add_component(E, eid, t.ca);
+		ecs_entity_add_component(E, eid, t.cb);
+	}
+
+	struct ecs_scheduler s;
+	ecs_scheduler_init(&s, E, pool);
+	ecs_scheduler_add(&s, (struct ecs_system){.name = "write a", .writes = {t.ca}, .num_writes = 1,
+		.run_chunk = ecs_scheduler_test_write_a, .chunk_ctype = t.ca, .chunk_size = 512});
+	ecs_scheduler_add(&s, (struct ecs_system){.name = "a to b", .reads = {t.ca}, .num_reads = 1, .writes = {t.cb}, .num_writes = 1,
+		.run_chunk = ecs_scheduler_test_a_to_b, .chunk_ctype = t.cb, .chunk_size = 512, .ctx = &t});
+	ecs_scheduler_add(&s, (struct ecs_system){.name = "sum b", .reads = {t.cb}, .num_reads = 1,
+		.run = ecs_scheduler_test_sum_b, .ctx = &t});
+
+	long long total = 0;
+	for (int frame = 0; frame < frames; frame++) {
+		ecs_scheduler_run(&s, frame);
+		total += t.sum;
+	}
+	ecs_scheduler_print_timings(&s);
+	ecs_free(E);
+	return total;
+}
+
+//The threaded scheduler has to respect the declared reads/writes, so it should get the same answer as the serial one.
+int ecs_scheduler_test_matches_serial()
+{
+	int nf = 0; //Number of failures
+	long long serial = ecs_scheduler_test_frames(NULL, 10);
+	thread_pool *pool = thread_pool_new(4);
+	long long threaded = ecs_scheduler_test_frames(pool, 10);
+	thread_pool_free(pool);
+	TEST_SOFT_ASSERT(nf, serial == threaded)
+	TEST_SOFT_ASSERT(nf, serial != 0)
+	return nf;
+}
@@ -0,0 +1,138 @@
+#include "test/test_main.h"
+#include "datastructures/ecs.h"
+#include "datastructures/ecs_snapshot.h"
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+struct ecs_snapshot_test_named {
+	char *name;
+	int id;
+};
+
+static ecs_c_constructor_destructor(ecs_snapshot_test_named_construct)
+{
+	struct ecs_snapshot_test_named *n = component;
+	n->name = strdup(n->name);
+}
+
+static ecs_c_constructor_destructor(ecs_snapshot_test_named_destruct)
+{
+	free(((struct ecs_snapshot_test_named *)component)->name);
+}
+
+static ecs_c_serialize_deserialize(ecs_snapshot_test_named_serialize)
+{
+	struct ecs_snapshot_test_named *n = component;
+	n->name = (char *)(uintptr_t)ecs_snapshot_blob_add_string(blobs, n->name);
+}
+
+static ecs_c_serialize_deserialize(ecs_snapshot_test_named_deserialize)
+{
+	struct ecs_snapshot_test_named *n = component;
+	n->name = ecs_snapshot_blob_get(blobs, (uintptr_t)n->name);
+	ecs_snapshot_test_named_construct(eid, component, userdata);
+}
+
+int ecs_snapshot_test_roundtrip()
+{
+	int nf = 0; //Number of failures
+	enum {num = 300};
+	uint32_t cpos, cname, cstable;
+	struct ecs_component_init_params params[] = {
+		{.num = 16, .size = sizeof(float[3]), .ctype = &cpos},
+		{.num = 16, .size = sizeof(struct ecs_snapshot_test_named), .ctype = &cname,
+			.construct = ecs_snapshot_test_named_construct, .destruct = ecs_snapshot_test_named_destruct,
+			.serialize = ecs_snapshot_test_named_serialize, .deserialize = ecs_snapshot_test_named_deserialize},
+		{.num = 16, .size = sizeof(int), .ctype = &cstable, .stable = true},
+	};
+	ecs_ctx e = ecs_new(16, 4);
+	ecs_ctx *E = &e;
+	for (int i = 0; i < LENGTH(params); i++)
+		ecs_component_init(E, &params[i]);
+
+	uint32_t eids[num];
+	char name[32];
+	for (int i = 0; i < num; i++) {
+		eids[i] = ecs_entity_add(E);
+		ecs_entity_add_copy_component(E, eids[i], cpos, (float[3]){i, 2 * i, 3 * i});
+		if (i % 3 == 0) {
+			snprintf(name, sizeof(name), "entity %d", i);
+			ecs_entity_add_copy_construct_component(E, eids[i], cname, &(struct ecs_snapshot_test_named){name, i});
+		}
+		if (i % 5 == 0)
+			ecs_entity_add_copy_component(E, eids[i], cstable, &i);
+	}
+	//Leave some holes, and a stale eid.
+	for (int i = 0; i < num; i += 7)
+		ecs_entity_destruct_remove(E, eids[i]);
+
+	char path[] = "/tmp/ecs_snapshot_test_XXXXXX";
+	int fd = mkstemp(path);
+	TEST_SOFT_ASSERT(nf, fd >= 0);
+	TEST_SOFT_ASSERT(nf, ecs_snapshot_write(E, fd));
+	close(fd);
+
+	//Map it with the ctype outputs cleared, they should be filled back in.
+	struct ecs_component_init_params *by_ctype[4] = {0};
+	for (int i = 0; i < LENGTH(params); i++)
+		by_ctype[*params[i].ctype] = &params[i];
+	uint32_t old_cpos = cpos;
+	cpos = cname = cstable = UINT32_MAX;
+	struct ecs_snapshot snap;
+	ecs_ctx e2;
+	ecs_ctx *E2 = &e2;
+	TEST_SOFT_ASSERT(nf, ecs_snapshot_map(&snap, path, E2, by_ctype, LENGTH(by_ctype)));
+	TEST_SOFT_ASSERT(nf, cpos == old_cpos);
+	TEST_SOFT_ASSERT(nf, ecs_entities_num(E2) == ecs_entities_num(E));
+	TEST_SOFT_ASSERT(nf, ecs_component_is_stable(E2, cstable));
+
+	for (int i = 0; i < num; i++) {
+		bool alive = i % 7 != 0;
+		float *pos = ecs_entity_get_component(E2, eids[i], cpos);
+		struct ecs_snapshot_test_named *n = ecs_entity_get_component(E2, eids[i], cname);
+		int *stable = ecs_entity_get_component(E2, eids[i], cstable);
+		snprintf(name, sizeof(name), "entity %d", i);
+		if (ecs_eid_used(E2, eids[i]) != alive ||
+			(alive && (!pos || pos[2] != 3 * i)) ||
+			(alive && i % 3 == 0 && (!n || n->id != i || strcmp(n->name, name))) ||
+			(alive && i % 5 == 0 && (!stable || *stable != i))) {
+			nf++;
+			break;
+		}
+	}
+
+	//The restored ECS has to keep working: new entities, removals, and growing the mapped pools.
+	for (int i = 0; i < num; i++) {
+		uint32_t eid = ecs_entity_add(E2);
+		ecs_entity_add_copy_component(E2, eid, cpos, (float[3]){-1, -1, -1});
+	}
+	ecs_entity_destruct_remove(E2, eids[1]);
+	TEST_SOFT_ASSERT(nf, ((float *)ecs_entity_get_component(E2, eids[2], cpos))[1] == 4);
+	TEST_SOFT_ASSERT(nf, ecs_entities_num(E2) == ecs_entities_num(E) + num - 1);
+
+	ecs_free(E2);
+	ecs_snapshot_unmap(&snap);
+	ecs_free(E);
+
+	//A pool with more components than it has room for is rejected, rather than overflowing on restore.
+	fd = open(path, O_RDWR);
+	struct ecs_snapshot_header h;
+	struct ecs_snapshot_ctype sc;
+	TEST_SOFT_ASSERT(nf, pread(fd, &h, sizeof(h), 0) == sizeof(h));
+	off_t sc_offset = h.ctypes_offset + cstable * sizeof(sc);
+	TEST_SOFT_ASSERT(nf, pread(fd, &sc, sizeof(sc), sc_offset) == sizeof(sc));
+	sc.num = sc.max + 1;
+	TEST_SOFT_ASSERT(nf, pwrite(fd, &sc, sizeof(sc), sc_offset) == sizeof(sc));
+	close(fd);
+	TEST_SOFT_ASSERT(nf, !ecs_snapshot_map(&snap, path, E2, NULL, 0));
+
+	//Anything that isn't a snapshot is rejected.
+	fd = open(path, O_WRONLY | O_TRUNC);
+	TEST_SOFT_ASSERT(nf, write(fd, "not a snapshot", 14) == 14);
+	close(fd);
+	TEST_SOFT_ASSERT(nf, !ecs_snapshot_map(&snap, path, E2, NULL, 0));
+	unlink(path);
+	return nf;
+}
@@ -0,0 +1,85 @@
+#include "test/test_main.h"
+#include "math/frustum.h"
+#include <stdlib.h>
+#include <math.h>
+
+//Row-major OpenGL perspective projection looking down -z, times a view matrix that moves the eye to eye.
+static void frustum_test_proj_view(float fov, float n, float f, const float eye[3], float out[16])
+{
+	float nn = 1.0 / tan(fov / 2.0);
+	float proj[16] = {
+		nn, 0,                 0,                   0,
+		0, nn,                 0,                   0,
+		0,  0, (f + n) / (n - f), 2 * f * n / (n - f),
+		0,  0,                -1,                   0
+	};
+	for (int i = 0; i < 4; i++) {
+		float *row = &proj[4 * i];
+		out[4 * i + 0] = row[0];
+		out[4 * i + 1] = row[1];
+		out[4 * i + 2] = row[2];
+		out[4 * i + 3] = row[3] - (row[0] * eye[0] + row[1] * eye[1] + row[2] * eye[2]);
+	}
+}
+
+int frustum_test_spheres_against_planes()
+{
+	int nf = 0; //Number of failures
+	float origin[3] = {0, 0, 0}, mat[16];
+	frustum_test_proj_view(M_PI / 2, 1, 100, origin, mat);
+	struct frustum f;
+
+	//A 90 degree field of view, so the side planes are at 45 degrees.
+	frustum_from_matrix(&f, mat, true);
+	TEST_SOFT_ASSERT(nf, f.num_planes == 6);
+	TEST_SOFT_ASSERT(nf, frustum_test_sphere(&f, (float[3]){0, 0, -10}, 1));
+	TEST_SOFT_ASSERT(nf, !frustum_test_sphere(&f, (float[3]){0, 0, 10}, 1));
+	TEST_SOFT_ASSERT(nf, !frustum_test_sphere(&f, (float[3]){20, 0, -10}, 1));
+	//7.07 away from the right plane.
+	TEST_SOFT_ASSERT(nf, !frustum_test_sphere(&f, (float[3]){20, 0, -10}, 7));
+	TEST_SOFT_ASSERT(nf, frustum_test_sphere(&f, (float[3]){20, 0, -10}, 7.2));
+	TEST_SOFT_ASSERT(nf, !frustum_test_sphere(&f, (float[3]){0, -30, -10}, 1));
+	TEST_SOFT_ASSERT(nf, !frustum_test_sphere(&f, (float[3]){0, 0, -200}, 1));
+	TEST_SOFT_ASSERT(nf, !frustum_test_sphere(&f, (float[3]){0, 0, -0.5}, 0.1));
+	TEST_SOFT_ASSERT(nf, f.tested == 8 && f.culled == 6);
+
+	//Without near and far, only the sides cull.
+	frustum_from_matrix(&f, mat, false);
+	TEST_SOFT_ASSERT(nf, f.num_planes == 4 && f.tested == 0 && f.culled == 0);
+	TEST_SOFT_ASSERT(nf, frustum_test_sphere(&f, (float[3]){0, 0, -200}, 1));
+	TEST_SOFT_ASSERT(nf, frustum_test_sphere(&f, (float[3]){0, 0, -0.5}, 0.1));
+
+	//An eye far from its origin, with positions given relative to the eye.
+	float eye[3] = {1e6, -2e6, 5e5};
+	frustum_test_proj_view(M_PI / 2, 1, 100, eye, mat);
+	frustum_from_matrix(&f, mat, false);
+	TEST_SOFT_ASSERT(nf, frustum_test_sphere(&f, (float[3]){eye[0], eye[1], eye[2] - 10}, 1));
+	frustum_recenter(&f, eye);
+	TEST_SOFT_ASSERT(nf, frustum_test_sphere(&f, (float[3]){0, 0, -10}, 1));
+	TEST_SOFT_ASSERT(nf, !frustum_test_sphere(&f, (float[3]){0, 0, 10}, 1));
+	TEST_SOFT_ASSERT(nf, !frustum_test_sphere(&f, (float[3]){0.1, 0, 0.2}, 0.05));
+	TEST_SOFT_ASSERT(nf, frustum_test_sphere(&f, (float[3]){0.1, 0, -0.2}, 0.05));
+
+	//Spheres tested together agree with spheres tested one at a time.
+	enum {num = 1000};
+	float x[num], y[num], z[num], radius[num];
+	uint8_t visible[num];
+	srand(7);
+	for (int i = 0; i < num; i++) {
+		x[i] = (rand() / (float)RAND_MAX - 0.5) * 100;
+		y[i] = (rand() / (float)RAND_MAX - 0.5) * 100;
+		z[i] = (rand() / (float)RAND_MAX - 0.5) * 100;
+		radius[i] = rand() / (float)RAND_MAX * 10;
+	}
+	frustum_from_matrix(&f, mat, true);
+	frustum_recenter(&f, eye);
+	size_t num_visible = frustum_test_spheres(&f, num, x, y, z, radius, visible);
+	TEST_SOFT_ASSERT(nf, f.tested == num && f.culled == num - num_visible);
+	TEST_SOFT_ASSERT(nf, num_visible > 0 && num_visible < num);
+	int disagree = 0;
+	for (int i = 0; i < num; i++)
+		disagree += visible[i] != frustum_test_sphere(&f, (float[3]){x[i], y[i], z[i]}, radius[i]);
+	TEST_SOFT_ASSERT(nf, disagree == 0);
+	TEST_SOFT_ASSERT(nf, f.tested == 2 * num && f.culled == 2 * (num - num_visible));
+	return nf;
+}
@@ -0,0 +1,87 @@
+#include "test/test_main.h"
+#include "space/galaxy_density.h"
+#include <stdlib.h>
+#include <inttypes.h>
+#include <math.h>
+
+//The galaxy_defaults from conf.lua.
+static const struct galaxy_density galaxy_density_test_params = {
+	.arm_width = 2.85,
+	.rotation = 543.0,
+	.diameter = 80.0,
+	.spiral_density = 2.8,
+	.disk_height = 5.24,
+	.bulge_mask_radius = 9.69,
+	.bulge_mask_power = 3.43,
+	.bulge_width_squared = 23.0 * 23.0,
+};
+
+//[0, 1)
+static float galaxy_density_test_rand(uint64_t *state)
+{
+	*state = *state * 6364136223846793005ull + 1442695040888963407ull;
+	return (*state >> 40) / (float)(1 << 24);
+}
+
+//Points all over the galaxy and a bit past it, mostly near the disk.
+static void galaxy_density_test_points(uint64_t seed, size_t num, float *x, float *y, float *z)
+{
+	for (size_t i = 0; i < num; i++) {
+		x[i] = galaxy_density_test_rand(&seed) * 100 - 50;
+		y[i] = (galaxy_density_test_rand(&seed) * 2 - 1) * (galaxy_density_test_rand(&seed) * 2 - 1) * 12;
+		z[i] = galaxy_density_test_rand(&seed) * 100 - 50;
+	}
+	//And the center, where the spiral's angle is undefined.
+	x[0] = y[0] = z[0] = 0;
+}
+
+int galaxy_density_test_batch()
+{
+	int nf = 0; //Number of failures
+	const struct galaxy_density *g = &galaxy_density_test_params;
+	enum {num = 10003}; //Not a multiple of the batch width, so the tail gets tested too.
+	float *x = malloc(4 * num * sizeof(float)), *y = x + num, *z = y + num, *density = z + num;
+	galaxy_density_test_points(1, num, x, y, z);
+	galaxy_density_batch(g, num, x, y, z, density);
+
+	float peak = g->spiral_density * powf(2, g->bulge_mask_power), max_err = 0;
+	int nonzero = 0;
+	for (int i = 0; i < num; i++) {
+		float expected = galaxy_density_at(g, (float[3]){x[i], y[i], z[i]});
+		max_err = fmaxf(max_err, fabsf(density[i] - expected));
+		nonzero += expected > 0.01f * g->spiral_density;
+	}
+	TEST_SOFT_ASSERT(nf, max_err < 1e-4f * peak);
+	//Make sure the points actually covered the interesting parts.
+	TEST_SOFT_ASSERT(nf, nonzero > num / 10);
+	//Empty past the rim.
+	TEST_SOFT_ASSERT(nf, galaxy_density_at(g, (float[3]){g->diameter, 0, 0}) == 0);
+
+	free(x);
+	return nf;
+}
+
+int galaxy_density_bench()
+{
+	const struct galaxy_density *g = &galaxy_density_test_params;
+	enum {num = 1 << 20, passes = 4};
+	float *x = malloc(4 * num * sizeof(float)), *y = x + num, *z = y + num, *density = z + num;
+	galaxy_density_test_points(2, num, x, y, z);
+
+	double start = test_time_seconds();
+	for (int pass = 0; pass < passes; pass++)
+		for (int i = 0; i < num; i++)
+			density[i] = galaxy_density_at(g, (float[3]){x[i], y[i], z[i]});
+	double scalar_time = test_time_seconds() - start;
+
+	start = test_time_seconds();
+	for (int pass = 0; pass < passes; pass++)
+		galaxy_density_batch(g, num, x, y, z, density);
+	double batch_time = test_time_seconds() - start;
+
+	printf(ANSI_COLOR_CYAN "galaxy_density_bench: %d points x %d passes, scalar %.2fms (%.1fM/s) vs batch %.2fms (%.1fM/s), %.1fx" ANSI_COLOR_RESET "\n",
+		num, passes, scalar_time * 1000, num * passes / scalar_time / 1e6, batch_time * 1000, num * passes / batch_time / 1e6,
+		scalar_time / batch_time);
+	free(x);
+	return 0;
+}
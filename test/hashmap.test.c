@@ -0,0 +1,151 @@
+#include "test/test_main.h"
+#include "datastructures/hashmap.h"
+#include "datastructures/hashtable.h"
+#include <string.h>
+#include <stdlib.h>
+
+int hashmap_test_insert_remove()
+{
+	int nf = 0; //Number of failures
+	enum {num = 20000};
+	struct hashmap m = hashmap_new(4, NULL);
+	char key[32];
+	for (int i = 0; i < num; i++) {
+		snprintf(key, sizeof(key), "key%d", i);
+		struct hashmap_entry *e = hashmap_find(&m, key, true);
+		TEST_SOFT_ASSERT(nf, e && !e->handle);
+		e->handle = i + 1;
+	}
+	TEST_SOFT_ASSERT(nf, m.num == num);
+	//Inserting an existing key finds the old entry.
+	TEST_SOFT_ASSERT(nf, hashmap_find(&m, "key7", true)->handle == 8);
+	TEST_SOFT_ASSERT(nf, m.num == num);
+	TEST_SOFT_ASSERT(nf, !hashmap_find(&m, "key-1", false));
+
+	//Remove every third key, the rest have to stay reachable after the backward shifts.
+	for (int i = 0; i < num; i += 3) {
+		snprintf(key, sizeof(key), "key%d", i);
+		TEST_SOFT_ASSERT(nf, hashmap_remove(&m, key));
+	}
+	TEST_SOFT_ASSERT(nf, !hashmap_remove(&m, "key0"));
+	for (int i = 0; i < num; i++) {
+		snprintf(key, sizeof(key), "key%d", i);
+		struct hashmap_entry *e = hashmap_find(&m, key, false);
+		if (i % 3 == 0 ? e != NULL : (!e || e->handle != i + 1 || strcmp(e->key, key))) {
+			nf++;
+			break;
+		}
+	}
+
+	size_t i = 0, visited = 0;
+	struct hashmap_entry *e;
+	while ((e = hashmap_next(&m, &i)))
+		visited++;
+	TEST_SOFT_ASSERT(nf, visited == m.num);
+	hashmap_delete(&m, NULL, NULL);
+
+	//Keys that are empty, or long enough to go through every path of the hash.
+	m = hashmap_new(0, NULL);
+	char long_key[200];
+	memset(long_key, 'a', sizeof(long_key) - 1);
+	long_key[sizeof(long_key) - 1] = '\0';
+	hashmap_find(&m, "", true)->handle = 1;
+	hashmap_find(&m, long_key, true)->handle = 2;
+	long_key[150] = 'b';
+	TEST_SOFT_ASSERT(nf, !hashmap_find(&m, long_key, false));
+	TEST_SOFT_ASSERT(nf, hashmap_find(&m, "", false)->handle == 1);
+	hashmap_delete(&m, NULL, NULL);
+	return nf;
+}
+
+int hashmap_test_interned()
+{
+	int nf = 0; //Number of failures
+	enum {num = 5000};
+	struct strpool sp = strpool_new(16);
+	struct hashmap m = hashmap_new(16, &sp);
+	const char *interned[num];
+	char key[32];
+	for (int i = 0; i < num; i++) {
+		snprintf(key, sizeof(key), "asset/%d.ply", i);
+		interned[i] = strpool_intern(&sp, key);
+		hashmap_find(&m, key, true)->handle = i;
+	}
+	//Interning again gives back the same address, which is also the map's key.
+	TEST_SOFT_ASSERT(nf, strpool_intern(&sp, "asset/42.ply") == interned[42]);
+	TEST_SOFT_ASSERT(nf, strpool_find(&sp, "asset/42.ply") == interned[42]);
+	TEST_SOFT_ASSERT(nf, !strpool_find(&sp, "asset/none.ply"));
+	TEST_SOFT_ASSERT(nf, sp.map.num == num);
+	for (int i = 0; i < num; i++) {
+		struct hashmap_entry *e = hashmap_find_interned(&m, interned[i], false);
+		if (!e || e->key != interned[i] || e->handle != i) {
+			nf++;
+			break;
+		}
+	}
+	//A string that was interned but never inserted into this map.
+	TEST_SOFT_ASSERT(nf, !hashmap_find_interned(&m, strpool_intern(&sp, "asset/none.ply"), false));
+	hashmap_delete(&m, NULL, NULL);
+	strpool_delete(&sp);
+	return nf;
+}
+
+int hashmap_bench()
+{
+	int nf = 0; //Number of failures
+	const int sizes[] = {1000, 100000, 1000000};
+	const int lookups = 2000000;
+	for (int s = 0; s < LENGTH(sizes); s++) {
+		int num = sizes[s];
+		char (*keys)[32] = malloc(num * sizeof(*keys));
+		for (int i = 0; i < num; i++)
+			snprintf(keys[i], sizeof(keys[i]), "assets/mesh_%d.ply", i);
+
+		//The old table gets as many buckets as keys, its best case.
+		double start = test_time_seconds();
+		hashtable *t = hashtable_new(num);
+		for (int i = 0; i < num; i++)
+			hashtable_find(t, keys[i], true)->handle = i;
+		double hashtable_insert_time = test_time_seconds() - start;
+		start = test_time_seconds();
+		long long sum = 0;
+		for (int i = 0; i < lookups; i++)
+			sum += hashtable_find(t, keys[(i * 7919LL) % num], false)->handle;
+		double hashtable_find_time = test_time_seconds() - start;
+
+		//The new map starts small and grows.
+		struct strpool sp = strpool_new(16);
+		start = test_time_seconds();
+		struct hashmap m = hashmap_new(16, &sp);
+		for (int i = 0; i < num; i++)
+			hashmap_find(&m, keys[i], true)->handle = i;
+		double hashmap_insert_time = test_time_seconds() - start;
+		start = test_time_seconds();
+		long long sum2 = 0;
+		for (int i = 0; i < lookups; i++)
+			sum2 += hashmap_find(&m, keys[(i * 7919LL) % num], false)->handle;
+		double hashmap_find_time = test_time_seconds() - start;
+
+		const char **interned = malloc(num * sizeof(const char *));
+		for (int i = 0; i < num; i++)
+			interned[i] = strpool_find(&sp, keys[i]);
+		start = test_time_seconds();
+		long long sum3 = 0;
+		for (int i = 0; i < lookups; i++)
+			sum3 += hashmap_find_interned(&m, interned[(i * 7919LL) % num], false)->handle;
+		double interned_find_time = test_time_seconds() - start;
+		TEST_SOFT_ASSERT(nf, sum == sum2 && sum == sum3);
+
+		printf(ANSI_COLOR_CYAN "hashmap_bench: %d keys, insert hashtable %.2fms vs hashmap %.2fms, "
+			"%d lookups hashtable %.2fms vs hashmap %.2fms vs interned %.2fms" ANSI_COLOR_RESET "\n",
+			num, hashtable_insert_time * 1000, hashmap_insert_time * 1000,
+			lookups, hashtable_find_time * 1000, hashmap_find_time * 1000, interned_find_time * 1000);
+
+		free(interned);
+		hashmap_delete(&m, NULL, NULL);
+		strpool_delete(&sp);
+		hashtable_free(t, NULL, NULL);
+		free(keys);
+	}
+	return nf;
+}
@@ -35,6 +35,27 @@ int hmempool_test_add_remove()
 //TODO(Gavin): This test
 // int hmempool_test_claim()
 
+int hmempool_test_stale_handle()
+{
+	int nf = 0; //Number of failures
+
+	int a = 1, b = 2;
+	struct hmempool hm = hmempool_new(1, sizeof(int));
+	struct hmempool *Hm = &hm;
+	uint32_t ha = hmempool_add(Hm, &a);
+	hmempool_remove(Hm, ha);
+	//Same slot, new generation.
+	uint32_t hb = hmempool_add(Hm, &b);
+	TEST_SOFT_ASSERT(nf, hmempool_handle_slot(ha) == hmempool_handle_slot(hb))
+	TEST_SOFT_ASSERT(nf, ha != hb)
+	TEST_SOFT_ASSERT(nf, hmempool_get(Hm, ha) == NULL)
+	TEST_SOFT_ASSERT(nf, *(int *)hmempool_get(Hm, hb) == b)
+	TEST_SOFT_ASSERT(nf, hmempool_get(Hm, 0) == NULL)
+
+	hmempool_delete(Hm);
+	return nf;
+}
+
 int hmempool_test_resize()
 {
 	int nf = 0; //Number of failures
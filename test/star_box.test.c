@@ -0,0 +1,54 @@
+#include "test/test_main.h"
+#include "space/star_box.h"
+#include "jobs/thread_pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+//The boxes a star_box would have out in the disk, and what generating them came out as.
+struct star_box_test_boxes {
+	qvec3 box_idx[STAR_BOX_NUM_BOXES];
+	uint16_t num_stars[STAR_BOX_NUM_BOXES];
+	int16_t stars[STAR_BOX_NUM_BOXES][3*STAR_BOX_STARS_PER_BOX];
+	uint16_t start_indices[STAR_BOX_NUM_BOXES][STAR_BOX_BUCKETS_PER_BOX + 1];
+};
+
+static thread_pool_job_fn(star_box_test_generate)
+{
+	struct star_box_test_boxes *b = ctx;
+	for (size_t i = begin; i < end; i++)
+		b->num_stars[i] = star_box_generate(&galaxy_density_test_params, b->box_idx[i], b->stars[i], b->start_indices[i]);
+}
+
+//A box at a time, so a pool with more threads spreads them out.
+static void star_box_test_fill(int num_threads, struct star_box_test_boxes *b)
+{
+	memset(b, 0, sizeof(*b));
+	for (int i = 0; i < STAR_BOX_NUM_BOXES; i++)
+		b->box_idx[i] = (qvec3){i % 3 + 99, i / 3 % 3 - 1, i / 9 - 1};
+	thread_pool *pool = thread_pool_new(num_threads);
+	atomic_size_t done;
+	atomic_init(&done, 0);
+	thread_pool_parallel_for(pool, star_box_test_generate, b, STAR_BOX_NUM_BOXES, 1, &done);
+	thread_pool_wait(pool, &done);
+	thread_pool_free(pool);
+}
+
+int star_box_test_threads()
+{
+	int nf = 0; //Number of failures
+	struct star_box_test_boxes *one = malloc(sizeof(struct star_box_test_boxes));
+	struct star_box_test_boxes *many = malloc(sizeof(struct star_box_test_boxes));
+	star_box_test_fill(1, one);
+	star_box_test_fill(8, many);
+	TEST_SOFT_ASSERT(nf, !memcmp(one, many, sizeof(struct star_box_test_boxes)));
+	//The galaxy thins them out, but not all the way.
+	int thinned = 0, empty = 0;
+	for (int i = 0; i < STAR_BOX_NUM_BOXES; i++) {
+		thinned += one->num_stars[i] < STAR_BOX_STARS_PER_BOX;
+		empty += one->num_stars[i] == 0;
+	}
+	TEST_SOFT_ASSERT(nf, thinned > 0 && empty < STAR_BOX_NUM_BOXES);
+	free(many);
+	free(one);
+	return nf;
+}
@@ -0,0 +1,192 @@
+#include "test/test_main.h"
+#include "space/star_index.h"
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+enum {star_index_test_boxes = 27, star_index_test_stars = 10000};
+
+struct star_index_test_set {
+	int32_t raw[star_index_test_boxes][3 * star_index_test_stars]; //Before quantizing
+	int16_t stars[star_index_test_boxes][3 * star_index_test_stars];
+	int32_t decoded[star_index_test_boxes][3 * star_index_test_stars]; //stars decoded, for brute force
+	uint16_t cell_starts[star_index_test_boxes][STAR_INDEX_CELLS + 1];
+	struct star_index_box boxes[star_index_test_boxes];
+};
+
+static uint32_t star_index_test_rand(uint64_t *state)
+{
+	*state = *state * 6364136223846793005ull + 1442695040888963407ull;
+	return *state >> 32;
+}
+
+static void star_index_test_star(void *ctx, uint32_t i, int32_t star[3])
+{
+	memcpy(star, (int32_t *)ctx + 3*i, 3 * sizeof(int32_t));
+}
+
+//27 boxes in a 3x3x3 block around the origin, like star_box keeps.
+static struct star_index_test_set * star_index_test_set_new(uint64_t seed)
+{
+	struct star_index_test_set *set = malloc(sizeof(struct star_index_test_set));
+	for (int b = 0; b < star_index_test_boxes; b++) {
+		for (int i = 0; i < 3 * star_index_test_stars; i++)
+			set->raw[b][i] = (int32_t)star_index_test_rand(&seed);
+		star_index_build(star_index_test_stars, star_index_test_star, set->raw[b], set->stars[b], set->cell_starts[b]);
+		for (uint32_t i = 0; i < star_index_test_stars; i++)
+			star_index_decode(&set->stars[b][3*i], star_index_cell_of(set->cell_starts[b], i), &set->decoded[b][3*i]);
+		set->boxes[b] = (struct star_index_box){
+			.stars = set->stars[b],
+			.cell_starts = set->cell_starts[b],
+			.origin = {(b % 3 - 1) * (int64_t)STAR_INDEX_BOX_SIZE, (b / 3 % 3 - 1) * (int64_t)STAR_INDEX_BOX_SIZE, (b / 9 - 1) * (int64_t)STAR_INDEX_BOX_SIZE},
+		};
+	}
+	return set;
+}
+
+//Within spread box widths of the center on each axis, the block of boxes is 3 wide.
+static void star_index_test_point(uint64_t *state, int64_t spread, int64_t pt[3])
+{
+	for (int a = 0; a < 3; a++)
+		pt[a] = ((int64_t)star_index_test_rand(state) - (1ll << 31)) * spread;
+}
+
+static double star_index_test_dist2(struct star_index_test_set *set, uint32_t idx, const int64_t pt[3])
+{
+	uint32_t b = idx / star_index_test_stars, i = idx % star_index_test_stars;
+	double d2 = 0;
+	for (int a = 0; a < 3; a++) {
+		double d = (double)(set->boxes[b].origin[a] + set->decoded[b][3*i + a] - pt[a]);
+		d2 += d * d;
+	}
+	return d2;
+}
+
+int star_index_test_queries()
+{
+	int nf = 0; //Number of failures
+	struct star_index_test_set *set = star_index_test_set_new(1);
+	const int num_queries = 300, num_stars = star_index_test_boxes * star_index_test_stars;
+	double *all_d2 = malloc(num_stars * sizeof(double));
+	uint64_t state = 7;
+
+	//Every cell holds only its own stars, and every star is somewhere.
+	for (int b = 0; b < star_index_test_boxes; b++)
+		for (uint32_t c = 0; c < STAR_INDEX_CELLS; c++)
+			for (uint32_t i = set->cell_starts[b][c]; i < set->cell_starts[b][c + 1]; i++)
+				if (star_index_cell(&set->decoded[b][3*i]) != c || star_index_cell_of(set->cell_starts[b], i) != c)
+					nf++;
+	TEST_SOFT_ASSERT(nf, set->cell_starts[0][STAR_INDEX_CELLS] == star_index_test_stars);
+
+	//Stars keep their order within a cell, and only move to the middle of their quantization step.
+	uint32_t next[STAR_INDEX_CELLS];
+	for (int c = 0; c < STAR_INDEX_CELLS; c++)
+		next[c] = set->cell_starts[0][c];
+	for (int i = 0; i < star_index_test_stars; i++) {
+		const int32_t *raw = &set->raw[0][3*i], *decoded = &set->decoded[0][3 * next[star_index_cell(raw)]++];
+		for (int a = 0; a < 3; a++)
+			if (llabs((int64_t)raw[a] - decoded[a]) > (1 << STAR_INDEX_STEP_SHIFT) / 2)
+				nf++;
+	}
+
+	for (int q = 0; q < num_queries; q++) {
+		int64_t pt[3];
+		star_index_test_point(&state, 4, pt); //A little past the boxes too
+		for (int i = 0; i < num_stars; i++)
+			all_d2[i] = star_index_test_dist2(set, i, pt);
+
+		//k nearest: the kth distance has to match the kth smallest of the brute force distances.
+		enum {k = 8};
+		uint32_t idx[k];
+		double d2[k];
+		TEST_SOFT_ASSERT(nf, star_index_knn(set->boxes, star_index_test_boxes, star_index_test_stars, pt, k, idx, d2) == k);
+		for (int j = 0; j < k; j++) {
+			size_t closer = 0;
+			for (int i = 0; i < num_stars; i++)
+				closer += all_d2[i] < d2[j];
+			if (closer > j || d2[j] != all_d2[idx[j]] || (j > 0 && d2[j] < d2[j - 1])) {
+				nf++;
+				break;
+			}
+		}
+
+		//Radius: exactly the stars within it, using the 3rd nearest so there are always a few.
+		double radius = nextafter(sqrt(d2[2]), INFINITY);
+		uint32_t in_radius[64];
+		size_t num_in = star_index_radius(set->boxes, star_index_test_boxes, star_index_test_stars, pt, radius, in_radius, LENGTH(in_radius));
+		size_t expected = 0;
+		for (int i = 0; i < num_stars; i++)
+			expected += all_d2[i] <= radius * radius;
+		TEST_SOFT_ASSERT(nf, num_in == expected && num_in >= 3);
+		for (size_t j = 0; j < num_in && j < LENGTH(in_radius); j++)
+			if (all_d2[in_radius[j]] > radius * radius)
+				nf++;
+
+		//Cone: the nearest star inside it.
+		double dir[3] = {star_index_test_rand(&state) - 2e9, star_index_test_rand(&state) - 2e9, star_index_test_rand(&state) - 2e9};
+		double len = sqrt(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]), half_angle = 0.1, max_dist = 3e9, dist;
+		uint32_t cone = star_index_cone(set->boxes, star_index_test_boxes, star_index_test_stars, pt, dir, half_angle, max_dist, &dist);
+		uint32_t brute = UINT32_MAX;
+		for (int i = 0; i < num_stars; i++) {
+			uint32_t b = i / star_index_test_stars, s = i % star_index_test_stars;
+			double along = 0;
+			for (int a = 0; a < 3; a++)
+				along += (double)(set->boxes[b].origin[a] + set->decoded[b][3*s + a] - pt[a]) * dir[a] / len;
+			if (all_d2[i] > 0 && all_d2[i] <= max_dist * max_dist && along >= sqrt(all_d2[i]) * cos(half_angle) &&
+				(brute == UINT32_MAX || all_d2[i] < all_d2[brute]))
+				brute = i;
+		}
+		if ((cone == UINT32_MAX) != (brute == UINT32_MAX) || (cone != UINT32_MAX && all_d2[cone] != all_d2[brute])) {
+			nf++;
+			break;
+		}
+	}
+
+	free(all_d2);
+	free(set);
+	return nf;
+}
+
+int star_index_bench()
+{
+	int nf = 0; //Number of failures
+	struct star_index_test_set *set = star_index_test_set_new(2);
+	const int num_queries = 1000000, num_brute = 1000, num_stars = star_index_test_boxes * star_index_test_stars;
+	uint64_t state = 3;
+	int64_t (*pts)[3] = malloc(num_queries * sizeof(*pts));
+	for (int i = 0; i < num_queries; i++)
+		star_index_test_point(&state, 3, pts[i]);
+
+	double start = test_time_seconds();
+	uint32_t *nearest = malloc(num_queries * sizeof(uint32_t));
+	for (int q = 0; q < num_queries; q++)
+		star_index_knn(set->boxes, star_index_test_boxes, star_index_test_stars, pts[q], 1, &nearest[q], NULL);
+	double index_time = test_time_seconds() - start;
+
+	start = test_time_seconds();
+	for (int q = 0; q < num_brute; q++) {
+		double best_d2 = INFINITY;
+		for (int i = 0; i < num_stars; i++)
+			best_d2 = fmin(best_d2, star_index_test_dist2(set, i, pts[q]));
+		if (best_d2 != star_index_test_dist2(set, nearest[q], pts[q]))
+			nf++;
+	}
+	double brute_time = test_time_seconds() - start;
+
+	start = test_time_seconds();
+	size_t found = 0;
+	uint32_t in_radius[256];
+	for (int q = 0; q < num_queries / 10; q++)
+		found += star_index_radius(set->boxes, star_index_test_boxes, star_index_test_stars, pts[q], 4e8, in_radius, LENGTH(in_radius));
+	double radius_time = test_time_seconds() - start;
+
+	printf(ANSI_COLOR_CYAN "star_index_bench: %d nearest queries over %d stars %.2fms (%.3fus each) vs brute force %.3fus each, "
+		"%d radius queries %.2fms (%zu found)" ANSI_COLOR_RESET "\n",
+		num_queries, num_stars, index_time * 1000, index_time * 1e6 / num_queries, brute_time * 1e6 / num_brute,
+		num_queries / 10, radius_time * 1000, found);
+
+	free(nearest);
+	free(pts);
+	free(set);
+	return nf;
+}
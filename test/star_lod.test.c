@@ -0,0 +1,84 @@
+#include "test/test_main.h"
+#include "space/star_lod.h"
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+enum {star_lod_test_stars = 20000};
+
+struct star_lod_test_box {
+	int32_t raw[3 * star_lod_test_stars];
+	int16_t stars[3 * star_lod_test_stars];
+	uint16_t cell_starts[STAR_INDEX_CELLS + 1];
+	int16_t vertices[STAR_LOD_VERTEX_SHORTS * star_lod_test_stars];
+	int16_t aggregates[STAR_LOD_VERTEX_SHORTS * STAR_LOD_MAX_AGGREGATES];
+};
+
+static void star_lod_test_star(void *ctx, uint32_t i, int32_t star[3])
+{
+	memcpy(star, (int32_t *)ctx + 3*i, 3 * sizeof(int32_t));
+}
+
+int star_lod_test_vertices()
+{
+	int nf = 0; //Number of failures
+	struct star_lod_test_box *box = malloc(sizeof(struct star_lod_test_box));
+	uint64_t state = 99;
+	//Clumped into the low half of the box on each axis, so most blocks are empty and some are crowded.
+	for (int i = 0; i < 3 * star_lod_test_stars; i++) {
+		state = state * 6364136223846793005ull + 1442695040888963407ull;
+		double u = (double)(state >> 11) / (1ull << 53);
+		box->raw[i] = (int32_t)(INT32_MIN + u * u * 2147483647.0);
+	}
+	star_index_build(star_lod_test_stars, star_lod_test_star, box->raw, box->stars, box->cell_starts);
+
+	//Full detail decodes to exactly what star_index does.
+	star_lod_vertices(box->stars, box->cell_starts, box->vertices);
+	int bad_vertices = 0;
+	for (uint32_t i = 0; i < star_lod_test_stars; i++) {
+		int32_t expected[3], star[3];
+		int brightness;
+		star_index_decode(&box->stars[3*i], star_index_cell_of(box->cell_starts, i), expected);
+		star_lod_decode(&box->vertices[STAR_LOD_VERTEX_SHORTS*i], star, &brightness);
+		bad_vertices += memcmp(star, expected, sizeof(star)) != 0 || brightness != 0;
+	}
+	TEST_SOFT_ASSERT(nf, bad_vertices == 0);
+
+	//Each aggregate against its block worked out the long way round.
+	uint16_t num = star_lod_aggregate(box->stars, box->cell_starts, box->aggregates);
+	uint16_t expected_num = 0;
+	int bad_aggregates = 0;
+	for (uint32_t block = 0; block < STAR_LOD_MAX_AGGREGATES; block++) {
+		uint32_t first = box->cell_starts[8*block], last = box->cell_starts[8*block + 8];
+		if (first == last)
+			continue;
+		double mean[3] = {0};
+		for (uint32_t i = first; i < last; i++) {
+			int32_t star[3];
+			star_index_decode(&box->stars[3*i], star_index_cell_of(box->cell_starts, i), star);
+			for (int a = 0; a < 3; a++)
+				mean[a] += star[a] / (double)(last - first);
+		}
+		int32_t star[3];
+		int brightness;
+		star_lod_decode(&box->aggregates[STAR_LOD_VERTEX_SHORTS*expected_num++], star, &brightness);
+		for (int a = 0; a < 3; a++)
+			bad_aggregates += fabs(star[a] - mean[a]) > 1 << STAR_INDEX_STEP_SHIFT;
+		int expected_brightness = (int)lround(log2(last - first));
+		bad_aggregates += brightness != (expected_brightness > 15 ? 15 : expected_brightness);
+	}
+	TEST_SOFT_ASSERT(nf, num == expected_num);
+	TEST_SOFT_ASSERT(nf, bad_aggregates == 0);
+	TEST_SOFT_ASSERT(nf, num <= STAR_LOD_MAX_AGGREGATES / 8);
+
+	//Selection goes by the nearest point of the box.
+	int64_t origin[3] = {0, 0, 0};
+	double half = STAR_INDEX_BOX_SIZE / 2, dist = STAR_INDEX_BOX_SIZE / 4;
+	TEST_SOFT_ASSERT(nf, star_lod_select(origin, (int64_t[3]){0, 0, 0}, dist) == STAR_LOD_FULL);
+	TEST_SOFT_ASSERT(nf, star_lod_select(origin, (int64_t[3]){half + dist - 1, 0, 0}, dist) == STAR_LOD_FULL);
+	TEST_SOFT_ASSERT(nf, star_lod_select(origin, (int64_t[3]){0, -(half + dist + 1), 0}, dist) == STAR_LOD_AGGREGATE);
+	TEST_SOFT_ASSERT(nf, star_lod_select(origin, (int64_t[3]){half + dist * 0.8, 0, half + dist * 0.8}, dist) == STAR_LOD_AGGREGATE);
+
+	free(box);
+	return nf;
+}
@@ -0,0 +1,331 @@
+#include "test/test_main.h"
+#include "space/terrain_lod.h"
+#include "space/tile_arena.h"
+#include "jobs/thread_pool.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+//Two providers with nothing in their tiles: one like proc_planet's, with an arena and generating on a thread pool,
+//and one like gpu_planet's, with malloc and generating right away. The tiles they end up with should be the same.
+//Other tests can have the malloc one give its tiles meshes.
+
+static struct tile_arena terrain_lod_test_arena;
+static thread_pool *terrain_lod_test_pool;
+
+//The providers' context.
+struct terrain_lod_test_context {
+	int finished; //Tiles given to finish.
+	void (*fill)(tri_tile *t); //Gives a tile its mesh, faces included, as it's finished. NULL leaves them empty.
+};
+
+static void terrain_lod_test_place(tri_tile *t, tri_tile *parent, struct tri_tile_big_vertex vertices[3])
+{
+	tri_tile_place(t, vertices);
+	t->offset = parent->offset;
+	t->finishing_touches_context = parent->finishing_touches_context;
+}
+
+static bool terrain_lod_test_arena_split(void *context, tri_tile *parent, struct tri_tile_big_vertex vertices[DEFAULT_NUM_TRI_TILE_DIVS][3], tri_tile *out[DEFAULT_NUM_TRI_TILE_DIVS])
+{
+	tri_tile *children = tile_arena_headers(&terrain_lod_test_arena, DEFAULT_NUM_TRI_TILE_DIVS);
+	if (!children)
+		return false;
+	for (int i = 0; i < DEFAULT_NUM_TRI_TILE_DIVS; i++) {
+		out[i] = &children[i];
+		terrain_lod_test_place(out[i], parent, vertices[i]);
+	}
+	return true;
+}
+
+static void terrain_lod_test_arena_free(void *t)
+{
+	tile_arena_header_free(&terrain_lod_test_arena, t);
+}
+
+static void terrain_lod_test_malloc_free(void *data)
+{
+	tri_tile *t = data;
+	free(t->mesh);
+	free(t);
+}
+
+static thread_pool_job_fn(terrain_lod_test_gen_job)
+{
+	tri_tile **tiles = ctx;
+	for (size_t i = begin; i < end; i++)
+		tiles[i]->override_col = (vec3){0, 1, 0};
+}
+
+static void terrain_lod_test_pool_gen(void *context, tri_tile **tiles, size_t num, atomic_size_t *remaining)
+{
+	thread_pool_parallel_for(terrain_lod_test_pool, terrain_lod_test_gen_job, tiles, num, 1, remaining);
+}
+
+static void terrain_lod_test_pool_wait(void *context, atomic_size_t *remaining)
+{
+	thread_pool_wait(terrain_lod_test_pool, remaining);
+}
+
+static bool terrain_lod_test_malloc_split(void *context, tri_tile *parent, struct tri_tile_big_vertex vertices[DEFAULT_NUM_TRI_TILE_DIVS][3], tri_tile *out[DEFAULT_NUM_TRI_TILE_DIVS])
+{
+	for (int i = 0; i < DEFAULT_NUM_TRI_TILE_DIVS; i++) {
+		out[i] = malloc(sizeof(tri_tile));
+		terrain_lod_test_place(out[i], parent, vertices[i]);
+	}
+	return true;
+}
+
+static void terrain_lod_test_gen(void *context, tri_tile **tiles, size_t num, atomic_size_t *remaining)
+{
+	terrain_lod_test_gen_job(tiles, 0, num);
+}
+
+static void terrain_lod_test_wait(void *context, atomic_size_t *remaining)
+{
+}
+
+static void terrain_lod_test_finish(void *context, tri_tile *t)
+{
+	struct terrain_lod_test_context *c = context;
+	if (c->fill)
+		c->fill(t);
+	c->finished++;
+}
+
+//Faces come from the arena if there's a node_allocator, so free_tile can give them back.
+static void terrain_lod_test_new(struct terrain_lod *lod, const struct terrain_lod_params *params, const struct terrain_lod_provider *provider, const quadtree_allocator *node_allocator)
+{
+	struct terrain_lod_test_context *c = provider->context;
+	tri_tile *faces[NUM_ICOSPHERE_FACES];
+	for (int i = 0; i < NUM_ICOSPHERE_FACES; i++) {
+		struct tri_tile_big_vertex verts[3];
+		terrain_lod_face_vertices(i, params->radius, verts);
+		faces[i] = node_allocator ? tile_arena_headers(&terrain_lod_test_arena, 1) : malloc(sizeof(tri_tile));
+		memset(faces[i], 0, sizeof(tri_tile));
+		tri_tile_place(faces[i], verts);
+		if (c->fill)
+			c->fill(faces[i]);
+	}
+	terrain_lod_init(lod, params, provider, faces, node_allocator);
+}
+
+static int terrain_lod_test_evictions;
+
+//Update until nothing changes any more, like a camera staying put for a few frames. Returns the drawlist's length.
+static int terrain_lod_test_converge(struct terrain_lod *lod, struct terrain_lod_view *view, tri_tile **tiles, int max_tiles)
+{
+	int num_tiles = 0;
+	for (int i = 0; i < 1000; i++) {
+		num_tiles = terrain_lod_update(lod, view, tiles, max_tiles);
+		struct terrain_lod_stats s = lod->stats;
+		terrain_lod_test_evictions += s.evictions;
+		if (!s.pending_splits && !s.splits && !s.merges && !s.expansions && !s.evictions)
+			break;
+		for (int j = 0; j < TERRAIN_LOD_MAX_PENDING_SPLITS; j++)
+			if (lod->splits[j].in_use)
+				lod->provider.wait(lod->provider.context, &lod->splits[j].jobs_remaining);
+	}
+	return num_tiles;
+}
+
+static int terrain_lod_test_compare_tiles(const void *a, const void *b)
+{
+	const tri_tile *ta = *(tri_tile **)a, *tb = *(tri_tile **)b;
+	for (int i = 0; i < 3; i++)
+		if (ta->centroid[i] != tb->centroid[i])
+			return ta->centroid[i] < tb->centroid[i] ? -1 : 1;
+	return 0;
+}
+
+//Splits a tile has had, from how much smaller it is than a face.
+static int terrain_lod_test_depth(tri_tile *t, float face_radius)
+{
+	return round(log2(face_radius / t->radius));
+}
+
+int terrain_lod_test_providers_agree()
+{
+	int nf = 0; //Number of failures
+	enum {max_tiles = 4096, num_steps = 6};
+	const float radius = 1000;
+	struct terrain_lod_params params = {
+		.radius = radius,
+		.max_height = 10,
+		.split_distance = 400,
+		.max_subdivisions = 5,
+		.tile_budget = (size_t)1 << 30,
+	};
+	struct terrain_lod_test_context arena_context = {0}, malloc_context = {0};
+	struct terrain_lod_provider arena_provider = {
+		.split = terrain_lod_test_arena_split,
+		.generate = terrain_lod_test_pool_gen,
+		.wait = terrain_lod_test_pool_wait,
+		.finish = terrain_lod_test_finish,
+		.free_tile = terrain_lod_test_arena_free,
+		.tile_bytes = 1000,
+		.context = &arena_context,
+	};
+	struct terrain_lod_provider malloc_provider = {
+		.split = terrain_lod_test_malloc_split,
+		.generate = terrain_lod_test_gen,
+		.wait = terrain_lod_test_wait,
+		.finish = terrain_lod_test_finish,
+		.free_tile = terrain_lod_test_malloc_free,
+		.tile_bytes = 1000,
+		.context = &malloc_context,
+	};
+	tile_arena_init(&terrain_lod_test_arena, sizeof(tri_tile), 0);
+	terrain_lod_test_pool = thread_pool_new(3);
+	struct terrain_lod arena_lod, malloc_lod;
+	terrain_lod_test_new(&arena_lod, &params, &arena_provider, &terrain_lod_test_arena.node_allocator);
+	terrain_lod_test_new(&malloc_lod, &params, &malloc_provider, NULL);
+	float face_radius = arena_lod.roots[0] ? ((tri_tile *)arena_lod.roots[0]->data)->radius : 0;
+
+	//Falling from far away to just above the surface, skimming along it, then leaving again.
+	vec3 path[num_steps] = {
+		{0, 0, 100 * radius},
+		{0, 0, 3 * radius},
+		{0, 0, radius + 5},
+		{0, 0.1 * radius, radius + 5},
+		{0, 0.3 * radius, 1.2 * radius},
+		{0, 0, 100 * radius},
+	};
+	tri_tile **arena_tiles = malloc(2 * max_tiles * sizeof(tri_tile *)), **malloc_tiles = arena_tiles + max_tiles;
+	int differing = 0, near_depth = 0, far_depth = 0;
+	for (int i = 0; i < num_steps; i++) {
+		struct terrain_lod_view view = {
+			.cam_pos = {path[i], {0, 0, 0}},
+			.max_splits = 4,
+			.max_uploads = TERRAIN_LOD_MAX_PENDING_SPLITS,
+		};
+		int num_arena = terrain_lod_test_converge(&arena_lod, &view, arena_tiles, max_tiles);
+		int num_malloc = terrain_lod_test_converge(&malloc_lod, &view, malloc_tiles, max_tiles);
+		TEST_SOFT_ASSERT(nf, num_arena > 0 && num_arena == num_malloc);
+		if (num_arena != num_malloc)
+			continue;
+		qsort(arena_tiles, num_arena, sizeof(tri_tile *), terrain_lod_test_compare_tiles);
+		qsort(malloc_tiles, num_malloc, sizeof(tri_tile *), terrain_lod_test_compare_tiles);
+		for (int j = 0; j < num_arena; j++)
+			differing += terrain_lod_test_compare_tiles(&arena_tiles[j], &malloc_tiles[j]) != 0;
+
+		//The tile under the camera is the deepest one, and far away nothing is split.
+		int deepest = 0, shallowest = params.max_subdivisions;
+		for (int j = 0; j < num_arena; j++) {
+			int depth = terrain_lod_test_depth(arena_tiles[j], face_radius);
+			deepest = depth > deepest ? depth : deepest;
+			shallowest = depth < shallowest ? depth : shallowest;
+		}
+		if (i == 2)
+			near_depth = deepest;
+		if (i == 0 || i == num_steps - 1)
+			far_depth += deepest;
+		TEST_SOFT_ASSERT(nf, i != 2 || shallowest < deepest);
+	}
+	TEST_SOFT_ASSERT(nf, differing == 0);
+	TEST_SOFT_ASSERT(nf, near_depth == params.max_subdivisions);
+	TEST_SOFT_ASSERT(nf, far_depth == 0);
+	//Leaving again merged everything, but the children were kept.
+	TEST_SOFT_ASSERT(nf, arena_lod.num_collapsed > 0 && arena_lod.stats.resident_tiles > NUM_ICOSPHERE_FACES);
+	TEST_SOFT_ASSERT(nf, arena_lod.stats.resident_tiles == malloc_lod.stats.resident_tiles);
+	TEST_SOFT_ASSERT(nf, arena_context.finished == malloc_context.finished && arena_context.finished == arena_lod.stats.resident_tiles - NUM_ICOSPHERE_FACES);
+
+	//Coming back costs nothing, the merged children are expanded again.
+	float *morphs = malloc(max_tiles * sizeof(float));
+	struct terrain_lod_view view = {
+		.cam_pos = {path[2], {0, 0, 0}},
+		.max_splits = 4,
+		.max_uploads = TERRAIN_LOD_MAX_PENDING_SPLITS,
+		.morphs = morphs,
+	};
+	int resident = malloc_lod.stats.resident_tiles;
+	int num_tiles = terrain_lod_update(&malloc_lod, &view, malloc_tiles, max_tiles);
+	TEST_SOFT_ASSERT(nf, malloc_lod.stats.expansions > 0 && malloc_lod.stats.pending_splits == 0);
+	TEST_SOFT_ASSERT(nf, malloc_lod.stats.resident_tiles == resident);
+
+	//Morphs stay between parent and child, and the tile right under the camera is all the way there.
+	int out_of_range = 0, deepest = 0;
+	for (int j = 0; j < num_tiles; j++) {
+		out_of_range += !(morphs[j] >= 0 && morphs[j] <= 1);
+		if (terrain_lod_test_depth(malloc_tiles[j], face_radius) > terrain_lod_test_depth(malloc_tiles[deepest], face_radius))
+			deepest = j;
+	}
+	TEST_SOFT_ASSERT(nf, num_tiles > 0 && out_of_range == 0 && morphs[deepest] == 1);
+	//Faces are never morphed, they have no parent.
+	view.cam_pos = (bpos){path[0], {0, 0, 0}};
+	num_tiles = terrain_lod_test_converge(&malloc_lod, &view, malloc_tiles, max_tiles);
+	int unmorphed = 0;
+	for (int j = 0; j < num_tiles; j++)
+		unmorphed += morphs[j] == 1;
+	TEST_SOFT_ASSERT(nf, num_tiles > 0 && unmorphed == num_tiles);
+	free(morphs);
+
+	free(arena_tiles);
+	terrain_lod_deinit(&arena_lod);
+	terrain_lod_deinit(&malloc_lod);
+	thread_pool_free(terrain_lod_test_pool);
+	TEST_SOFT_ASSERT(nf, tile_arena_stats(&terrain_lod_test_arena).headers == 0 && tile_arena_stats(&terrain_lod_test_arena).nodes == 0);
+	tile_arena_deinit(&terrain_lod_test_arena);
+	return nf;
+}
+
+//The collapsed list links up both ways, holds num_collapsed nodes, and every one of them is collapsed.
+static bool terrain_lod_test_collapsed_linked(struct terrain_lod *lod)
+{
+	int num = 0;
+	quadtree_node *older = NULL;
+	for (quadtree_node *node = lod->oldest_collapsed; node; older = node, node = ((tri_tile *)node->data)->collapsed_newer, num++)
+		if (((tri_tile *)node->data)->collapsed_older != older || !((tri_tile *)node->data)->collapsed)
+			return false;
+	return older == lod->newest_collapsed && num == lod->num_collapsed;
+}
+
+int terrain_lod_test_budget()
+{
+	int nf = 0; //Number of failures
+	enum {max_tiles = 4096, tile_bytes = 1000, budget_tiles = 200};
+	const float radius = 1000;
+	struct terrain_lod_params params = {
+		.radius = radius,
+		.max_height = 10,
+		.split_distance = 400,
+		.max_subdivisions = 5,
+		.tile_budget = budget_tiles * tile_bytes,
+	};
+	struct terrain_lod_test_context context = {0};
+	struct terrain_lod_provider provider = {
+		.split = terrain_lod_test_malloc_split,
+		.generate = terrain_lod_test_gen,
+		.wait = terrain_lod_test_wait,
+		.finish = terrain_lod_test_finish,
+		.free_tile = terrain_lod_test_malloc_free,
+		.tile_bytes = tile_bytes,
+		.context = &context,
+	};
+	struct terrain_lod lod;
+	terrain_lod_test_new(&lod, &params, &provider, NULL);
+	tri_tile **tiles = malloc(max_tiles * sizeof(tri_tile *));
+
+	//Skimming around the planet close to the surface leaves a trail of merged tiles behind, which has to be cut.
+	int over_budget = 0, unlinked = 0;
+	terrain_lod_test_evictions = 0;
+	for (int i = 0; i < 64; i++) {
+		float angle = 2 * M_PI * i / 64;
+		struct terrain_lod_view view = {
+			.cam_pos = {{(radius + 5) * sin(angle), 0, (radius + 5) * cos(angle)}, {0, 0, 0}},
+			.max_splits = 4,
+			.max_uploads = TERRAIN_LOD_MAX_PENDING_SPLITS,
+		};
+		int num_tiles = terrain_lod_test_converge(&lod, &view, tiles, max_tiles);
+		over_budget += lod.stats.resident_bytes > params.tile_budget || !num_tiles;
+		unlinked += !terrain_lod_test_collapsed_linked(&lod);
+	}
+	TEST_SOFT_ASSERT(nf, over_budget == 0);
+	TEST_SOFT_ASSERT(nf, unlinked == 0);
+	TEST_SOFT_ASSERT(nf, terrain_lod_test_evictions > 0);
+	TEST_SOFT_ASSERT(nf, lod.stats.resident_tiles * tile_bytes == lod.stats.resident_bytes);
+
+	free(tiles);
+	terrain_lod_deinit(&lod);
+	return nf;
+}
@@ -0,0 +1,147 @@
+#include "test/test_main.h"
+#include "space/terrain_noise.h"
+#include "open-simplex-noise-in-c/open-simplex-noise.h"
+#include <stdlib.h>
+#include <math.h>
+
+//Points in a cube of side spread, a little way off the origin.
+static void terrain_noise_test_points(uint64_t seed, int num, float spread, float *x, float *y, float *z)
+{
+	uint64_t state = seed;
+	for (int i = 0; i < num; i++) {
+		float p[3];
+		for (int a = 0; a < 3; a++) {
+			state = state * 6364136223846793005ull + 1442695040888963407ull;
+			p[a] = ((float)(state >> 40) / (1 << 24) - 0.5f) * spread;
+		}
+		x[i] = p[0] + 3;
+		y[i] = p[1] - 5;
+		z[i] = p[2] + 17;
+	}
+}
+
+int terrain_noise_test_batch()
+{
+	int nf = 0; //Number of failures
+	struct terrain_noise tn;
+	terrain_noise_init(&tn, 83619);
+	enum {num = 100003}; //Not a multiple of the batch width, for the leftovers.
+	float *x = malloc(7 * num * sizeof(float)), *y = x + num, *z = y + num;
+	float *value = z + num, *gx = value + num, *gy = gx + num, *gz = gy + num;
+	terrain_noise_test_points(1, num, 64, x, y, z);
+	terrain_noise_batch(&tn, num, x, y, z, value, gx, gy, gz);
+
+	int bad_batch = 0, bad_gradient = 0, out_of_range = 0;
+	for (int i = 0; i < num; i++) {
+		float p[3] = {x[i], y[i], z[i]}, g[3];
+		float v = terrain_noise_at(&tn, p, g);
+		bad_batch += fabsf(v - value[i]) > 1e-5 || fabsf(g[0] - gx[i]) > 1e-4 || fabsf(g[1] - gy[i]) > 1e-4 || fabsf(g[2] - gz[i]) > 1e-4;
+		out_of_range += v < -1 || v > 1;
+
+		//Against central differences, which are only good to a few digits in floats.
+		float h = 1e-2;
+		for (int a = 0; a < 3; a++) {
+			float pp[3] = {p[0], p[1], p[2]}, pm[3] = {p[0], p[1], p[2]};
+			pp[a] += h;
+			pm[a] -= h;
+			float d = (terrain_noise_at(&tn, pp, NULL) - terrain_noise_at(&tn, pm, NULL)) / (2 * h);
+			bad_gradient += fabsf(d - g[a]) > 1e-2;
+		}
+	}
+	TEST_SOFT_ASSERT(nf, bad_batch == 0);
+	TEST_SOFT_ASSERT(nf, bad_gradient == 0);
+	TEST_SOFT_ASSERT(nf, out_of_range == 0);
+
+	//Seeding is deterministic, and different seeds give different noise.
+	struct terrain_noise same, other;
+	terrain_noise_init(&same, 83619);
+	terrain_noise_init(&other, 83620);
+	float p[3] = {x[0], y[0], z[0]};
+	TEST_SOFT_ASSERT(nf, terrain_noise_at(&same, p, NULL) == terrain_noise_at(&tn, p, NULL));
+	int differs = 0;
+	for (int i = 0; i < 100; i++)
+		differs += terrain_noise_at(&other, (float[3]){x[i], y[i], z[i]}, NULL) != value[i];
+	TEST_SOFT_ASSERT(nf, differs > 90);
+
+	free(x);
+	return nf;
+}
+
+//Against open-simplex-noise-in-c itself, on a grid that crosses the origin and plenty of lattice cells.
+int terrain_noise_test_open_simplex()
+{
+	int nf = 0; //Number of failures
+	enum {side = 40, num = side * side * side};
+	struct terrain_noise tn;
+	terrain_noise_init(&tn, 83619);
+	struct osn_context *ctx;
+	open_simplex_noise(83619, &ctx);
+	float *x = malloc(7 * num * sizeof(float)), *y = x + num, *z = y + num;
+	float *value = z + num, *gx = value + num, *gy = gx + num, *gz = gy + num;
+	for (int i = 0; i < num; i++) {
+		x[i] = (i % side - side / 2) * 0.29f + 0.013f;
+		y[i] = (i / side % side - side / 2) * 0.37f;
+		z[i] = (i / (side * side) - side / 2) * 0.41f - 0.007f;
+	}
+	terrain_noise_batch(&tn, num, x, y, z, value, gx, gy, gz);
+
+	int bad_at = 0, bad_batch = 0;
+	for (int i = 0; i < num; i++) {
+		double expected = open_simplex_noise3(ctx, x[i], y[i], z[i]);
+		bad_at += fabs(terrain_noise_at(&tn, (float[3]){x[i], y[i], z[i]}, NULL) - expected) > 1e-5;
+		bad_batch += fabs(value[i] - expected) > 1e-5;
+	}
+	TEST_SOFT_ASSERT(nf, bad_at == 0);
+	TEST_SOFT_ASSERT(nf, bad_batch == 0);
+
+	open_simplex_noise_free(ctx);
+	free(x);
+	return nf;
+}
+
+/*
+The noise for a tile's worth of vertices, for 2 octaves as the solar system's planets have. The old way takes
+3 samples an octave for finite differences, the new way one batched sample with its gradient.
+*/
+int terrain_noise_bench()
+{
+	enum {num = (128 + 1) * (128 + 2) / 2, octaves = 2, tiles = 64};
+	struct terrain_noise tn;
+	terrain_noise_init(&tn, 83619);
+	struct osn_context *ctx;
+	open_simplex_noise(83619, &ctx);
+	float *x = malloc(10 * num * sizeof(float)), *y = x + num, *z = y + num, *sx = z + num, *sy = sx + num, *sz = sy + num;
+	float *value = sz + num, *gx = value + num, *gy = gx + num, *gz = gy + num;
+	terrain_noise_test_points(2, num, 0.3, x, y, z);
+
+	double start = test_time_seconds();
+	for (int tile = 0; tile < tiles; tile++)
+		for (int i = 0; i < num; i++)
+			for (int j = 0; j < octaves; j++) {
+				double scale = pow(2, j*2)*2, e = 1e-3;
+				open_simplex_noise3(ctx, x[i] * scale, y[i] * scale, z[i] * scale);
+				open_simplex_noise3(ctx, (x[i] + e) * scale, y[i] * scale, z[i] * scale);
+				open_simplex_noise3(ctx, x[i] * scale, y[i] * scale, (z[i] + e) * scale);
+			}
+	double old_time = test_time_seconds() - start;
+
+	start = test_time_seconds();
+	for (int tile = 0; tile < tiles; tile++)
+		for (int j = 0; j < octaves; j++) {
+			float scale = pow(2, j*2)*2;
+			for (int i = 0; i < num; i++) {
+				sx[i] = x[i] * scale;
+				sy[i] = y[i] * scale;
+				sz[i] = z[i] * scale;
+			}
+			terrain_noise_batch(&tn, num, sx, sy, sz, value, gx, gy, gz);
+		}
+	double new_time = test_time_seconds() - start;
+
+	printf(ANSI_COLOR_CYAN "terrain_noise_bench: %d vertices x %d octaves x %d tiles, finite differences %.2fms (%.2fM vertices/s) vs batched gradient %.2fms (%.2fM vertices/s), %.1fx" ANSI_COLOR_RESET "\n",
+		num, octaves, tiles, old_time * 1000, num * tiles / old_time / 1e6, new_time * 1000, num * tiles / new_time / 1e6,
+		old_time / new_time);
+	open_simplex_noise_free(ctx);
+	free(x);
+	return 0;
+}
@@ -0,0 +1,219 @@
+#include "test/test_main.h"
+#include "space/terrain_query.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+//Tiles with small meshes of rolling hills, which the fallback works out exactly, so the two can be compared.
+
+enum {terrain_query_test_rows = 8};
+static const float terrain_query_test_radius = 1000;
+
+static float terrain_query_test_hills(vec3 d)
+{
+	return 10 * sin(5 * d[0]) * cos(4 * d[1]) + 5 * d[2];
+}
+
+static void terrain_query_test_fallback(void *context, const vec3 directions[], int n, float out[])
+{
+	int *calls = context;
+	(*calls)++;
+	for (int i = 0; i < n; i++)
+		out[i] = terrain_query_test_hills(directions[i]);
+}
+
+//Vertex j of row r, where the repo's tiles put it, raised to the hills.
+static void terrain_query_test_mesh(tri_tile *t)
+{
+	int rows = terrain_query_test_rows;
+	t->num_rows = rows;
+	t->num_vertices = (rows + 1) * (rows + 2) / 2;
+	t->mesh = malloc(t->num_vertices * sizeof(struct tri_tile_vertex));
+	for (int r = 0, k = 0; r <= rows; r++) {
+		vec3 left = vec3_lerp(t->big_vertices[0].position, t->big_vertices[1].position, (float)r / rows);
+		vec3 right = vec3_lerp(t->big_vertices[0].position, t->big_vertices[2].position, (float)r / rows);
+		for (int j = 0; j <= r; j++, k++) {
+			vec3 d = vec3_normalize(r ? vec3_lerp(left, right, (float)j / r) : left);
+			t->mesh[k].position = d * (terrain_query_test_radius + terrain_query_test_hills(d));
+		}
+	}
+}
+
+//The terrain_lod tests' malloc provider, with the hills in its tiles.
+static void terrain_query_test_new(struct terrain_lod *lod, struct terrain_lod_test_context *context, size_t budget_tiles)
+{
+	*context = (struct terrain_lod_test_context){.fill = terrain_query_test_mesh};
+	struct terrain_lod_params params = {
+		.radius = terrain_query_test_radius,
+		.max_height = 15,
+		.split_distance = 400,
+		.max_subdivisions = 5,
+		.tile_budget = budget_tiles * 1000,
+	};
+	struct terrain_lod_provider provider = {
+		.split = terrain_lod_test_malloc_split,
+		.generate = terrain_lod_test_gen,
+		.wait = terrain_lod_test_wait,
+		.finish = terrain_lod_test_finish,
+		.free_tile = terrain_lod_test_malloc_free,
+		.tile_bytes = 1000,
+		.context = context,
+	};
+	terrain_lod_test_new(lod, &params, &provider, NULL);
+}
+
+//Update until the tiles under cam_pos are as deep as they get.
+static void terrain_query_test_look(struct terrain_lod *lod, vec3 cam_pos, tri_tile **tiles, int max_tiles)
+{
+	struct terrain_lod_view view = {
+		.cam_pos = {cam_pos, {0, 0, 0}},
+		.max_splits = 4,
+		.max_uploads = TERRAIN_LOD_MAX_PENDING_SPLITS,
+	};
+	terrain_lod_test_converge(lod, &view, tiles, max_tiles);
+}
+
+struct terrain_query_test_search {
+	quadtree_node *node;
+	bool found;
+};
+
+static bool terrain_query_test_search_visit(quadtree_node *node, void *context)
+{
+	struct terrain_query_test_search *search = context;
+	search->found |= node == search->node;
+	return !search->found;
+}
+
+//The face node is under.
+static quadtree_node * terrain_query_test_face(struct terrain_lod *lod, quadtree_node *node)
+{
+	for (int i = 0; i < NUM_ICOSPHERE_FACES; i++) {
+		struct terrain_query_test_search search = {node};
+		quadtree_preorder_visit(lod->roots[i], terrain_query_test_search_visit, &search);
+		if (search.found)
+			return lod->roots[i];
+	}
+	return NULL;
+}
+
+//Positions in a patch around the direction center, some high up, some underground.
+static void terrain_query_test_positions(vec3 center, float spread, int n, bpos out[])
+{
+	srand(4529);
+	for (int i = 0; i < n; i++) {
+		vec3 jitter = {rand() / (float)RAND_MAX - 0.5f, rand() / (float)RAND_MAX - 0.5f, rand() / (float)RAND_MAX - 0.5f};
+		vec3 d = vec3_normalize(center + jitter * spread);
+		out[i] = (bpos){d * (terrain_query_test_radius * (0.9f + 0.2f * i / n)), {0, 0, 0}};
+	}
+}
+
+int terrain_query_test_heights()
+{
+	int nf = 0; //Number of failures
+	enum {max_tiles = 4096, num = 1000};
+	struct terrain_lod lod;
+	struct terrain_lod_test_context context;
+	terrain_query_test_new(&lod, &context, 1000);
+	tri_tile **tiles = malloc(max_tiles * sizeof(tri_tile *));
+	bpos *positions = malloc(num * sizeof(bpos));
+	float *heights = malloc(num * sizeof(float));
+	int fallback_calls = 0;
+	struct terrain_query q;
+	terrain_query_init(&q, &lod, lod.params.max_subdivisions, terrain_query_test_fallback, &fallback_calls);
+
+	//Right under the camera, the tiles are deep enough, and their meshes are close to the hills.
+	vec3 near = vec3_normalize((vec3){0.3, 0.2, 1});
+	terrain_query_test_look(&lod, near * (terrain_query_test_radius + 5), tiles, max_tiles);
+	terrain_query_test_positions(near, 0.01, num, positions);
+	terrain_query_heights(&q, positions, num, heights);
+	float max_error = 0;
+	for (int i = 0; i < num; i++)
+		max_error = fmax(max_error, fabs(heights[i] - terrain_query_test_hills(vec3_normalize(positions[i].offset))));
+	TEST_SOFT_ASSERT(nf, max_error < 0.01);
+	TEST_SOFT_ASSERT(nf, q.stats.queries == num && q.stats.fallbacks == 0 && fallback_calls == 0);
+	TEST_SOFT_ASSERT(nf, q.stats.hits + q.stats.misses == num && q.stats.misses < num / 10);
+
+	//Asking again only takes the kept patches.
+	q.stats = (struct terrain_query_stats){0};
+	float *again = malloc(num * sizeof(float));
+	terrain_query_heights(&q, positions, num, again);
+	TEST_SOFT_ASSERT(nf, q.stats.misses == 0 && !memcmp(heights, again, num * sizeof(float)));
+
+	//A patch whose tile was split since finds the deeper tile, which can be further down the patches already. It's
+	//moved up rather than kept twice.
+	quadtree_node *deep = q.patches[0], *face = terrain_query_test_face(&lod, deep);
+	TEST_SOFT_ASSERT(nf, face && deep->depth > 0);
+	q.patches[0] = face;
+	q.patches[1] = deep;
+	q.num_patches = 2;
+	terrain_query_heights(&q, &positions[num - 1], 1, again);
+	TEST_SOFT_ASSERT(nf, q.num_patches == 1 && q.patches[0] == deep && again[0] == heights[num - 1]);
+
+	//Across the planet the tiles are too coarse, so the fallback does them, in one batch.
+	q.stats = (struct terrain_query_stats){0};
+	terrain_query_test_positions(-near, 0.01, num, positions);
+	terrain_query_heights(&q, positions, num, heights);
+	max_error = 0;
+	for (int i = 0; i < num; i++)
+		max_error = fmax(max_error, fabs(heights[i] - terrain_query_test_hills(vec3_normalize(positions[i].offset))));
+	TEST_SOFT_ASSERT(nf, max_error < 1e-4 && q.stats.fallbacks == num);
+	TEST_SOFT_ASSERT(nf, fallback_calls == (num + TERRAIN_QUERY_CHUNK - 1) / TERRAIN_QUERY_CHUNK);
+
+	//Going around the planet on a small budget evicts the tiles the patches were on, which have to be let go.
+	terrain_lod_deinit(&lod);
+	terrain_query_test_new(&lod, &context, 200);
+	terrain_query_init(&q, &lod, lod.params.max_subdivisions, terrain_query_test_fallback, &fallback_calls);
+	int stale = 0, mesh_misses = 0;
+	for (int i = 0; i < 16; i++) {
+		float angle = 2 * M_PI * i / 16;
+		vec3 dir = {sin(angle), 0, cos(angle)};
+		uint32_t generation = lod.generation;
+		terrain_query_test_look(&lod, dir * (terrain_query_test_radius + 5), tiles, max_tiles);
+		stale += lod.generation != generation;
+		q.stats = (struct terrain_query_stats){0};
+		terrain_query_test_positions(dir, 0.005, num, positions);
+		terrain_query_heights(&q, positions, num, heights);
+		for (int j = 0; j < num; j++)
+			mesh_misses += fabs(heights[j] - terrain_query_test_hills(vec3_normalize(positions[j].offset))) > 0.01;
+	}
+	TEST_SOFT_ASSERT(nf, stale > 0 && mesh_misses == 0);
+
+	free(again);
+	free(heights);
+	free(positions);
+	free(tiles);
+	terrain_lod_deinit(&lod);
+	return nf;
+}
+
+int terrain_query_bench()
+{
+	enum {max_tiles = 4096, num = 4096, frames = 64};
+	struct terrain_lod lod;
+	struct terrain_lod_test_context context;
+	terrain_query_test_new(&lod, &context, 1000);
+	tri_tile **tiles = malloc(max_tiles * sizeof(tri_tile *));
+	bpos *positions = malloc(num * sizeof(bpos));
+	float *heights = malloc(num * sizeof(float));
+	int fallback_calls = 0;
+	struct terrain_query q;
+	terrain_query_init(&q, &lod, lod.params.max_subdivisions, terrain_query_test_fallback, &fallback_calls);
+
+	//A few thousand things on the ground around the camera, every frame.
+	vec3 near = vec3_normalize((vec3){0.3, 0.2, 1});
+	terrain_query_test_look(&lod, near * (terrain_query_test_radius + 5), tiles, max_tiles);
+	terrain_query_test_positions(near, 0.02, num, positions);
+	double start = test_time_seconds();
+	for (int i = 0; i < frames; i++)
+		terrain_query_heights(&q, positions, num, heights);
+	double time = test_time_seconds() - start;
+
+	printf(ANSI_COLOR_CYAN "terrain_query_bench: %d queries x %d frames, %.3fms a frame (%.2fM queries/s), %.1f%% from kept patches, %d fallbacks" ANSI_COLOR_RESET "\n",
+		num, frames, time * 1000 / frames, num * frames / time / 1e6, 100.0 * q.stats.hits / q.stats.queries, q.stats.fallbacks);
+	free(heights);
+	free(positions);
+	free(tiles);
+	terrain_lod_deinit(&lod);
+	return 0;
+}
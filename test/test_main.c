@@ -2,14 +2,37 @@
 #include "macros.h"
 #include "mempool.test.c"
 #include "hmempool.test.c"
+#include "chunkpool.test.c"
+#include "hashmap.test.c"
 #include "ecs.test.c"
+#include "ecs_cmdbuf.test.c"
+#include "ecs_snapshot.test.c"
+#include "ecs_scheduler.test.c"
+#include "star_index.test.c"
+#include "galaxy_density.test.c"
+#include "star_lod.test.c"
+#include "star_box.test.c"
+#include "terrain_noise.test.c"
+#include "tile_arena.test.c"
+#include "frustum.test.c"
+#include "terrain_lod.test.c"
+#include "tile_atlas.test.c"
+#include "terrain_query.test.c"
 #include "ply_mesh.test.c"
 #include <unistd.h>
+#include <time.h>
 
 #define RUN_TEST(testfn) run_test(testfn, #testfn)
 
 bool nofork = false;
 
+double test_time_seconds()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
 int run_test(int (test_fn)(void), char *test_fn_name)
 {
 	int wstatus = 0;
@@ -55,8 +78,49 @@ int test_main(int argc, char **argv)
 	RUN_TEST(hmempool_test_add_remove);
 	RUN_TEST(hmempool_test_resize);
 	RUN_TEST(hmempool_test_resize_stretch);
+	RUN_TEST(hmempool_test_stale_handle);
+
+	RUN_TEST(chunkpool_test_add_remove);
+	RUN_TEST(chunkpool_test_runs);
+	RUN_TEST(chunkpool_bench);
+
+	RUN_TEST(hashmap_test_insert_remove);
+	RUN_TEST(hashmap_test_interned);
+	RUN_TEST(hashmap_bench);
 
 	RUN_TEST(ecs_test_1);
+	RUN_TEST(ecs_test_query);
+	RUN_TEST(ecs_test_generations);
+	RUN_TEST(ecs_bench_query);
+	RUN_TEST(ecs_test_spawn);
+	RUN_TEST(ecs_bench_spawn);
+	RUN_TEST(ecs_test_stable_component);
+	RUN_TEST(ecs_test_change_tracking);
+
+	RUN_TEST(ecs_cmdbuf_test_flush);
+	RUN_TEST(ecs_snapshot_test_roundtrip);
+
+	RUN_TEST(thread_pool_test_parallel_for);
+	RUN_TEST(ecs_scheduler_test_matches_serial);
+
+	RUN_TEST(star_index_test_queries);
+	RUN_TEST(star_index_bench);
+	RUN_TEST(galaxy_density_test_batch);
+	RUN_TEST(galaxy_density_bench);
+	RUN_TEST(star_lod_test_vertices);
+	RUN_TEST(star_box_test_threads);
+	RUN_TEST(terrain_noise_test_batch);
+	RUN_TEST(terrain_noise_test_open_simplex);
+	RUN_TEST(terrain_noise_bench);
+	RUN_TEST(tile_arena_test_families);
+	RUN_TEST(frustum_test_spheres_against_planes);
+
+	RUN_TEST(terrain_lod_test_providers_agree);
+	RUN_TEST(terrain_lod_test_budget);
+	RUN_TEST(tile_atlas_test_lru);
+	RUN_TEST(tile_atlas_test_texels);
+	RUN_TEST(terrain_query_test_heights);
+	RUN_TEST(terrain_query_bench);
 
 	RUN_TEST(ply_mesh_load_cube);
 	RUN_TEST(ply_mesh_load_newship);
@@ -8,5 +8,7 @@
 #define TEST_SOFT_ASSERT(numfailed, x) if (!(x)) {printf(ANSI_COLOR_RED "Soft assert failed: " ANSI_COLOR_YELLOW "(" #x ") in " __FILE__ ":%d" ANSI_COLOR_RESET "\n", __LINE__); numfailed++;}
 
 int test_main(int argc, char **argv);
+//Monotonic time in seconds, for benchmarks.
+double test_time_seconds();
 
 #endif
\ No newline at end of file
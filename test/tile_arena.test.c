@@ -0,0 +1,73 @@
+#include "test/test_main.h"
+#include "space/tile_arena.h"
+#include <string.h>
+#include <stdlib.h>
+
+static int tile_arena_test_freed;
+
+static void tile_arena_test_free_data(void *data)
+{
+	tile_arena_test_freed++;
+}
+
+int tile_arena_test_families()
+{
+	int nf = 0; //Number of failures
+	enum {header_size = 200, mesh_size = 1000, num_meshes = 20};
+	struct tile_arena a;
+	tile_arena_init(&a, header_size, mesh_size);
+
+	//Headers come in families side by side, and holes left by single frees get reused.
+	unsigned char *family = tile_arena_headers(&a, 4), *next = tile_arena_headers(&a, 4);
+	TEST_SOFT_ASSERT(nf, family && next && next == family + 4 * header_size);
+	tile_arena_header_free(&a, family + header_size);
+	unsigned char *another = tile_arena_headers(&a, 4);
+	TEST_SOFT_ASSERT(nf, another == next + 4 * header_size);
+	TEST_SOFT_ASSERT(nf, tile_arena_headers(&a, 1) == family + header_size);
+	TEST_SOFT_ASSERT(nf, tile_arena_stats(&a).headers == 12);
+
+	//Two levels of children, each family in a row, all given back when they're removed.
+	quadtree_node *root = quadtree_new(NULL, 0);
+	root->allocator = &a.node_allocator;
+	void *data[QUADTREE_NUM_CHILDREN] = {0};
+	TEST_SOFT_ASSERT(nf, quadtree_node_add_children(root, data));
+	int apart = 0;
+	for (int i = 0; i < QUADTREE_NUM_CHILDREN; i++) {
+		apart += root->children[i] != root->children[0] + i;
+		quadtree_node_add_children(root->children[i], data);
+		for (int j = 0; j < QUADTREE_NUM_CHILDREN; j++)
+			apart += root->children[i]->children[j] != root->children[i]->children[0] + j || root->children[i]->children[j]->depth != 2;
+	}
+	TEST_SOFT_ASSERT(nf, apart == 0);
+	TEST_SOFT_ASSERT(nf, tile_arena_stats(&a).nodes == 20);
+	tile_arena_test_freed = 0;
+	quadtree_node_remove_children(root->children[2], tile_arena_test_free_data);
+	TEST_SOFT_ASSERT(nf, tile_arena_test_freed == 4 && tile_arena_stats(&a).nodes == 16);
+	quadtree_free(root, tile_arena_test_free_data);
+	TEST_SOFT_ASSERT(nf, tile_arena_test_freed == 4 + 17 && tile_arena_stats(&a).nodes == 0);
+
+	//Meshes come from slabs, then from the free list once there's anything on it.
+	unsigned char *meshes[num_meshes];
+	for (int i = 0; i < num_meshes; i++) {
+		meshes[i] = tile_arena_mesh(&a);
+		memset(meshes[i], i, mesh_size);
+	}
+	int overlapping = 0;
+	for (int i = 0; i < num_meshes; i++)
+		overlapping += meshes[i][0] != i || meshes[i][mesh_size - 1] != i;
+	TEST_SOFT_ASSERT(nf, overlapping == 0);
+	struct tile_arena_stats stats = tile_arena_stats(&a);
+	size_t slabs = (num_meshes + TILE_ARENA_MESHES_PER_SLAB - 1) / TILE_ARENA_MESHES_PER_SLAB;
+	TEST_SOFT_ASSERT(nf, stats.meshes == num_meshes && stats.slabs == slabs && stats.mesh_reuses == 0);
+	for (int i = 0; i < num_meshes; i += 2)
+		tile_arena_mesh_free(&a, meshes[i]);
+	tile_arena_mesh_free(&a, NULL);
+	for (int i = 0; i < num_meshes; i += 2)
+		meshes[i] = tile_arena_mesh(&a);
+	stats = tile_arena_stats(&a);
+	TEST_SOFT_ASSERT(nf, stats.meshes == num_meshes && stats.slabs == slabs && stats.mesh_reuses == num_meshes / 2);
+	TEST_SOFT_ASSERT(nf, stats.reserved_bytes >= slabs * TILE_ARENA_MESHES_PER_SLAB * mesh_size);
+
+	tile_arena_deinit(&a);
+	return nf;
+}
@@ -0,0 +1,263 @@
+#include "test/test_main.h"
+#include "space/tile_atlas.h"
+#include "math/utility.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+int tile_atlas_test_lru()
+{
+	int nf = 0; //Number of failures
+	enum {cells = 4, cell_size = 33, num_cells = cells * cells, num_tiles = 3 * num_cells};
+	struct tile_atlas a;
+	TEST_SOFT_ASSERT(nf, tile_atlas_init(&a, cells, cell_size));
+	uint32_t handles[num_tiles] = {0};
+
+	//Fill it, every slot in a different cell, all inside the atlas.
+	int seen[num_cells] = {0}, out_of_range = 0;
+	for (int i = 0; i < num_cells; i++) {
+		tile_atlas_alloc(&a, &handles[i]);
+		struct tile_atlas_slot *s = tile_atlas_touch(&a, handles[i]);
+		if (!s || s->cell < 0 || s->cell >= num_cells) {
+			out_of_range++;
+			continue;
+		}
+		seen[s->cell]++;
+		out_of_range += s->origin[0] < 0 || s->origin[1] < 0 || s->origin[0] % cell_size || s->origin[1] % cell_size ||
+			s->origin[0] + cell_size > cells * cell_size || s->origin[1] + cell_size > cells * cell_size;
+	}
+	int twice = 0;
+	for (int i = 0; i < num_cells; i++)
+		twice += seen[i] != 1;
+	TEST_SOFT_ASSERT(nf, out_of_range == 0 && twice == 0);
+	TEST_SOFT_ASSERT(nf, a.stats.used == num_cells && a.stats.evictions == 0);
+
+	//Everything was used this frame, so there's nothing to evict.
+	uint32_t none = 1;
+	TEST_SOFT_ASSERT(nf, tile_atlas_alloc(&a, &none) == 0 && none == 0 && a.stats.misses == 1);
+
+	//Next frame, touch all but the first two, which are then the ones evicted, oldest first.
+	tile_atlas_next_frame(&a);
+	int touched = 0;
+	for (int i = 2; i < num_cells; i++)
+		touched += !!tile_atlas_touch(&a, handles[i]);
+	TEST_SOFT_ASSERT(nf, touched == num_cells - 2);
+	int first_cells[2] = {a.cells[a.oldest].handle == handles[0] ? a.oldest : -1, a.cells[a.oldest].next};
+	uint32_t evicted[2] = {handles[0], handles[1]};
+	tile_atlas_alloc(&a, &handles[num_cells]);
+	tile_atlas_alloc(&a, &handles[num_cells + 1]);
+	struct tile_atlas_slot *s0 = tile_atlas_touch(&a, handles[num_cells]), *s1 = tile_atlas_touch(&a, handles[num_cells + 1]);
+	TEST_SOFT_ASSERT(nf, s0 && s1 && s0->cell == first_cells[0] && s1->cell == first_cells[1]);
+	TEST_SOFT_ASSERT(nf, a.stats.evictions == 2 && tile_atlas_alloc(&a, &none) == 0);
+	//The evicted tiles' handles are zeroed, and the old ones are stale anyway.
+	TEST_SOFT_ASSERT(nf, handles[0] == 0 && handles[1] == 0 && !tile_atlas_touch(&a, 0));
+	TEST_SOFT_ASSERT(nf, !tile_atlas_touch(&a, evicted[0]) && !tile_atlas_touch(&a, evicted[1]));
+	TEST_SOFT_ASSERT(nf, !tile_atlas_get(&a, evicted[0]) && tile_atlas_get(&a, handles[num_cells]) == s0);
+	//Freeing a stale handle leaves the new owner alone.
+	tile_atlas_free(&a, evicted[0]);
+	TEST_SOFT_ASSERT(nf, tile_atlas_touch(&a, handles[num_cells]) && a.stats.used == num_cells);
+
+	//Freed slots are used before anything is evicted, even ones not touched for a while.
+	tile_atlas_next_frame(&a);
+	int freed_cell = tile_atlas_touch(&a, handles[5])->cell;
+	tile_atlas_free(&a, handles[5]);
+	TEST_SOFT_ASSERT(nf, a.stats.used == num_cells - 1 && !tile_atlas_touch(&a, handles[5]));
+	tile_atlas_alloc(&a, &handles[5]);
+	TEST_SOFT_ASSERT(nf, tile_atlas_touch(&a, handles[5])->cell == freed_cell && a.stats.evictions == 0);
+
+	//Churn through many frames with more tiles than slots. Whatever's touched stays, and the list stays whole.
+	int lost = 0;
+	for (int frame = 0; frame < 50; frame++) {
+		tile_atlas_next_frame(&a);
+		for (int j = 0; j < num_cells / 2; j++) {
+			int k = (frame * 5 + j) % num_tiles;
+			if (!tile_atlas_touch(&a, handles[k]))
+				tile_atlas_alloc(&a, &handles[k]);
+			lost += !handles[k];
+		}
+		for (int j = 0; j < num_cells / 2; j++)
+			lost += !tile_atlas_touch(&a, handles[(frame * 5 + j) % num_tiles]);
+	}
+	int listed = 0;
+	for (int i = a.oldest; i >= 0 && listed <= num_cells; i = a.cells[i].next)
+		listed++;
+	TEST_SOFT_ASSERT(nf, lost == 0 && listed == num_cells && a.stats.used == num_cells);
+	tile_atlas_deinit(&a);
+
+	//A tile left undrawn while its cell is evicted over and over keeps a zeroed handle, even once the generations
+	//wrap around and its old handle would be good again.
+	TEST_SOFT_ASSERT(nf, tile_atlas_init(&a, 1, cell_size));
+	uint32_t held, churn = 0;
+	uint32_t old = tile_atlas_alloc(&a, &held);
+	int wrapped = 0, shared = 0;
+	for (int i = 0; i < 300; i++) {
+		tile_atlas_next_frame(&a);
+		tile_atlas_alloc(&a, &churn);
+		wrapped += !!tile_atlas_get(&a, old);
+		shared += !!tile_atlas_touch(&a, held);
+	}
+	TEST_SOFT_ASSERT(nf, wrapped > 0 && shared == 0 && held == 0 && a.stats.used == 1);
+	//So freeing it doesn't take the cell from its owner.
+	tile_atlas_free(&a, held);
+	TEST_SOFT_ASSERT(nf, tile_atlas_touch(&a, churn) && a.stats.used == 1);
+
+	tile_atlas_deinit(&a);
+	return nf;
+}
+
+//A flat parent tile and its children, in terrain_lod's order, rendered into an atlas on the CPU the way the atlas
+//pass does, and read back the way the vertex shader does. Flat, so morphing a child all the way to 0 gives exactly
+//its parent's shape.
+
+enum {tile_atlas_test_rows = 8};
+
+static float tile_atlas_test_height(const float p[2])
+{
+	return sin(3 * p[0]) * cos(2 * p[1]) + p[0];
+}
+
+//Where vertex (j, r) is, like tile_position in gpu_planet.glsl.
+static void tile_atlas_test_position(const float corners[3][2], int j, int r, float out[2])
+{
+	float y = (float)r / tile_atlas_test_rows, x = r ? (float)j / r : 0;
+	for (int k = 0; k < 2; k++) {
+		float left = corners[0][k] + (corners[1][k] - corners[0][k]) * y;
+		float right = corners[0][k] + (corners[2][k] - corners[0][k]) * y;
+		out[k] = left + (right - left) * x;
+	}
+}
+
+static float * tile_atlas_test_texel(float *texels, int size, const int texel[2])
+{
+	return &texels[2 * (texel[1] * size + texel[0])];
+}
+
+//Height, and what it would be on the parent tile, into each of the tile's texels.
+static void tile_atlas_test_render(float *texels, int size, const struct tile_atlas_slot *s, const float corners[3][2])
+{
+	for (int r = 0; r <= tile_atlas_test_rows; r++) {
+		for (int j = 0; j <= r; j++) {
+			int texel[2] = {s->origin[0] + j, s->origin[1] + r}, parent[2][2];
+			float *h = tile_atlas_test_texel(texels, size, texel), p[2][2];
+			tile_atlas_test_position(corners, j, r, p[0]);
+			h[0] = tile_atlas_test_height(p[0]);
+			tile_atlas_parent_vertices(j, r, parent);
+			tile_atlas_test_position(corners, parent[0][0], parent[0][1], p[0]);
+			tile_atlas_test_position(corners, parent[1][0], parent[1][1], p[1]);
+			h[1] = (tile_atlas_test_height(p[0]) + tile_atlas_test_height(p[1])) / 2;
+		}
+	}
+}
+
+int tile_atlas_test_texels()
+{
+	int nf = 0; //Number of failures
+	enum {rows = tile_atlas_test_rows, num_verts = (rows + 1) * (rows + 2) / 2, cells = 3, cell_size = rows + 1, size = cells * cell_size};
+	//Lattice steps of one along the parent's edges from corner 0, so its vertex (j, r) is at (r - j, j) / rows.
+	const float parent[3][2] = {{0, 0}, {1, 0}, {0, 1}};
+	float mid[3][2];
+	for (int k = 0; k < 2; k++) {
+		mid[0][k] = (parent[0][k] + parent[1][k]) / 2;
+		mid[1][k] = (parent[0][k] + parent[2][k]) / 2;
+		mid[2][k] = (parent[1][k] + parent[2][k]) / 2;
+	}
+	const float *child_corners[4][3] = {
+		{parent[0], mid[0],    mid[1]},
+		{mid[0],    parent[1], mid[2]},
+		{mid[0],    mid[2],    mid[1]},
+		{mid[1],    mid[2],    parent[2]},
+	};
+	float children[4][3][2];
+	for (int i = 0; i < 4; i++)
+		for (int k = 0; k < 3; k++)
+			memcpy(children[i][k], child_corners[i][k], sizeof(children[i][k]));
+
+	//Every vertex's parent vertices are the parent's, on either side of it.
+	int bad_parents = 0;
+	for (int r = 0; r <= rows; r++) {
+		for (int j = 0; j <= r; j++) {
+			int pv[2][2];
+			tile_atlas_parent_vertices(j, r, pv);
+			for (int k = 0; k < 2; k++)
+				bad_parents += pv[k][0] % 2 || pv[k][1] % 2 || pv[k][0] < 0 || pv[k][0] > pv[k][1] || pv[k][1] > rows;
+			bad_parents += pv[0][0] + pv[1][0] != 2 * j || pv[0][1] + pv[1][1] != 2 * r;
+		}
+	}
+	TEST_SOFT_ASSERT(nf, bad_parents == 0);
+
+	struct tile_atlas a;
+	TEST_SOFT_ASSERT(nf, tile_atlas_init(&a, cells, cell_size));
+	float *texels = calloc(size * size * 2, sizeof(float));
+	uint32_t handles[5];
+	for (int i = 0; i < 5; i++)
+		tile_atlas_alloc(&a, &handles[i]);
+	tile_atlas_test_render(texels, size, tile_atlas_get(&a, handles[0]), parent);
+	for (int i = 0; i < 4; i++)
+		tile_atlas_test_render(texels, size, tile_atlas_get(&a, handles[i + 1]), children[i]);
+
+	//Each vertex's lerp reads its own texel, at the row counts planets use too.
+	const int row_counts[] = {rows, 80, 128};
+	int wrong_texels = 0;
+	for (size_t i = 0; i < LENGTH(row_counts); i++) {
+		int n = row_counts[i];
+		float *lerps = malloc((n + 1) * (n + 2) * sizeof(float)), instance[3] = {cell_size, 0, 1};
+		get_tri_lerp_vals(lerps, n);
+		for (int r = 0, v = 0; r <= n; r++) {
+			for (int j = 0; j <= r; j++, v++) {
+				int texel[2];
+				tile_atlas_vertex_texel(instance, n, &lerps[2 * v], texel);
+				wrong_texels += texel[0] != cell_size + j || texel[1] != r;
+			}
+		}
+		free(lerps);
+	}
+	TEST_SOFT_ASSERT(nf, wrong_texels == 0);
+
+	//And morphs from the parent's surface there to its own height.
+	float lerps[2 * num_verts];
+	TEST_SOFT_ASSERT(nf, get_tri_lerp_vals(lerps, rows) == 2 * num_verts);
+	int wrong_parents = 0, wrong_heights = 0;
+	for (int i = 0; i < 4; i++) {
+		float instance[3];
+		for (float morph = 0; morph <= 1; morph++) {
+			tile_atlas_instance(&a, handles[i + 1], morph, instance);
+			for (int r = 0, v = 0; r <= rows; r++) {
+				for (int j = 0; j <= r; j++, v++) {
+					int texel[2];
+					tile_atlas_vertex_texel(instance, rows, &lerps[2 * v], texel);
+					wrong_texels += texel[0] != instance[0] + j || texel[1] != instance[1] + r;
+					const float *h = tile_atlas_test_texel(texels, size, texel);
+					float height = h[1] + (h[0] - h[1]) * instance[2], p[2];
+					tile_atlas_test_position(children[i], j, r, p);
+					if (morph == 1)
+						wrong_heights += fabs(height - tile_atlas_test_height(p)) > 1e-5;
+					if (morph != 0)
+						continue;
+					//Where the parent's surface is, from its vertices on either side in its own cell.
+					int pv[2][2];
+					tile_atlas_parent_vertices(j, r, pv);
+					float on_parent = 0;
+					for (int k = 0; k < 2; k++) {
+						tile_atlas_test_position(children[i], pv[k][0], pv[k][1], p);
+						int pj = roundf(p[1] * rows), pr = roundf((p[0] + p[1]) * rows);
+						struct tile_atlas_slot *s = tile_atlas_get(&a, handles[0]);
+						int parent_texel[2] = {s->origin[0] + pj, s->origin[1] + pr};
+						on_parent += tile_atlas_test_texel(texels, size, parent_texel)[0] / 2;
+					}
+					wrong_parents += fabs(height - on_parent) > 1e-5;
+				}
+			}
+		}
+	}
+	TEST_SOFT_ASSERT(nf, wrong_texels == 0 && wrong_parents == 0 && wrong_heights == 0);
+
+	//Tiles without a cell are told so, and left to the vertex shader's own noise.
+	float instance[3];
+	tile_atlas_free(&a, handles[4]);
+	tile_atlas_instance(&a, handles[4], 0.5, instance);
+	TEST_SOFT_ASSERT(nf, instance[0] < 0 && instance[1] < 0 && instance[2] == 0.5);
+
+	free(texels);
+	tile_atlas_deinit(&a);
+	return nf;
+}